@@ -0,0 +1,586 @@
+#include <public.sdk/source/vst/hosting/eventlist.h>
+#include <public.sdk/source/vst/hosting/hostclasses.h>
+#include <public.sdk/source/vst/hosting/module.h>
+#include <public.sdk/source/vst/hosting/parameterchanges.h>
+#include <public.sdk/source/vst/hosting/plugprovider.h>
+#include <public.sdk/source/vst/hosting/processdata.h>
+#include <public.sdk/source/vst/utility/stringconvert.h>
+#include <pluginterfaces/vst/ivstaudioprocessor.h>
+#include <pluginterfaces/vst/ivsteditcontroller.h>
+#include <pluginterfaces/vst/ivstprocesscontext.h>
+
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <filesystem>
+#endif
+
+// drives the sandbox proxy and the plugin it sandboxes side by side, offline and on one thread like
+// a host would, and writes what the sandbox costs as json. The proxy has to list the plugin in its
+// vstsandbox.json, the classes are matched by name
+
+struct benchmark_settings {
+    std::string proxy_path;
+    std::string plugin_path;
+    std::string class_name;
+    std::string output_path; // stdout when empty
+    std::uint32_t block_count { 2000 }; // measured blocks per instance
+    std::uint32_t warmup_block_count { 100 };
+    double sample_rate { 48000. };
+    std::vector<std::int32_t> buffer_sizes { 32, 64, 256, 1024 };
+    std::vector<std::int32_t> channel_counts { 2 };
+    std::vector<std::int32_t> instance_counts { 1, 8 };
+    std::vector<std::int32_t> automation_densities { 0, 16 }; // parameter points per block
+    std::vector<std::int32_t> event_densities { 0 }; // note events per block, only for plugins with an event input
+};
+
+struct benchmark_target {
+    std::string name; // "direct" or "proxy"
+    bool is_proxy { false };
+    VST3::Hosting::Module::Ptr module;
+    VST3::Hosting::ClassInfo class_info;
+    double load_milliseconds { 0 };
+};
+
+struct benchmark_configuration {
+    std::int32_t buffer_size { 64 };
+    std::int32_t channel_count { 2 };
+    std::int32_t instance_count { 1 };
+    std::int32_t automation_density { 0 };
+    std::int32_t event_density { 0 };
+};
+
+struct benchmark_statistics {
+    double p50 { 0 };
+    double p90 { 0 };
+    double p99 { 0 };
+    double p999 { 0 };
+    double max { 0 };
+    double mean { 0 };
+};
+
+struct benchmark_result {
+    std::string target;
+    benchmark_configuration configuration;
+    bool is_supported { true };
+    std::string error;
+    benchmark_statistics instantiation_milliseconds;
+    benchmark_statistics block_microseconds; // one process call of one instance
+    double host_cpu_microseconds { 0 }; // per instance and block
+    double worker_cpu_microseconds { -1 }; // per instance and block, negative when it cannot be measured. Linux counts in ticks of 10ms so it needs long runs
+};
+
+[[nodiscard]] std::vector<std::int32_t> parse_list(const std::string& text)
+{
+    std::vector<std::int32_t> _values;
+    std::stringstream _stream(text);
+    std::string _item;
+    while (std::getline(_stream, _item, ',')) {
+        if (!_item.empty()) {
+            _values.push_back(std::stoi(_item));
+        }
+    }
+    return _values;
+}
+
+[[nodiscard]] benchmark_statistics get_statistics(std::vector<double> values)
+{
+    benchmark_statistics _statistics;
+    if (values.empty()) {
+        return _statistics;
+    }
+    std::sort(values.begin(), values.end());
+    const auto _percentile = [&](double fraction) {
+        return values[static_cast<std::size_t>(fraction * static_cast<double>(values.size() - 1))];
+    };
+    _statistics.p50 = _percentile(0.5);
+    _statistics.p90 = _percentile(0.9);
+    _statistics.p99 = _percentile(0.99);
+    _statistics.p999 = _percentile(0.999);
+    _statistics.max = values.back();
+    double _total = 0;
+    for (double _value : values) {
+        _total += _value;
+    }
+    _statistics.mean = _total / static_cast<double>(values.size());
+    return _statistics;
+}
+
+[[nodiscard]] double get_process_cpu_seconds()
+{
+#if defined(_WIN32)
+    FILETIME _creation, _exit, _kernel, _user;
+    if (!GetProcessTimes(GetCurrentProcess(), &_creation, &_exit, &_kernel, &_user)) {
+        return 0.;
+    }
+    const auto _seconds = [](const FILETIME& time) {
+        return static_cast<double>((static_cast<std::uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7;
+    };
+    return _seconds(_kernel) + _seconds(_user);
+#else
+    rusage _usage;
+    getrusage(RUSAGE_SELF, &_usage);
+    return static_cast<double>(_usage.ru_utime.tv_sec + _usage.ru_stime.tv_sec) + static_cast<double>(_usage.ru_utime.tv_usec + _usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+// cpu time of the running worker processes we spawned, only known on Linux
+[[nodiscard]] double get_worker_cpu_seconds()
+{
+#if defined(__linux__)
+    const long _ticks_per_second = sysconf(_SC_CLK_TCK);
+    const long _process_id = static_cast<long>(getpid());
+    double _seconds = 0;
+    std::error_code _error;
+    for (const std::filesystem::directory_entry& _entry : std::filesystem::directory_iterator("/proc", _error)) {
+        std::ifstream _stat(_entry.path() / "stat");
+        std::string _line;
+        if (!_stat || !std::getline(_stat, _line)) {
+            continue;
+        }
+        // the command name may hold spaces, the fields we want come after its closing parenthesis
+        const std::size_t _name_end = _line.rfind(')');
+        if (_name_end == std::string::npos || _line.find("vstsandbox_work") == std::string::npos) {
+            continue;
+        }
+        std::istringstream _fields(_line.substr(_name_end + 2));
+        std::string _state;
+        long _parent_id = 0;
+        _fields >> _state >> _parent_id;
+        if (_parent_id != _process_id) {
+            continue;
+        }
+        std::string _skipped;
+        for (int _field = 0; _field < 9; ++_field) {
+            _fields >> _skipped;
+        }
+        unsigned long long _user_ticks = 0;
+        unsigned long long _system_ticks = 0;
+        _fields >> _user_ticks >> _system_ticks;
+        _seconds += static_cast<double>(_user_ticks + _system_ticks) / static_cast<double>(_ticks_per_second);
+    }
+    return _seconds;
+#else
+    return -1.;
+#endif
+}
+
+[[nodiscard]] Steinberg::Vst::SpeakerArrangement get_speaker_arrangement(std::int32_t channel_count)
+{
+    switch (channel_count) {
+    case 1:
+        return Steinberg::Vst::SpeakerArr::kMono;
+    case 2:
+        return Steinberg::Vst::SpeakerArr::kStereo;
+    case 6:
+        return Steinberg::Vst::SpeakerArr::k51;
+    case 8:
+        return Steinberg::Vst::SpeakerArr::k71Cine;
+    default:
+        return 0;
+    }
+}
+
+[[nodiscard]] bool load_target(benchmark_target& target, const std::string& path, const std::string& class_name)
+{
+    const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+    std::string _error;
+    target.module = VST3::Hosting::Module::create(path, _error);
+    target.load_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+    if (!target.module) {
+        std::cerr << "Benchmark error: could not load " << path << ", " << _error << std::endl;
+        return false;
+    }
+    for (const VST3::Hosting::ClassInfo& _class_info : target.module->getFactory().classInfos()) {
+        const bool _is_sandboxed = _class_info.name().find("(Sandboxed)") != std::string::npos;
+        if (_class_info.category() == kVstAudioEffectClass && _class_info.name().find(class_name) != std::string::npos && _is_sandboxed == target.is_proxy) {
+            target.class_info = _class_info;
+            return true;
+        }
+    }
+    std::cerr << "Benchmark error: no audio effect class named " << class_name << " in " << path << std::endl;
+    return false;
+}
+
+struct benchmark_instance {
+    Steinberg::IPtr<Steinberg::Vst::PlugProvider> provider;
+    Steinberg::IPtr<Steinberg::Vst::IComponent> component;
+    Steinberg::FUnknownPtr<Steinberg::Vst::IAudioProcessor> processor;
+    std::vector<Steinberg::Vst::ParamID> automated_parameters;
+    bool has_event_input { false };
+};
+
+// creates the instances and prepares them for offline processing, fills the instantiation times
+[[nodiscard]] bool create_instances(const benchmark_target& target, const benchmark_configuration& configuration, const benchmark_settings& settings, std::vector<benchmark_instance>& instances, benchmark_result& result)
+{
+    std::vector<double> _instantiation_times;
+    for (std::int32_t _index = 0; _index < configuration.instance_count; ++_index) {
+        benchmark_instance& _instance = instances.emplace_back();
+        const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+        _instance.provider = Steinberg::owned(new Steinberg::Vst::PlugProvider(target.module->getFactory(), target.class_info, true));
+        _instance.component = _instance.provider->getComponent();
+        _instantiation_times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count());
+        _instance.processor = Steinberg::FUnknownPtr<Steinberg::Vst::IAudioProcessor>(_instance.component);
+        if (!_instance.component || !_instance.processor) {
+            result.error = "could not create the plugin";
+            return false;
+        }
+
+        if (Steinberg::IPtr<Steinberg::Vst::IEditController> _controller = _instance.provider->getController()) {
+            for (Steinberg::int32 _parameter = 0; _parameter < _controller->getParameterCount(); ++_parameter) {
+                Steinberg::Vst::ParameterInfo _info {};
+                if (_controller->getParameterInfo(_parameter, _info) == Steinberg::kResultOk && (_info.flags & Steinberg::Vst::ParameterInfo::kCanAutomate)) {
+                    _instance.automated_parameters.push_back(_info.id);
+                }
+            }
+        }
+        _instance.has_event_input = _instance.component->getBusCount(Steinberg::Vst::kEvent, Steinberg::Vst::kInput) > 0;
+
+        Steinberg::Vst::SpeakerArrangement _input_arrangement = get_speaker_arrangement(configuration.channel_count);
+        Steinberg::Vst::SpeakerArrangement _output_arrangement = _input_arrangement;
+        const Steinberg::int32 _input_count = std::min<Steinberg::int32>(1, _instance.component->getBusCount(Steinberg::Vst::kAudio, Steinberg::Vst::kInput));
+        if (!_output_arrangement || _instance.processor->setBusArrangements(&_input_arrangement, _input_count, &_output_arrangement, 1) != Steinberg::kResultTrue) {
+            result.is_supported = false;
+            result.error = "the bus arrangement was refused";
+            return false;
+        }
+        for (Steinberg::int32 _bus = 0; _bus < _input_count; ++_bus) {
+            _instance.component->activateBus(Steinberg::Vst::kAudio, Steinberg::Vst::kInput, _bus, true);
+        }
+        _instance.component->activateBus(Steinberg::Vst::kAudio, Steinberg::Vst::kOutput, 0, true);
+        if (_instance.has_event_input) {
+            _instance.component->activateBus(Steinberg::Vst::kEvent, Steinberg::Vst::kInput, 0, true);
+        }
+
+        Steinberg::Vst::ProcessSetup _setup { Steinberg::Vst::kOffline, Steinberg::Vst::kSample32, configuration.buffer_size, settings.sample_rate };
+        if (_instance.processor->setupProcessing(_setup) != Steinberg::kResultOk) {
+            result.error = "setupProcessing failed";
+            return false;
+        }
+        if (_instance.component->setActive(true) != Steinberg::kResultOk) {
+            result.error = "setActive failed";
+            return false;
+        }
+        _instance.processor->setProcessing(true);
+    }
+    result.instantiation_milliseconds = get_statistics(_instantiation_times);
+    return true;
+}
+
+void destroy_instances(std::vector<benchmark_instance>& instances)
+{
+    for (benchmark_instance& _instance : instances) {
+        if (_instance.processor) {
+            _instance.processor->setProcessing(false);
+        }
+        if (_instance.component) {
+            _instance.component->setActive(false);
+        }
+    }
+    instances.clear();
+}
+
+void fill_block_changes(const benchmark_instance& instance, const benchmark_configuration& configuration, std::uint32_t block, Steinberg::Vst::ParameterChanges& parameter_changes, Steinberg::Vst::EventList& events)
+{
+    parameter_changes.clearQueue();
+    events.clear();
+    if (!instance.automated_parameters.empty()) {
+        for (std::int32_t _point = 0; _point < configuration.automation_density; ++_point) {
+            Steinberg::int32 _queue_index = 0;
+            Steinberg::int32 _point_index = 0;
+            const Steinberg::Vst::ParamID _id = instance.automated_parameters[_point % instance.automated_parameters.size()];
+            if (Steinberg::Vst::IParamValueQueue* _queue = parameter_changes.addParameterData(_id, _queue_index)) {
+                const double _phase = static_cast<double>(block * configuration.automation_density + _point) * 0.01;
+                _queue->addPoint(_point * configuration.buffer_size / configuration.automation_density, 0.5 + 0.5 * std::sin(_phase), _point_index);
+            }
+        }
+    }
+    if (instance.has_event_input) {
+        for (std::int32_t _index = 0; _index < configuration.event_density; ++_index) {
+            Steinberg::Vst::Event _event {};
+            _event.sampleOffset = _index * configuration.buffer_size / configuration.event_density;
+            _event.type = _index % 2 ? Steinberg::Vst::Event::kNoteOffEvent : Steinberg::Vst::Event::kNoteOnEvent;
+            if (_event.type == Steinberg::Vst::Event::kNoteOnEvent) {
+                _event.noteOn.pitch = static_cast<Steinberg::int16>(48 + (block + _index / 2) % 24);
+                _event.noteOn.velocity = 0.8f;
+                _event.noteOn.noteId = -1;
+            } else {
+                _event.noteOff.pitch = static_cast<Steinberg::int16>(48 + (block + _index / 2) % 24);
+                _event.noteOff.velocity = 0.f;
+                _event.noteOff.noteId = -1;
+            }
+            events.addEvent(_event);
+        }
+    }
+}
+
+[[nodiscard]] benchmark_result run_configuration(const benchmark_target& target, const benchmark_configuration& configuration, const benchmark_settings& settings)
+{
+    benchmark_result _result;
+    _result.target = target.name;
+    _result.configuration = configuration;
+    std::vector<benchmark_instance> _instances;
+    if (!create_instances(target, configuration, settings, _instances, _result)) {
+        destroy_instances(_instances);
+        return _result;
+    }
+
+    // one process data per instance, filled with a sine that stays the same from block to block
+    std::vector<std::unique_ptr<Steinberg::Vst::HostProcessData>> _process_data;
+    Steinberg::Vst::ParameterChanges _input_parameter_changes(std::max<Steinberg::int32>(1, configuration.automation_density));
+    Steinberg::Vst::ParameterChanges _output_parameter_changes(64);
+    Steinberg::Vst::EventList _input_events(std::max<Steinberg::int32>(1, configuration.event_density));
+    Steinberg::Vst::EventList _output_events(64);
+    Steinberg::Vst::ProcessContext _process_context {};
+    _process_context.sampleRate = settings.sample_rate;
+    _process_context.tempo = 120.;
+    _process_context.state = Steinberg::Vst::ProcessContext::kPlaying | Steinberg::Vst::ProcessContext::kTempoValid;
+    for (benchmark_instance& _instance : _instances) {
+        std::unique_ptr<Steinberg::Vst::HostProcessData>& _data = _process_data.emplace_back(std::make_unique<Steinberg::Vst::HostProcessData>());
+        _data->prepare(*_instance.component, configuration.buffer_size, Steinberg::Vst::kSample32);
+        _data->numSamples = configuration.buffer_size;
+        _data->processMode = Steinberg::Vst::kOffline;
+        _data->inputParameterChanges = &_input_parameter_changes;
+        _data->outputParameterChanges = &_output_parameter_changes;
+        _data->inputEvents = &_input_events;
+        _data->outputEvents = &_output_events;
+        _data->processContext = &_process_context;
+        for (Steinberg::int32 _bus = 0; _bus < _data->numInputs; ++_bus) {
+            for (Steinberg::int32 _channel = 0; _channel < _data->inputs[_bus].numChannels; ++_channel) {
+                for (std::int32_t _sample = 0; _sample < configuration.buffer_size; ++_sample) {
+                    _data->inputs[_bus].channelBuffers32[_channel][_sample] = static_cast<float>(0.5 * std::sin(_sample * 0.05 + _channel));
+                }
+            }
+        }
+    }
+
+    std::vector<double> _block_times;
+    _block_times.reserve(static_cast<std::size_t>(settings.block_count) * _instances.size());
+    double _host_cpu_start = 0;
+    double _worker_cpu_start = 0;
+    for (std::uint32_t _block = 0; _block < settings.warmup_block_count + settings.block_count; ++_block) {
+        const bool _is_measured = _block >= settings.warmup_block_count;
+        if (_block == settings.warmup_block_count) {
+            _host_cpu_start = get_process_cpu_seconds();
+            _worker_cpu_start = target.is_proxy ? get_worker_cpu_seconds() : -1.;
+        }
+        for (std::size_t _index = 0; _index < _instances.size(); ++_index) {
+            fill_block_changes(_instances[_index], configuration, _block, _input_parameter_changes, _input_events);
+            _output_parameter_changes.clearQueue();
+            _output_events.clear();
+            const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+            _instances[_index].processor->process(*_process_data[_index]);
+            if (_is_measured) {
+                _block_times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - _start).count());
+            }
+        }
+        _process_context.projectTimeSamples += configuration.buffer_size;
+    }
+    const double _instance_blocks = static_cast<double>(settings.block_count) * static_cast<double>(_instances.size());
+    _result.host_cpu_microseconds = (get_process_cpu_seconds() - _host_cpu_start) * 1e6 / _instance_blocks;
+    const double _worker_cpu_end = target.is_proxy ? get_worker_cpu_seconds() : -1.;
+    if (_worker_cpu_start >= 0 && _worker_cpu_end >= 0) {
+        _result.worker_cpu_microseconds = (_worker_cpu_end - _worker_cpu_start) * 1e6 / _instance_blocks;
+    }
+    _result.block_microseconds = get_statistics(std::move(_block_times));
+
+    for (std::unique_ptr<Steinberg::Vst::HostProcessData>& _data : _process_data) {
+        _data->unprepare();
+    }
+    destroy_instances(_instances);
+    return _result;
+}
+
+template <typename writer_t>
+void write_statistics(writer_t& writer, const char* name, const benchmark_statistics& statistics)
+{
+    writer.Key(name);
+    writer.StartObject();
+    writer.Key("p50");
+    writer.Double(statistics.p50);
+    writer.Key("p90");
+    writer.Double(statistics.p90);
+    writer.Key("p99");
+    writer.Double(statistics.p99);
+    writer.Key("p999");
+    writer.Double(statistics.p999);
+    writer.Key("max");
+    writer.Double(statistics.max);
+    writer.Key("mean");
+    writer.Double(statistics.mean);
+    writer.EndObject();
+}
+
+[[nodiscard]] benchmark_statistics subtract_statistics(const benchmark_statistics& proxy, const benchmark_statistics& direct)
+{
+    return { proxy.p50 - direct.p50, proxy.p90 - direct.p90, proxy.p99 - direct.p99, proxy.p999 - direct.p999, proxy.max - direct.max, proxy.mean - direct.mean };
+}
+
+// every proxy result is followed by the overhead over the direct result of the same configuration
+[[nodiscard]] std::string write_results(const benchmark_settings& settings, const std::vector<benchmark_target>& targets, const std::vector<benchmark_result>& results)
+{
+    rapidjson::StringBuffer _buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> _writer(_buffer);
+    _writer.StartObject();
+    _writer.Key("proxy");
+    _writer.String(settings.proxy_path.c_str());
+    _writer.Key("plugin");
+    _writer.String(settings.plugin_path.c_str());
+    _writer.Key("class");
+    _writer.String(settings.class_name.c_str());
+    _writer.Key("blocks");
+    _writer.Uint(settings.block_count);
+    _writer.Key("sample_rate");
+    _writer.Double(settings.sample_rate);
+    _writer.Key("load_milliseconds");
+    _writer.StartObject();
+    for (const benchmark_target& _target : targets) {
+        _writer.Key(_target.name.c_str());
+        _writer.Double(_target.load_milliseconds);
+    }
+    _writer.EndObject();
+
+    _writer.Key("results");
+    _writer.StartArray();
+    for (std::size_t _index = 0; _index < results.size(); ++_index) {
+        const benchmark_result& _result = results[_index];
+        _writer.StartObject();
+        _writer.Key("target");
+        _writer.String(_result.target.c_str());
+        _writer.Key("buffer_size");
+        _writer.Int(_result.configuration.buffer_size);
+        _writer.Key("channels");
+        _writer.Int(_result.configuration.channel_count);
+        _writer.Key("instances");
+        _writer.Int(_result.configuration.instance_count);
+        _writer.Key("automation_points");
+        _writer.Int(_result.configuration.automation_density);
+        _writer.Key("events");
+        _writer.Int(_result.configuration.event_density);
+        _writer.Key("supported");
+        _writer.Bool(_result.is_supported && _result.error.empty());
+        if (!_result.error.empty()) {
+            _writer.Key("error");
+            _writer.String(_result.error.c_str());
+        } else {
+            write_statistics(_writer, "instantiation_milliseconds", _result.instantiation_milliseconds);
+            write_statistics(_writer, "block_microseconds", _result.block_microseconds);
+            _writer.Key("host_cpu_microseconds_per_block");
+            _writer.Double(_result.host_cpu_microseconds);
+            if (_result.worker_cpu_microseconds >= 0) {
+                _writer.Key("worker_cpu_microseconds_per_block");
+                _writer.Double(_result.worker_cpu_microseconds);
+            }
+            if (_result.target == "proxy" && _index > 0 && results[_index - 1].target == "direct" && results[_index - 1].error.empty()) {
+                write_statistics(_writer, "overhead_microseconds", subtract_statistics(_result.block_microseconds, results[_index - 1].block_microseconds));
+            }
+        }
+        _writer.EndObject();
+    }
+    _writer.EndArray();
+    _writer.EndObject();
+    return _buffer.GetString();
+}
+
+int main(int argc, char* argv[])
+{
+    benchmark_settings _settings;
+    for (int _index = 1; _index + 1 < argc; _index += 2) {
+        const std::string _key = argv[_index];
+        const std::string _value = argv[_index + 1];
+        if (_key == "--proxy") {
+            _settings.proxy_path = _value;
+        } else if (_key == "--plugin") {
+            _settings.plugin_path = _value;
+        } else if (_key == "--class") {
+            _settings.class_name = _value;
+        } else if (_key == "--output") {
+            _settings.output_path = _value;
+        } else if (_key == "--blocks") {
+            _settings.block_count = static_cast<std::uint32_t>(std::max(1, std::stoi(_value)));
+        } else if (_key == "--warmup") {
+            _settings.warmup_block_count = static_cast<std::uint32_t>(std::max(0, std::stoi(_value)));
+        } else if (_key == "--sample-rate") {
+            _settings.sample_rate = std::stod(_value);
+        } else if (_key == "--buffer-sizes") {
+            _settings.buffer_sizes = parse_list(_value);
+        } else if (_key == "--channels") {
+            _settings.channel_counts = parse_list(_value);
+        } else if (_key == "--instances") {
+            _settings.instance_counts = parse_list(_value);
+        } else if (_key == "--automation") {
+            _settings.automation_densities = parse_list(_value);
+        } else if (_key == "--events") {
+            _settings.event_densities = parse_list(_value);
+        }
+    }
+    if (_settings.proxy_path.empty() || _settings.plugin_path.empty() || _settings.class_name.empty()) {
+        std::cerr << "usage: vstsandbox_proxy_benchmark --proxy <vstsandbox.vst3> --plugin <plugin.vst3> --class <class name> [--output <file.json>] [--blocks 2000] [--warmup 100] [--sample-rate 48000]"
+                  << " [--buffer-sizes 32,64,256,1024] [--channels 2] [--instances 1,8] [--automation 0,16] [--events 0]" << std::endl;
+        return 2;
+    }
+
+    Steinberg::IPtr<Steinberg::Vst::HostApplication> _host = Steinberg::owned(new Steinberg::Vst::HostApplication());
+    Steinberg::Vst::PluginContextFactory::instance().setPluginContext(_host);
+
+    std::vector<benchmark_target> _targets(2);
+    _targets[0].name = "direct";
+    _targets[1].name = "proxy";
+    _targets[1].is_proxy = true;
+    if (!load_target(_targets[0], _settings.plugin_path, _settings.class_name) || !load_target(_targets[1], _settings.proxy_path, _settings.class_name)) {
+        return 1;
+    }
+
+    std::vector<benchmark_result> _results;
+    for (std::int32_t _buffer_size : _settings.buffer_sizes) {
+        for (std::int32_t _channel_count : _settings.channel_counts) {
+            for (std::int32_t _instance_count : _settings.instance_counts) {
+                for (std::int32_t _automation_density : _settings.automation_densities) {
+                    for (std::int32_t _event_density : _settings.event_densities) {
+                        const benchmark_configuration _configuration { std::max(1, _buffer_size), _channel_count, std::max(1, _instance_count), std::max(0, _automation_density), std::max(0, _event_density) };
+                        for (const benchmark_target& _target : _targets) {
+                            std::cerr << _target.name << ": " << _configuration.buffer_size << " samples, " << _configuration.channel_count << " channels, "
+                                      << _configuration.instance_count << " instances, " << _configuration.automation_density << " points, " << _configuration.event_density << " events" << std::endl;
+                            _results.push_back(run_configuration(_target, _configuration, _settings));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    const std::string _json = write_results(_settings, _targets, _results);
+    if (_settings.output_path.empty()) {
+        std::cout << _json << std::endl;
+    } else {
+        std::ofstream _output(_settings.output_path);
+        _output << _json << std::endl;
+        if (!_output) {
+            std::cerr << "Benchmark error: could not write " << _settings.output_path << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
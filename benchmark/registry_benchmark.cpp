@@ -0,0 +1,180 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <registry.hpp>
+
+// stands in for sandboxed_plugin_instance, the canary catches lookups that reach a destroyed value
+struct benchmark_instance {
+    static constexpr std::uint64_t alive_canary = 0x616C697665;
+
+    benchmark_instance() = default;
+    ~benchmark_instance() { canary = 0; }
+
+    std::uint64_t canary { alive_canary };
+    std::atomic<std::uint32_t> proxy_count { 0 };
+};
+
+struct benchmark_settings {
+    std::uint32_t thread_count { std::max(2u, std::thread::hardware_concurrency() * 2) };
+    std::uint32_t instance_count { 20000 }; // per thread
+    std::uint32_t mailbox_count { 64 }; // plugins proxies are paired through
+};
+
+struct benchmark_result {
+    double seconds { 0 };
+    std::uint64_t paired_count { 0 };
+    std::uint64_t error_count { 0 };
+};
+
+// every iteration creates a processor proxy instance, offers it to a controller of the same plugin
+// and claims whatever another thread offered, exactly like create_sandbox_processor_instance and
+// create_sandbox_controller_instance do, then looks up a few stale handles and drops everything
+
+[[nodiscard]] benchmark_result run_registry_benchmark(const benchmark_settings& settings)
+{
+    slot_registry<benchmark_instance> _registry;
+    std::vector<std::atomic<registry_handle>> _mailboxes(settings.mailbox_count);
+    std::atomic<std::uint64_t> _paired_count { 0 };
+    std::atomic<std::uint64_t> _error_count { 0 };
+
+    const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+    std::vector<std::thread> _threads;
+    for (std::uint32_t _thread_index = 0; _thread_index < settings.thread_count; ++_thread_index) {
+        _threads.emplace_back([&, _thread_index]() {
+            std::vector<registry_handle> _stale_handles;
+            for (std::uint32_t _iteration = 0; _iteration < settings.instance_count; ++_iteration) {
+                std::atomic<registry_handle>& _mailbox = _mailboxes[(_thread_index + _iteration) % settings.mailbox_count];
+                slot_registry<benchmark_instance>::reference _processor = _registry.create();
+                if (!_processor) {
+                    _error_count.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                _processor->proxy_count.fetch_add(1, std::memory_order_relaxed);
+                _mailbox.store(_processor.handle(), std::memory_order_release);
+
+                slot_registry<benchmark_instance>::reference _controller = _registry.acquire(_mailbox.exchange(0, std::memory_order_acq_rel));
+                if (_controller) {
+                    if (_controller->canary != benchmark_instance::alive_canary) {
+                        _error_count.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    _controller->proxy_count.fetch_add(1, std::memory_order_relaxed);
+                    _paired_count.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                _stale_handles.push_back(_processor.handle());
+                if (_stale_handles.size() == 8) {
+                    _processor.reset();
+                    _controller.reset();
+                    for (registry_handle _handle : _stale_handles) {
+                        slot_registry<benchmark_instance>::reference _stale = _registry.acquire(_handle);
+                        if (_stale && _stale->canary != benchmark_instance::alive_canary) {
+                            _error_count.fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                    _stale_handles.clear();
+                }
+            }
+        });
+    }
+    for (std::thread& _thread : _threads) {
+        _thread.join();
+    }
+
+    benchmark_result _result;
+    _result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+    _result.paired_count = _paired_count.load();
+    _result.error_count = _error_count.load();
+    return _result;
+}
+
+// the previous scheme, a map of shared pointers guarded by one mutex per plugin
+[[nodiscard]] benchmark_result run_mutex_benchmark(const benchmark_settings& settings)
+{
+    struct mutex_plugin {
+        std::mutex pending_mutex;
+        std::unordered_map<std::size_t, std::shared_ptr<benchmark_instance>> instances;
+        std::size_t next_instance_id { 0 };
+        std::size_t pending_instance_id { 0 };
+        bool has_pending_instance { false };
+    };
+    std::vector<mutex_plugin> _plugins(settings.mailbox_count);
+    std::atomic<std::uint64_t> _paired_count { 0 };
+
+    const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+    std::vector<std::thread> _threads;
+    for (std::uint32_t _thread_index = 0; _thread_index < settings.thread_count; ++_thread_index) {
+        _threads.emplace_back([&, _thread_index]() {
+            for (std::uint32_t _iteration = 0; _iteration < settings.instance_count; ++_iteration) {
+                mutex_plugin& _plugin = _plugins[(_thread_index + _iteration) % settings.mailbox_count];
+                std::size_t _processor_id = 0;
+                {
+                    std::lock_guard _lock(_plugin.pending_mutex);
+                    _processor_id = _plugin.next_instance_id++;
+                    _plugin.instances[_processor_id] = std::make_shared<benchmark_instance>();
+                    _plugin.pending_instance_id = _processor_id;
+                    _plugin.has_pending_instance = true;
+                }
+                std::shared_ptr<benchmark_instance> _controller;
+                {
+                    std::lock_guard _lock(_plugin.pending_mutex);
+                    if (std::exchange(_plugin.has_pending_instance, false)) {
+                        const auto _found = _plugin.instances.find(_plugin.pending_instance_id);
+                        if (_found != _plugin.instances.end()) {
+                            _controller = _found->second;
+                        }
+                    }
+                }
+                if (_controller) {
+                    _paired_count.fetch_add(1, std::memory_order_relaxed);
+                }
+                std::lock_guard _lock(_plugin.pending_mutex);
+                _plugin.instances.erase(_processor_id);
+            }
+        });
+    }
+    for (std::thread& _thread : _threads) {
+        _thread.join();
+    }
+
+    benchmark_result _result;
+    _result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+    _result.paired_count = _paired_count.load();
+    return _result;
+}
+
+void print_benchmark_result(const std::string& name, const benchmark_settings& settings, const benchmark_result& result)
+{
+    const double _instance_count = static_cast<double>(settings.thread_count) * settings.instance_count;
+    std::cout << name << ": " << _instance_count / result.seconds / 1000000. << " M instances/s, "
+              << result.paired_count << " paired, " << result.error_count << " errors (" << result.seconds << " s)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    benchmark_settings _settings;
+    for (int _index = 1; _index + 1 < argc; _index += 2) {
+        const std::string _key = argv[_index];
+        const std::uint32_t _value = static_cast<std::uint32_t>(std::stoul(argv[_index + 1]));
+        if (_key == "--threads") {
+            _settings.thread_count = std::max(1u, _value);
+        } else if (_key == "--instances") {
+            _settings.instance_count = _value;
+        } else if (_key == "--plugins") {
+            _settings.mailbox_count = std::max(1u, _value);
+        }
+    }
+
+    std::cout << _settings.thread_count << " threads, " << _settings.instance_count << " instances per thread, " << _settings.mailbox_count << " plugins" << std::endl;
+    const benchmark_result _registry_result = run_registry_benchmark(_settings);
+    print_benchmark_result("slot_registry", _settings, _registry_result);
+    print_benchmark_result("mutex + unordered_map", _settings, run_mutex_benchmark(_settings));
+    return _registry_result.error_count ? 1 : 0;
+}
@@ -13,13 +13,23 @@ Steinberg::tresult PLUGIN_API sandbox_controller::initialize(Steinberg::FUnknown
 {
 
     auto k = EditControllerEx1::initialize(context);
-
-    std::vector<Steinberg::Vst::ParameterInfo>& _params = _proxy_data.plugin_data->original_parameters;
-    for (const auto& info : _params) {
-        // parameters.addParameter(info);
+    if (k != Steinberg::kResultOk) {
+        return k;
     }
 
-    // forward parameters
+    // hosts query the parameter table all the time so it is served from the scan, classes that come
+    // from moduleinfo.json were never instantiated by the scan and ask the worker once
+    std::lock_guard _lock(_proxy_data.instance->lifecycle_mutex);
+    std::vector<Steinberg::Vst::ParameterInfo> _parameters = _proxy_data.plugin_data->original_parameters;
+    if (_parameters.empty() && _proxy_data.instance->is_plugin_loaded && _proxy_data.instance->worker.get_parameters(_parameters) != Steinberg::kResultOk) {
+        std::cerr << "Sandbox error: could not get the parameters of " << _proxy_data.plugin_data->plugin_name << std::endl;
+        _parameters.clear();
+    }
+    parameters.init(static_cast<Steinberg::int32>(_parameters.size()));
+    for (const Steinberg::Vst::ParameterInfo& _info : _parameters) {
+        parameters.addParameter(_info);
+    }
+    _parameter_generation = _proxy_data.instance->worker.get_parameter_generation();
     return k;
 }
 
@@ -30,6 +40,111 @@ Steinberg::tresult PLUGIN_API sandbox_controller::terminate()
 
 Steinberg::tresult PLUGIN_API sandbox_controller::setComponentState(Steinberg::IBStream* state)
 {
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    // strings may depend on other parameters, a new state starts the cache over
+    _parameter_cache.clear();
+    if (_instance->is_plugin_loaded) {
+        _instance->state_changes.fetch_add(1, std::memory_order_relaxed);
+        return _instance->worker.send_state(worker_command::controller_set_component_state, state);
+    }
+    // the processor usually kept the same state already, the plugin gets it once loaded
+    return keep_instance_state(_instance->replay.component_state, state);
+}
+
+Steinberg::tresult sandbox_controller::convert_parameter(worker_command command, parameter_conversion& conversion)
+{
+    // a plugin that is not loaded keeps the conversions it answered before it hibernated
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    const std::uint32_t _generation = _instance->worker.get_parameter_generation();
+    if (_instance->is_plugin_loaded && _generation != _parameter_generation) {
+        _parameter_cache.clear();
+        _parameter_generation = _generation;
+    }
+    const parameter_cache::key _key = parameter_cache::make_key(command, conversion);
+    if (const parameter_conversion* _cached = _parameter_cache.find(_key)) {
+        conversion = *_cached;
+        return Steinberg::kResultOk;
+    }
+    if (!_instance->is_plugin_loaded) {
+        if (!wake_sandboxed_instance(_proxy_data.plugin_data, _proxy_data.instance)) {
+            return Steinberg::kResultFalse;
+        }
+        _parameter_generation = _instance->worker.get_parameter_generation();
+    }
+    const Steinberg::tresult _result = _instance->worker.send_command(command, &conversion, sizeof(conversion), &conversion, sizeof(conversion));
+    if (_result == Steinberg::kResultOk) {
+        _parameter_cache.insert(_key, conversion);
+    }
+    return _result;
+}
+
+Steinberg::tresult PLUGIN_API sandbox_controller::getParamStringByValue(Steinberg::Vst::ParamID id, Steinberg::Vst::ParamValue valueNormalized, Steinberg::Vst::String128 string)
+{
+    if (!string) {
+        return Steinberg::kInvalidArgument;
+    }
+    parameter_conversion _conversion {};
+    _conversion.id = id;
+    _conversion.value = valueNormalized;
+    const Steinberg::tresult _result = convert_parameter(worker_command::get_param_string_by_value, _conversion);
+    if (_result == Steinberg::kResultOk) {
+        std::memcpy(string, _conversion.text, sizeof(_conversion.text));
+        string[std::size(_conversion.text) - 1] = 0;
+    }
+    return _result;
+}
+
+Steinberg::tresult PLUGIN_API sandbox_controller::getParamValueByString(Steinberg::Vst::ParamID id, Steinberg::Vst::TChar* string, Steinberg::Vst::ParamValue& valueNormalized)
+{
+    if (!string) {
+        return Steinberg::kInvalidArgument;
+    }
+    parameter_conversion _conversion {};
+    _conversion.id = id;
+    for (std::size_t _index = 0; _index + 1 < std::size(_conversion.text) && string[_index]; ++_index) {
+        _conversion.text[_index] = string[_index];
+    }
+    const Steinberg::tresult _result = convert_parameter(worker_command::get_param_value_by_string, _conversion);
+    if (_result == Steinberg::kResultOk) {
+        valueNormalized = _conversion.value;
+    }
+    return _result;
+}
+
+Steinberg::Vst::ParamValue PLUGIN_API sandbox_controller::normalizedParamToPlain(Steinberg::Vst::ParamID id, Steinberg::Vst::ParamValue valueNormalized)
+{
+    parameter_conversion _conversion {};
+    _conversion.id = id;
+    _conversion.value = valueNormalized;
+    return convert_parameter(worker_command::normalized_param_to_plain, _conversion) == Steinberg::kResultOk ? _conversion.value : valueNormalized;
+}
+
+Steinberg::Vst::ParamValue PLUGIN_API sandbox_controller::plainParamToNormalized(Steinberg::Vst::ParamID id, Steinberg::Vst::ParamValue plainValue)
+{
+    parameter_conversion _conversion {};
+    _conversion.id = id;
+    _conversion.value = plainValue;
+    return convert_parameter(worker_command::plain_param_to_normalized, _conversion) == Steinberg::kResultOk ? _conversion.value : plainValue;
+}
+
+Steinberg::tresult PLUGIN_API sandbox_controller::notify(Steinberg::Vst::IMessage* message)
+{
+    if (!message || !Steinberg::FIDStringsEqual(message->getMessageID(), sandbox_instance_message)) {
+        return EditControllerEx1::notify(message);
+    }
+
+    // the processor we are connected to tells us which instance it runs on
+    Steinberg::int64 _handle = 0;
+    if (message->getAttributes()->getInt(sandbox_instance_handle_attribute, _handle) != Steinberg::kResultOk) {
+        return Steinberg::kInvalidArgument;
+    }
+    instance_reference _instance = get_instance_registry().acquire(static_cast<registry_handle>(_handle));
+    if (_instance && _instance.get() != _proxy_data.instance.get()) {
+        _instance->is_proxy_controller_created = true;
+        _proxy_data.instance = std::move(_instance);
+    }
     return Steinberg::kResultOk;
 }
 
@@ -40,12 +155,25 @@ Steinberg::IPlugView* PLUGIN_API sandbox_controller::createView(Steinberg::FIDSt
 
 Steinberg::tresult PLUGIN_API sandbox_controller::setState(Steinberg::IBStream* state)
 {
-    _proxy_data.plugin_data->sandboxed_instances[_proxy_data.instance_id]->sandboxed_controller->setState(state);
-    return Steinberg::kResultOk;
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    _parameter_cache.clear();
+    if (_instance->is_plugin_loaded) {
+        _instance->state_changes.fetch_add(1, std::memory_order_relaxed);
+        return _instance->worker.send_state(worker_command::controller_set_state, state);
+    }
+    return keep_instance_state(_instance->replay.controller_state, state);
 }
 
 Steinberg::tresult PLUGIN_API sandbox_controller::getState(Steinberg::IBStream* state)
 {
-    _proxy_data.plugin_data->sandboxed_instances[_proxy_data.instance_id]->sandboxed_controller->setState(state);
-    return Steinberg::kResultOk;
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    if (!_instance->is_plugin_loaded && _instance->replay.controller_state) {
+        return _instance->replay.controller_state->copy_to(state);
+    }
+    if (!wake_sandboxed_instance(_proxy_data.plugin_data, _proxy_data.instance)) {
+        return Steinberg::kResultFalse;
+    }
+    return _instance->worker.receive_state(worker_command::controller_get_state, state);
 }
\ No newline at end of file
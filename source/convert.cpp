@@ -0,0 +1,195 @@
+#include <pluginterfaces/vst/ivstaudioprocessor.h>
+
+#include <cstring>
+
+#include <convert.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define sandbox_convert_x86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define sandbox_target_avx
+#else
+#define sandbox_target_avx __attribute__((target("avx")))
+#endif
+#else
+#define sandbox_convert_x86 0
+#endif
+
+using float_to_double_kernel = void (*)(double*, const float*, std::size_t);
+using double_to_float_kernel = void (*)(float*, const double*, std::size_t);
+using silence_kernel = bool (*)(const std::byte*, std::size_t, std::uint64_t); // bytes and sign bits of one 64 bit word
+
+void convert_float_to_double_scalar(double* destination, const float* source, std::size_t count)
+{
+    for (std::size_t _index = 0; _index < count; ++_index) {
+        destination[_index] = static_cast<double>(source[_index]);
+    }
+}
+
+void convert_double_to_float_scalar(float* destination, const double* source, std::size_t count)
+{
+    for (std::size_t _index = 0; _index < count; ++_index) {
+        destination[_index] = static_cast<float>(source[_index]);
+    }
+}
+
+[[nodiscard]] bool is_silent_scalar(const std::byte* samples, std::size_t size, std::uint64_t sign_mask)
+{
+    std::size_t _offset = 0;
+    for (; _offset + sizeof(std::uint64_t) <= size; _offset += sizeof(std::uint64_t)) {
+        std::uint64_t _word;
+        std::memcpy(&_word, samples + _offset, sizeof(_word));
+        if (_word & ~sign_mask) {
+            return false;
+        }
+    }
+    // an odd float count leaves one last sample
+    if (_offset < size) {
+        std::uint32_t _word;
+        std::memcpy(&_word, samples + _offset, sizeof(_word));
+        return !(_word & ~static_cast<std::uint32_t>(sign_mask));
+    }
+    return true;
+}
+
+#if sandbox_convert_x86
+
+// SSE2 is part of every x86_64 CPU so these never need a runtime check there
+
+void convert_float_to_double_sse2(double* destination, const float* source, std::size_t count)
+{
+    std::size_t _index = 0;
+    for (; _index + 4 <= count; _index += 4) {
+        const __m128 _floats = _mm_loadu_ps(source + _index);
+        _mm_storeu_pd(destination + _index, _mm_cvtps_pd(_floats));
+        _mm_storeu_pd(destination + _index + 2, _mm_cvtps_pd(_mm_movehl_ps(_floats, _floats)));
+    }
+    convert_float_to_double_scalar(destination + _index, source + _index, count - _index);
+}
+
+void convert_double_to_float_sse2(float* destination, const double* source, std::size_t count)
+{
+    std::size_t _index = 0;
+    for (; _index + 4 <= count; _index += 4) {
+        const __m128 _low = _mm_cvtpd_ps(_mm_loadu_pd(source + _index));
+        const __m128 _high = _mm_cvtpd_ps(_mm_loadu_pd(source + _index + 2));
+        _mm_storeu_ps(destination + _index, _mm_movelh_ps(_low, _high));
+    }
+    convert_double_to_float_scalar(destination + _index, source + _index, count - _index);
+}
+
+[[nodiscard]] bool is_silent_sse2(const std::byte* samples, std::size_t size, std::uint64_t sign_mask)
+{
+    const __m128i _sign_mask = _mm_set1_epi64x(static_cast<long long>(sign_mask));
+    std::size_t _offset = 0;
+    for (; _offset + 64 <= size; _offset += 64) {
+        const __m128i _low = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + _offset)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + _offset + 16)));
+        const __m128i _high = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + _offset + 32)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + _offset + 48)));
+        const __m128i _bits = _mm_andnot_si128(_sign_mask, _mm_or_si128(_low, _high));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_bits, _mm_setzero_si128())) != 0xFFFF) {
+            return false;
+        }
+    }
+    return is_silent_scalar(samples + _offset, size - _offset, sign_mask);
+}
+
+sandbox_target_avx void convert_float_to_double_avx(double* destination, const float* source, std::size_t count)
+{
+    std::size_t _index = 0;
+    for (; _index + 8 <= count; _index += 8) {
+        _mm256_storeu_pd(destination + _index, _mm256_cvtps_pd(_mm_loadu_ps(source + _index)));
+        _mm256_storeu_pd(destination + _index + 4, _mm256_cvtps_pd(_mm_loadu_ps(source + _index + 4)));
+    }
+    convert_float_to_double_scalar(destination + _index, source + _index, count - _index);
+}
+
+sandbox_target_avx void convert_double_to_float_avx(float* destination, const double* source, std::size_t count)
+{
+    std::size_t _index = 0;
+    for (; _index + 8 <= count; _index += 8) {
+        _mm_storeu_ps(destination + _index, _mm256_cvtpd_ps(_mm256_loadu_pd(source + _index)));
+        _mm_storeu_ps(destination + _index + 4, _mm256_cvtpd_ps(_mm256_loadu_pd(source + _index + 4)));
+    }
+    convert_double_to_float_scalar(destination + _index, source + _index, count - _index);
+}
+
+sandbox_target_avx bool is_silent_avx(const std::byte* samples, std::size_t size, std::uint64_t sign_mask)
+{
+    const __m256 _sign_mask = _mm256_castsi256_ps(_mm256_set1_epi64x(static_cast<long long>(sign_mask)));
+    std::size_t _offset = 0;
+    for (; _offset + 128 <= size; _offset += 128) {
+        const __m256 _low = _mm256_or_ps(_mm256_loadu_ps(reinterpret_cast<const float*>(samples + _offset)), _mm256_loadu_ps(reinterpret_cast<const float*>(samples + _offset + 32)));
+        const __m256 _high = _mm256_or_ps(_mm256_loadu_ps(reinterpret_cast<const float*>(samples + _offset + 64)), _mm256_loadu_ps(reinterpret_cast<const float*>(samples + _offset + 96)));
+        const __m256i _bits = _mm256_castps_si256(_mm256_andnot_ps(_sign_mask, _mm256_or_ps(_low, _high)));
+        if (!_mm256_testz_si256(_bits, _bits)) {
+            return false;
+        }
+    }
+    return is_silent_sse2(samples + _offset, size - _offset, sign_mask);
+}
+
+[[nodiscard]] bool has_avx()
+{
+#if defined(_MSC_VER)
+    int _info[4] = {};
+    __cpuid(_info, 1);
+    const bool _has_os_support = (_info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+    return _has_os_support && (_info[2] & (1 << 28));
+#else
+    return __builtin_cpu_supports("avx");
+#endif
+}
+
+#endif
+
+struct conversion_kernels {
+    float_to_double_kernel float_to_double;
+    double_to_float_kernel double_to_float;
+    silence_kernel is_silent;
+};
+
+[[nodiscard]] const conversion_kernels& get_conversion_kernels()
+{
+    static const conversion_kernels _kernels = []() -> conversion_kernels {
+#if sandbox_convert_x86
+        if (has_avx()) {
+            return { convert_float_to_double_avx, convert_double_to_float_avx, is_silent_avx };
+        }
+        return { convert_float_to_double_sse2, convert_double_to_float_sse2, is_silent_sse2 };
+#else
+        return { convert_float_to_double_scalar, convert_double_to_float_scalar, is_silent_scalar };
+#endif
+    }();
+    return _kernels;
+}
+
+void convert_samples(double* destination, const float* source, std::size_t count)
+{
+    get_conversion_kernels().float_to_double(destination, source, count);
+}
+
+void convert_samples(float* destination, const double* source, std::size_t count)
+{
+    get_conversion_kernels().double_to_float(destination, source, count);
+}
+
+void copy_samples(void* destination, std::int32_t destination_sample_size, const void* source, std::int32_t source_sample_size, std::size_t count)
+{
+    if (destination_sample_size == source_sample_size) {
+        std::memcpy(destination, source, count * (source_sample_size == Steinberg::Vst::kSample64 ? sizeof(double) : sizeof(float)));
+    } else if (destination_sample_size == Steinberg::Vst::kSample64) {
+        convert_samples(static_cast<double*>(destination), static_cast<const float*>(source), count);
+    } else {
+        convert_samples(static_cast<float*>(destination), static_cast<const double*>(source), count);
+    }
+}
+
+bool is_silent(const void* samples, std::int32_t symbolic_sample_size, std::size_t count)
+{
+    if (symbolic_sample_size == Steinberg::Vst::kSample64) {
+        return get_conversion_kernels().is_silent(static_cast<const std::byte*>(samples), count * sizeof(double), 0x8000000000000000ull);
+    }
+    return get_conversion_kernels().is_silent(static_cast<const std::byte*>(samples), count * sizeof(float), 0x8000000080000000ull);
+}
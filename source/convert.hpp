@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// copies count samples from source to destination in a single pass, converting between
+// kSample32 and kSample64 on the way when the two sample sizes differ. Conversions use AVX or SSE2
+// when the CPU has them and a scalar loop otherwise
+void copy_samples(void* destination, std::int32_t destination_sample_size, const void* source, std::int32_t source_sample_size, std::size_t count);
+
+void convert_samples(double* destination, const float* source, std::size_t count);
+void convert_samples(float* destination, const double* source, std::size_t count);
+
+// whether every sample is zero whatever its sign, with the same kernels. Stops at the first sample
+// that is not
+[[nodiscard]] bool is_silent(const void* samples, std::int32_t symbolic_sample_size, std::size_t count);
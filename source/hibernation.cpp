@@ -0,0 +1,214 @@
+#include <condition_variable>
+#include <thread>
+
+#include <public.sdk/source/main/moduleinit.h>
+
+#include <sandbox.hpp>
+
+struct hibernation_monitor {
+    std::vector<registry_handle> handles; // instances that went inactive since the last pass
+    std::thread monitor_thread;
+    std::mutex monitor_mutex;
+    std::condition_variable monitor_condition;
+    bool should_stop { false };
+};
+
+// never destroyed and stopped before the library unloads, see the instance pool
+static hibernation_monitor& global_hibernation_monitor = *new hibernation_monitor();
+static Steinberg::ModuleTerminator global_hibernation_monitor_terminator(stop_hibernation_monitor);
+
+[[nodiscard]] Steinberg::tresult replay_state(sandbox_worker& worker, worker_command command, state_buffer* state)
+{
+    if (!state || state->seek(0, Steinberg::IBStream::kIBSeekSet, nullptr) != Steinberg::kResultOk) {
+        return Steinberg::kResultOk;
+    }
+    return worker.send_state(command, state);
+}
+
+Steinberg::tresult keep_instance_state(Steinberg::IPtr<state_buffer>& kept_state, Steinberg::IBStream* state)
+{
+    Steinberg::IPtr<state_buffer> _state = Steinberg::owned(new state_buffer());
+    const Steinberg::tresult _result = _state->assign(state);
+    if (_result != Steinberg::kResultOk) {
+        return _result;
+    }
+    _state->shrink();
+    kept_state = _state;
+    return Steinberg::kResultOk;
+}
+
+bool wake_sandboxed_instance(sandboxed_plugin_data* data, const instance_reference& instance, std::shared_ptr<worker_host> host)
+{
+    if (instance->is_plugin_loaded) {
+        return true;
+    }
+    // an instance only runs a plugin once a processor proxy owns it and until it is terminated
+    if (instance->is_terminated || !instance->is_proxy_processor_created) {
+        return false;
+    }
+    if (!load_sandboxed_instance(data, *instance, std::move(host))) {
+        instance->worker.shutdown();
+        return false;
+    }
+
+    instance_replay& _replay = instance->replay;
+    sandbox_worker& _worker = instance->worker;
+    if (_replay.has_arrangements) {
+        bus_arrangements _arrangements = _replay.arrangements;
+        static_cast<void>(_worker.set_bus_arrangements(_arrangements));
+    }
+    for (const bus_activation& _activation : _replay.activations) {
+        static_cast<void>(_worker.send_command(worker_command::activate_bus, &_activation, sizeof(_activation)));
+    }
+    if (replay_state(_worker, worker_command::processor_set_state, _replay.component_state.get()) != Steinberg::kResultOk
+        || replay_state(_worker, worker_command::controller_set_component_state, _replay.component_state.get()) != Steinberg::kResultOk
+        || replay_state(_worker, worker_command::controller_set_state, _replay.controller_state.get()) != Steinberg::kResultOk) {
+        std::cerr << "Sandbox error: could not restore the state of " << data->plugin_name << std::endl;
+    }
+
+    // the plugin holds the state again, the buffers would only go stale. A recovery monitor
+    // snapshots an instance without a state right away
+    _replay.component_state = nullptr;
+    _replay.controller_state = nullptr;
+    instance->is_hibernated = false;
+    instance->telemetry->is_hibernated.store(0, std::memory_order_relaxed);
+
+    // a plugin woken up by a state or parameter query while inactive may go back to sleep
+    if (!instance->is_active && get_sandbox_config().hibernation_delay.count()) {
+        instance->inactive_since = std::chrono::steady_clock::now();
+        watch_inactive_instance(instance.handle());
+    }
+    return true;
+}
+
+bool snapshot_sandboxed_instance(sandboxed_plugin_instance& instance)
+{
+    // changes that come in while the worker answers are caught by the next snapshot
+    const std::uint32_t _changes = instance.state_changes.load(std::memory_order_relaxed);
+    Steinberg::IPtr<state_buffer> _component_state = Steinberg::owned(new state_buffer());
+    if (instance.worker.receive_state(worker_command::processor_get_state, _component_state) != Steinberg::kResultOk) {
+        return false;
+    }
+    Steinberg::IPtr<state_buffer> _controller_state = Steinberg::owned(new state_buffer());
+    if (instance.worker.receive_state(worker_command::controller_get_state, _controller_state) != Steinberg::kResultOk) {
+        _controller_state = nullptr;
+    } else {
+        _controller_state->shrink();
+    }
+    _component_state->shrink();
+    instance.replay.component_state = _component_state;
+    instance.replay.controller_state = _controller_state;
+    instance.replay.snapshot_changes = _changes;
+    return true;
+}
+
+// lifecycle_mutex must be held, the instance is inactive so the audio thread never touches it
+void hibernate_sandboxed_instance(sandboxed_plugin_instance& instance)
+{
+    sandbox_worker& _worker = instance.worker;
+    if (!snapshot_sandboxed_instance(instance)) {
+        return; // a plugin that cannot give its state back keeps running
+    }
+    std::uint32_t _latency = 0;
+    std::uint32_t _tail = 0;
+    if (_worker.send_command(worker_command::get_latency_samples, nullptr, 0, &_latency, sizeof(_latency)) != Steinberg::kResultOk) {
+        _latency = 0;
+    }
+    if (_worker.send_command(worker_command::get_tail_samples, nullptr, 0, &_tail, sizeof(_tail)) != Steinberg::kResultOk) {
+        _tail = 0;
+    }
+    instance.replay.latency_samples = _latency;
+    instance.replay.tail_samples = _tail;
+    _worker.shutdown();
+    instance.transport.close();
+    instance.is_plugin_loaded = false;
+    instance.is_hibernated = true;
+    instance.telemetry->is_hibernated.store(1, std::memory_order_relaxed);
+    instance.telemetry->hibernation_count.store(instance.telemetry->hibernation_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// returns false once the instance no longer needs watching
+[[nodiscard]] bool check_inactive_instance(registry_handle handle, std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& next_check)
+{
+    instance_reference _instance = get_instance_registry().acquire(handle);
+    if (!_instance) {
+        return false;
+    }
+    // a proxy busy with the instance keeps it awake, we come back on the next pass
+    std::unique_lock _lock(_instance->lifecycle_mutex, std::try_to_lock);
+    if (!_lock.owns_lock()) {
+        return true;
+    }
+    if (_instance->is_active || !_instance->is_plugin_loaded || _instance->is_terminated) {
+        return false;
+    }
+    const std::chrono::steady_clock::time_point _deadline = _instance->inactive_since + get_sandbox_config().hibernation_delay;
+    if (now < _deadline) {
+        next_check = std::min(next_check, _deadline);
+        return true;
+    }
+    hibernate_sandboxed_instance(*_instance);
+    return false;
+}
+
+void run_hibernation_monitor()
+{
+    const std::chrono::seconds _delay = get_sandbox_config().hibernation_delay;
+    std::vector<registry_handle> _watched;
+    while (true) {
+        const std::chrono::steady_clock::time_point _now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point _next_check = _now + _delay;
+        std::vector<registry_handle> _still_watched;
+        for (registry_handle _handle : _watched) {
+            if (check_inactive_instance(_handle, _now, _next_check)) {
+                _still_watched.push_back(_handle);
+            }
+        }
+        _watched = std::move(_still_watched);
+
+        std::unique_lock _lock(global_hibernation_monitor.monitor_mutex);
+        const auto _has_news = []() { return !global_hibernation_monitor.handles.empty() || global_hibernation_monitor.should_stop; };
+        if (_watched.empty()) {
+            global_hibernation_monitor.monitor_condition.wait(_lock, _has_news);
+        } else {
+            global_hibernation_monitor.monitor_condition.wait_until(_lock, _next_check, _has_news);
+        }
+        if (global_hibernation_monitor.should_stop) {
+            return;
+        }
+        for (registry_handle _handle : global_hibernation_monitor.handles) {
+            if (std::find(_watched.begin(), _watched.end(), _handle) == _watched.end()) {
+                _watched.push_back(_handle);
+            }
+        }
+        global_hibernation_monitor.handles.clear();
+    }
+}
+
+void watch_inactive_instance(registry_handle handle)
+{
+    {
+        std::lock_guard _lock(global_hibernation_monitor.monitor_mutex);
+        if (global_hibernation_monitor.should_stop) {
+            return;
+        }
+        global_hibernation_monitor.handles.push_back(handle);
+        if (!global_hibernation_monitor.monitor_thread.joinable()) {
+            global_hibernation_monitor.monitor_thread = std::thread(run_hibernation_monitor);
+        }
+    }
+    global_hibernation_monitor.monitor_condition.notify_one();
+}
+
+void stop_hibernation_monitor()
+{
+    {
+        std::lock_guard _lock(global_hibernation_monitor.monitor_mutex);
+        global_hibernation_monitor.should_stop = true;
+    }
+    global_hibernation_monitor.monitor_condition.notify_one();
+    if (global_hibernation_monitor.monitor_thread.joinable()) {
+        global_hibernation_monitor.monitor_thread.join();
+    }
+    global_hibernation_monitor.handles.clear();
+}
@@ -0,0 +1,658 @@
+#include <ipc.hpp>
+
+#include <climits>
+#include <cstring>
+#include <sstream>
+
+#if SMTG_OS_WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if SMTG_OS_LINUX
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#endif
+extern char** environ;
+#endif
+
+#if SMTG_OS_WINDOWS
+[[nodiscard]] std::wstring to_wide_name(const std::string& name)
+{
+    return std::wstring(L"Local\\") + std::wstring(name.begin(), name.end());
+}
+#endif
+
+std::string make_ipc_name(const std::string& purpose)
+{
+    // macOS limits shared memory names to 31 characters so we keep them short
+    static std::atomic<std::uint32_t> _counter { 0 };
+    std::ostringstream _name;
+#if !SMTG_OS_WINDOWS
+    _name << "/";
+#endif
+    _name << "vsb" << std::hex << get_current_process_id() << "." << _counter.fetch_add(1) << "." << purpose;
+    return _name.str();
+}
+
+// shared_memory
+
+shared_memory::~shared_memory()
+{
+    close();
+}
+
+bool shared_memory::create(const std::string& name, std::size_t size)
+{
+    close();
+#if SMTG_OS_WINDOWS
+    const std::uint64_t _size64 = static_cast<std::uint64_t>(size);
+    _handle = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(_size64 >> 32), static_cast<DWORD>(_size64 & 0xFFFFFFFF), to_wide_name(name).c_str());
+    if (!_handle) {
+        return false;
+    }
+    _data = MapViewOfFile(_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!_data) {
+        CloseHandle(_handle);
+        _handle = nullptr;
+        return false;
+    }
+#else
+    const int _fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if (_fd < 0) {
+        return false;
+    }
+    if (ftruncate(_fd, static_cast<off_t>(size)) != 0) {
+        ::close(_fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void* _mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    ::close(_fd);
+    if (_mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+    _data = _mapping;
+#endif
+    _name = name;
+    _size = size;
+    _is_owner = true;
+    return true;
+}
+
+bool shared_memory::open(const std::string& name, std::size_t size)
+{
+    close();
+#if SMTG_OS_WINDOWS
+    _handle = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, to_wide_name(name).c_str());
+    if (!_handle) {
+        return false;
+    }
+    _data = MapViewOfFile(_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!_data) {
+        CloseHandle(_handle);
+        _handle = nullptr;
+        return false;
+    }
+#else
+    const int _fd = shm_open(name.c_str(), O_RDWR, S_IRUSR | S_IWUSR);
+    if (_fd < 0) {
+        return false;
+    }
+    void* _mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    ::close(_fd);
+    if (_mapping == MAP_FAILED) {
+        return false;
+    }
+    _data = _mapping;
+#endif
+    _name = name;
+    _size = size;
+    _is_owner = false;
+    return true;
+}
+
+void shared_memory::close()
+{
+    if (!_data) {
+        return;
+    }
+#if SMTG_OS_WINDOWS
+    UnmapViewOfFile(_data);
+    CloseHandle(_handle);
+    _handle = nullptr;
+#else
+    munmap(_data, _size);
+    if (_is_owner) {
+        shm_unlink(_name.c_str());
+    }
+#endif
+    _data = nullptr;
+    _size = 0;
+    _name.clear();
+    _is_owner = false;
+}
+
+void shared_memory::remove(const std::string& name)
+{
+#if !SMTG_OS_WINDOWS
+    shm_unlink(name.c_str());
+#endif
+}
+
+bool shared_memory::prefault(bool should_lock)
+{
+    if (!_data) {
+        return false;
+    }
+#if SMTG_OS_WINDOWS
+    SYSTEM_INFO _system_info;
+    GetSystemInfo(&_system_info);
+    const std::size_t _page_size = _system_info.dwPageSize;
+#else
+    const std::size_t _page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    // shared memory has no zero page, reading a page commits it like writing would, without
+    // racing with the other process
+    const volatile std::byte* _bytes = static_cast<const volatile std::byte*>(_data);
+    for (std::size_t _offset = 0; _offset < _size; _offset += _page_size) {
+        static_cast<void>(_bytes[_offset]);
+    }
+    if (!should_lock) {
+        return true;
+    }
+#if SMTG_OS_WINDOWS
+    return VirtualLock(_data, _size) != 0;
+#else
+    return mlock(_data, _size) == 0;
+#endif
+}
+
+// mapped_file
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+bool mapped_file::open(const std::filesystem::path& path)
+{
+    close();
+#if SMTG_OS_WINDOWS
+    _file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) {
+        _file = nullptr;
+        return false;
+    }
+    LARGE_INTEGER _file_size;
+    if (!GetFileSizeEx(_file, &_file_size) || _file_size.QuadPart <= 0) {
+        close();
+        return false;
+    }
+    _handle = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!_handle) {
+        close();
+        return false;
+    }
+    _data = MapViewOfFile(_handle, FILE_MAP_READ, 0, 0, 0);
+    if (!_data) {
+        close();
+        return false;
+    }
+    _size = static_cast<std::size_t>(_file_size.QuadPart);
+#else
+    const int _fd = ::open(path.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        return false;
+    }
+    struct stat _stat;
+    if (fstat(_fd, &_stat) != 0 || _stat.st_size <= 0) {
+        ::close(_fd);
+        return false;
+    }
+    void* _mapping = mmap(nullptr, static_cast<std::size_t>(_stat.st_size), PROT_READ, MAP_SHARED, _fd, 0);
+    ::close(_fd);
+    if (_mapping == MAP_FAILED) {
+        return false;
+    }
+    _data = _mapping;
+    _size = static_cast<std::size_t>(_stat.st_size);
+#endif
+    return true;
+}
+
+bool mapped_file::create(const std::filesystem::path& path, std::size_t size)
+{
+    close();
+#if SMTG_OS_WINDOWS
+    _file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) {
+        _file = nullptr;
+        return false;
+    }
+    const std::uint64_t _size64 = static_cast<std::uint64_t>(size);
+    _handle = CreateFileMappingW(_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(_size64 >> 32), static_cast<DWORD>(_size64 & 0xFFFFFFFF), nullptr);
+    if (!_handle) {
+        close();
+        return false;
+    }
+    _data = MapViewOfFile(_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!_data) {
+        close();
+        return false;
+    }
+#else
+    const int _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (_fd < 0) {
+        return false;
+    }
+    if (ftruncate(_fd, static_cast<off_t>(size)) != 0) {
+        ::close(_fd);
+        return false;
+    }
+    void* _mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    ::close(_fd);
+    if (_mapping == MAP_FAILED) {
+        return false;
+    }
+    _data = _mapping;
+#endif
+    _size = size;
+    return true;
+}
+
+void mapped_file::close()
+{
+#if SMTG_OS_WINDOWS
+    if (_data) {
+        UnmapViewOfFile(_data);
+    }
+    if (_handle) {
+        CloseHandle(_handle);
+    }
+    if (_file) {
+        CloseHandle(_file);
+    }
+    _handle = nullptr;
+    _file = nullptr;
+#else
+    if (_data) {
+        munmap(_data, _size);
+    }
+#endif
+    _data = nullptr;
+    _size = 0;
+}
+
+// ipc_signal
+
+ipc_signal::~ipc_signal()
+{
+    close();
+}
+
+bool ipc_signal::create(const std::string& name, std::atomic<std::uint32_t>* word)
+{
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t));
+    close();
+    _word = word;
+#if SMTG_OS_WINDOWS
+    _event = CreateEventW(nullptr, FALSE, FALSE, to_wide_name(name + ".e").c_str());
+    return _event != nullptr;
+#else
+    return true;
+#endif
+}
+
+bool ipc_signal::open(const std::string& name, std::atomic<std::uint32_t>* word)
+{
+    close();
+    _word = word;
+#if SMTG_OS_WINDOWS
+    _event = OpenEventW(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, to_wide_name(name + ".e").c_str());
+    return _event != nullptr;
+#else
+    return true;
+#endif
+}
+
+void ipc_signal::close()
+{
+#if SMTG_OS_WINDOWS
+    if (_event) {
+        CloseHandle(_event);
+        _event = nullptr;
+    }
+#endif
+    _word = nullptr;
+}
+
+void ipc_signal::store(std::uint32_t value)
+{
+    _word->store(value, std::memory_order_release);
+    notify();
+}
+
+void ipc_signal::notify()
+{
+#if SMTG_OS_WINDOWS
+    SetEvent(_event);
+#elif SMTG_OS_LINUX
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(_word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+void ipc_signal::wait(std::uint32_t expected, std::chrono::nanoseconds timeout)
+{
+    if (timeout.count() <= 0) {
+        return;
+    }
+#if SMTG_OS_WINDOWS
+    const DWORD _milliseconds = static_cast<DWORD>(std::max<std::int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count()));
+    if (_word->load(std::memory_order_acquire) == expected) {
+        WaitForSingleObject(_event, _milliseconds);
+    }
+#elif SMTG_OS_LINUX
+    timespec _timeout;
+    _timeout.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+    _timeout.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(_word), FUTEX_WAIT, expected, &_timeout, nullptr, 0);
+#else
+    const std::chrono::nanoseconds _poll_interval = std::min<std::chrono::nanoseconds>(timeout, std::chrono::microseconds(20));
+    if (_word->load(std::memory_order_acquire) == expected) {
+        std::this_thread::sleep_for(_poll_interval);
+    }
+#endif
+}
+
+// worker_process
+
+worker_process::~worker_process()
+{
+    kill();
+    close_exit_watch();
+}
+
+void worker_process::close_exit_watch()
+{
+#if SMTG_OS_WINDOWS
+    if (_exit_handle) {
+        CloseHandle(_exit_handle);
+        _exit_handle = nullptr;
+    }
+#else
+    if (_exit_fd >= 0) {
+        close(_exit_fd);
+        _exit_fd = -1;
+    }
+#endif
+}
+
+bool worker_process::spawn(const std::filesystem::path& executable, const std::vector<std::string>& arguments)
+{
+    kill();
+    close_exit_watch();
+    _has_exited = false;
+    _exit_status = 0;
+#if SMTG_OS_WINDOWS
+    std::wstring _command_line = L"\"" + executable.wstring() + L"\"";
+    for (const std::string& _argument : arguments) {
+        _command_line += L" \"" + std::filesystem::path(_argument).wstring() + L"\"";
+    }
+    STARTUPINFOW _startup_info = {};
+    _startup_info.cb = sizeof(_startup_info);
+    PROCESS_INFORMATION _process_info = {};
+    if (!CreateProcessW(executable.wstring().c_str(), _command_line.data(), nullptr, nullptr, FALSE, CREATE_NO_WINDOW, nullptr, nullptr, &_startup_info, &_process_info)) {
+        return false;
+    }
+    CloseHandle(_process_info.hThread);
+    _handle = _process_info.hProcess;
+    if (!DuplicateHandle(GetCurrentProcess(), _handle, GetCurrentProcess(), &_exit_handle, SYNCHRONIZE, FALSE, 0)) {
+        _exit_handle = nullptr;
+    }
+    return true;
+#else
+    const std::string _executable = executable.string();
+    std::vector<char*> _argv;
+    _argv.push_back(const_cast<char*>(_executable.c_str()));
+    for (const std::string& _argument : arguments) {
+        _argv.push_back(const_cast<char*>(_argument.c_str()));
+    }
+    _argv.push_back(nullptr);
+    pid_t _child = -1;
+    if (posix_spawn(&_child, _executable.c_str(), nullptr, nullptr, _argv.data(), environ) != 0) {
+        return false;
+    }
+    _pid = static_cast<int>(_child);
+#if SMTG_OS_LINUX && defined(SYS_pidfd_open)
+    // kernels before 5.3 have no pidfd, their processes are only seen gone by is_running
+    _exit_fd = static_cast<int>(syscall(SYS_pidfd_open, _child, 0));
+#endif
+    return true;
+#endif
+}
+
+bool worker_process::has_ended() const
+{
+#if SMTG_OS_WINDOWS
+    return _exit_handle && WaitForSingleObject(_exit_handle, 0) == WAIT_OBJECT_0;
+#elif SMTG_OS_LINUX
+    if (_exit_fd < 0) {
+        return false;
+    }
+    pollfd _poll = { _exit_fd, POLLIN, 0 };
+    return poll(&_poll, 1, 0) > 0;
+#else
+    return false;
+#endif
+}
+
+bool worker_process::is_running()
+{
+#if SMTG_OS_WINDOWS
+    if (!_handle) {
+        return false;
+    }
+    if (WaitForSingleObject(_handle, 0) == WAIT_TIMEOUT) {
+        return true;
+    }
+    DWORD _exit_code = 0;
+    if (!_has_exited && GetExitCodeProcess(_handle, &_exit_code)) {
+        _has_exited = true;
+        _exit_status = static_cast<std::int64_t>(_exit_code);
+    }
+    return false;
+#else
+    if (_pid < 0) {
+        return false;
+    }
+    int _status = 0;
+    const pid_t _result = waitpid(_pid, &_status, WNOHANG);
+    if (_result == 0) {
+        return true;
+    }
+    if (_result == _pid) {
+        _has_exited = true;
+        _exit_status = _status;
+    }
+    _pid = -1;
+    return false;
+#endif
+}
+
+void worker_process::kill()
+{
+#if SMTG_OS_WINDOWS
+    if (_handle) {
+        TerminateProcess(_handle, 1);
+        WaitForSingleObject(_handle, INFINITE);
+        CloseHandle(_handle);
+        _handle = nullptr;
+    }
+#else
+    if (_pid >= 0) {
+        ::kill(_pid, SIGKILL);
+        int _status = 0;
+        waitpid(_pid, &_status, 0);
+        _pid = -1;
+    }
+#endif
+}
+
+void worker_process::join(std::chrono::milliseconds timeout)
+{
+    const std::chrono::steady_clock::time_point _deadline = std::chrono::steady_clock::now() + timeout;
+    while (is_running()) {
+        if (std::chrono::steady_clock::now() >= _deadline) {
+            kill();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+#if SMTG_OS_WINDOWS
+    if (_handle) {
+        CloseHandle(_handle);
+        _handle = nullptr;
+    }
+#endif
+}
+
+std::string worker_process::get_exit_reason() const
+{
+    if (!_has_exited) {
+        return "was killed";
+    }
+#if SMTG_OS_WINDOWS
+    std::ostringstream _reason;
+    _reason << "exited with code 0x" << std::hex << static_cast<std::uint32_t>(_exit_status);
+    return _reason.str();
+#else
+    const int _status = static_cast<int>(_exit_status);
+    if (WIFSIGNALED(_status)) {
+        return "crashed with signal " + std::to_string(WTERMSIG(_status)) + " (" + strsignal(WTERMSIG(_status)) + ")";
+    }
+    return "exited with code " + std::to_string(WEXITSTATUS(_status));
+#endif
+}
+
+std::uint64_t get_current_process_id()
+{
+#if SMTG_OS_WINDOWS
+    return static_cast<std::uint64_t>(GetCurrentProcessId());
+#else
+    return static_cast<std::uint64_t>(getpid());
+#endif
+}
+
+bool is_process_running(std::uint64_t process_id)
+{
+#if SMTG_OS_WINDOWS
+    HANDLE _process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(process_id));
+    if (!_process) {
+        return false;
+    }
+    const bool _is_running = WaitForSingleObject(_process, 0) == WAIT_TIMEOUT;
+    CloseHandle(_process);
+    return _is_running;
+#else
+    return ::kill(static_cast<pid_t>(process_id), 0) == 0 || errno == EPERM;
+#endif
+}
+
+// real time
+
+realtime_grant set_thread_realtime(realtime_policy policy, std::int32_t& priority)
+{
+    if (policy == realtime_policy::none) {
+        return realtime_grant::full;
+    }
+#if SMTG_OS_WINDOWS
+    return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) ? realtime_grant::full : realtime_grant::none;
+#else
+    const int _policy = policy == realtime_policy::round_robin ? SCHED_RR : SCHED_FIFO;
+    sched_param _parameters {};
+    _parameters.sched_priority = std::clamp(priority, sched_get_priority_min(_policy), sched_get_priority_max(_policy));
+    if (pthread_setschedparam(pthread_self(), _policy, &_parameters) == 0) {
+        priority = _parameters.sched_priority;
+        return realtime_grant::full;
+    }
+#if SMTG_OS_LINUX
+    // unprivileged users may still ask for priorities up to their rtprio limit, which is how the
+    // audio group of most distributions grants real time scheduling
+    rlimit _limit {};
+    if (getrlimit(RLIMIT_RTPRIO, &_limit) == 0 && _limit.rlim_cur > 0) {
+        _parameters.sched_priority = static_cast<int>(std::min<rlim_t>(_limit.rlim_cur, static_cast<rlim_t>(_parameters.sched_priority)));
+        if (pthread_setschedparam(pthread_self(), _policy, &_parameters) == 0) {
+            priority = _parameters.sched_priority;
+            return realtime_grant::reduced_priority;
+        }
+    }
+    // the nice limit is 20 minus the lowest nice value allowed, the nice value of a thread is its own
+    if (getrlimit(RLIMIT_NICE, &_limit) == 0) {
+        const int _nice = 20 - static_cast<int>(std::min<rlim_t>(_limit.rlim_cur, 40));
+        if (_nice < 0 && setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), _nice) == 0) {
+            priority = _nice;
+            return realtime_grant::nice;
+        }
+    }
+#endif
+    return realtime_grant::none;
+#endif
+}
+
+bool set_thread_affinity(const std::vector<std::uint32_t>& cpus)
+{
+    if (cpus.empty()) {
+        return true;
+    }
+#if SMTG_OS_WINDOWS
+    DWORD_PTR _mask = 0;
+    for (std::uint32_t _cpu : cpus) {
+        if (_cpu < sizeof(DWORD_PTR) * CHAR_BIT) {
+            _mask |= DWORD_PTR(1) << _cpu;
+        }
+    }
+    return _mask && SetThreadAffinityMask(GetCurrentThread(), _mask) != 0;
+#elif SMTG_OS_LINUX
+    cpu_set_t _set;
+    CPU_ZERO(&_set);
+    for (std::uint32_t _cpu : cpus) {
+        if (_cpu < CPU_SETSIZE) {
+            CPU_SET(_cpu, &_set);
+        }
+    }
+    return CPU_COUNT(&_set) && pthread_setaffinity_np(pthread_self(), sizeof(_set), &_set) == 0;
+#else
+    // macOS only has affinity hints between the threads of a process
+    return false;
+#endif
+}
+
+bool lock_process_memory()
+{
+#if SMTG_OS_WINDOWS
+    return false;
+#else
+    int _flags = MCL_CURRENT;
+    rlimit _limit {};
+    if (getrlimit(RLIMIT_MEMLOCK, &_limit) == 0 && _limit.rlim_cur == RLIM_INFINITY) {
+        _flags |= MCL_FUTURE;
+    }
+    return mlockall(_flags) == 0;
+#endif
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <pluginterfaces/base/fplatform.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum struct ipc_wait_mode {
+    sleep, // block in the kernel right away
+    spin, // busy wait for spin_duration before blocking in the kernel
+};
+
+struct ipc_wait_settings {
+    ipc_wait_mode mode { ipc_wait_mode::sleep };
+    std::chrono::microseconds spin_duration { 50 };
+};
+
+[[nodiscard]] std::string make_ipc_name(const std::string& purpose);
+
+struct shared_memory {
+    shared_memory() = default;
+    shared_memory(const shared_memory&) = delete;
+    shared_memory& operator=(const shared_memory&) = delete;
+    ~shared_memory();
+
+    [[nodiscard]] bool create(const std::string& name, std::size_t size);
+    [[nodiscard]] bool open(const std::string& name, std::size_t size);
+    void close();
+    // removes a segment whose owner died without closing it, Windows does that by itself
+    static void remove(const std::string& name);
+
+    [[nodiscard]] void* data() const { return _data; }
+    [[nodiscard]] std::size_t size() const { return _size; }
+    [[nodiscard]] const std::string& name() const { return _name; }
+
+    // maps every page now so that the audio threads never fault on them, and also keeps them in
+    // physical memory when should_lock is set. Returns false when they could not be locked
+    [[nodiscard]] bool prefault(bool should_lock);
+
+private:
+    std::string _name;
+    void* _data { nullptr };
+    std::size_t _size { 0 };
+    bool _is_owner { false };
+#if SMTG_OS_WINDOWS
+    void* _handle { nullptr };
+#endif
+};
+
+// view of a whole file, read only for caches we only want to page in when they are read, or read
+// write for files that other processes watch while we update them
+struct mapped_file {
+    mapped_file() = default;
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    ~mapped_file();
+
+    [[nodiscard]] bool open(const std::filesystem::path& path);
+    [[nodiscard]] bool create(const std::filesystem::path& path, std::size_t size); // replaces the file, zero filled
+    void close();
+
+    [[nodiscard]] const std::byte* data() const { return static_cast<const std::byte*>(_data); }
+    [[nodiscard]] std::byte* writable_data() const { return static_cast<std::byte*>(_data); } // created files only
+    [[nodiscard]] std::size_t size() const { return _size; }
+
+private:
+    void* _data { nullptr };
+    std::size_t _size { 0 };
+#if SMTG_OS_WINDOWS
+    void* _file { nullptr };
+    void* _handle { nullptr };
+#endif
+};
+
+// 32 bit word living in shared memory that one process waits on while another one modifies it.
+// Linux uses shared futexes, Windows pairs the word with a named event and other platforms fall
+// back to polling with short sleeps
+struct ipc_signal {
+    ipc_signal() = default;
+    ipc_signal(const ipc_signal&) = delete;
+    ipc_signal& operator=(const ipc_signal&) = delete;
+    ~ipc_signal();
+
+    [[nodiscard]] bool create(const std::string& name, std::atomic<std::uint32_t>* word);
+    [[nodiscard]] bool open(const std::string& name, std::atomic<std::uint32_t>* word);
+    void close();
+
+    [[nodiscard]] std::uint32_t load() const { return _word->load(std::memory_order_acquire); }
+    void store(std::uint32_t value);
+    void notify();
+
+    // blocks while the word equals expected, may return spuriously
+    void wait(std::uint32_t expected, std::chrono::nanoseconds timeout);
+
+    // waits until the predicate returns true or the deadline is reached, returns the predicate result
+    template <typename predicate_t>
+    [[nodiscard]] bool wait_until(predicate_t&& predicate, std::chrono::steady_clock::time_point deadline, const ipc_wait_settings& settings);
+
+private:
+    std::atomic<std::uint32_t>* _word { nullptr };
+#if SMTG_OS_WINDOWS
+    void* _event { nullptr };
+#endif
+};
+
+template <typename predicate_t>
+bool ipc_signal::wait_until(predicate_t&& predicate, std::chrono::steady_clock::time_point deadline, const ipc_wait_settings& settings)
+{
+    if (predicate()) {
+        return true;
+    }
+
+    if (settings.mode == ipc_wait_mode::spin) {
+        const std::chrono::steady_clock::time_point _spin_end = std::min(deadline, std::chrono::steady_clock::now() + settings.spin_duration);
+        std::uint32_t _iterations = 0;
+        while (std::chrono::steady_clock::now() < _spin_end) {
+            if (predicate()) {
+                return true;
+            }
+            if (++_iterations % 64 == 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    while (true) {
+        const std::uint32_t _seen = load();
+        if (predicate()) {
+            return true;
+        }
+        const std::chrono::steady_clock::time_point _now = std::chrono::steady_clock::now();
+        if (_now >= deadline) {
+            return false;
+        }
+        wait(_seen, deadline - _now);
+    }
+}
+
+enum struct realtime_policy {
+    none, // default scheduling
+    fifo, // SCHED_FIFO, runs until it blocks or a higher priority thread wakes
+    round_robin, // SCHED_RR, also yields to threads of the same priority after a time slice
+};
+
+struct realtime_settings {
+    realtime_policy policy { realtime_policy::none };
+    std::int32_t priority { 70 }; // 1 to 99 on POSIX
+    std::vector<std::uint32_t> cpus; // empty runs on any cpu
+    bool should_lock_memory { false };
+};
+
+enum struct realtime_grant {
+    full,
+    reduced_priority, // real time, but below the requested priority
+    nice, // default scheduling with a lower nice value
+    none,
+};
+
+// what a process asked for in its realtime_settings and did not get
+constexpr std::uint32_t realtime_refused_priority = 1; // lower priority, a nice value or default scheduling instead
+constexpr std::uint32_t realtime_refused_affinity = 2;
+constexpr std::uint32_t realtime_refused_memory_lock = 4;
+
+// gives the calling thread the real time policy. Without the privilege it retries with the highest
+// priority the rtprio limit allows, then with the lowest value the nice limit allows, so that no
+// rtkit daemon is needed. priority receives the granted priority, or nice value
+[[nodiscard]] realtime_grant set_thread_realtime(realtime_policy policy, std::int32_t& priority);
+[[nodiscard]] bool set_thread_affinity(const std::vector<std::uint32_t>& cpus);
+
+// locks the pages mapped so far, and the future ones when the memlock limit is unlimited since
+// allocations fail once a limited process reaches it
+[[nodiscard]] bool lock_process_memory();
+
+struct worker_process {
+    worker_process() = default;
+    worker_process(const worker_process&) = delete;
+    worker_process& operator=(const worker_process&) = delete;
+    ~worker_process();
+
+    [[nodiscard]] bool spawn(const std::filesystem::path& executable, const std::vector<std::string>& arguments);
+    [[nodiscard]] bool is_running();
+    void kill();
+
+    // lock free and without reaping, so any thread may ask while another one owns the process. Only
+    // sees the exit where the system can watch a process, false otherwise
+    [[nodiscard]] bool has_ended() const;
+
+    // waits for the process to exit, kills it if it is still running after the timeout
+    void join(std::chrono::milliseconds timeout);
+
+    // describes how the process ended once is_running returned false
+    [[nodiscard]] bool has_exited_successfully() const { return _has_exited && _exit_status == 0; }
+    [[nodiscard]] std::string get_exit_reason() const;
+
+private:
+    void close_exit_watch();
+
+#if SMTG_OS_WINDOWS
+    void* _handle { nullptr };
+    void* _exit_handle { nullptr }; // open until the next spawn, unlike _handle that kill closes
+#else
+    int _pid { -1 };
+    int _exit_fd { -1 }; // pidfd of the process, open until the next spawn
+#endif
+    bool _has_exited { false };
+    std::int64_t _exit_status { 0 }; // raw wait status on POSIX, exit code on Windows
+};
+
+[[nodiscard]] std::uint64_t get_current_process_id();
+[[nodiscard]] bool is_process_running(std::uint64_t process_id);
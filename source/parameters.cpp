@@ -0,0 +1,59 @@
+#include <sandbox.hpp>
+
+bool parameter_cache::key::operator==(const key& other) const
+{
+    return command == other.command && id == other.id && value_bits == other.value_bits && text == other.text;
+}
+
+std::size_t parameter_cache::key_hash::operator()(const key& conversion_key) const
+{
+    std::size_t _hash = std::hash<std::uint64_t>()(conversion_key.value_bits);
+    _hash ^= std::hash<std::uint64_t>()((static_cast<std::uint64_t>(conversion_key.command) << 32) | conversion_key.id) + 0x9e3779b97f4a7c15ull + (_hash << 6) + (_hash >> 2);
+    if (!conversion_key.text.empty()) {
+        _hash ^= std::hash<std::u16string>()(conversion_key.text) + 0x9e3779b97f4a7c15ull + (_hash << 6) + (_hash >> 2);
+    }
+    return _hash;
+}
+
+parameter_cache::key parameter_cache::make_key(worker_command command, const parameter_conversion& conversion)
+{
+    key _key { command, conversion.id, 0, {} };
+    if (command == worker_command::get_param_value_by_string) {
+        _key.text.assign(conversion.text, std::find(conversion.text, conversion.text + std::size(conversion.text), 0));
+    } else {
+        std::memcpy(&_key.value_bits, &conversion.value, sizeof(_key.value_bits));
+    }
+    return _key;
+}
+
+const parameter_conversion* parameter_cache::find(const key& conversion_key)
+{
+    const auto _found = _index.find(conversion_key);
+    if (_found == _index.end()) {
+        return nullptr;
+    }
+    _entries.splice(_entries.begin(), _entries, _found->second);
+    return &_found->second->second;
+}
+
+void parameter_cache::insert(const key& conversion_key, const parameter_conversion& conversion)
+{
+    const auto _found = _index.find(conversion_key);
+    if (_found != _index.end()) {
+        _found->second->second = conversion;
+        _entries.splice(_entries.begin(), _entries, _found->second);
+        return;
+    }
+    if (_entries.size() >= parameter_cache_capacity) {
+        _index.erase(_entries.back().first);
+        _entries.pop_back();
+    }
+    _entries.emplace_front(conversion_key, conversion);
+    _index.emplace(conversion_key, _entries.begin());
+}
+
+void parameter_cache::clear()
+{
+    _index.clear();
+    _entries.clear();
+}
@@ -0,0 +1,146 @@
+#include <sandbox.hpp>
+
+void pipeline_fifo::prepare(std::uint32_t channel_count, std::uint32_t latency, std::uint32_t capacity, std::int32_t symbolic_sample_size)
+{
+    _latency = latency;
+    _capacity = std::max(latency, capacity);
+    _symbolic_sample_size = symbolic_sample_size;
+    _channels.assign(channel_count, std::vector<std::byte>(static_cast<std::size_t>(_capacity) * get_sample_bytes(symbolic_sample_size)));
+    reset();
+}
+
+void pipeline_fifo::reset()
+{
+    for (std::vector<std::byte>& _channel : _channels) {
+        std::fill(_channel.begin(), _channel.end(), std::byte { 0 });
+    }
+    _read_index = 0;
+    _count = _latency;
+}
+
+void pipeline_fifo::write(std::uint32_t channel, const void* samples, std::int32_t symbolic_sample_size, std::uint32_t count)
+{
+    // the ring wraps at most once per write, the conversion happens in the copy
+    const std::size_t _sample_bytes = get_sample_bytes(_symbolic_sample_size);
+    const std::size_t _source_sample_bytes = get_sample_bytes(symbolic_sample_size);
+    const std::uint32_t _write_index = (_read_index + _count) % _capacity;
+    const std::uint32_t _first_count = std::min(count, _capacity - _write_index);
+    std::byte* _ring = _channels[channel].data();
+    copy_samples(_ring + _write_index * _sample_bytes, _symbolic_sample_size, samples, symbolic_sample_size, _first_count);
+    if (count > _first_count) {
+        copy_samples(_ring, _symbolic_sample_size, static_cast<const std::byte*>(samples) + _first_count * _source_sample_bytes, symbolic_sample_size, count - _first_count);
+    }
+}
+
+void pipeline_fifo::commit_write(std::uint32_t count)
+{
+    _count = std::min(_capacity, _count + count);
+}
+
+void pipeline_fifo::read(std::uint32_t channel, void* samples, std::uint32_t count) const
+{
+    const std::size_t _sample_bytes = get_sample_bytes(_symbolic_sample_size);
+    const std::uint32_t _first_count = std::min(count, _capacity - _read_index);
+    const std::byte* _ring = _channels[channel].data();
+    std::memcpy(samples, _ring + _read_index * _sample_bytes, _first_count * _sample_bytes);
+    if (count > _first_count) {
+        std::memcpy(static_cast<std::byte*>(samples) + _first_count * _sample_bytes, _ring, (count - _first_count) * _sample_bytes);
+    }
+}
+
+void pipeline_fifo::commit_read(std::uint32_t count)
+{
+    _read_index = (_read_index + count) % _capacity;
+    _count -= std::min(_count, count);
+}
+
+void piece_parameter_changes::prepare(std::size_t queue_count)
+{
+    _queues = std::make_unique<queue[]>(queue_count);
+    _queue_capacity = queue_count;
+    for (std::size_t _index = 0; _index < queue_count; ++_index) {
+        _queues[_index].changes = this;
+    }
+    _points.resize(sandbox_max_parameter_points);
+    clear();
+}
+
+void piece_parameter_changes::clear()
+{
+    _queue_count = 0;
+    _point_count = 0;
+}
+
+Steinberg::int32 PLUGIN_API piece_parameter_changes::getParameterCount()
+{
+    return static_cast<Steinberg::int32>(_queue_count);
+}
+
+Steinberg::Vst::IParamValueQueue* PLUGIN_API piece_parameter_changes::getParameterData(Steinberg::int32 index)
+{
+    return index >= 0 && static_cast<std::size_t>(index) < _queue_count ? &_queues[static_cast<std::size_t>(index)] : nullptr;
+}
+
+Steinberg::Vst::IParamValueQueue* PLUGIN_API piece_parameter_changes::addParameterData(const Steinberg::Vst::ParamID& id, Steinberg::int32& index)
+{
+    for (std::size_t _index = 0; _index < _queue_count; ++_index) {
+        if (_queues[_index].id == id) {
+            index = static_cast<Steinberg::int32>(_index);
+            return &_queues[_index];
+        }
+    }
+    if (_queue_count == _queue_capacity) {
+        return nullptr;
+    }
+    queue& _queue = _queues[_queue_count];
+    _queue.id = id;
+    _queue.first_point = _point_count;
+    _queue.point_count = 0;
+    index = static_cast<Steinberg::int32>(_queue_count++);
+    return &_queue;
+}
+
+Steinberg::Vst::ParamID PLUGIN_API piece_parameter_changes::queue::getParameterId()
+{
+    return id;
+}
+
+Steinberg::int32 PLUGIN_API piece_parameter_changes::queue::getPointCount()
+{
+    return static_cast<Steinberg::int32>(point_count);
+}
+
+Steinberg::tresult PLUGIN_API piece_parameter_changes::queue::getPoint(Steinberg::int32 index, Steinberg::int32& sampleOffset, Steinberg::Vst::ParamValue& value)
+{
+    if (index < 0 || static_cast<std::size_t>(index) >= point_count) {
+        return Steinberg::kResultFalse;
+    }
+    const point& _point = changes->_points[first_point + static_cast<std::size_t>(index)];
+    sampleOffset = _point.sample_offset;
+    value = _point.value;
+    return Steinberg::kResultTrue;
+}
+
+Steinberg::tresult PLUGIN_API piece_parameter_changes::queue::addPoint(Steinberg::int32 sampleOffset, Steinberg::Vst::ParamValue value, Steinberg::int32& index)
+{
+    // points stay sorted and a point at the same sample replaces the previous one, like the SDK queues
+    point* _points = changes->_points.data() + first_point;
+    std::size_t _index = 0;
+    while (_index < point_count && _points[_index].sample_offset < sampleOffset) {
+        ++_index;
+    }
+    if (_index < point_count && _points[_index].sample_offset == sampleOffset) {
+        _points[_index].value = value;
+        index = static_cast<Steinberg::int32>(_index);
+        return Steinberg::kResultTrue;
+    }
+    if (first_point + point_count != changes->_point_count || changes->_point_count == changes->_points.size()) {
+        return Steinberg::kResultFalse;
+    }
+    std::move_backward(_points + _index, _points + point_count, _points + point_count + 1);
+    _points[_index] = { sampleOffset, value };
+    ++point_count;
+    ++changes->_point_count;
+    index = static_cast<Steinberg::int32>(_index);
+    return Steinberg::kResultTrue;
+}
@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <condition_variable>
+#include <thread>
+
+#include <public.sdk/source/main/moduleinit.h>
+
+#include <sandbox.hpp>
+
+struct instance_pool {
+    std::vector<std::shared_ptr<sandboxed_plugin_data>> plugins; // any plugin may ask for a standby later
+    std::thread refill_thread;
+    std::mutex refill_mutex;
+    std::condition_variable refill_condition;
+    bool should_refill { false };
+    bool should_stop { false };
+};
+
+// never destroyed, a thread still joinable at static destruction would terminate the host. The
+// thread is stopped before the library unloads instead, static destructors run under the loader
+// lock on Windows where joining it would deadlock
+static instance_pool& global_instance_pool = *new instance_pool();
+static Steinberg::ModuleTerminator global_instance_pool_terminator(stop_instance_pool);
+
+[[nodiscard]] bool refill_plugin_pool(sandboxed_plugin_data& data)
+{
+    {
+        std::lock_guard _lock(data.pool_mutex);
+        if (data.pooled_instances.size() >= data.pool_size) {
+            return false;
+        }
+    }
+
+    // launching takes a while so the instance is only published once it is ready
+    instance_reference _instance = get_instance_registry().create();
+    if (!_instance || !load_sandboxed_instance(&data, *_instance)) {
+        std::cerr << "Sandbox error: could not prepare a pooled instance of " << data.plugin_name << ", disabling its pool" << std::endl;
+        std::lock_guard _lock(data.pool_mutex);
+        data.pool_size = 0;
+        return false;
+    }
+    std::lock_guard _lock(data.pool_mutex);
+    data.pooled_instances.push_back(std::move(_instance));
+    return true;
+}
+
+// the standby only launches its worker and loads the module, the plugin is created once an instance recovers on it
+[[nodiscard]] bool refill_plugin_standby(sandboxed_plugin_data& data)
+{
+    {
+        std::lock_guard _lock(data.pool_mutex);
+        if (!data.has_standby || (data.standby && data.standby->is_running())) {
+            return false;
+        }
+    }
+
+    std::unique_ptr<sandbox_worker> _standby = std::make_unique<sandbox_worker>();
+    if (!_standby->launch(std::string()) || _standby->load_module(data.stages) != Steinberg::kResultOk) {
+        std::cerr << "Sandbox error: could not prepare a standby worker for " << data.plugin_name << ", disabling it" << std::endl;
+        std::lock_guard _lock(data.pool_mutex);
+        data.has_standby = false;
+        return false;
+    }
+    std::lock_guard _lock(data.pool_mutex);
+    data.standby = std::move(_standby);
+    return true;
+}
+
+void run_instance_pool()
+{
+    while (true) {
+        {
+            std::unique_lock _lock(global_instance_pool.refill_mutex);
+            global_instance_pool.refill_condition.wait(_lock, []() { return global_instance_pool.should_refill || global_instance_pool.should_stop; });
+            if (global_instance_pool.should_stop) {
+                return;
+            }
+            global_instance_pool.should_refill = false;
+        }
+
+        // one instance per plugin and per pass so that every pool gets its first instances early
+        bool _has_refilled = true;
+        while (_has_refilled) {
+            _has_refilled = false;
+            for (const std::shared_ptr<sandboxed_plugin_data>& _plugin : global_instance_pool.plugins) {
+                {
+                    std::lock_guard _lock(global_instance_pool.refill_mutex);
+                    if (global_instance_pool.should_stop) {
+                        return;
+                    }
+                }
+                _has_refilled |= refill_plugin_pool(*_plugin);
+                _has_refilled |= refill_plugin_standby(*_plugin);
+            }
+        }
+    }
+}
+
+// the refill thread only starts once a pool needs it
+void request_pool_refill()
+{
+    {
+        std::lock_guard _lock(global_instance_pool.refill_mutex);
+        if (global_instance_pool.should_stop) {
+            return;
+        }
+        global_instance_pool.should_refill = true;
+        if (!global_instance_pool.refill_thread.joinable()) {
+            global_instance_pool.refill_thread = std::thread(run_instance_pool);
+        }
+    }
+    global_instance_pool.refill_condition.notify_one();
+}
+
+void start_instance_pool(const std::vector<std::shared_ptr<sandboxed_plugin_data>>& plugins)
+{
+    global_instance_pool.plugins = plugins;
+    if (std::any_of(plugins.begin(), plugins.end(), [](const std::shared_ptr<sandboxed_plugin_data>& plugin) { return plugin->pool_size > 0; })) {
+        request_pool_refill();
+    }
+}
+
+void stop_instance_pool()
+{
+    {
+        std::lock_guard _lock(global_instance_pool.refill_mutex);
+        global_instance_pool.should_stop = true;
+    }
+    global_instance_pool.refill_condition.notify_one();
+    if (global_instance_pool.refill_thread.joinable()) {
+        global_instance_pool.refill_thread.join();
+    }
+    for (const std::shared_ptr<sandboxed_plugin_data>& _plugin : global_instance_pool.plugins) {
+        std::lock_guard _lock(_plugin->pool_mutex);
+        _plugin->pooled_instances.clear();
+        _plugin->standby.reset();
+    }
+    global_instance_pool.plugins.clear();
+}
+
+instance_reference claim_pooled_instance(sandboxed_plugin_data* data)
+{
+    instance_reference _instance;
+    {
+        std::lock_guard _lock(data->pool_mutex);
+        while (!data->pooled_instances.empty() && !_instance) {
+            _instance = std::move(data->pooled_instances.back());
+            data->pooled_instances.pop_back();
+            if (!_instance->worker.is_running()) {
+                _instance.reset(); // the worker died while waiting in the pool
+            }
+        }
+        if (!data->pool_size) {
+            return _instance;
+        }
+    }
+
+    request_pool_refill();
+    return _instance;
+}
+
+void request_standby_worker(sandboxed_plugin_data* data)
+{
+    {
+        std::lock_guard _lock(data->pool_mutex);
+        if (data->has_standby) {
+            return;
+        }
+        data->has_standby = true;
+    }
+    request_pool_refill();
+}
+
+std::unique_ptr<sandbox_worker> claim_standby_worker(sandboxed_plugin_data* data)
+{
+    std::unique_ptr<sandbox_worker> _standby;
+    {
+        std::lock_guard _lock(data->pool_mutex);
+        if (!data->has_standby) {
+            return nullptr;
+        }
+        _standby = std::move(data->standby);
+    }
+
+    request_pool_refill();
+    if (_standby && !_standby->is_running()) {
+        _standby.reset(); // the worker died while standing by
+    }
+    return _standby;
+}
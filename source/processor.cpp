@@ -1,5 +1,121 @@
+#include <public.sdk/source/vst/utility/processdataslicer.h>
+#include <public.sdk/source/vst/utility/sampleaccurate.h>
+
+#include <cmath>
+#include <limits>
+
 #include <sandbox.hpp>
 
+[[nodiscard]] std::uint32_t get_bus_list_channel_count(Steinberg::Vst::BusList& buses)
+{
+    std::uint32_t _channel_count = 0;
+    for (Steinberg::IPtr<Steinberg::Vst::Bus>& _bus : buses) {
+        _channel_count += Steinberg::Vst::SpeakerArr::getChannelCount(static_cast<Steinberg::Vst::AudioBus*>(_bus.get())->getArrangement());
+    }
+    return _channel_count;
+}
+
+// the transport only carries the channels of active buses, packed in bus order on both sides
+[[nodiscard]] bool is_bus_active(const Steinberg::Vst::BusList& buses, std::int32_t index)
+{
+    return index < static_cast<std::int32_t>(buses.size()) && buses[index]->isActive();
+}
+
+[[nodiscard]] std::uint32_t get_active_channel_count(const Steinberg::Vst::BusList& buses)
+{
+    std::uint32_t _channel_count = 0;
+    for (const Steinberg::IPtr<Steinberg::Vst::Bus>& _bus : buses) {
+        if (_bus->isActive()) {
+            _channel_count += Steinberg::Vst::SpeakerArr::getChannelCount(static_cast<Steinberg::Vst::AudioBus*>(_bus.get())->getArrangement());
+        }
+    }
+    return _channel_count;
+}
+
+[[nodiscard]] void* get_channel_buffer(Steinberg::Vst::AudioBusBuffers& buffers, std::int32_t channel, std::int32_t symbolic_sample_size)
+{
+    if (symbolic_sample_size == Steinberg::Vst::kSample64) {
+        return buffers.channelBuffers64[channel];
+    }
+    return buffers.channelBuffers32[channel];
+}
+
+// the transport carries samples at the precision of the sandboxed plugin, when the host asked for
+// the other one the conversion happens inside the copy so that every sample is touched once
+
+void write_transport_inputs(transport_header* header, transport_slot* slot, Steinberg::Vst::ProcessData& data, const Steinberg::Vst::BusList& buses)
+{
+    const std::size_t _count = static_cast<std::size_t>(data.numSamples);
+    std::uint32_t _channel = 0;
+    slot->num_samples = data.numSamples;
+    slot->input_silence_flags = 0;
+    for (std::int32_t _bus = 0; _bus < data.numInputs; ++_bus) {
+        if (!is_bus_active(buses, _bus)) {
+            continue;
+        }
+        for (std::int32_t _bus_channel = 0; _bus_channel < data.inputs[_bus].numChannels && _channel < header->input_channels; ++_bus_channel, ++_channel) {
+            // the worker feeds channels flagged silent from a buffer of its own
+            if (data.inputs[_bus].silenceFlags & (std::uint64_t(1) << _bus_channel)) {
+                slot->input_silence_flags |= std::uint64_t(1) << _channel;
+            } else if (_count) {
+                copy_samples(get_transport_channel(header, slot, Steinberg::Vst::kInput, _channel), header->symbolic_sample_size,
+                    get_channel_buffer(data.inputs[_bus], _bus_channel, data.symbolicSampleSize), data.symbolicSampleSize, _count);
+            }
+        }
+    }
+
+    slot->has_process_context = data.processContext ? 1 : 0;
+    if (data.processContext) {
+        slot->process_context = *data.processContext;
+    }
+    write_transport_parameters(header, slot, Steinberg::Vst::kInput, data.inputParameterChanges);
+    write_transport_events(header, slot, Steinberg::Vst::kInput, data.inputEvents);
+}
+
+void read_transport_outputs(transport_header* header, transport_slot* slot, Steinberg::Vst::ProcessData& data, const Steinberg::Vst::BusList& buses)
+{
+    const std::size_t _count = static_cast<std::size_t>(data.numSamples);
+    std::uint32_t _channel = 0;
+    for (std::int32_t _bus = 0; _bus < data.numOutputs; ++_bus) {
+        if (!is_bus_active(buses, _bus)) {
+            continue;
+        }
+        data.outputs[_bus].silenceFlags = 0;
+        for (std::int32_t _bus_channel = 0; _bus_channel < data.outputs[_bus].numChannels; ++_bus_channel, ++_channel) {
+            if (!_count) {
+                continue;
+            }
+            void* _buffer = get_channel_buffer(data.outputs[_bus], _bus_channel, data.symbolicSampleSize);
+            if (_channel < header->output_channels) {
+                copy_samples(_buffer, data.symbolicSampleSize,
+                    get_transport_channel(header, slot, Steinberg::Vst::kOutput, _channel), header->symbolic_sample_size, _count);
+                if (slot->output_silence_flags & (std::uint64_t(1) << _channel)) {
+                    data.outputs[_bus].silenceFlags |= std::uint64_t(1) << _bus_channel;
+                }
+            } else {
+                std::memset(_buffer, 0, _count * get_sample_bytes(data.symbolicSampleSize));
+                data.outputs[_bus].silenceFlags |= std::uint64_t(1) << _bus_channel;
+            }
+        }
+    }
+
+    read_transport_parameters(header, slot, Steinberg::Vst::kOutput, data.outputParameterChanges);
+    read_transport_events(header, slot, Steinberg::Vst::kOutput, data.outputEvents);
+}
+
+void clear_outputs(Steinberg::Vst::ProcessData& data)
+{
+    if (data.numSamples <= 0) {
+        return;
+    }
+    for (std::int32_t _bus = 0; _bus < data.numOutputs; ++_bus) {
+        for (std::int32_t _bus_channel = 0; _bus_channel < data.outputs[_bus].numChannels; ++_bus_channel) {
+            std::memset(get_channel_buffer(data.outputs[_bus], _bus_channel, data.symbolicSampleSize), 0, data.numSamples * get_sample_bytes(data.symbolicSampleSize));
+        }
+        data.outputs[_bus].silenceFlags = ((std::uint64_t)1 << data.outputs[_bus].numChannels) - 1;
+    }
+}
+
 sandbox_processor::sandbox_processor(const sandboxed_proxy_data& proxy_data)
     : _proxy_data(proxy_data)
 {
@@ -16,108 +132,1029 @@ Steinberg::tresult PLUGIN_API sandbox_processor::initialize(Steinberg::FUnknown*
 
     auto result = AudioEffect::initialize(context);
     if (result == Steinberg::kResultTrue) {
+        add_buses();
+    }
+
+    // the sandboxed processor is initialized by the worker when it loads the plugin
+
+    return result;
+}
+
+void sandbox_processor::add_buses()
+{
+    // classes that come from moduleinfo.json were never instantiated by the scan, the worker
+    // already loaded the plugin and tells its buses instead
+    std::vector<scanned_bus> _buses = _proxy_data.plugin_data->original_buses;
+    if (_buses.empty() && _proxy_data.instance->worker.get_buses(_buses) != Steinberg::kResultOk) {
+        _buses.clear();
+    }
+    if (_buses.empty()) {
+        std::cerr << "Sandbox error: could not get the buses of " << _proxy_data.plugin_data->plugin_name << ", falling back to stereo" << std::endl;
         addAudioInput(STR("Input"), Steinberg::Vst::SpeakerArr::kStereo);
         addAudioOutput(STR("Output"), Steinberg::Vst::SpeakerArr::kStereo);
     }
 
-    // return _sandboxed_processor->initialize(context);
-    // return Steinberg::kResultOk;
-    
-    // sandboxed_plugin_instance* _instance = _proxy_data.plugin_data->instances[_proxy_data.instance_id].get();
-    // _proxy_data.plugin_data->instances[_proxy_data.instance_id]->sandboxed_processor->initialize(context);
+    for (const scanned_bus& _bus : _buses) {
+        const Steinberg::Vst::BusInfo& _info = _bus.info;
+        const bool _is_input = _info.direction == Steinberg::Vst::kInput;
+        if (_info.mediaType == Steinberg::Vst::kAudio) {
+            if (_is_input) {
+                addAudioInput(_info.name, _bus.arrangement, _info.busType, _info.flags);
+            } else {
+                addAudioOutput(_info.name, _bus.arrangement, _info.busType, _info.flags);
+            }
+        } else if (_info.mediaType == Steinberg::Vst::kEvent) {
+            if (_is_input) {
+                addEventInput(_info.name, _info.channelCount, _info.busType, _info.flags);
+            } else {
+                addEventOutput(_info.name, _info.channelCount, _info.busType, _info.flags);
+            }
+        }
+    }
 
-    return result;
+    // the worker activated the same buses when it loaded the plugin
+    for (Steinberg::Vst::BusList* _list : { &audioInputs, &audioOutputs, &eventInputs }) {
+        if (!_list->empty()) {
+            _list->front()->setActive(true);
+        }
+    }
 }
 
 Steinberg::tresult PLUGIN_API sandbox_processor::terminate()
 {
-    _proxy_data.get_sandboxed_processor()->terminate();
-    // no we must call ourself plugprovider + module shutdown bc on a pas d'autre entry point pour ca
-    // + delete instance de la map
+    // the worker terminates the sandboxed processor and controller and unloads the module on shutdown
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    report_missed_blocks();
+    _instance->is_terminated = true;
+    _instance->worker.shutdown();
+    _instance->transport.close();
     return AudioEffect::terminate();
 }
 
 Steinberg::tresult PLUGIN_API sandbox_processor::setActive(Steinberg::TBool state)
 {
-    // Steinberg::tresult _result = _original_processor->setActive(state);
+    const std::int32_t _state = state ? 1 : 0;
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    _should_reset_pipeline.store(true);
+    if (!state) {
+        report_missed_blocks();
+    }
+
+    // lazy and hibernated instances load their plugin here, the transport follows with the setup the
+    // host gave while it was not loaded
+    const sandbox_config& _config = get_sandbox_config();
+    if (state) {
+        // a worker that crashed while inactive comes back from the last snapshot like a hibernated one
+        if (_instance->is_plugin_loaded && _config.should_recover && !_instance->worker.is_running()) {
+            _instance->worker.shutdown();
+            _instance->transport.close();
+            _instance->is_plugin_loaded = false;
+        }
+        const bool _was_loaded = _instance->is_plugin_loaded;
+        const bool _was_hibernated = _instance->is_hibernated;
+        const std::chrono::steady_clock::time_point _wake_start = std::chrono::steady_clock::now();
+        if (!wake_sandboxed_instance(_proxy_data.plugin_data, _proxy_data.instance)) {
+            return Steinberg::kResultFalse;
+        }
+        if (!_was_loaded) {
+            _instance->is_worker_lost.store(false, std::memory_order_relaxed);
+            _instance->telemetry->is_worker_lost.store(0, std::memory_order_relaxed);
+        }
+        if (!_instance->transport.header && _has_setup) {
+            const Steinberg::tresult _setup_result = setup_worker_processing(processSetup);
+            if (_setup_result != Steinberg::kResultOk) {
+                return _setup_result;
+            }
+        }
+        if (_was_hibernated) {
+            _instance->telemetry->restore_time.record(clamp_telemetry_duration(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _wake_start).count()));
+        }
+    } else if (!_instance->is_plugin_loaded) {
+        _instance->is_active = false;
+        return AudioEffect::setActive(state);
+    }
+
+    sandbox_worker& _worker = _instance->worker;
+    const Steinberg::tresult _result = _worker.send_command(worker_command::set_active, &_state, sizeof(_state));
+    if (_result != Steinberg::kResultOk) {
+        return _result;
+    }
+    _instance->is_active = state;
+    if (!state && _config.hibernation_delay.count()) {
+        _instance->inactive_since = std::chrono::steady_clock::now();
+        watch_inactive_instance(_proxy_data.instance.handle());
+    }
+    // the standby is prepared once the plugin runs, so that it never slows down the first activation
+    if (state && _config.should_recover) {
+        watch_active_instance(_proxy_data.plugin_data, _proxy_data.instance.handle());
+        if (_config.has_standby && _config.worker_groups.grouping == worker_grouping::instance) {
+            request_standby_worker(_proxy_data.plugin_data);
+        }
+    }
+
+    // the plugin knows its tail and latency once active. Silent blocks keep going to the worker
+    // until the outputs of the last sound went through both, plugins with an infinite tail never
+    // skip it and neither do plugins that take events since a held note sounds without any input
+    _silent_samples = 0;
+    _silence_bypass_samples = std::numeric_limits<std::uint64_t>::max();
+    std::uint32_t _tail = Steinberg::Vst::kInfiniteTail;
+    std::uint32_t _latency = 0;
+    const bool _has_event_input = std::any_of(eventInputs.begin(), eventInputs.end(), [](const Steinberg::IPtr<Steinberg::Vst::Bus>& bus) { return bus->isActive(); });
+    if (state && !_has_event_input && _worker.send_command(worker_command::get_tail_samples, nullptr, 0, &_tail, sizeof(_tail)) == Steinberg::kResultOk && _tail != Steinberg::Vst::kInfiniteTail
+        && _worker.send_command(worker_command::get_latency_samples, nullptr, 0, &_latency, sizeof(_latency)) == Steinberg::kResultOk) {
+        _silence_bypass_samples = std::uint64_t(_tail) + _latency + _pipeline.latency();
+    }
     return AudioEffect::setActive(state);
 }
 
+Steinberg::tresult PLUGIN_API sandbox_processor::setProcessing(Steinberg::TBool state)
+{
+    const std::int32_t _state = state ? 1 : 0;
+    std::lock_guard _lock(_proxy_data.instance->lifecycle_mutex);
+    _should_reset_pipeline.store(true);
+    if (!_proxy_data.instance->is_plugin_loaded) {
+        return Steinberg::kResultOk; // nothing processes before the plugin is loaded by setActive
+    }
+    const Steinberg::tresult _result = _proxy_data.instance->worker.send_command(worker_command::set_processing, &_state, sizeof(_state));
+    if (_result == Steinberg::kResultOk) {
+        _proxy_data.instance->is_processing = state;
+    }
+    return _result;
+}
+
 Steinberg::tresult PLUGIN_API sandbox_processor::setupProcessing(Steinberg::Vst::ProcessSetup& newSetup)
 {
+    std::lock_guard _lock(_proxy_data.instance->lifecycle_mutex);
+    if (_proxy_data.instance->is_plugin_loaded) {
+        const Steinberg::tresult _result = setup_worker_processing(newSetup);
+        if (_result != Steinberg::kResultOk) {
+            return _result;
+        }
+    }
+    _has_setup = true;
     return AudioEffect::setupProcessing(newSetup);
 }
 
+Steinberg::tresult sandbox_processor::setup_worker_processing(const Steinberg::Vst::ProcessSetup& setup)
+{
+    // the transport has room for every bus since hosts may activate buses after this call
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    const std::uint32_t _input_channels = get_bus_list_channel_count(audioInputs);
+    const std::uint32_t _output_channels = get_bus_list_channel_count(audioOutputs);
+
+    // the sandboxed plugin runs in double precision only when both the host and the plugin want it,
+    // every other combination goes through 32 bit samples and the proxy converts
+    std::int32_t _plugin_sample_size = setup.symbolicSampleSize;
+    if (_plugin_sample_size == Steinberg::Vst::kSample64 && _instance->worker.send_command(worker_command::can_process_sample_size, &_plugin_sample_size, sizeof(_plugin_sample_size)) != Steinberg::kResultTrue) {
+        _plugin_sample_size = Steinberg::Vst::kSample32;
+    }
+    // every block left with the worker needs a slot of its own besides the one we fill. Offline
+    // rendering has no real time budget and queues many blocks, so that the worker processes them
+    // back to back while the host prepares the next ones
+    const sandbox_config& _config = get_sandbox_config();
+    const std::uint32_t _max_samples = static_cast<std::uint32_t>(std::max(1, setup.maxSamplesPerBlock));
+    const bool _is_offline_setup = setup.processMode == Steinberg::Vst::kOffline;
+    const std::uint32_t _depth = _config.fixed_block_size ? 0 : (_is_offline_setup ? _config.offline_depth : (_config.is_pipelined ? 1 : 0));
+    // with fixed blocks the plugin only ever sees blocks of that size, whatever the host sends
+    const std::uint32_t _worker_samples = _config.fixed_block_size ? _config.fixed_block_size : _max_samples;
+    if (!_instance->transport.create(_depth + 1, _worker_samples, _input_channels, _output_channels, _plugin_sample_size)) {
+        return Steinberg::kResultFalse;
+    }
+    // the audio thread must never fault on the transport, this is the last call before processing
+    std::uint32_t _realtime_refusals = 0;
+    if (!_instance->transport.memory.prefault(_config.realtime.should_lock_memory)) {
+        std::cerr << "Sandbox error: could not lock the transport in memory, the memlock limit of the user is too low" << std::endl;
+        _realtime_refusals |= realtime_refused_memory_lock;
+    }
+
+    _instance->transport.header->parameter_tolerance = _config.automation_tolerance;
+
+    transport_setup _transport_setup;
+    copy_ipc_name(_transport_setup.transport_name, _instance->transport.memory.name());
+    _transport_setup.process_setup = setup;
+    _transport_setup.process_setup.symbolicSampleSize = _plugin_sample_size;
+    _transport_setup.process_setup.maxSamplesPerBlock = static_cast<Steinberg::int32>(_worker_samples);
+    _transport_setup.slot_count = _instance->transport.header->slot_count;
+    _transport_setup.input_channels = _input_channels;
+    _transport_setup.output_channels = _output_channels;
+    _transport_setup.transport_size = _instance->transport.memory.size();
+    const Steinberg::tresult _result = _instance->worker.send_command(worker_command::setup_processing, &_transport_setup, sizeof(_transport_setup));
+    if (_result != Steinberg::kResultOk) {
+        _instance->transport.close();
+        return _result;
+    }
+    // the worker answered once its processing threads got their scheduling
+    _realtime_refusals |= _instance->worker.get_realtime_refusals();
+    _instance->telemetry->realtime_refusals.store(_realtime_refusals, std::memory_order_relaxed);
+    // a worker that replaces a crashed one maps the same transport
+    _instance->replay.setup = _transport_setup;
+    _instance->replay.has_setup = true;
+
+    // waiting offline means the worker is the bottleneck, spinning would only take a core from it
+    _wait_settings = _is_offline_setup ? ipc_wait_settings {} : _config.wait_settings;
+    _pipeline_depth = _depth;
+    _is_offline = _is_offline_setup;
+    _should_bypass_silence = _config.should_bypass_silence;
+    _blocks_in_flight = 0;
+    _should_reset_pipeline.store(false);
+    _fixed_block_size = _config.fixed_block_size;
+    _fixed_block_fill = 0;
+    if (_fixed_block_size) {
+        _pipeline.prepare(_output_channels, _fixed_block_size, _fixed_block_size + _max_samples, setup.symbolicSampleSize);
+    } else {
+        _pipeline.prepare(_depth ? _output_channels : 0, _depth * _max_samples, _depth * _max_samples, setup.symbolicSampleSize);
+    }
+    // the fixed block path looks the values up by id on the audio thread, without hashing
+    const std::vector<Steinberg::Vst::ParameterInfo>& _parameters = _proxy_data.plugin_data->original_parameters;
+    _parameter_values.clear();
+    _parameter_values.reserve(_parameters.size());
+    for (const Steinberg::Vst::ParameterInfo& _info : _parameters) {
+        _parameter_values.emplace_back(_info.id, std::numeric_limits<Steinberg::Vst::ParamValue>::quiet_NaN());
+    }
+    std::sort(_parameter_values.begin(), _parameter_values.end());
+    _has_flushed_parameters = false;
+    if (_fixed_block_size) {
+        _piece_parameters.prepare(_parameters.size());
+    }
+
+    // offline rendering never falls back, see wait_for_worker
+    const watchdog_settings& _watchdog = _config.watchdog;
+    _block_deadline = sandbox_process_timeout;
+    if (_watchdog.deadline > 0. && setup.sampleRate > 0. && !_is_offline_setup) {
+        const std::chrono::duration<double> _block_duration(_max_samples / setup.sampleRate);
+        _block_deadline = std::min<std::chrono::nanoseconds>(sandbox_process_timeout, std::chrono::duration_cast<std::chrono::nanoseconds>(_watchdog.deadline * _block_duration));
+    }
+    _fallback = _watchdog.fallback;
+    _is_worker_late = false;
+    _window_blocks = 0;
+    _window_missed_blocks = 0;
+    _late_missed_blocks = static_cast<std::uint32_t>(std::ceil(std::clamp(_watchdog.late_ratio, 0., 1.) * watchdog_window_blocks));
+    _last_outputs.assign(_fallback == watchdog_fallback::repeat ? _output_channels : 0, std::vector<std::byte>(_max_samples * get_sample_bytes(setup.symbolicSampleSize)));
+    _last_output_count = 0;
+    _instance->telemetry->block_duration.store(setup.sampleRate > 0. ? static_cast<std::uint64_t>(_max_samples * 1e9 / setup.sampleRate) : 0, std::memory_order_relaxed);
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API sandbox_processor::connect(Steinberg::Vst::IConnectionPoint* other)
+{
+    const Steinberg::tresult _result = AudioEffect::connect(other);
+    if (_result != Steinberg::kResultOk) {
+        return _result;
+    }
+    Steinberg::IPtr<Steinberg::Vst::IMessage> _message = Steinberg::owned(allocateMessage());
+    if (_message) {
+        _message->setMessageID(sandbox_instance_message);
+        _message->getAttributes()->setInt(sandbox_instance_handle_attribute, static_cast<Steinberg::int64>(_proxy_data.instance.handle()));
+        sendMessage(_message);
+    }
+    return _result;
+}
+
 Steinberg::tresult PLUGIN_API sandbox_processor::canProcessSampleSize(std::int32_t symbolicSampleSize)
 {
-    if (symbolicSampleSize == Steinberg::Vst::kSample32)
+    // both are always accepted, setupProcessing converts when the sandboxed plugin lacks kSample64
+    if (symbolicSampleSize == Steinberg::Vst::kSample32 || symbolicSampleSize == Steinberg::Vst::kSample64) {
+        return Steinberg::kResultTrue;
+    }
+    return Steinberg::kResultFalse;
+}
+
+Steinberg::tresult PLUGIN_API sandbox_processor::setBusArrangements(Steinberg::Vst::SpeakerArrangement* inputs, Steinberg::int32 numIns, Steinberg::Vst::SpeakerArrangement* outputs, Steinberg::int32 numOuts)
+{
+    if (numIns < 0 || numOuts < 0 || (numIns && !inputs) || (numOuts && !outputs)) {
+        return Steinberg::kInvalidArgument;
+    }
+    if (numIns > static_cast<Steinberg::int32>(audioInputs.size()) || numOuts > static_cast<Steinberg::int32>(audioOutputs.size())) {
+        return Steinberg::kResultFalse;
+    }
+
+    // our buses take whatever the sandboxed processor kept so that getBusArrangement answers like it
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    bus_arrangements _arrangements {};
+    _arrangements.input_count = numIns;
+    _arrangements.output_count = numOuts;
+    std::copy(inputs, inputs + numIns, _arrangements.arrangements);
+    std::copy(outputs, outputs + numOuts, _arrangements.arrangements + numIns);
+    _instance->replay.arrangements = _arrangements;
+    _instance->replay.has_arrangements = true;
+
+    // a plugin that is not loaded accepts the arrangements it already has, only it can tell about others
+    const auto _is_current = [](const Steinberg::Vst::BusList& buses, const Steinberg::Vst::SpeakerArrangement* arrangements, Steinberg::int32 count) {
+        for (Steinberg::int32 _index = 0; _index < count; ++_index) {
+            if (static_cast<Steinberg::Vst::AudioBus*>(buses[_index].get())->getArrangement() != arrangements[_index]) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (!_instance->is_plugin_loaded && _is_current(audioInputs, inputs, numIns) && _is_current(audioOutputs, outputs, numOuts)) {
         return Steinberg::kResultTrue;
+    }
+    if (!wake_sandboxed_instance(_proxy_data.plugin_data, _proxy_data.instance)) {
+        return Steinberg::kResultFalse;
+    }
+    const Steinberg::tresult _result = _instance->worker.set_bus_arrangements(_arrangements);
+    for (Steinberg::int32 _index = 0; _index < numIns; ++_index) {
+        static_cast<Steinberg::Vst::AudioBus*>(audioInputs[_index].get())->setArrangement(_arrangements.arrangements[_index]);
+    }
+    for (Steinberg::int32 _index = 0; _index < numOuts; ++_index) {
+        static_cast<Steinberg::Vst::AudioBus*>(audioOutputs[_index].get())->setArrangement(_arrangements.arrangements[numIns + _index]);
+    }
+    return _result;
+}
 
-    // disable the following comment if your processing support kSample64
-    /* if (symbolicSampleSize == Vst::kSample64)
-            return kResultTrue; */
+Steinberg::tresult PLUGIN_API sandbox_processor::activateBus(Steinberg::Vst::MediaType type, Steinberg::Vst::BusDirection dir, Steinberg::int32 index, Steinberg::TBool state)
+{
+    const bus_activation _activation { type, dir, index, state ? 1 : 0 };
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    if (_instance->is_plugin_loaded) {
+        const Steinberg::tresult _result = _instance->worker.send_command(worker_command::activate_bus, &_activation, sizeof(_activation));
+        if (_result != Steinberg::kResultOk) {
+            return _result;
+        }
+    }
+    std::vector<bus_activation>& _activations = _instance->replay.activations;
+    const auto _previous = std::find_if(_activations.begin(), _activations.end(), [&](const bus_activation& activation) {
+        return activation.type == type && activation.direction == dir && activation.index == index;
+    });
+    if (_previous != _activations.end()) {
+        *_previous = _activation;
+    } else {
+        _activations.push_back(_activation);
+    }
+    return AudioEffect::activateBus(type, dir, index, state);
+}
 
-    return Steinberg::kResultFalse;
+Steinberg::uint32 PLUGIN_API sandbox_processor::getLatencySamples()
+{
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    // hosts ask every instance while opening a project, one that never ran answers 0 until its first
+    // activation rather than loading the plugin for it
+    std::uint32_t _latency = 0;
+    if (_instance->is_hibernated) {
+        _latency = _instance->replay.latency_samples;
+    } else if (_instance->is_plugin_loaded && _instance->worker.send_command(worker_command::get_latency_samples, nullptr, 0, &_latency, sizeof(_latency)) != Steinberg::kResultOk) {
+        _latency = 0;
+    }
+    return _latency + _pipeline.latency();
 }
 
-Steinberg::tresult PLUGIN_API sandbox_processor::process(Steinberg::Vst::ProcessData& data)
+Steinberg::uint32 PLUGIN_API sandbox_processor::getTailSamples()
 {
-    static bool ok = false;
-    if (!ok) {
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    std::uint32_t _tail = 0;
+    if (_instance->is_hibernated) {
+        _tail = _instance->replay.tail_samples;
+    } else if (_instance->is_plugin_loaded && _instance->worker.send_command(worker_command::get_tail_samples, nullptr, 0, &_tail, sizeof(_tail)) != Steinberg::kResultOk) {
+        _tail = 0;
+    }
+    return _tail;
+}
+
+bool sandbox_processor::wait_for_worker(transport_header* header, std::uint32_t read_position, std::chrono::steady_clock::time_point deadline)
+{
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    const auto _is_done = [&]() { return static_cast<std::int32_t>(header->read_position.load(std::memory_order_acquire) - read_position) >= 0; };
+
+    // offline rendering waits for as long as the worker runs, however slow the plugin, and only
+    // gives up on a worker that crashed or hangs. The worker may not have been woken for the
+    // blocks we wait on yet, see process_pipelined
+    if (_is_offline) {
+        if (!_is_done()) {
+            _instance->worker.notify_blocks();
+        }
+        const std::chrono::steady_clock::time_point _give_up = std::chrono::steady_clock::now() + sandbox_command_timeout;
+        while (!_instance->transport.response_signal.wait_until(_is_done, std::min(_give_up, std::chrono::steady_clock::now() + sandbox_process_timeout), _wait_settings)) {
+            if (_instance->worker.has_ended() || std::chrono::steady_clock::now() >= _give_up) {
+                _instance->is_worker_lost.store(true, std::memory_order_relaxed);
+                _instance->telemetry->is_worker_lost.store(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        return true;
+    }
 
+    if (_instance->transport.response_signal.wait_until(_is_done, deadline, _wait_settings)) {
+        return true;
     }
-    if (data.numSamples > 0) {
-        //--- ------------------------------------------
-        // here as example a default implementation where we try to copy the inputs to the outputs:
-        // if less input than outputs then clear outputs
-        //--- ------------------------------------------
 
-        std::int32_t minBus = std::min(data.numInputs, data.numOutputs);
-        for (std::int32_t i = 0; i < minBus; i++) {
-            std::int32_t minChan = std::min(data.inputs[i].numChannels, data.outputs[i].numChannels);
-            for (std::int32_t c = 0; c < minChan; c++) {
-                // do not need to be copied if the buffers are the same
-                if (data.outputs[i].channelBuffers32[c] != data.inputs[i].channelBuffers32[c]) {
-                    std::memcpy(data.outputs[i].channelBuffers32[c], data.inputs[i].channelBuffers32[c],
-                        data.numSamples * sizeof(Steinberg::Vst::Sample32));
+    // the published blocks stay with the worker and their results are dropped, nothing new is
+    // published until it caught up with them. A worker that stays behind for too long crashed or hangs
+    const std::chrono::steady_clock::time_point _now = std::chrono::steady_clock::now();
+    if (!_is_worker_late) {
+        _is_worker_late = true;
+        _late_since = _now;
+    } else if (_now - _late_since >= sandbox_process_timeout) {
+        _instance->is_worker_lost.store(true, std::memory_order_relaxed);
+        _instance->telemetry->is_worker_lost.store(1, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+void sandbox_processor::write_fallback_outputs(Steinberg::Vst::ProcessData& data)
+{
+    if (_fallback == watchdog_fallback::silence || data.numSamples <= 0) {
+        clear_outputs(data);
+        return;
+    }
+    const std::size_t _count = static_cast<std::size_t>(data.numSamples);
+    const std::size_t _sample_bytes = get_sample_bytes(data.symbolicSampleSize);
+    std::uint32_t _channel = 0;
+    std::int32_t _input_bus = 0;
+    std::int32_t _input_bus_channel = 0;
+    for (std::int32_t _bus = 0; _bus < data.numOutputs; ++_bus) {
+        if (!is_bus_active(audioOutputs, _bus)) {
+            continue;
+        }
+        data.outputs[_bus].silenceFlags = 0;
+        for (std::int32_t _bus_channel = 0; _bus_channel < data.outputs[_bus].numChannels; ++_bus_channel, ++_channel) {
+            std::byte* _buffer = static_cast<std::byte*>(get_channel_buffer(data.outputs[_bus], _bus_channel, data.symbolicSampleSize));
+            if (_fallback == watchdog_fallback::passthrough) {
+                while (_input_bus < data.numInputs && (_input_bus_channel >= data.inputs[_input_bus].numChannels || !is_bus_active(audioInputs, _input_bus))) {
+                    ++_input_bus;
+                    _input_bus_channel = 0;
                 }
+                if (_input_bus < data.numInputs) {
+                    const void* _input = get_channel_buffer(data.inputs[_input_bus], _input_bus_channel, data.symbolicSampleSize);
+                    if (_input != _buffer) {
+                        std::memcpy(_buffer, _input, _count * _sample_bytes);
+                    }
+                    if (data.inputs[_input_bus].silenceFlags & (std::uint64_t(1) << _input_bus_channel)) {
+                        data.outputs[_bus].silenceFlags |= std::uint64_t(1) << _bus_channel;
+                    }
+                    ++_input_bus_channel;
+                    continue;
+                }
+            } else if (_channel < _last_outputs.size() && _last_output_count) {
+                const std::byte* _last = _last_outputs[_channel].data();
+                for (std::size_t _offset = 0; _offset < _count; _offset += _last_output_count) {
+                    std::memcpy(_buffer + _offset * _sample_bytes, _last, std::min<std::size_t>(_count - _offset, _last_output_count) * _sample_bytes);
+                }
+                continue;
+            }
+            std::memset(_buffer, 0, _count * _sample_bytes);
+            data.outputs[_bus].silenceFlags |= std::uint64_t(1) << _bus_channel;
+        }
+    }
+}
+
+void sandbox_processor::keep_last_outputs(Steinberg::Vst::ProcessData& data)
+{
+    if (_last_outputs.empty() || data.numSamples <= 0) {
+        return;
+    }
+    const std::size_t _bytes = static_cast<std::size_t>(data.numSamples) * get_sample_bytes(data.symbolicSampleSize);
+    std::uint32_t _channel = 0;
+    for (std::int32_t _bus = 0; _bus < data.numOutputs; ++_bus) {
+        if (!is_bus_active(audioOutputs, _bus)) {
+            continue;
+        }
+        for (std::int32_t _bus_channel = 0; _bus_channel < data.outputs[_bus].numChannels && _channel < _last_outputs.size(); ++_bus_channel, ++_channel) {
+            std::memcpy(_last_outputs[_channel].data(), get_channel_buffer(data.outputs[_bus], _bus_channel, data.symbolicSampleSize), _bytes);
+        }
+    }
+    _last_output_count = static_cast<std::uint32_t>(data.numSamples);
+}
+
+void sandbox_processor::count_block(bool is_missed)
+{
+    telemetry_instance* _telemetry = _proxy_data.instance->telemetry.get();
+    _telemetry->block_count.store(_telemetry->block_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (is_missed) {
+        _telemetry->missed_block_count.store(_telemetry->missed_block_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        ++_window_missed_blocks;
+    }
+    if (++_window_blocks == watchdog_window_blocks) {
+        if (_late_missed_blocks && _window_missed_blocks >= _late_missed_blocks) {
+            _telemetry->is_late.store(1, std::memory_order_relaxed);
+        }
+        _window_blocks = 0;
+        _window_missed_blocks = 0;
+    }
+}
+
+void sandbox_processor::record_block_times(transport_slot* slot, std::int64_t round_trip_end)
+{
+    telemetry_instance* _telemetry = _proxy_data.instance->telemetry.get();
+    _telemetry->round_trip_time.record(clamp_telemetry_duration(round_trip_end - slot->publish_time));
+    _telemetry->wakeup_latency.record(clamp_telemetry_duration(slot->start_time - slot->publish_time));
+    _telemetry->plugin_time.record(clamp_telemetry_duration(slot->end_time - slot->start_time));
+}
+
+void sandbox_processor::report_missed_blocks()
+{
+    // the audio thread only counts, the misses are printed when processing stops
+    telemetry_instance* _telemetry = _proxy_data.instance->telemetry.get();
+    const std::uint64_t _missed_blocks = _telemetry->missed_block_count.load(std::memory_order_relaxed);
+    if (_missed_blocks == _reported_missed_blocks) {
+        return;
+    }
+    std::cerr << "Sandbox error: " << _proxy_data.plugin_data->plugin_name << " missed the deadline of " << _missed_blocks - _reported_missed_blocks
+              << " blocks (" << _missed_blocks << " of " << _telemetry->block_count.load(std::memory_order_relaxed) << " in total)"
+              << (_telemetry->is_late.load(std::memory_order_relaxed) ? ", flagged as consistently late" : "") << std::endl;
+    _reported_missed_blocks = _missed_blocks;
+}
+
+bool sandbox_processor::is_block_silent(Steinberg::Vst::ProcessData& data) const
+{
+    if ((data.inputEvents && data.inputEvents->getEventCount() > 0) || (data.inputParameterChanges && data.inputParameterChanges->getParameterCount() > 0)) {
+        return false;
+    }
+    // hosts do not always flag their silent buffers so unflagged channels are scanned
+    const std::size_t _count = static_cast<std::size_t>(std::max(0, data.numSamples));
+    for (std::int32_t _bus = 0; _bus < data.numInputs; ++_bus) {
+        if (!is_bus_active(audioInputs, _bus)) {
+            continue;
+        }
+        for (std::int32_t _bus_channel = 0; _bus_channel < data.inputs[_bus].numChannels; ++_bus_channel) {
+            if (!(data.inputs[_bus].silenceFlags & (std::uint64_t(1) << _bus_channel)) && !is_silent(get_channel_buffer(data.inputs[_bus], _bus_channel, data.symbolicSampleSize), data.symbolicSampleSize, _count)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool sandbox_processor::bypass_silent_block(Steinberg::Vst::ProcessData& data)
+{
+    if (!_should_bypass_silence || !is_block_silent(data)) {
+        _silent_samples = 0;
+        return false;
+    }
+    if (_silent_samples < _silence_bypass_samples) {
+        _silent_samples += static_cast<std::uint64_t>(std::max(0, data.numSamples));
+        return false;
+    }
+
+    // the pipeline only holds silence by now, it starts over with the next block that has sound
+    if (_blocks_in_flight || _fixed_block_fill) {
+        _should_reset_pipeline.store(true, std::memory_order_relaxed);
+    }
+    clear_outputs(data);
+    _last_output_count = 0;
+    telemetry_instance* _telemetry = _proxy_data.instance->telemetry.get();
+    _telemetry->silent_block_count.store(_telemetry->silent_block_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return true;
+}
+
+Steinberg::tresult sandbox_processor::process_pipelined(Steinberg::Vst::ProcessData& data, transport_header* header, std::chrono::steady_clock::time_point deadline)
+{
+    // block N goes to the worker while block N - depth, which had depth block periods to complete,
+    // comes back through the fifo. Its events and parameter changes are shifted to where its
+    // audio lands in the current block
+    const std::uint32_t _position = header->write_position.load(std::memory_order_relaxed);
+    if (_should_reset_pipeline.exchange(false, std::memory_order_relaxed)) {
+        if (_blocks_in_flight && !wait_for_worker(header, _position, deadline)) {
+            write_fallback_outputs(data);
+            count_block(true);
+            return Steinberg::kResultOk;
+        }
+        _blocks_in_flight = 0;
+        _pipeline.reset();
+    }
+
+    transport_slot* _slot = get_transport_slot(header, _position);
+    write_transport_inputs(header, _slot, data, audioInputs);
+    _slot->publish_time = get_transport_time();
+    header->write_position.store(_position + 1, std::memory_order_release);
+
+    // offline the worker is only woken once half of the queue waits for it, then it processes
+    // them back to back instead of sleeping and waking up for every block
+    if (!_is_offline || _position + 1 - header->read_position.load(std::memory_order_acquire) >= std::max(1u, _pipeline_depth / 2)) {
+        _proxy_data.instance->worker.notify_blocks();
+    }
+
+    Steinberg::tresult _result = Steinberg::kResultOk;
+    if (++_blocks_in_flight > _pipeline_depth) {
+        const std::uint32_t _oldest_position = _position + 1 - _blocks_in_flight;
+        if (!wait_for_worker(header, _oldest_position + 1, deadline)) {
+            write_fallback_outputs(data);
+            count_block(true);
+            return Steinberg::kResultOk;
+        }
+        --_blocks_in_flight;
+        transport_slot* _oldest_slot = get_transport_slot(header, _oldest_position);
+        write_pipeline_outputs(header, _oldest_slot, data, data.numSamples);
+        _result = _oldest_slot->result;
+        record_block_times(_oldest_slot, _oldest_slot->end_time);
+    }
+
+    read_pipeline_outputs(data, header);
+    keep_last_outputs(data);
+    count_block(false);
+    return _result;
+}
+
+void sandbox_processor::write_pipeline_outputs(transport_header* header, transport_slot* slot, Steinberg::Vst::ProcessData& data, std::int32_t host_count)
+{
+    // events and parameter changes are shifted to where the audio of the slot lands once the
+    // current host block reads the fifo, the ones that land later are clamped to its last sample
+    const std::uint32_t _count = static_cast<std::uint32_t>(std::max(0, slot->num_samples));
+    const std::int32_t _offset_shift = static_cast<std::int32_t>(_pipeline.size());
+    const std::uint32_t _channel_count = std::min(get_active_channel_count(audioOutputs), header->output_channels);
+    for (std::uint32_t _channel = 0; _channel < _channel_count; ++_channel) {
+        _pipeline.write(_channel, get_transport_channel(header, slot, Steinberg::Vst::kOutput, _channel), header->symbolic_sample_size, _count);
+    }
+    _pipeline.commit_write(_count);
+    read_transport_parameters(header, slot, Steinberg::Vst::kOutput, data.outputParameterChanges, _offset_shift, host_count - 1);
+    read_transport_events(header, slot, Steinberg::Vst::kOutput, data.outputEvents, _offset_shift, host_count - 1);
+}
+
+void sandbox_processor::read_pipeline_outputs(Steinberg::Vst::ProcessData& data, transport_header* header)
+{
+    // silence flags are not tracked through the fifo, so the outputs are never reported silent
+    const std::uint32_t _count = static_cast<std::uint32_t>(data.numSamples);
+    std::uint32_t _channel = 0;
+    for (std::int32_t _bus = 0; _bus < data.numOutputs; ++_bus) {
+        if (!is_bus_active(audioOutputs, _bus)) {
+            continue;
+        }
+        data.outputs[_bus].silenceFlags = 0;
+        for (std::int32_t _bus_channel = 0; _bus_channel < data.outputs[_bus].numChannels; ++_bus_channel, ++_channel) {
+            void* _buffer = get_channel_buffer(data.outputs[_bus], _bus_channel, data.symbolicSampleSize);
+            if (_channel < header->output_channels) {
+                _pipeline.read(_channel, _buffer, _count);
+            } else {
+                std::memset(_buffer, 0, _count * get_sample_bytes(data.symbolicSampleSize));
             }
-            data.outputs[i].silenceFlags = data.inputs[i].silenceFlags;
+        }
+    }
+    _pipeline.commit_read(_count);
+}
 
-            // clear the remaining output buffers
-            for (std::int32_t c = minChan; c < data.outputs[i].numChannels; c++) {
-                // clear output buffers
-                std::memset(data.outputs[i].channelBuffers32[c], 0,
-                    data.numSamples * sizeof(Steinberg::Vst::Sample32));
+// value a ramp of the queue reaches at a sample offset, the way a sample accurate plugin reads it
+[[nodiscard]] Steinberg::Vst::ParamValue get_queue_value(Steinberg::Vst::IParamValueQueue* queue, Steinberg::Vst::ParamValue start_value, std::int32_t sample_offset)
+{
+    Steinberg::Vst::SampleAccurate::Parameter _parameter(queue->getParameterId(), start_value);
+    _parameter.beginChanges(queue);
+    const Steinberg::Vst::ParamValue _value = _parameter.advance(sample_offset);
+    _parameter.endChanges();
+    return _value;
+}
 
-                // inform the host that this channel is silent
-                data.outputs[i].silenceFlags |= ((std::uint64_t)1 << c);
+void sandbox_processor::write_fixed_block_piece(Steinberg::Vst::ProcessData& slice, std::int32_t host_count, std::int32_t host_offset, std::int32_t slice_offset, std::int32_t count, transport_header* header, transport_slot* slot)
+{
+    // the piece covers count samples of the host block from host_offset and lands in the slot from
+    // _fixed_block_fill. The slice has the event and parameter changes of the whole host block but
+    // its buffers start slice_offset samples before the piece
+    const std::int32_t _from = host_offset;
+    const std::int32_t _to = _from + count;
+    const std::int32_t _last_offset = std::max(0, host_count - 1);
+    const std::int32_t _slot_offset = static_cast<std::int32_t>(_fixed_block_fill);
+    const bool _is_block_start = _fixed_block_fill == 0;
+    if (_is_block_start) {
+        slot->num_samples = static_cast<std::int32_t>(_fixed_block_size);
+        slot->input_silence_flags = header->input_channels < 64 ? (std::uint64_t(1) << header->input_channels) - 1 : ~std::uint64_t(0);
+        slot->has_process_context = slice.processContext ? 1 : 0;
+        if (slice.processContext) {
+            // the worker block starts _from samples into the host block
+            Steinberg::Vst::ProcessContext& _context = slot->process_context;
+            _context = *slice.processContext;
+            _context.projectTimeSamples += _from;
+            _context.continousTimeSamples += _from;
+            if ((_context.state & Steinberg::Vst::ProcessContext::kProjectTimeMusicValid) && (_context.state & Steinberg::Vst::ProcessContext::kTempoValid) && _context.sampleRate > 0.) {
+                _context.projectTimeMusic += _from / _context.sampleRate * _context.tempo / 60.;
+            }
+            if ((_context.state & Steinberg::Vst::ProcessContext::kSystemTimeValid) && _context.sampleRate > 0.) {
+                _context.systemTime += static_cast<Steinberg::int64>(_from * 1e9 / _context.sampleRate);
             }
         }
-        // clear the remaining output buffers
-        for (std::int32_t i = minBus; i < data.numOutputs; i++) {
-            // clear output buffers
-            for (std::int32_t c = 0; c < data.outputs[i].numChannels; c++) {
-                memset(data.outputs[i].channelBuffers32[c], 0,
-                    data.numSamples * sizeof(Steinberg::Vst::Sample32));
+    }
+
+    // channels stay flagged silent while every piece written to them was, the others get zeros
+    // for their silent pieces
+    const std::size_t _host_sample_bytes = get_sample_bytes(slice.symbolicSampleSize);
+    const std::size_t _slot_sample_bytes = get_sample_bytes(header->symbolic_sample_size);
+    std::uint32_t _channel = 0;
+    for (std::int32_t _bus = 0; _bus < slice.numInputs; ++_bus) {
+        if (!is_bus_active(audioInputs, _bus)) {
+            continue;
+        }
+        for (std::int32_t _bus_channel = 0; _bus_channel < slice.inputs[_bus].numChannels && _channel < header->input_channels; ++_bus_channel, ++_channel) {
+            std::byte* _destination = static_cast<std::byte*>(get_transport_channel(header, slot, Steinberg::Vst::kInput, _channel)) + _slot_offset * _slot_sample_bytes;
+            if (slice.inputs[_bus].silenceFlags & (std::uint64_t(1) << _bus_channel)) {
+                std::memset(_destination, 0, count * _slot_sample_bytes);
+                continue;
             }
-            // inform the host that this bus is silent
-            data.outputs[i].silenceFlags = ((std::uint64_t)1 << data.outputs[i].numChannels) - 1;
+            const std::byte* _source = static_cast<const std::byte*>(get_channel_buffer(slice.inputs[_bus], _bus_channel, slice.symbolicSampleSize)) + slice_offset * _host_sample_bytes;
+            copy_samples(_destination, header->symbolic_sample_size, _source, slice.symbolicSampleSize, static_cast<std::size_t>(count));
+            slot->input_silence_flags &= ~(std::uint64_t(1) << _channel);
         }
     }
-    return Steinberg::kResultOk;
+
+    // points keep their sample, ramps that cross an edge of the piece get a point with the value
+    // they have there so that the worker block follows the ramps of the host block
+    _piece_parameters.clear();
+    const std::int32_t _queue_count = slice.inputParameterChanges ? slice.inputParameterChanges->getParameterCount() : 0;
+    for (std::int32_t _queue_index = 0; _queue_index < _queue_count; ++_queue_index) {
+        Steinberg::Vst::IParamValueQueue* _queue = slice.inputParameterChanges->getParameterData(_queue_index);
+        const std::int32_t _point_count = _queue ? _queue->getPointCount() : 0;
+        Steinberg::int32 _first_offset = 0;
+        Steinberg::Vst::ParamValue _first_value = 0.;
+        if (!_point_count || _queue->getPoint(0, _first_offset, _first_value) != Steinberg::kResultOk) {
+            continue;
+        }
+        const Steinberg::Vst::ParamID _id = _queue->getParameterId();
+        const Steinberg::Vst::ParamValue* _known_value = find_parameter_value(_id);
+        const bool _is_start_known = _known_value && !std::isnan(*_known_value);
+        const Steinberg::Vst::ParamValue _start_value = _is_start_known ? *_known_value : _first_value;
+        Steinberg::int32 _index = 0;
+        Steinberg::Vst::IParamValueQueue* _piece = _piece_parameters.addParameterData(_id, _index);
+        if (!_piece) {
+            continue;
+        }
+        bool _has_point_at_from = false;
+        bool _has_point_at_end = false;
+        bool _has_point_after_from = false;
+        bool _has_point_after_piece = false;
+        for (std::int32_t _point_index = 0; _point_index < _point_count; ++_point_index) {
+            Steinberg::int32 _offset = 0;
+            Steinberg::Vst::ParamValue _value = 0.;
+            if (_queue->getPoint(_point_index, _offset, _value) != Steinberg::kResultOk) {
+                continue;
+            }
+            _offset = std::clamp(_offset, 0, _last_offset);
+            _has_point_at_from |= _offset == _from;
+            _has_point_at_end |= _offset == _to - 1;
+            _has_point_after_from |= _offset > _from;
+            _has_point_after_piece |= _offset >= _to;
+            if (_offset >= _from && _offset < _to) {
+                _piece->addPoint(_slot_offset + _offset - _from, _value, _index);
+            }
+        }
+        if (_from == 0 && _slot_offset > 0 && _is_start_known) {
+            // the host block ramps from the last value, the worker block would ramp from its last
+            // point before this piece instead. A point at the start of the piece takes effect there
+            _piece->addPoint(_has_point_at_from ? _slot_offset - 1 : _slot_offset, _start_value, _index);
+        } else if (_from > 0 && !_has_point_at_from && _has_point_after_from) {
+            _piece->addPoint(_slot_offset, get_queue_value(_queue, _start_value, _from), _index);
+        }
+        if (!_has_point_at_end && _has_point_after_piece) {
+            _piece->addPoint(_slot_offset + count - 1, get_queue_value(_queue, _start_value, _to - 1), _index);
+        }
+    }
+    write_transport_parameters(header, slot, Steinberg::Vst::kInput, &_piece_parameters, !_is_block_start || _has_flushed_parameters);
+    _has_flushed_parameters = false;
+
+    _piece_events.clear();
+    const std::int32_t _event_count = slice.inputEvents ? slice.inputEvents->getEventCount() : 0;
+    for (std::int32_t _event_index = 0; _event_index < _event_count; ++_event_index) {
+        Steinberg::Vst::Event _event {};
+        if (slice.inputEvents->getEvent(_event_index, _event) != Steinberg::kResultOk) {
+            continue;
+        }
+        const std::int32_t _offset = std::clamp(_event.sampleOffset, 0, _last_offset);
+        if (_offset >= _from && _offset < _to) {
+            _event.sampleOffset = _slot_offset + _offset - _from;
+            _piece_events.addEvent(_event);
+        }
+    }
+    write_transport_events(header, slot, Steinberg::Vst::kInput, &_piece_events, !_is_block_start);
+}
+
+void sandbox_processor::write_fixed_block_flush(Steinberg::Vst::IParameterChanges* changes, transport_header* header)
+{
+    // a flush has no samples to cut, its last values take effect at the next sample of the worker block
+    _piece_parameters.clear();
+    const std::int32_t _queue_count = changes ? changes->getParameterCount() : 0;
+    for (std::int32_t _queue_index = 0; _queue_index < _queue_count; ++_queue_index) {
+        Steinberg::Vst::IParamValueQueue* _queue = changes->getParameterData(_queue_index);
+        const std::int32_t _point_count = _queue ? _queue->getPointCount() : 0;
+        Steinberg::int32 _offset = 0;
+        Steinberg::Vst::ParamValue _value = 0.;
+        if (!_point_count || _queue->getPoint(_point_count - 1, _offset, _value) != Steinberg::kResultOk) {
+            continue;
+        }
+        Steinberg::int32 _index = 0;
+        if (Steinberg::Vst::IParamValueQueue* _piece = _piece_parameters.addParameterData(_queue->getParameterId(), _index)) {
+            _piece->addPoint(static_cast<Steinberg::int32>(_fixed_block_fill), _value, _index);
+        }
+    }
+    if (!_piece_parameters.getParameterCount()) {
+        return;
+    }
+    transport_slot* _slot = get_transport_slot(header, header->write_position.load(std::memory_order_relaxed));
+    write_transport_parameters(header, _slot, Steinberg::Vst::kInput, &_piece_parameters, _fixed_block_fill > 0 || _has_flushed_parameters);
+    _has_flushed_parameters = true;
+}
+
+Steinberg::Vst::ParamValue* sandbox_processor::find_parameter_value(Steinberg::Vst::ParamID id)
+{
+    const auto _found = std::lower_bound(_parameter_values.begin(), _parameter_values.end(), id, [](const std::pair<Steinberg::Vst::ParamID, Steinberg::Vst::ParamValue>& known, Steinberg::Vst::ParamID searched) { return known.first < searched; });
+    return _found != _parameter_values.end() && _found->first == id ? &_found->second : nullptr;
+}
+
+void sandbox_processor::remember_parameter_values(Steinberg::Vst::IParameterChanges* changes)
+{
+    // the next host block ramps from the last value of each parameter
+    const std::int32_t _queue_count = changes ? changes->getParameterCount() : 0;
+    for (std::int32_t _queue_index = 0; _queue_index < _queue_count; ++_queue_index) {
+        Steinberg::Vst::IParamValueQueue* _queue = changes->getParameterData(_queue_index);
+        const std::int32_t _point_count = _queue ? _queue->getPointCount() : 0;
+        Steinberg::int32 _offset = 0;
+        Steinberg::Vst::ParamValue _value = 0.;
+        if (!_point_count || _queue->getPoint(_point_count - 1, _offset, _value) != Steinberg::kResultOk) {
+            continue;
+        }
+        if (Steinberg::Vst::ParamValue* _known_value = find_parameter_value(_queue->getParameterId())) {
+            *_known_value = _value;
+        }
+    }
+}
+
+Steinberg::tresult sandbox_processor::process_fixed_blocks(Steinberg::Vst::ProcessData& data, transport_header* header, std::chrono::steady_clock::time_point deadline)
+{
+    // the host block is cut in slices of the worker block size that fill the slot of the next
+    // worker block, which goes to the worker once full. Its outputs come back through the fifo, one
+    // worker block later than the inputs went in
+    if (_should_reset_pipeline.exchange(false, std::memory_order_relaxed)) {
+        _fixed_block_fill = 0;
+        _pipeline.reset();
+    }
+    const std::int32_t _host_count = data.numSamples;
+    if (!_host_count) {
+        write_fixed_block_flush(data.inputParameterChanges, header);
+    }
+    const std::int32_t _block_size = static_cast<std::int32_t>(_fixed_block_size);
+    Steinberg::tresult _result = Steinberg::kResultOk;
+    bool _is_missed = false;
+    std::int32_t _host_offset = 0;
+    Steinberg::Vst::ProcessDataSlicer _slicer(_block_size);
+    const auto _process_slice = [&](Steinberg::Vst::ProcessData& slice) {
+        // the slicer hands data itself over with fewer samples and moved buffers
+        for (std::int32_t _slice_offset = 0; _slice_offset < slice.numSamples;) {
+            const std::int32_t _count = std::min(slice.numSamples - _slice_offset, _block_size - static_cast<std::int32_t>(_fixed_block_fill));
+            const std::uint32_t _position = header->write_position.load(std::memory_order_relaxed);
+            transport_slot* _slot = get_transport_slot(header, _position);
+            write_fixed_block_piece(slice, _host_count, _host_offset, _slice_offset, _count, header, _slot);
+            _fixed_block_fill += static_cast<std::uint32_t>(_count);
+            _host_offset += _count;
+            _slice_offset += _count;
+            if (_fixed_block_fill < _fixed_block_size) {
+                continue;
+            }
+
+            _slot->publish_time = get_transport_time();
+            header->write_position.store(_position + 1, std::memory_order_release);
+            _proxy_data.instance->worker.notify_blocks();
+            if (!wait_for_worker(header, _position + 1, deadline)) {
+                _is_missed = true;
+                _slicer.stop();
+                return;
+            }
+            record_block_times(_slot, get_transport_time());
+            write_pipeline_outputs(header, _slot, data, _host_count);
+            _result = _slot->result;
+            _fixed_block_fill = 0;
+        }
+    };
+    if (data.symbolicSampleSize == Steinberg::Vst::kSample64) {
+        _slicer.process<Steinberg::Vst::SymbolicSampleSizes::kSample64>(data, _process_slice);
+    } else {
+        _slicer.process<Steinberg::Vst::SymbolicSampleSizes::kSample32>(data, _process_slice);
+    }
+    remember_parameter_values(data.inputParameterChanges);
+
+    if (_is_missed) {
+        write_fallback_outputs(data);
+        count_block(true);
+        return Steinberg::kResultOk;
+    }
+    read_pipeline_outputs(data, header);
+    keep_last_outputs(data);
+    count_block(false);
+    return _result;
+}
+
+Steinberg::tresult sandbox_processor::process_block(Steinberg::Vst::ProcessData& data, std::chrono::steady_clock::time_point deadline)
+{
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    transport_header* _header = _instance->transport.header;
+    if (!_header || data.numSamples < 0 || data.numSamples > (_fixed_block_size ? processSetup.maxSamplesPerBlock : static_cast<std::int32_t>(_header->max_samples))) {
+        clear_outputs(data);
+        return Steinberg::kResultOk;
+    }
+    if (_instance->is_worker_lost.load(std::memory_order_seq_cst)) {
+        write_fallback_outputs(data);
+        return Steinberg::kResultOk;
+    }
+    // the worker that replaced a crashed one starts with an empty transport
+    const std::uint32_t _recovery_total = _instance->recovery_count.load(std::memory_order_acquire);
+    if (_recovery_total != _recovery_count) {
+        _recovery_count = _recovery_total;
+        _is_worker_late = false;
+        _blocks_in_flight = 0;
+        _fixed_block_fill = 0;
+        _silent_samples = 0;
+        _pipeline.reset();
+    }
+    if (bypass_silent_block(data)) {
+        return Steinberg::kResultOk;
+    }
+
+    // a late worker gets until the deadline of this block to catch up, the pipeline starts over after it
+    if (_is_worker_late) {
+        if (!wait_for_worker(_header, _header->write_position.load(std::memory_order_relaxed), deadline)) {
+            write_fallback_outputs(data);
+            count_block(true);
+            return Steinberg::kResultOk;
+        }
+        _is_worker_late = false;
+        _blocks_in_flight = 0;
+        _fixed_block_fill = 0;
+        _pipeline.reset();
+    }
+
+    if (_fixed_block_size) {
+        return process_fixed_blocks(data, _header, deadline);
+    }
+    if (_pipeline_depth) {
+        return process_pipelined(data, _header, deadline);
+    }
+
+    const std::uint32_t _position = _header->write_position.load(std::memory_order_relaxed);
+    transport_slot* _slot = get_transport_slot(_header, _position);
+    write_transport_inputs(_header, _slot, data, audioInputs);
+    _slot->publish_time = get_transport_time();
+    _header->write_position.store(_position + 1, std::memory_order_release);
+    _instance->worker.notify_blocks();
+
+    if (!wait_for_worker(_header, _position + 1, deadline)) {
+        write_fallback_outputs(data);
+        count_block(true);
+        return Steinberg::kResultOk;
+    }
+
+    record_block_times(_slot, get_transport_time());
+    read_transport_outputs(_header, _slot, data, audioOutputs);
+    keep_last_outputs(data);
+    count_block(false);
+    return _slot->result;
+}
+
+Steinberg::tresult PLUGIN_API sandbox_processor::process(Steinberg::Vst::ProcessData& data)
+{
+    // everything the block needs was set up in setupProcessing, nothing here allocates, locks or hashes
+    const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    if (data.inputParameterChanges && data.inputParameterChanges->getParameterCount() > 0) {
+        _instance->state_changes.fetch_add(1, std::memory_order_relaxed);
+    }
+    // a crash recovery waits for the block we are in before it replaces the worker
+    _instance->is_in_process.store(true, std::memory_order_seq_cst);
+    const Steinberg::tresult _result = process_block(data, _start + _block_deadline);
+    _instance->is_in_process.store(false, std::memory_order_release);
+    const std::uint64_t _process_time = clamp_telemetry_duration(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count());
+
+    // an xrun is a block that took longer to process than to play, only meaningful in real time
+    telemetry_instance* _telemetry = _instance->telemetry.get();
+    _telemetry->process_time.record(_process_time);
+    if (processSetup.processMode != Steinberg::Vst::kOffline && processSetup.sampleRate > 0. && data.numSamples > 0 && _process_time > data.numSamples * 1e9 / processSetup.sampleRate) {
+        _telemetry->xrun_count.store(_telemetry->xrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    return _result;
 }
 
 Steinberg::tresult PLUGIN_API sandbox_processor::setState(Steinberg::IBStream* state)
 {
-    // Steinberg::IBStreamer streamer (state, kLittleEndian);
-    _proxy_data.get_sandboxed_processor()->setState(state);
-    return Steinberg::kResultOk;
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    if (_instance->is_plugin_loaded) {
+        _instance->state_changes.fetch_add(1, std::memory_order_relaxed);
+        Steinberg::int64 _start = 0;
+        const bool _should_keep = get_sandbox_config().should_recover && state && state->tell(&_start) == Steinberg::kResultOk;
+        const Steinberg::tresult _result = _instance->worker.send_state(worker_command::processor_set_state, state);
+        // a crash recovers the state the host just gave instead of a snapshot taken before it
+        if (_result == Steinberg::kResultOk && _should_keep && state->seek(_start, Steinberg::IBStream::kIBSeekSet, nullptr) == Steinberg::kResultOk
+            && keep_instance_state(_instance->replay.component_state, state) == Steinberg::kResultOk) {
+            _instance->replay.controller_state = nullptr;
+        }
+        return _result;
+    }
+
+    // the controller state saved with the previous one no longer applies
+    const Steinberg::tresult _result = keep_instance_state(_instance->replay.component_state, state);
+    if (_result == Steinberg::kResultOk) {
+        _instance->replay.controller_state = nullptr;
+    }
+    return _result;
 }
 
 Steinberg::tresult PLUGIN_API sandbox_processor::getState(Steinberg::IBStream* state)
 {
-    // Steinberg::IBStreamer streamer (state, kLittleEndian);
-    _proxy_data.get_sandboxed_processor()->getState(state);
-    return Steinberg::kResultOk;
+    sandboxed_plugin_instance* _instance = _proxy_data.instance.get();
+    std::lock_guard _lock(_instance->lifecycle_mutex);
+    if (!_instance->is_plugin_loaded && _instance->replay.component_state) {
+        return _instance->replay.component_state->copy_to(state);
+    }
+    if (!wake_sandboxed_instance(_proxy_data.plugin_data, _proxy_data.instance)) {
+        return Steinberg::kResultFalse;
+    }
+    return _instance->worker.receive_state(worker_command::processor_get_state, state);
 }
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include <condition_variable>
+#include <thread>
+
+#include <public.sdk/source/main/moduleinit.h>
+
+#include <sandbox.hpp>
+
+struct watched_instance {
+    sandboxed_plugin_data* data;
+    registry_handle handle;
+    std::chrono::steady_clock::time_point next_snapshot;
+    bool is_recovering { false }; // the last recovery failed, the instance stays lost until one succeeds
+    std::chrono::steady_clock::time_point next_recovery;
+};
+
+struct recovery_monitor {
+    std::vector<watched_instance> pending; // instances activated since the last pass
+    std::thread monitor_thread;
+    std::mutex monitor_mutex;
+    std::condition_variable monitor_condition;
+    bool should_stop { false };
+};
+
+// never destroyed and stopped before the library unloads, see the instance pool
+static recovery_monitor& global_recovery_monitor = *new recovery_monitor();
+static Steinberg::ModuleTerminator global_recovery_monitor_terminator(stop_recovery_monitor);
+
+// lifecycle_mutex must be held. The audio thread outputs the watchdog fallback from the moment the
+// instance is flagged lost until the new worker mapped the same transport and got the last snapshot
+[[nodiscard]] bool recover_sandboxed_instance(sandboxed_plugin_data* data, const instance_reference& instance)
+{
+    const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+    // sequentially consistent on both sides so that either the audio thread sees the flag before
+    // touching the worker or we see it inside process and wait for it to leave
+    instance->is_worker_lost.store(true, std::memory_order_seq_cst);
+    instance->telemetry->is_worker_lost.store(1, std::memory_order_relaxed);
+    while (instance->is_in_process.load(std::memory_order_seq_cst)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    // a previous attempt may have left a running plugin that only missed its processing setup
+    bool _has_standby = false;
+    if (!instance->worker.is_running()) {
+        instance->worker.shutdown();
+        instance->is_plugin_loaded = false;
+    }
+    if (!instance->is_plugin_loaded) {
+        // waking drops the snapshot, it is put back for the next attempt if this one fails
+        const Steinberg::IPtr<state_buffer> _component_state = instance->replay.component_state;
+        const Steinberg::IPtr<state_buffer> _controller_state = instance->replay.controller_state;
+        // the standby already loaded the module, so its worker only creates the plugin for us. The
+        // session of the standby closes right after and the pool prepares the next one
+        std::unique_ptr<sandbox_worker> _standby = claim_standby_worker(data);
+        _has_standby = static_cast<bool>(_standby);
+        if (!wake_sandboxed_instance(data, instance, _has_standby ? _standby->get_host() : nullptr)) {
+            return false;
+        }
+        _standby.reset();
+        instance->replay.component_state = _component_state;
+        instance->replay.controller_state = _controller_state;
+    }
+
+    // the blocks the crashed worker left behind are dropped
+    transport_header* _header = instance->transport.header;
+    if (!instance->replay.has_setup || !_header) {
+        return false;
+    }
+    _header->read_position.store(_header->write_position.load(std::memory_order_relaxed), std::memory_order_release);
+    const std::int32_t _state = 1;
+    sandbox_worker& _worker = instance->worker;
+    if (_worker.send_command(worker_command::setup_processing, &instance->replay.setup, sizeof(instance->replay.setup)) != Steinberg::kResultOk
+        || _worker.send_command(worker_command::set_active, &_state, sizeof(_state)) != Steinberg::kResultOk
+        || (instance->is_processing && _worker.send_command(worker_command::set_processing, &_state, sizeof(_state)) != Steinberg::kResultOk)) {
+        std::cerr << "Sandbox error: could not set up " << data->plugin_name << " for processing after its worker crashed" << std::endl;
+        return false;
+    }
+    // same as after a wake, the plugin holds the state again
+    instance->replay.component_state = nullptr;
+    instance->replay.controller_state = nullptr;
+
+    const std::chrono::nanoseconds _duration = std::chrono::steady_clock::now() - _start;
+    instance->telemetry->recovery_time.record(clamp_telemetry_duration(_duration.count()));
+    instance->telemetry->recovery_count.store(instance->telemetry->recovery_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    instance->recovery_count.fetch_add(1, std::memory_order_relaxed);
+    instance->is_worker_lost.store(false, std::memory_order_release);
+    instance->telemetry->is_worker_lost.store(0, std::memory_order_relaxed);
+    std::cerr << "Sandbox error: the worker of " << data->plugin_name << " crashed, recovered " << (_has_standby ? "on a standby " : "")
+              << "in " << std::chrono::duration<double, std::milli>(_duration).count() << " ms" << std::endl;
+    return true;
+}
+
+// returns false once the instance no longer needs watching
+[[nodiscard]] bool check_active_instance(watched_instance& watched, std::chrono::steady_clock::time_point now)
+{
+    instance_reference _instance = get_instance_registry().acquire(watched.handle);
+    if (!_instance) {
+        return false;
+    }
+    // a proxy busy with the instance is checked again on the next pass
+    std::unique_lock _lock(_instance->lifecycle_mutex, std::try_to_lock);
+    if (!_lock.owns_lock()) {
+        return true;
+    }
+    // an instance the host deactivates while lost is loaded again by its next activation
+    if (!_instance->is_active || _instance->is_terminated || (!_instance->is_plugin_loaded && !watched.is_recovering)) {
+        return false;
+    }
+    // a worker that hangs keeps running and stays lost, only crashes are recovered. Failed recoveries
+    // are reported once and tried again until one succeeds
+    if (watched.is_recovering || !_instance->worker.is_running()) {
+        if (watched.is_recovering && now < watched.next_recovery) {
+            return true;
+        }
+        const bool _was_recovering = watched.is_recovering;
+        watched.is_recovering = !recover_sandboxed_instance(watched.data, _instance);
+        watched.next_recovery = now + sandbox_recovery_retry_interval;
+        if (watched.is_recovering && !_was_recovering) {
+            std::cerr << "Sandbox error: could not recover " << watched.data->plugin_name << " after its worker crashed, trying again every "
+                      << sandbox_recovery_retry_interval.count() << " ms" << std::endl;
+        }
+        return true;
+    }
+
+    // automation, states and parameter changes are what changes a state, instances that got none
+    // of them since their last snapshot are left alone
+    if (now >= watched.next_snapshot) {
+        watched.next_snapshot = now + get_sandbox_config().snapshot_interval;
+        if (!_instance->replay.component_state || _instance->state_changes.load(std::memory_order_relaxed) != _instance->replay.snapshot_changes) {
+            static_cast<void>(snapshot_sandboxed_instance(*_instance));
+        }
+    }
+    return true;
+}
+
+void run_recovery_monitor()
+{
+    std::vector<watched_instance> _watched;
+    while (true) {
+        const std::chrono::steady_clock::time_point _now = std::chrono::steady_clock::now();
+        _watched.erase(std::remove_if(_watched.begin(), _watched.end(), [&](watched_instance& watched) { return !check_active_instance(watched, _now); }), _watched.end());
+
+        std::unique_lock _lock(global_recovery_monitor.monitor_mutex);
+        const auto _has_news = []() { return !global_recovery_monitor.pending.empty() || global_recovery_monitor.should_stop; };
+        if (_watched.empty()) {
+            global_recovery_monitor.monitor_condition.wait(_lock, _has_news);
+        } else {
+            global_recovery_monitor.monitor_condition.wait_until(_lock, _now + sandbox_crash_poll_interval, _has_news);
+        }
+        if (global_recovery_monitor.should_stop) {
+            return;
+        }
+        for (const watched_instance& _pending : global_recovery_monitor.pending) {
+            if (std::none_of(_watched.begin(), _watched.end(), [&](const watched_instance& watched) { return watched.handle == _pending.handle; })) {
+                _watched.push_back(_pending);
+            }
+        }
+        global_recovery_monitor.pending.clear();
+    }
+}
+
+void watch_active_instance(sandboxed_plugin_data* data, registry_handle handle)
+{
+    {
+        std::lock_guard _lock(global_recovery_monitor.monitor_mutex);
+        if (global_recovery_monitor.should_stop) {
+            return;
+        }
+        global_recovery_monitor.pending.push_back({ data, handle, std::chrono::steady_clock::now(), false, {} });
+        if (!global_recovery_monitor.monitor_thread.joinable()) {
+            global_recovery_monitor.monitor_thread = std::thread(run_recovery_monitor);
+        }
+    }
+    global_recovery_monitor.monitor_condition.notify_one();
+}
+
+void stop_recovery_monitor()
+{
+    {
+        std::lock_guard _lock(global_recovery_monitor.monitor_mutex);
+        global_recovery_monitor.should_stop = true;
+    }
+    global_recovery_monitor.monitor_condition.notify_one();
+    if (global_recovery_monitor.monitor_thread.joinable()) {
+        global_recovery_monitor.monitor_thread.join();
+    }
+    global_recovery_monitor.pending.clear();
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+// handles pack the slot generation in the high 32 bits and the slot index + 1 in the low 32 bits,
+// so 0 is never a valid handle and a handle to a destroyed value never matches a reused slot
+using registry_handle = std::uint64_t;
+
+// fixed capacity array of reference counted slots. Creating, looking up and releasing values never
+// takes a lock: slots come from a tagged free list and a lookup only succeeds while the generation
+// of the slot still matches the handle and its reference count is not zero. Slot memory is never
+// returned to the system so a stale handle can always be checked safely
+template <typename value_t, std::uint32_t chunk_size = 256, std::uint32_t max_chunks = 256>
+struct slot_registry {
+    struct reference;
+
+    slot_registry() = default;
+    slot_registry(const slot_registry&) = delete;
+    slot_registry& operator=(const slot_registry&) = delete;
+    ~slot_registry();
+
+    // returns an empty reference when every slot is in use
+    template <typename... args_t>
+    [[nodiscard]] reference create(args_t&&... args);
+
+    // returns an empty reference when the value behind the handle was destroyed
+    [[nodiscard]] reference acquire(registry_handle handle);
+
+    [[nodiscard]] static constexpr std::uint32_t capacity() { return chunk_size * max_chunks; }
+
+private:
+    static constexpr std::uint64_t count_mask = 0xFFFFFFFF;
+
+    struct slot {
+        std::atomic<std::uint64_t> state { 0 }; // generation << 32 | reference count
+        std::atomic<std::uint32_t> next_free { 0 }; // index + 1 of the next free slot
+        alignas(value_t) unsigned char storage[sizeof(value_t)];
+
+        [[nodiscard]] value_t* value() { return std::launder(reinterpret_cast<value_t*>(storage)); }
+    };
+
+    [[nodiscard]] slot* get_slot(std::uint32_t index) const;
+    [[nodiscard]] slot* allocate_slot(std::uint32_t& index);
+    void push_free_slot(slot* free_slot, std::uint32_t index);
+    void release(slot* used_slot, std::uint32_t index);
+
+    std::array<std::atomic<slot*>, max_chunks> _chunks {};
+    std::atomic<std::uint32_t> _next_unused { 0 };
+    std::atomic<std::uint64_t> _free_head { 0 }; // tag << 32 | index + 1, the tag prevents ABA
+};
+
+template <typename value_t, std::uint32_t chunk_size, std::uint32_t max_chunks>
+struct slot_registry<value_t, chunk_size, max_chunks>::reference {
+    reference() = default;
+    reference(const reference& other)
+        : _registry(other._registry)
+        , _slot(other._slot)
+        , _index(other._index)
+        , _handle(other._handle)
+    {
+        if (_slot) {
+            _slot->state.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    reference(reference&& other) noexcept
+        : _registry(std::exchange(other._registry, nullptr))
+        , _slot(std::exchange(other._slot, nullptr))
+        , _index(std::exchange(other._index, 0))
+        , _handle(std::exchange(other._handle, 0))
+    {
+    }
+    reference& operator=(reference other) noexcept
+    {
+        std::swap(_registry, other._registry);
+        std::swap(_slot, other._slot);
+        std::swap(_index, other._index);
+        std::swap(_handle, other._handle);
+        return *this;
+    }
+    ~reference()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        if (_slot) {
+            _registry->release(_slot, _index);
+        }
+        _registry = nullptr;
+        _slot = nullptr;
+        _index = 0;
+        _handle = 0;
+    }
+
+    [[nodiscard]] registry_handle handle() const { return _handle; }
+    [[nodiscard]] value_t* get() const { return _slot ? _slot->value() : nullptr; }
+    [[nodiscard]] value_t* operator->() const { return get(); }
+    [[nodiscard]] value_t& operator*() const { return *get(); }
+    [[nodiscard]] explicit operator bool() const { return _slot != nullptr; }
+
+private:
+    friend struct slot_registry;
+
+    reference(slot_registry* registry, slot* referenced_slot, std::uint32_t index, registry_handle handle)
+        : _registry(registry)
+        , _slot(referenced_slot)
+        , _index(index)
+        , _handle(handle)
+    {
+    }
+
+    slot_registry* _registry { nullptr };
+    slot* _slot { nullptr };
+    std::uint32_t _index { 0 };
+    registry_handle _handle { 0 };
+};
+
+template <typename value_t, std::uint32_t chunk_size, std::uint32_t max_chunks>
+slot_registry<value_t, chunk_size, max_chunks>::~slot_registry()
+{
+    for (std::atomic<slot*>& _chunk : _chunks) {
+        slot* _slots = _chunk.load(std::memory_order_acquire);
+        if (!_slots) {
+            continue;
+        }
+        for (std::uint32_t _index = 0; _index < chunk_size; ++_index) {
+            if (_slots[_index].state.load(std::memory_order_acquire) & count_mask) {
+                _slots[_index].value()->~value_t();
+            }
+        }
+        delete[] _slots;
+    }
+}
+
+template <typename value_t, std::uint32_t chunk_size, std::uint32_t max_chunks>
+template <typename... args_t>
+typename slot_registry<value_t, chunk_size, max_chunks>::reference slot_registry<value_t, chunk_size, max_chunks>::create(args_t&&... args)
+{
+    std::uint32_t _index = 0;
+    slot* _slot = allocate_slot(_index);
+    if (!_slot) {
+        return {};
+    }
+    new (_slot->storage) value_t(std::forward<args_t>(args)...);
+    const std::uint64_t _generation = _slot->state.load(std::memory_order_relaxed) >> 32;
+    _slot->state.store((_generation << 32) | 1, std::memory_order_release);
+    return reference(this, _slot, _index, (_generation << 32) | (std::uint64_t(_index) + 1));
+}
+
+template <typename value_t, std::uint32_t chunk_size, std::uint32_t max_chunks>
+typename slot_registry<value_t, chunk_size, max_chunks>::reference slot_registry<value_t, chunk_size, max_chunks>::acquire(registry_handle handle)
+{
+    if (!(handle & count_mask)) {
+        return {};
+    }
+    const std::uint32_t _index = static_cast<std::uint32_t>(handle & count_mask) - 1;
+    if (_index >= _next_unused.load(std::memory_order_acquire)) {
+        return {};
+    }
+    slot* _slot = get_slot(_index);
+    if (!_slot) {
+        return {};
+    }
+    std::uint64_t _state = _slot->state.load(std::memory_order_acquire);
+    while ((_state >> 32) == (handle >> 32) && (_state & count_mask)) {
+        if (_slot->state.compare_exchange_weak(_state, _state + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return reference(this, _slot, _index, handle);
+        }
+    }
+    return {};
+}
+
+template <typename value_t, std::uint32_t chunk_size, std::uint32_t max_chunks>
+typename slot_registry<value_t, chunk_size, max_chunks>::slot* slot_registry<value_t, chunk_size, max_chunks>::get_slot(std::uint32_t index) const
+{
+    slot* _slots = _chunks[index / chunk_size].load(std::memory_order_acquire);
+    return _slots ? _slots + index % chunk_size : nullptr;
+}
+
+template <typename value_t, std::uint32_t chunk_size, std::uint32_t max_chunks>
+typename slot_registry<value_t, chunk_size, max_chunks>::slot* slot_registry<value_t, chunk_size, max_chunks>::allocate_slot(std::uint32_t& index)
+{
+    std::uint64_t _head = _free_head.load(std::memory_order_acquire);
+    while (_head & count_mask) {
+        const std::uint32_t _index = static_cast<std::uint32_t>(_head & count_mask) - 1;
+        slot* _slot = get_slot(_index);
+        if (!_slot) {
+            // only slots of allocated chunks are ever freed, so this head is stale
+            _head = _free_head.load(std::memory_order_acquire);
+            continue;
+        }
+        const std::uint64_t _next = (((_head >> 32) + 1) << 32) | _slot->next_free.load(std::memory_order_relaxed);
+        if (_free_head.compare_exchange_weak(_head, _next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            index = _index;
+            return _slot;
+        }
+    }
+
+    // no slot to reuse, take a new one and allocate its chunk if we are the first one there
+    index = _next_unused.load(std::memory_order_relaxed);
+    do {
+        if (index >= capacity()) {
+            return nullptr;
+        }
+    } while (!_next_unused.compare_exchange_weak(index, index + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+    std::atomic<slot*>& _chunk = _chunks[index / chunk_size];
+    slot* _slots = _chunk.load(std::memory_order_acquire);
+    if (!_slots) {
+        slot* _new_slots = new slot[chunk_size];
+        if (_chunk.compare_exchange_strong(_slots, _new_slots, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            _slots = _new_slots;
+        } else {
+            delete[] _new_slots;
+        }
+    }
+    return _slots + index % chunk_size;
+}
+
+template <typename value_t, std::uint32_t chunk_size, std::uint32_t max_chunks>
+void slot_registry<value_t, chunk_size, max_chunks>::push_free_slot(slot* free_slot, std::uint32_t index)
+{
+    std::uint64_t _head = _free_head.load(std::memory_order_relaxed);
+    do {
+        free_slot->next_free.store(static_cast<std::uint32_t>(_head & count_mask), std::memory_order_relaxed);
+    } while (!_free_head.compare_exchange_weak(_head, (((_head >> 32) + 1) << 32) | (std::uint64_t(index) + 1), std::memory_order_acq_rel, std::memory_order_relaxed));
+}
+
+template <typename value_t, std::uint32_t chunk_size, std::uint32_t max_chunks>
+void slot_registry<value_t, chunk_size, max_chunks>::release(slot* used_slot, std::uint32_t index)
+{
+    const std::uint64_t _state = used_slot->state.fetch_sub(1, std::memory_order_acq_rel);
+    if ((_state & count_mask) != 1) {
+        return;
+    }
+    // nobody can acquire the slot anymore since its count is zero, bumping the generation makes
+    // the old handles fail even once the slot is reused
+    used_slot->value()->~value_t();
+    used_slot->state.store(((_state >> 32) + 1) << 32, std::memory_order_release);
+    push_free_slot(used_slot, index);
+}
@@ -1,31 +1,60 @@
 #include <sandbox.hpp>
 
-std::shared_ptr<sandboxed_plugin_instance> get_or_create_pending_instance(sandboxed_plugin_data* data, std::size_t& id)
+[[nodiscard]] std::string get_worker_group_key(const sandboxed_plugin_data* data)
 {
-    std::lock_guard _lock(data->pending_mutex);
-
-    if (data->should_increment.exchange(false)) {
-        id = data->next_instance_id.fetch_add(1);
-    } else {
-        id = data->next_instance_id.load();
+    const worker_group_settings& _settings = get_sandbox_config().worker_groups;
+    switch (_settings.grouping) {
+    case worker_grouping::plugin:
+        return "plugin:" + data->plugin_path.u8string();
+    case worker_grouping::vendor:
+        // classes without a vendor are not grouped with each other
+        return data->class_info.vendor().empty() ? "plugin:" + data->plugin_path.u8string() : "vendor:" + data->class_info.vendor();
+    case worker_grouping::fixed: {
+        static std::atomic<std::uint32_t> _next_worker { 0 };
+        return "fixed:" + std::to_string(_next_worker.fetch_add(1) % std::max(1u, _settings.process_count));
     }
-
-    std::shared_ptr<sandboxed_plugin_instance>& _instance_slot = data->sandboxed_instances[id];
-    if (!_instance_slot) {
-        _instance_slot = std::make_shared<sandboxed_plugin_instance>();
+    default:
+        return {};
     }
+}
 
-    return _instance_slot;
+bool load_sandboxed_instance(sandboxed_plugin_data* data, sandboxed_plugin_instance& instance, std::shared_ptr<worker_host> host)
+{
+    if (!(host ? instance.worker.launch(std::move(host)) : instance.worker.launch(get_worker_group_key(data)))) {
+        std::cerr << "Sandbox error: could not launch worker process" << std::endl;
+        return false;
+    }
+    if (instance.worker.load_plugin(data->stages) != Steinberg::kResultOk) {
+        std::cerr << "Sandbox error: worker could not create sandboxed processor or controller" << std::endl;
+        return false;
+    }
+    instance.is_plugin_loaded = true;
+    return true;
 }
 
-Steinberg::Vst::IComponent* sandboxed_proxy_data::get_sandboxed_processor()
+instance_registry& get_instance_registry()
 {
-    return plugin_data->sandboxed_instances[instance_id]->sandboxed_processor;
+    // never destroyed so that proxies and pooled instances released during static destruction
+    // still find their slots
+    static instance_registry* _registry = new instance_registry();
+    return *_registry;
 }
 
-Steinberg::Vst::IEditController* sandboxed_proxy_data::get_sandboxed_controller()
+// a controller created without a pending processor is usually paired again by connect(), it would
+// waste a pooled instance with a running plugin
+[[nodiscard]] instance_reference create_instance(sandboxed_plugin_data* data, bool can_claim_pooled)
 {
-    return plugin_data->sandboxed_instances[instance_id]->sandboxed_controller;
+    instance_reference _instance;
+    if (can_claim_pooled) {
+        _instance = claim_pooled_instance(data);
+    }
+    if (!_instance) {
+        _instance = get_instance_registry().create();
+    }
+    if (!_instance) {
+        std::cerr << "Sandbox error: too many sandboxed instances" << std::endl;
+    }
+    return _instance;
 }
 
 Steinberg::FUnknown* create_sandbox_processor_instance(void* context)
@@ -34,30 +63,26 @@ Steinberg::FUnknown* create_sandbox_processor_instance(void* context)
 
     _proxy_data.plugin_data = static_cast<sandboxed_plugin_data*>(context);
     if (!_proxy_data.plugin_data) {
-        const std::string _error_text = "Sandbox error: invalid context for sandbox processor creation";
-        std::cerr << _error_text << std::endl;
-        throw std::runtime_error(_error_text);
+        std::cerr << "Sandbox error: invalid context for sandbox processor creation" << std::endl;
+        return nullptr;
     }
 
-    std::shared_ptr<sandboxed_plugin_instance> _plugin_instance = get_or_create_pending_instance(_proxy_data.plugin_data, _proxy_data.instance_id);
-    std::string _module_error;
-    _plugin_instance->host_module = VST3::Hosting::Module::create(_proxy_data.plugin_data->plugin_path.string(), _module_error);
-    if (!_plugin_instance->host_module) {
-        std::string _error_text = "Sandbox error: could not create Module with error " + _module_error;
-        std::cerr << _error_text << std::endl;
-        throw std::runtime_error(_error_text);
+    _proxy_data.instance = create_instance(_proxy_data.plugin_data, true);
+    if (!_proxy_data.instance) {
+        return nullptr;
     }
-    _plugin_instance->plugin_provider = std::make_shared<Steinberg::Vst::PlugProvider>(_plugin_instance->host_module->getFactory(), _proxy_data.plugin_data->class_info, true);
-    _plugin_instance->sandboxed_processor = _plugin_instance->plugin_provider->getComponent();
-    _plugin_instance->sandboxed_controller = _plugin_instance->plugin_provider->getController();
-    if (!_plugin_instance->sandboxed_processor || !_plugin_instance->sandboxed_controller) {
-        std::string _error_text = "Sandbox error: could not create sandboxed processor or controller";
-        std::cerr << _error_text << std::endl;
-        throw std::runtime_error(_error_text);
+    sandboxed_plugin_instance* _plugin_instance = _proxy_data.instance.get();
+    // lazy instances load on their first activation, unless only the worker can tell their buses
+    const bool _should_load = !get_sandbox_config().is_lazy_loaded || _proxy_data.plugin_data->original_buses.empty();
+    if (!_plugin_instance->is_plugin_loaded && _should_load && !load_sandboxed_instance(_proxy_data.plugin_data, *_plugin_instance)) {
+        std::cerr << "Sandbox error: could not create sandboxed instance" << std::endl;
+        return nullptr;
     }
     _plugin_instance->is_proxy_processor_created = true;
-    _plugin_instance->sandboxed_processor->addRef(); // Must addRef before returning
-    _plugin_instance->sandboxed_controller->addRef(); // Must addRef before returning
+    _plugin_instance->telemetry.publish(get_proxy_working_directory(), _proxy_data.plugin_data->plugin_name);
+
+    // hosts usually create the controller right after the processor, connect() fixes the pairing otherwise
+    _proxy_data.plugin_data->pending_instance.store(_proxy_data.instance.handle(), std::memory_order_release);
 
     return (Steinberg::Vst::IAudioProcessor*)new sandbox_processor(_proxy_data);
 }
@@ -68,13 +93,18 @@ Steinberg::FUnknown* create_sandbox_controller_instance(void* context)
 
     _proxy_data.plugin_data = static_cast<sandboxed_plugin_data*>(context);
     if (!_proxy_data.plugin_data) {
-        const std::string _error_text = "Sandbox error: invalid context for sandbox processor creation";
-        std::cerr << _error_text << std::endl;
-        throw std::runtime_error(_error_text);
+        std::cerr << "Sandbox error: invalid context for sandbox controller creation" << std::endl;
+        return nullptr;
     }
 
-    std::shared_ptr<sandboxed_plugin_instance> _plugin_instance = get_or_create_pending_instance(_proxy_data.plugin_data, _proxy_data.instance_id);
-    _plugin_instance->is_proxy_controller_created = true;
+    _proxy_data.instance = get_instance_registry().acquire(_proxy_data.plugin_data->pending_instance.exchange(0, std::memory_order_acq_rel));
+    if (!_proxy_data.instance) {
+        _proxy_data.instance = create_instance(_proxy_data.plugin_data, false);
+    }
+    if (!_proxy_data.instance) {
+        return nullptr;
+    }
+    _proxy_data.instance->is_proxy_controller_created = true;
 
     return (Steinberg::Vst::IEditController*)new sandbox_controller(_proxy_data);
 }
@@ -1,25 +1,336 @@
 #pragma once
 
+#include <public.sdk/source/vst/hosting/eventlist.h>
 #include <public.sdk/source/vst/hosting/module.h>
+#include <public.sdk/source/vst/hosting/parameterchanges.h>
 #include <public.sdk/source/vst/hosting/plugprovider.h>
 #include <public.sdk/source/vst/vstaudioeffect.h>
 #include <public.sdk/source/vst/vsteditcontroller.h>
 
+#include <chrono>
 #include <filesystem>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
+#include <convert.hpp>
+#include <ipc.hpp>
+#include <registry.hpp>
+#include <scan.hpp>
+#include <state.hpp>
+#include <telemetry.hpp>
+#include <transport.hpp>
+
+constexpr std::chrono::milliseconds sandbox_command_timeout { 30000 };
+constexpr std::chrono::milliseconds sandbox_process_timeout { 250 };
+constexpr std::size_t parameter_cache_capacity = 1024; // conversions per controller
+constexpr std::uint32_t sandbox_max_offline_blocks = 64; // queued ahead of the worker, each one takes a transport slot
+constexpr std::chrono::milliseconds sandbox_crash_poll_interval { 10 }; // how often the workers of active instances are checked
+constexpr std::chrono::milliseconds sandbox_recovery_retry_interval { 1000 }; // between the recovery attempts of an instance whose last one failed
+
+// which instances share a worker process
+enum struct worker_grouping {
+    instance, // one process per instance
+    plugin, // one process per plugin module path
+    vendor, // one process per plugin vendor
+    fixed, // instances are spread over a fixed number of processes
+};
+
+struct worker_group_settings {
+    worker_grouping grouping { worker_grouping::instance };
+    std::uint32_t process_count { 4 }; // fixed grouping only
+    std::uint32_t thread_count { 0 }; // processing threads per worker, 0 uses the hardware concurrency
+};
+
+// what the proxy outputs for a block the worker did not finish in time
+enum struct watchdog_fallback {
+    silence,
+    passthrough, // inputs copied to the outputs of the same channel
+    repeat, // the last block that made it in time, looped
+};
+
+struct watchdog_settings {
+    double deadline { 1. }; // fraction of the block duration, 0 waits up to sandbox_process_timeout
+    watchdog_fallback fallback { watchdog_fallback::silence };
+    double late_ratio { 0.05 }; // missed fraction of a window that flags an instance as late, 0 never flags
+};
+
+// instances are flagged once the misses of a window reach late_ratio
+constexpr std::uint32_t watchdog_window_blocks { 128 };
+
+struct worker_realtime_settings {
+    realtime_policy policy { realtime_policy::none };
+    std::int32_t priority { 70 };
+    std::vector<std::vector<std::uint32_t>> cpu_sets; // handed to the workers in launch order, round robin, empty runs them on any cpu
+    bool should_lock_memory { false }; // workers lock all their memory, proxies only their transports
+};
+
+// plugins that run one after the other in a single worker session, registered as one plugin
+struct chain_settings {
+    std::string name;
+    std::vector<std::string> plugins; // plugin names or processor uids, in processing order
+};
+
+struct sandbox_config {
+    std::vector<std::filesystem::path> vst3_paths;
+    ipc_wait_settings wait_settings;
+    worker_group_settings worker_groups;
+    worker_realtime_settings realtime;
+    bool is_pipelined { false }; // processes one block ahead at the cost of one block of latency
+    std::uint32_t offline_depth { 8 }; // blocks queued ahead of the worker while rendering offline, 0 renders one block at a time
+    std::uint32_t fixed_block_size { 0 }; // samples of every block the worker processes, 0 forwards the host blocks as they come
+    bool should_bypass_silence { true }; // silent blocks skip the worker once the plugin played its tail
+    double automation_tolerance { 0. }; // automation points this close to the ramp through their neighbours are dropped, 0 keeps them all
+    bool is_lazy_loaded { true }; // instances launch their worker when first activated instead of when created
+    std::chrono::seconds hibernation_delay { 0 }; // inactive instances give their worker up after this long, 0 never
+    bool should_recover { false }; // active instances whose worker crashed are loaded again from their last snapshot
+    std::chrono::milliseconds snapshot_interval { 1000 }; // between the state snapshots of changed instances
+    bool has_standby { false }; // plugins with an active instance keep a worker with their module loaded ready to recover on
+    watchdog_settings watchdog;
+    scan_settings scan;
+    std::unordered_map<std::string, std::size_t> instance_pool_sizes; // keyed by plugin name or processor uid
+    std::vector<chain_settings> chains;
+};
+
+[[nodiscard]] const sandbox_config& get_sandbox_config();
+[[nodiscard]] std::filesystem::path get_proxy_binary_directory();
+[[nodiscard]] std::filesystem::path get_proxy_working_directory(); // holds vstsandbox.json
+[[nodiscard]] std::filesystem::path get_worker_executable_path(); // also runs the scanners
+
+// a plugin class for the worker to load
+struct sandboxed_stage {
+    std::filesystem::path plugin_path;
+    Steinberg::FUID processor_uid;
+};
+
+// worker process shared by every instance of a group, each instance talks to it through its own
+// session control block
+struct worker_host {
+    worker_host() = default;
+    worker_host(const worker_host&) = delete;
+    worker_host& operator=(const worker_host&) = delete;
+    ~worker_host();
+
+    [[nodiscard]] bool launch(const ipc_wait_settings& wait_settings, std::uint32_t thread_count, const realtime_settings& realtime);
+    [[nodiscard]] bool is_running();
+    // real time safe, no lock. Also true once is_running found the process gone on systems that
+    // cannot watch it
+    [[nodiscard]] bool has_ended() const;
+    void shutdown();
+
+    [[nodiscard]] Steinberg::tresult open_session(const std::string& control_name);
+
+    // the caller serializes the commands sent to one control block
+    [[nodiscard]] Steinberg::tresult transact(control_block* control, ipc_signal& response_signal, worker_command command, std::size_t payload_size);
+
+    // real time safe, only enters the kernel when the worker is asleep
+    void notify_blocks();
+
+    // realtime_refused_* bits, what the worker asked for and did not get so far
+    [[nodiscard]] std::uint32_t get_realtime_refusals() const;
+
+private:
+    std::mutex _process_mutex;
+    worker_process _process;
+    std::atomic<bool> _has_ended { false };
+    std::mutex _command_mutex; // guards the group control block
+    shared_memory _group_memory;
+    worker_group_block* _group { nullptr };
+    ipc_signal _command_doorbell;
+    ipc_signal _block_doorbell;
+    ipc_signal _response_signal;
+};
+
+// returns the running worker of the group or launches it, an empty key always launches a new one
+[[nodiscard]] std::shared_ptr<worker_host> acquire_worker_host(const std::string& group_key, const sandbox_config& config);
+
+struct sandbox_worker {
+    sandbox_worker() = default;
+    sandbox_worker(const sandbox_worker&) = delete;
+    sandbox_worker& operator=(const sandbox_worker&) = delete;
+    ~sandbox_worker();
+
+    [[nodiscard]] bool launch(const std::string& group_key);
+    [[nodiscard]] bool launch(std::shared_ptr<worker_host> host); // opens the session on a worker that already runs
+    [[nodiscard]] bool is_running();
+    void shutdown();
+
+    // several stages load a chain
+    [[nodiscard]] Steinberg::tresult load_plugin(const std::vector<sandboxed_stage>& stages);
+    // only loads the modules of the stages, the plugins that later sessions load on this worker skip it
+    [[nodiscard]] Steinberg::tresult load_module(const std::vector<sandboxed_stage>& stages);
+    // the response payload is only copied when it has exactly response_size bytes
+    [[nodiscard]] Steinberg::tresult send_command(worker_command command, const void* payload = nullptr, std::size_t payload_size = 0, void* response = nullptr, std::size_t response_size = 0);
+    [[nodiscard]] Steinberg::tresult send_state(worker_command command, Steinberg::IBStream* state);
+    [[nodiscard]] Steinberg::tresult receive_state(worker_command command, Steinberg::IBStream* state);
+    [[nodiscard]] Steinberg::tresult get_buses(std::vector<scanned_bus>& buses);
+    [[nodiscard]] Steinberg::tresult get_parameters(std::vector<Steinberg::Vst::ParameterInfo>& parameters);
+    // read from shared memory, no command
+    [[nodiscard]] std::uint32_t get_parameter_generation() const;
+    [[nodiscard]] std::uint32_t get_realtime_refusals() const;
+    [[nodiscard]] std::shared_ptr<worker_host> get_host();
+    // arrangements receives the arrangements the sandboxed processor kept, also when it refused them
+    [[nodiscard]] Steinberg::tresult set_bus_arrangements(bus_arrangements& arrangements);
+
+    // called from the audio thread after publishing a block
+    void notify_blocks() { _host->notify_blocks(); }
+    // called from the audio thread while it waits, unlike is_running it never takes the command lock
+    [[nodiscard]] bool has_ended() const { return _host && _host->has_ended(); }
+
+private:
+    [[nodiscard]] Steinberg::tresult transact(worker_command command, std::size_t payload_size); // _command_mutex must be held
+
+    std::mutex _command_mutex;
+    std::shared_ptr<worker_host> _host;
+    shared_memory _control_memory;
+    control_block* _control { nullptr };
+    ipc_signal _response_signal;
+    std::uint64_t _component_state_hash { 0 }; // last state the sandboxed controller got through setComponentState
+    bool _has_component_state_hash { false };
+};
+
+struct sandbox_transport {
+    [[nodiscard]] bool create(std::uint32_t slot_count, std::uint32_t max_samples, std::uint32_t input_channels, std::uint32_t output_channels, std::int32_t symbolic_sample_size);
+    void close();
+
+    shared_memory memory;
+    transport_header* header { nullptr };
+    ipc_signal response_signal; // signals header->read_position to the proxy, blocks go through the worker doorbell
+};
+
+// delays the worker outputs by exactly latency samples in the pipelined mode whatever the block
+// sizes of the host. Once the results of the previous block are written it holds latency samples
+// again, so reading the current block never underruns. With fixed worker blocks it holds up to a
+// worker block more than a host block, hence a capacity above the latency. Samples are stored at
+// host precision
+struct pipeline_fifo {
+    void prepare(std::uint32_t channel_count, std::uint32_t latency, std::uint32_t capacity, std::int32_t symbolic_sample_size);
+    void reset(); // back to latency samples of silence
+
+    // the same count is written to or read from every channel before the commit
+    void write(std::uint32_t channel, const void* samples, std::int32_t symbolic_sample_size, std::uint32_t count);
+    void commit_write(std::uint32_t count);
+    void read(std::uint32_t channel, void* samples, std::uint32_t count) const;
+    void commit_read(std::uint32_t count);
+
+    [[nodiscard]] std::uint32_t latency() const { return _latency; }
+    [[nodiscard]] std::uint32_t size() const { return _count; } // samples held
+
+private:
+    std::vector<std::vector<std::byte>> _channels;
+    std::uint32_t _latency { 0 };
+    std::uint32_t _capacity { 0 };
+    std::int32_t _symbolic_sample_size { Steinberg::Vst::kSample32 };
+    std::uint32_t _read_index { 0 };
+    std::uint32_t _count { 0 };
+};
+
+// parameter changes of one piece of a worker block, filled on the audio thread without allocating.
+// The queues are allocated by prepare and their points share one pool as large as a transport
+// slot takes. Only the queue added last takes new points, which is how the pieces are written
+struct piece_parameter_changes : public Steinberg::U::Implements<Steinberg::U::Directly<Steinberg::Vst::IParameterChanges>> {
+    void prepare(std::size_t queue_count);
+    void clear();
+
+    Steinberg::int32 PLUGIN_API getParameterCount() override;
+    Steinberg::Vst::IParamValueQueue* PLUGIN_API getParameterData(Steinberg::int32 index) override;
+    Steinberg::Vst::IParamValueQueue* PLUGIN_API addParameterData(const Steinberg::Vst::ParamID& id, Steinberg::int32& index) override;
+
+private:
+    struct point {
+        Steinberg::int32 sample_offset;
+        Steinberg::Vst::ParamValue value;
+    };
+
+    struct queue : public Steinberg::U::Implements<Steinberg::U::Directly<Steinberg::Vst::IParamValueQueue>> {
+        Steinberg::Vst::ParamID PLUGIN_API getParameterId() override;
+        Steinberg::int32 PLUGIN_API getPointCount() override;
+        Steinberg::tresult PLUGIN_API getPoint(Steinberg::int32 index, Steinberg::int32& sampleOffset, Steinberg::Vst::ParamValue& value) override;
+        Steinberg::tresult PLUGIN_API addPoint(Steinberg::int32 sampleOffset, Steinberg::Vst::ParamValue value, Steinberg::int32& index) override;
+
+        piece_parameter_changes* changes { nullptr };
+        Steinberg::Vst::ParamID id { 0 };
+        std::size_t first_point { 0 };
+        std::size_t point_count { 0 };
+    };
+
+    std::unique_ptr<queue[]> _queues;
+    std::size_t _queue_capacity { 0 };
+    std::size_t _queue_count { 0 };
+    std::vector<point> _points;
+    std::size_t _point_count { 0 };
+};
+
+// bounded least recently used cache of the parameter conversions the sandboxed controller answered.
+// Hosts ask for the same values over and over while drawing automation lanes, those never wait on
+// the worker again
+struct parameter_cache {
+    struct key {
+        worker_command command;
+        Steinberg::Vst::ParamID id;
+        std::uint64_t value_bits; // unused for string to value conversions
+        std::u16string text; // only used for string to value conversions
+        [[nodiscard]] bool operator==(const key& other) const;
+    };
+
+    [[nodiscard]] static key make_key(worker_command command, const parameter_conversion& conversion);
+    [[nodiscard]] const parameter_conversion* find(const key& conversion_key);
+    void insert(const key& conversion_key, const parameter_conversion& conversion);
+    void clear();
+
+private:
+    struct key_hash {
+        [[nodiscard]] std::size_t operator()(const key& conversion_key) const;
+    };
+    using entry = std::pair<key, parameter_conversion>;
+
+    std::list<entry> _entries; // most recently used first
+    std::unordered_map<key, std::list<entry>::iterator, key_hash> _index;
+};
+
+// what the proxies told an instance whose plugin is not loaded, played back to the plugin once it is
+struct instance_replay {
+    Steinberg::IPtr<state_buffer> component_state; // also the component state of the controller
+    Steinberg::IPtr<state_buffer> controller_state;
+    bus_arrangements arrangements {};
+    bool has_arrangements { false };
+    std::vector<bus_activation> activations; // last one of each bus
+    std::uint32_t latency_samples { 0 }; // hibernated instances only
+    std::uint32_t tail_samples { 0 };
+    transport_setup setup {}; // last one the worker accepted, a recovered worker maps the same transport
+    bool has_setup { false };
+    std::uint32_t snapshot_changes { 0 }; // state_changes of the instance when the states were saved
+};
+
 struct sandboxed_plugin_instance {
-    std::shared_ptr<VST3::Hosting::Module> host_module;
-    std::shared_ptr<Steinberg::Vst::PlugProvider> plugin_provider;
-    Steinberg::Vst::IComponent* sandboxed_processor { nullptr }; // owned by plugin_provider
-    Steinberg::Vst::IEditController* sandboxed_controller { nullptr }; // owned by plugin_provider
+    sandbox_worker worker;
+    sandbox_transport transport;
+    std::atomic<bool> is_worker_lost { false }; // set from the audio thread when the worker stops answering
+    std::atomic<bool> is_in_process { false }; // the audio thread is inside process, see recover_sandboxed_instance
+    std::atomic<std::uint32_t> state_changes { 0 }; // bumped by whatever may change the state of the plugin
+    std::atomic<std::uint32_t> recovery_count { 0 }; // the audio thread starts its pipeline over when it changes
+    telemetry_record telemetry; // published once a processor proxy owns the instance
+    std::mutex lifecycle_mutex; // held by the proxies while they talk to the worker, guards everything below
+    bool is_plugin_loaded { false }; // already true for instances claimed from the pool
+    bool is_hibernated { false }; // the plugin was unloaded after idling, its state waits in replay
+    bool is_terminated { false }; // the processor proxy shut the worker down for good
+    bool is_active { false };
+    bool is_processing { false };
+    std::chrono::steady_clock::time_point inactive_since;
+    instance_replay replay;
     bool is_proxy_processor_created { false }; // represents proxy!! should come first because we reorder
     bool is_proxy_controller_created { false }; // represents proxy!!
 };
 
+using instance_registry = slot_registry<sandboxed_plugin_instance>;
+using instance_reference = instance_registry::reference;
+
+[[nodiscard]] instance_registry& get_instance_registry();
+
 struct sandboxed_plugin_data {
     std::filesystem::path plugin_path;
     std::string plugin_name;
@@ -30,20 +341,56 @@ struct sandboxed_plugin_data {
     Steinberg::FUID proxy_controller_uid;
     VST3::Hosting::ClassInfo class_info;
     std::vector<Steinberg::Vst::ParameterInfo> original_parameters;
-    std::unordered_map<std::size_t, std::shared_ptr<sandboxed_plugin_instance>> sandboxed_instances;
-    std::mutex pending_mutex;
-    std::atomic<std::size_t> next_instance_id { 0 };
-    std::atomic<bool> should_increment { false };
+    std::vector<scanned_bus> original_buses;
+    std::vector<sandboxed_stage> stages; // the plugin itself, or the plugins of a chain
+    std::atomic<registry_handle> pending_instance { 0 }; // last processor instance waiting for its controller
+    std::size_t pool_size { 0 };
+    std::vector<instance_reference> pooled_instances;
+    bool has_standby { false }; // a standby worker is kept since an instance was activated
+    std::unique_ptr<sandbox_worker> standby; // a session on its own worker that only loaded the module
+    std::mutex pool_mutex; // also guards the standby
 };
 
 struct sandboxed_proxy_data {
     sandboxed_plugin_data* plugin_data; // owned by global static
-    std::size_t instance_id;
-
-    Steinberg::Vst::IComponent* get_sandboxed_processor();
-    Steinberg::Vst::IEditController* get_sandboxed_controller();
+    instance_reference instance; // shared by the processor and controller proxies
 };
 
+// launches the worker of an instance and loads the plugin in it, or opens its session on host when
+// given, a standby worker that already loaded the module
+[[nodiscard]] bool load_sandboxed_instance(sandboxed_plugin_data* data, sandboxed_plugin_instance& instance, std::shared_ptr<worker_host> host = nullptr);
+
+// loads the plugin of an instance that was never loaded or hibernated and plays the replay back
+// to it, lifecycle_mutex must be held. Returns false when the plugin cannot run
+[[nodiscard]] bool wake_sandboxed_instance(sandboxed_plugin_data* data, const instance_reference& instance, std::shared_ptr<worker_host> host = nullptr);
+// saves the states of the plugin in the replay, lifecycle_mutex must be held
+[[nodiscard]] bool snapshot_sandboxed_instance(sandboxed_plugin_instance& instance);
+// copies a state the host gives to an instance whose plugin is not loaded
+[[nodiscard]] Steinberg::tresult keep_instance_state(Steinberg::IPtr<state_buffer>& kept_state, Steinberg::IBStream* state);
+// hibernates the instance once it stayed inactive for the hibernation delay, from a background thread
+void watch_inactive_instance(registry_handle handle);
+void stop_hibernation_monitor();
+
+// snapshots active instances while their state changes and loads them again from the last
+// snapshot once their worker crashed, from a background thread
+void watch_active_instance(sandboxed_plugin_data* data, registry_handle handle);
+void stop_recovery_monitor();
+
+// keeps pool_size instances with a running worker and a loaded plugin ready for every plugin that
+// asks for it, and their standby workers, refilled from a background thread as they are claimed
+void start_instance_pool(const std::vector<std::shared_ptr<sandboxed_plugin_data>>& plugins);
+void stop_instance_pool();
+[[nodiscard]] instance_reference claim_pooled_instance(sandboxed_plugin_data* data);
+// keeps a worker that loaded the module of the plugin from now on, the standby that crashed
+// instances recover on. Claiming it prepares the next one
+void request_standby_worker(sandboxed_plugin_data* data);
+[[nodiscard]] std::unique_ptr<sandbox_worker> claim_standby_worker(sandboxed_plugin_data* data);
+
+// the processor proxy sends this message with its instance handle when it gets connected, so that
+// the controller proxy ends up on the same instance whatever order the host created them in
+#define sandbox_instance_message "vstsandbox.instance"
+#define sandbox_instance_handle_attribute "handle"
+
 struct sandbox_processor : public Steinberg::Vst::AudioEffect {
     sandbox_processor(const sandboxed_proxy_data& proxy_data);
     ~sandbox_processor() override;
@@ -51,14 +398,67 @@ struct sandbox_processor : public Steinberg::Vst::AudioEffect {
     Steinberg::tresult PLUGIN_API initialize(Steinberg::FUnknown* context) override;
     Steinberg::tresult PLUGIN_API terminate() override;
     Steinberg::tresult PLUGIN_API setActive(Steinberg::TBool state) override;
+    Steinberg::tresult PLUGIN_API setProcessing(Steinberg::TBool state) override;
     Steinberg::tresult PLUGIN_API setupProcessing(Steinberg::Vst::ProcessSetup& newSetup) override;
+    Steinberg::tresult PLUGIN_API connect(Steinberg::Vst::IConnectionPoint* other) override;
     Steinberg::tresult PLUGIN_API canProcessSampleSize(std::int32_t symbolicSampleSize) override;
+    Steinberg::tresult PLUGIN_API setBusArrangements(Steinberg::Vst::SpeakerArrangement* inputs, Steinberg::int32 numIns, Steinberg::Vst::SpeakerArrangement* outputs, Steinberg::int32 numOuts) override;
+    Steinberg::tresult PLUGIN_API activateBus(Steinberg::Vst::MediaType type, Steinberg::Vst::BusDirection dir, Steinberg::int32 index, Steinberg::TBool state) override;
+    Steinberg::uint32 PLUGIN_API getLatencySamples() override;
+    Steinberg::uint32 PLUGIN_API getTailSamples() override;
     Steinberg::tresult PLUGIN_API process(Steinberg::Vst::ProcessData& data) override;
     Steinberg::tresult PLUGIN_API setState(Steinberg::IBStream* state) override;
     Steinberg::tresult PLUGIN_API getState(Steinberg::IBStream* state) override;
 
 private:
+    void add_buses();
+    [[nodiscard]] Steinberg::tresult setup_worker_processing(const Steinberg::Vst::ProcessSetup& setup); // lifecycle_mutex must be held
+    [[nodiscard]] bool wait_for_worker(transport_header* header, std::uint32_t read_position, std::chrono::steady_clock::time_point deadline);
+    [[nodiscard]] Steinberg::tresult process_pipelined(Steinberg::Vst::ProcessData& data, transport_header* header, std::chrono::steady_clock::time_point deadline);
+    [[nodiscard]] Steinberg::tresult process_fixed_blocks(Steinberg::Vst::ProcessData& data, transport_header* header, std::chrono::steady_clock::time_point deadline);
+    void write_fixed_block_piece(Steinberg::Vst::ProcessData& slice, std::int32_t host_count, std::int32_t host_offset, std::int32_t slice_offset, std::int32_t count, transport_header* header, transport_slot* slot);
+    void write_fixed_block_flush(Steinberg::Vst::IParameterChanges* changes, transport_header* header);
+    void remember_parameter_values(Steinberg::Vst::IParameterChanges* changes);
+    [[nodiscard]] Steinberg::Vst::ParamValue* find_parameter_value(Steinberg::Vst::ParamID id);
+    void write_pipeline_outputs(transport_header* header, transport_slot* slot, Steinberg::Vst::ProcessData& data, std::int32_t host_count);
+    void read_pipeline_outputs(Steinberg::Vst::ProcessData& data, transport_header* header);
+    void write_fallback_outputs(Steinberg::Vst::ProcessData& data);
+    void keep_last_outputs(Steinberg::Vst::ProcessData& data);
+    [[nodiscard]] bool is_block_silent(Steinberg::Vst::ProcessData& data) const;
+    [[nodiscard]] bool bypass_silent_block(Steinberg::Vst::ProcessData& data);
+    [[nodiscard]] Steinberg::tresult process_block(Steinberg::Vst::ProcessData& data, std::chrono::steady_clock::time_point deadline);
+    void count_block(bool is_missed);
+    void record_block_times(transport_slot* slot, std::int64_t round_trip_end);
+    void report_missed_blocks();
+
     sandboxed_proxy_data _proxy_data;
+    ipc_wait_settings _wait_settings;
+    std::uint32_t _pipeline_depth { 0 }; // blocks left with the worker when process returns, 0 waits for every block
+    std::uint32_t _blocks_in_flight { 0 }; // published blocks whose results did not go through the fifo yet
+    bool _is_offline { false }; // no deadline, blocks wait for as long as the worker lives
+    std::uint32_t _fixed_block_size { 0 }; // 0 forwards the host blocks, otherwise they are cut or gathered into worker blocks of this size
+    std::uint32_t _fixed_block_fill { 0 }; // samples of the next worker block already in its slot
+    std::vector<std::pair<Steinberg::Vst::ParamID, Steinberg::Vst::ParamValue>> _parameter_values; // sorted by id, last automated values, NaN until the host automates them
+    piece_parameter_changes _piece_parameters;
+    bool _has_flushed_parameters { false }; // the slot of the next worker block already holds the changes of a flush
+    Steinberg::Vst::EventList _piece_events { sandbox_max_events };
+    std::atomic<bool> _should_reset_pipeline { false };
+    pipeline_fifo _pipeline;
+    watchdog_fallback _fallback { watchdog_fallback::silence };
+    std::chrono::nanoseconds _block_deadline { sandbox_process_timeout };
+    bool _is_worker_late { false }; // the published blocks were abandoned, nothing is published until they complete
+    std::chrono::steady_clock::time_point _late_since;
+    std::uint32_t _window_blocks { 0 };
+    std::uint32_t _window_missed_blocks { 0 };
+    std::uint32_t _late_missed_blocks { 0 }; // 0 never flags
+    std::uint64_t _reported_missed_blocks { 0 };
+    std::vector<std::vector<std::byte>> _last_outputs; // repeat fallback only, at host precision
+    std::uint32_t _last_output_count { 0 };
+    bool _should_bypass_silence { false };
+    std::uint64_t _silence_bypass_samples { std::numeric_limits<std::uint64_t>::max() }; // silent samples the worker still processes, tail and latencies
+    std::uint64_t _silent_samples { 0 }; // published since the inputs went silent
+    bool _has_setup { false }; // processSetup holds what the host asked for, the worker gets it once loaded
+    std::uint32_t _recovery_count { 0 }; // of the instance when the pipeline last started over
 };
 
 struct sandbox_controller : public Steinberg::Vst::EditControllerEx1 {
@@ -68,10 +468,19 @@ struct sandbox_controller : public Steinberg::Vst::EditControllerEx1 {
     Steinberg::tresult PLUGIN_API initialize(Steinberg::FUnknown* context) override;
     Steinberg::tresult PLUGIN_API terminate() override;
     Steinberg::tresult PLUGIN_API setComponentState(Steinberg::IBStream* state) override;
+    Steinberg::tresult PLUGIN_API getParamStringByValue(Steinberg::Vst::ParamID id, Steinberg::Vst::ParamValue valueNormalized, Steinberg::Vst::String128 string) override;
+    Steinberg::tresult PLUGIN_API getParamValueByString(Steinberg::Vst::ParamID id, Steinberg::Vst::TChar* string, Steinberg::Vst::ParamValue& valueNormalized) override;
+    Steinberg::Vst::ParamValue PLUGIN_API normalizedParamToPlain(Steinberg::Vst::ParamID id, Steinberg::Vst::ParamValue valueNormalized) override;
+    Steinberg::Vst::ParamValue PLUGIN_API plainParamToNormalized(Steinberg::Vst::ParamID id, Steinberg::Vst::ParamValue plainValue) override;
+    Steinberg::tresult PLUGIN_API notify(Steinberg::Vst::IMessage* message) override;
     Steinberg::IPlugView* PLUGIN_API createView(Steinberg::FIDString name) override;
     Steinberg::tresult PLUGIN_API setState(Steinberg::IBStream* state) override;
     Steinberg::tresult PLUGIN_API getState(Steinberg::IBStream* state) override;
 
 private:
+    [[nodiscard]] Steinberg::tresult convert_parameter(worker_command command, parameter_conversion& conversion);
+
     sandboxed_proxy_data _proxy_data;
+    parameter_cache _parameter_cache; // lifecycle_mutex of the instance must be held
+    std::uint32_t _parameter_generation { 0 }; // of the cached conversions
 };
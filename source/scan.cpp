@@ -0,0 +1,512 @@
+#include <public.sdk/source/vst/hosting/plugprovider.h>
+#include <public.sdk/source/vst/moduleinfo/moduleinfoparser.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <scan.hpp>
+
+bool get_module_fingerprint(const std::filesystem::path& plugin_path, std::int64_t& modification_time, std::uint64_t& size)
+{
+    std::error_code _error;
+    modification_time = 0;
+    size = 0;
+    if (!std::filesystem::is_directory(plugin_path, _error)) {
+        modification_time = std::filesystem::last_write_time(plugin_path, _error).time_since_epoch().count();
+        size = std::filesystem::file_size(plugin_path, _error);
+        return !_error;
+    }
+
+    std::filesystem::recursive_directory_iterator _iterator(plugin_path, _error);
+    for (; !_error && _iterator != std::filesystem::recursive_directory_iterator(); _iterator.increment(_error)) {
+        if (_iterator->is_directory(_error)) {
+            if (_iterator->path().filename() == "Resources") {
+                _iterator.disable_recursion_pending();
+            }
+            continue;
+        }
+        modification_time = std::max<std::int64_t>(modification_time, _iterator->last_write_time(_error).time_since_epoch().count());
+        size += _iterator->file_size(_error);
+    }
+    if (_error) {
+        return false;
+    }
+
+    const VST3::Optional<std::string> _module_info_path = VST3::Hosting::Module::getModuleInfoPath(plugin_path.string());
+    if (_module_info_path) {
+        const std::filesystem::path _path = std::filesystem::u8path(*_module_info_path);
+        modification_time = std::max<std::int64_t>(modification_time, std::filesystem::last_write_time(_path, _error).time_since_epoch().count());
+        size += std::filesystem::file_size(_path, _error);
+    }
+    return !_error;
+}
+
+void scan_buses(Steinberg::Vst::IComponent* component, Steinberg::Vst::IAudioProcessor* processor, std::vector<scanned_bus>& buses)
+{
+    for (Steinberg::Vst::MediaType _type : { Steinberg::Vst::kAudio, Steinberg::Vst::kEvent }) {
+        for (Steinberg::Vst::BusDirection _direction : { Steinberg::Vst::kInput, Steinberg::Vst::kOutput }) {
+            const Steinberg::int32 _bus_count = component->getBusCount(_type, _direction);
+            for (Steinberg::int32 _index = 0; _index < _bus_count; ++_index) {
+                scanned_bus _bus {};
+                if (component->getBusInfo(_type, _direction, _index, _bus.info) != Steinberg::kResultOk) {
+                    continue;
+                }
+                if (_type == Steinberg::Vst::kAudio && processor) {
+                    static_cast<void>(processor->getBusArrangement(_direction, _index, _bus.arrangement));
+                }
+                buses.push_back(_bus);
+            }
+        }
+    }
+}
+
+void combine_chain_buses(const std::vector<std::vector<scanned_bus>>& stage_buses, std::vector<scanned_bus>& buses)
+{
+    if (stage_buses.empty()) {
+        return;
+    }
+    const std::vector<scanned_bus>* _event_input_buses = nullptr;
+    for (const std::vector<scanned_bus>& _buses : stage_buses) {
+        if (std::any_of(_buses.begin(), _buses.end(), [](const scanned_bus& bus) { return bus.info.mediaType == Steinberg::Vst::kEvent && bus.info.direction == Steinberg::Vst::kInput; })) {
+            _event_input_buses = &_buses;
+            break;
+        }
+    }
+    // same order as scan_buses
+    for (Steinberg::Vst::MediaType _type : { Steinberg::Vst::kAudio, Steinberg::Vst::kEvent }) {
+        for (Steinberg::Vst::BusDirection _direction : { Steinberg::Vst::kInput, Steinberg::Vst::kOutput }) {
+            const std::vector<scanned_bus>* _source = _direction == Steinberg::Vst::kOutput ? &stage_buses.back() : _type == Steinberg::Vst::kEvent ? _event_input_buses : &stage_buses.front();
+            if (!_source) {
+                continue;
+            }
+            for (const scanned_bus& _bus : *_source) {
+                if (_bus.info.mediaType == _type && _bus.info.direction == _direction) {
+                    buses.push_back(_bus);
+                }
+            }
+        }
+    }
+}
+
+void scan_module(const std::filesystem::path& plugin_path, scanned_module& module)
+{
+    std::string _module_error;
+    VST3::Hosting::Module::Ptr _module = VST3::Hosting::Module::create(plugin_path.string(), _module_error);
+    if (!_module) {
+        std::string _error_text = "Sandbox error: could not create Module with error " + _module_error;
+        std::cerr << _error_text << std::endl;
+        throw std::runtime_error(_error_text);
+    }
+
+    module.path = plugin_path;
+    module.classes.clear();
+    VST3::Hosting::PluginFactory _factory = _module->getFactory();
+    for (VST3::Hosting::ClassInfo& _class_info : _factory.classInfos()) {
+        if (_class_info.category() != kVstAudioEffectClass) {
+            continue;
+        }
+
+        std::unique_ptr<Steinberg::Vst::PlugProvider> _plugin_provider = std::make_unique<Steinberg::Vst::PlugProvider>(_factory, _class_info, true);
+        Steinberg::Vst::IComponent* _instance_processor = _plugin_provider->getComponent();
+        Steinberg::Vst::IEditController* _instance_controller = _plugin_provider->getController();
+        if (!_instance_processor || !_instance_controller) {
+            continue;
+        }
+
+        Steinberg::TUID _original_controller_tuid;
+        if (_instance_processor->getControllerClassId(_original_controller_tuid) != Steinberg::kResultOk) {
+            continue;
+        }
+
+        scanned_class& _scanned_class = module.classes.emplace_back();
+        _scanned_class.class_info = _class_info;
+        _scanned_class.controller_uid = Steinberg::FUID::fromTUID(_original_controller_tuid);
+        _scanned_class.is_complete = true;
+
+        Steinberg::FUnknownPtr<Steinberg::Vst::IAudioProcessor> _instance_audio_processor(_instance_processor);
+        scan_buses(_instance_processor, _instance_audio_processor, _scanned_class.buses);
+
+        const Steinberg::int32 _parameters_count = _instance_controller->getParameterCount();
+        _scanned_class.parameters.reserve(_parameters_count);
+        for (Steinberg::int32 _k = 0; _k < _parameters_count; ++_k) {
+            Steinberg::Vst::ParameterInfo _info;
+            if (_instance_controller->getParameterInfo(_k, _info) == Steinberg::kResultOk) {
+                _scanned_class.parameters.push_back(_info);
+            }
+        }
+    }
+}
+
+struct scan_job {
+    scanned_module* module;
+    worker_process process;
+    std::filesystem::path output_path;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+void scan_module_in_process(scanned_module& module)
+{
+    // best effort when no scanner can be launched, a crashing module takes the host down with it
+    try {
+        scan_module(module.path, module);
+    } catch (const std::exception& _exception) {
+        module.classes.clear();
+        module.blocked_reason = _exception.what();
+    }
+}
+
+void finish_scan_job(scan_job& job)
+{
+    scanned_module& _module = *job.module;
+    scan_cache _result;
+    if (!_result.open(job.output_path) || !_result.find(_module.path, _module.modification_time, _module.size, _module)) {
+        _module.classes.clear();
+        _module.blocked_reason = job.process.has_exited_successfully() ? "scanner did not write a result" : "scanner " + job.process.get_exit_reason();
+    } else if (!job.process.has_exited_successfully() && _module.blocked_reason.empty()) {
+        _module.blocked_reason = "scanner " + job.process.get_exit_reason();
+    }
+    _result.close();
+    std::error_code _error;
+    std::filesystem::remove(job.output_path, _error);
+}
+
+void scan_modules_in_processes(const std::filesystem::path& scanner_executable, const std::vector<scanned_module*>& modules, const scan_settings& settings)
+{
+    const std::size_t _process_count = std::max<std::size_t>(1, settings.process_count ? settings.process_count : std::thread::hardware_concurrency());
+    const std::filesystem::path _output_directory = std::filesystem::temp_directory_path();
+    const std::string _output_prefix = "vstsandbox-" + std::to_string(get_current_process_id()) + "-";
+
+    std::vector<std::unique_ptr<scan_job>> _jobs;
+    std::size_t _next_module = 0;
+    while (_next_module < modules.size() || !_jobs.empty()) {
+        while (_jobs.size() < _process_count && _next_module < modules.size()) {
+            std::unique_ptr<scan_job> _job = std::make_unique<scan_job>();
+            _job->module = modules[_next_module];
+            _job->output_path = _output_directory / (_output_prefix + std::to_string(_next_module) + ".scan");
+            _job->deadline = std::chrono::steady_clock::now() + settings.timeout;
+            ++_next_module;
+            const std::vector<std::string> _arguments = {
+                "--scan", _job->module->path.u8string(),
+                "--output", _job->output_path.u8string(),
+                "--parent", std::to_string(get_current_process_id())
+            };
+            if (!_job->process.spawn(scanner_executable, _arguments)) {
+                std::cerr << "Sandbox error: could not launch scanner " << scanner_executable << ", scanning " << _job->module->path << " in process" << std::endl;
+                scan_module_in_process(*_job->module);
+                continue;
+            }
+            _jobs.push_back(std::move(_job));
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        const std::chrono::steady_clock::time_point _now = std::chrono::steady_clock::now();
+        for (std::size_t _index = 0; _index < _jobs.size();) {
+            scan_job& _job = *_jobs[_index];
+            if (_job.process.is_running()) {
+                if (_now < _job.deadline) {
+                    ++_index;
+                    continue;
+                }
+                _job.process.kill();
+                _job.module->classes.clear();
+                _job.module->blocked_reason = "scan timed out after " + std::to_string(settings.timeout.count()) + " ms";
+                std::error_code _error;
+                std::filesystem::remove(_job.output_path, _error);
+            } else {
+                finish_scan_job(_job);
+            }
+            _jobs.erase(_jobs.begin() + static_cast<std::ptrdiff_t>(_index));
+        }
+    }
+}
+
+bool read_module_info(const std::filesystem::path& plugin_path, scanned_module& module)
+{
+    const VST3::Optional<std::string> _module_info_path = VST3::Hosting::Module::getModuleInfoPath(plugin_path.string());
+    if (!_module_info_path) {
+        return false;
+    }
+    std::ifstream _file(std::filesystem::u8path(*_module_info_path), std::ios::binary);
+    if (!_file) {
+        return false;
+    }
+    std::stringstream _buffer;
+    _buffer << _file.rdbuf();
+    const std::string _json = _buffer.str();
+    std::optional<Steinberg::ModuleInfo> _module_info = Steinberg::ModuleInfoLib::parseJson(_json, &std::cerr);
+    if (!_module_info) {
+        return false;
+    }
+
+    // moduleinfo.json does not link processors to their controllers so we only trust it when
+    // there is a single controller class to choose from
+    const Steinberg::ModuleInfo::ClassInfo* _controller = nullptr;
+    for (const Steinberg::ModuleInfo::ClassInfo& _class : _module_info->classes) {
+        if (_class.category == kVstComponentControllerClass) {
+            if (_controller) {
+                return false;
+            }
+            _controller = &_class;
+        }
+    }
+    const VST3::Optional<VST3::UID> _controller_uid = _controller ? VST3::UID::fromString(_controller->cid) : VST3::Optional<VST3::UID> {};
+    if (!_controller_uid) {
+        return false;
+    }
+
+    module.path = plugin_path;
+    module.classes.clear();
+    for (const Steinberg::ModuleInfo::ClassInfo& _class : _module_info->classes) {
+        if (_class.category != kVstAudioEffectClass) {
+            continue;
+        }
+        const VST3::Optional<VST3::UID> _class_uid = VST3::UID::fromString(_class.cid);
+        if (!_class_uid) {
+            continue;
+        }
+        scanned_class& _scanned_class = module.classes.emplace_back();
+        VST3::Hosting::ClassInfo::Data& _data = _scanned_class.class_info.get();
+        _data.classID = *_class_uid;
+        _data.cardinality = _class.cardinality;
+        _data.category = _class.category;
+        _data.name = _class.name;
+        _data.vendor = _class.vendor;
+        _data.version = _class.version;
+        _data.sdkVersion = _class.sdkVersion;
+        _data.subCategories = _class.subCategories;
+        _data.classFlags = _class.flags;
+        _scanned_class.controller_uid = Steinberg::FUID::fromTUID(_controller_uid->data());
+    }
+    return true;
+}
+
+// cache layout: a scan_cache_header followed by one record per module. Every record starts with
+// its size so that opening the cache only reads the module paths
+
+struct scan_cache_header {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t module_count;
+    std::uint32_t bus_size; // layouts of the SDK structures we copy as is
+    std::uint32_t parameter_size;
+};
+
+struct scan_cache_writer {
+    template <typename value_t>
+    void write(const value_t& value)
+    {
+        const std::byte* _bytes = reinterpret_cast<const std::byte*>(&value);
+        bytes.insert(bytes.end(), _bytes, _bytes + sizeof(value_t));
+    }
+
+    template <typename value_t>
+    void write_array(const std::vector<value_t>& values)
+    {
+        write(static_cast<std::uint32_t>(values.size()));
+        const std::byte* _bytes = reinterpret_cast<const std::byte*>(values.data());
+        bytes.insert(bytes.end(), _bytes, _bytes + values.size() * sizeof(value_t));
+    }
+
+    void write_string(const std::string& value)
+    {
+        write(static_cast<std::uint32_t>(value.size()));
+        const std::byte* _bytes = reinterpret_cast<const std::byte*>(value.data());
+        bytes.insert(bytes.end(), _bytes, _bytes + value.size());
+    }
+
+    std::vector<std::byte> bytes;
+};
+
+struct scan_cache_reader {
+    template <typename value_t>
+    [[nodiscard]] bool read(value_t& value)
+    {
+        if (size - offset < sizeof(value_t)) {
+            return false;
+        }
+        std::memcpy(&value, data + offset, sizeof(value_t));
+        offset += sizeof(value_t);
+        return true;
+    }
+
+    template <typename value_t>
+    [[nodiscard]] bool read_array(std::vector<value_t>& values)
+    {
+        std::uint32_t _count = 0;
+        if (!read(_count) || (size - offset) / sizeof(value_t) < _count) {
+            return false;
+        }
+        values.resize(_count);
+        std::memcpy(values.data(), data + offset, _count * sizeof(value_t));
+        offset += _count * sizeof(value_t);
+        return true;
+    }
+
+    [[nodiscard]] bool read_string(std::string& value)
+    {
+        std::uint32_t _size = 0;
+        if (!read(_size) || size - offset < _size) {
+            return false;
+        }
+        value.assign(reinterpret_cast<const char*>(data + offset), _size);
+        offset += _size;
+        return true;
+    }
+
+    const std::byte* data;
+    std::size_t size;
+    std::size_t offset;
+};
+
+void write_scanned_class(scan_cache_writer& writer, const scanned_class& scanned)
+{
+    const VST3::Hosting::ClassInfo& _info = scanned.class_info;
+    writer.write(_info.ID().data());
+    writer.write(_info.cardinality());
+    writer.write_string(_info.category());
+    writer.write_string(_info.name());
+    writer.write_string(_info.vendor());
+    writer.write_string(_info.version());
+    writer.write_string(_info.sdkVersion());
+    writer.write_string(_info.subCategoriesString());
+    writer.write(_info.classFlags());
+    Steinberg::TUID _controller_tuid;
+    scanned.controller_uid.toTUID(_controller_tuid);
+    writer.write(_controller_tuid);
+    writer.write(static_cast<std::uint8_t>(scanned.is_complete));
+    writer.write_array(scanned.buses);
+    writer.write_array(scanned.parameters);
+}
+
+[[nodiscard]] bool read_scanned_class(scan_cache_reader& reader, scanned_class& scanned)
+{
+    VST3::Hosting::ClassInfo::Data& _data = scanned.class_info.get();
+    Steinberg::TUID _class_tuid;
+    Steinberg::TUID _controller_tuid;
+    std::string _sub_categories;
+    std::uint8_t _is_complete = 0;
+    if (!reader.read(_class_tuid) || !reader.read(_data.cardinality) || !reader.read_string(_data.category) || !reader.read_string(_data.name)
+        || !reader.read_string(_data.vendor) || !reader.read_string(_data.version) || !reader.read_string(_data.sdkVersion)
+        || !reader.read_string(_sub_categories) || !reader.read(_data.classFlags) || !reader.read(_controller_tuid) || !reader.read(_is_complete)
+        || !reader.read_array(scanned.buses) || !reader.read_array(scanned.parameters)) {
+        return false;
+    }
+    _data.classID = VST3::UID::fromTUID(_class_tuid);
+    _data.subCategories.clear();
+    std::istringstream _stream(_sub_categories);
+    for (std::string _category; std::getline(_stream, _category, '|');) {
+        _data.subCategories.push_back(_category);
+    }
+    scanned.controller_uid = Steinberg::FUID::fromTUID(_controller_tuid);
+    scanned.is_complete = _is_complete != 0;
+    return true;
+}
+
+bool scan_cache::open(const std::filesystem::path& cache_path)
+{
+    close();
+    if (!_file.open(cache_path)) {
+        return false;
+    }
+
+    scan_cache_reader _reader { _file.data(), _file.size(), 0 };
+    scan_cache_header _header;
+    if (!_reader.read(_header) || _header.magic != scan_cache_magic || _header.version != scan_cache_version
+        || _header.bus_size != sizeof(scanned_bus) || _header.parameter_size != sizeof(Steinberg::Vst::ParameterInfo)) {
+        close();
+        return false;
+    }
+    for (std::uint32_t _index = 0; _index < _header.module_count; ++_index) {
+        const std::size_t _record_offset = _reader.offset;
+        std::uint64_t _record_size = 0;
+        std::string _path;
+        if (!_reader.read(_record_size) || !_reader.read_string(_path) || _record_size > _file.size() - _record_offset) {
+            close();
+            return false;
+        }
+        _offsets[_path] = _record_offset;
+        _reader.offset = _record_offset + static_cast<std::size_t>(_record_size);
+    }
+    return true;
+}
+
+void scan_cache::close()
+{
+    _offsets.clear();
+    _file.close();
+}
+
+bool scan_cache::find(const std::filesystem::path& plugin_path, std::int64_t modification_time, std::uint64_t size, scanned_module& module) const
+{
+    const std::unordered_map<std::string, std::size_t>::const_iterator _found = _offsets.find(plugin_path.u8string());
+    if (_found == _offsets.end()) {
+        return false;
+    }
+
+    scan_cache_reader _reader { _file.data(), _file.size(), _found->second };
+    std::uint64_t _record_size = 0;
+    std::string _path;
+    std::int64_t _modification_time = 0;
+    std::uint64_t _size = 0;
+    std::uint32_t _class_count = 0;
+    if (!_reader.read(_record_size) || !_reader.read_string(_path) || !_reader.read(_modification_time) || !_reader.read(_size)
+        || _modification_time != modification_time || _size != size || !_reader.read_string(module.blocked_reason) || !_reader.read(_class_count)) {
+        return false;
+    }
+
+    module.path = plugin_path;
+    module.modification_time = modification_time;
+    module.size = size;
+    module.classes.resize(_class_count);
+    for (scanned_class& _class : module.classes) {
+        if (!read_scanned_class(_reader, _class)) {
+            module.classes.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool scan_cache::write(const std::filesystem::path& cache_path, const std::vector<scanned_module>& modules)
+{
+    scan_cache_writer _writer;
+    _writer.write(scan_cache_header { scan_cache_magic, scan_cache_version, static_cast<std::uint32_t>(modules.size()), sizeof(scanned_bus), sizeof(Steinberg::Vst::ParameterInfo) });
+    for (const scanned_module& _module : modules) {
+        const std::size_t _record_offset = _writer.bytes.size();
+        _writer.write(std::uint64_t(0));
+        _writer.write_string(_module.path.u8string());
+        _writer.write(_module.modification_time);
+        _writer.write(_module.size);
+        _writer.write_string(_module.blocked_reason);
+        _writer.write(static_cast<std::uint32_t>(_module.classes.size()));
+        for (const scanned_class& _class : _module.classes) {
+            write_scanned_class(_writer, _class);
+        }
+        const std::uint64_t _record_size = _writer.bytes.size() - _record_offset;
+        std::memcpy(_writer.bytes.data() + _record_offset, &_record_size, sizeof(_record_size));
+    }
+
+    // written next to the cache then renamed so that a crash never leaves a truncated cache behind
+    std::filesystem::path _temporary_path = cache_path;
+    _temporary_path += ".tmp";
+    {
+        std::ofstream _file(_temporary_path, std::ios::binary | std::ios::trunc);
+        if (!_file || !_file.write(reinterpret_cast<const char*>(_writer.bytes.data()), static_cast<std::streamsize>(_writer.bytes.size()))) {
+            std::cerr << "Sandbox error: could not write scan cache " << _temporary_path << std::endl;
+            return false;
+        }
+    }
+    std::error_code _error;
+    std::filesystem::rename(_temporary_path, cache_path, _error);
+    if (_error) {
+        std::cerr << "Sandbox error: could not replace scan cache " << cache_path << " with error " << _error.message() << std::endl;
+        std::filesystem::remove(_temporary_path, _error);
+        return false;
+    }
+    return true;
+}
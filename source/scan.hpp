@@ -0,0 +1,85 @@
+#pragma once
+
+#include <public.sdk/source/vst/hosting/module.h>
+#include <pluginterfaces/vst/ivstaudioprocessor.h>
+#include <pluginterfaces/vst/ivstcomponent.h>
+#include <pluginterfaces/vst/ivsteditcontroller.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ipc.hpp>
+
+constexpr std::uint32_t scan_cache_magic = 0x63627376; // "vsbc"
+constexpr std::uint32_t scan_cache_version = 2;
+
+struct scanned_bus {
+    Steinberg::Vst::BusInfo info;
+    Steinberg::Vst::SpeakerArrangement arrangement; // only meaningful for audio buses
+};
+
+struct scanned_class {
+    VST3::Hosting::ClassInfo class_info;
+    Steinberg::FUID controller_uid;
+    bool is_complete { false }; // false when the class comes from moduleinfo.json without bus and parameter tables
+    std::vector<scanned_bus> buses;
+    std::vector<Steinberg::Vst::ParameterInfo> parameters;
+};
+
+struct scanned_module {
+    std::filesystem::path path;
+    std::int64_t modification_time { 0 };
+    std::uint64_t size { 0 };
+    std::vector<scanned_class> classes;
+    std::string blocked_reason; // empty unless the module failed to scan, kept until the module changes
+};
+
+struct scan_settings {
+    std::chrono::milliseconds timeout { 30000 };
+    std::uint32_t process_count { 0 }; // 0 uses one scanner per core
+};
+
+// a module is considered unchanged while the newest modification time and the total size of its
+// binaries stay the same. Bundle resources are skipped except moduleinfo.json
+[[nodiscard]] bool get_module_fingerprint(const std::filesystem::path& plugin_path, std::int64_t& modification_time, std::uint64_t& size);
+
+// audio input, audio output, event input then event output buses, arrangements are only queried when processor is set
+void scan_buses(Steinberg::Vst::IComponent* component, Steinberg::Vst::IAudioProcessor* processor, std::vector<scanned_bus>& buses);
+
+// buses of a chain as the host sees them. Audio inputs come from the first plugin, event inputs from
+// the first plugin that has some and the outputs from the last plugin
+void combine_chain_buses(const std::vector<std::vector<scanned_bus>>& stage_buses, std::vector<scanned_bus>& buses);
+
+// loads the module and instantiates every audio effect class to query its buses and parameters
+void scan_module(const std::filesystem::path& plugin_path, scanned_module& module);
+
+// scans every module in its own short lived scanner process, at most settings.process_count at the
+// same time. Modules whose scanner fails, crashes or times out come back with a blocked_reason
+void scan_modules_in_processes(const std::filesystem::path& scanner_executable, const std::vector<scanned_module*>& modules, const scan_settings& settings);
+
+// fills the classes from the moduleinfo.json of the bundle without loading the module, returns false
+// when there is no such file or when it does not tell which controller belongs to the processors.
+// moduleinfo.json does not link them, so modules with several controller classes are scanned
+[[nodiscard]] bool read_module_info(const std::filesystem::path& plugin_path, scanned_module& module);
+
+// binary cache of scanned modules, memory mapped so that looking up an unchanged module only
+// touches the pages of its own record
+struct scan_cache {
+    [[nodiscard]] bool open(const std::filesystem::path& cache_path);
+    void close();
+
+    [[nodiscard]] std::size_t module_count() const { return _offsets.size(); }
+    [[nodiscard]] bool contains(const std::filesystem::path& plugin_path) const { return _offsets.count(plugin_path.u8string()) != 0; }
+    [[nodiscard]] bool find(const std::filesystem::path& plugin_path, std::int64_t modification_time, std::uint64_t size, scanned_module& module) const;
+
+    // the cache must be closed before it is written on Windows, where mapped files can not be replaced
+    [[nodiscard]] static bool write(const std::filesystem::path& cache_path, const std::vector<scanned_module>& modules);
+
+private:
+    mapped_file _file;
+    std::unordered_map<std::string, std::size_t> _offsets;
+};
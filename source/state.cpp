@@ -0,0 +1,474 @@
+#include <algorithm>
+#include <cstring>
+
+#include <state.hpp>
+
+constexpr std::uint64_t hash_prime_1 = 0x9e3779b185ebca87ull;
+constexpr std::uint64_t hash_prime_2 = 0xc2b2ae3d27d4eb4full;
+constexpr std::uint64_t hash_prime_3 = 0x165667b19e3779f9ull;
+constexpr std::uint64_t hash_prime_4 = 0x85ebca77c2b2ae63ull;
+constexpr std::uint64_t hash_prime_5 = 0x27d4eb2f165667c5ull;
+
+[[nodiscard]] constexpr std::uint64_t rotate_hash_left(std::uint64_t value, int count)
+{
+    return (value << count) | (value >> (64 - count));
+}
+
+[[nodiscard]] constexpr std::uint64_t hash_round(std::uint64_t lane, std::uint64_t input)
+{
+    return rotate_hash_left(lane + input * hash_prime_2, 31) * hash_prime_1;
+}
+
+[[nodiscard]] constexpr std::uint64_t merge_hash_round(std::uint64_t hash, std::uint64_t lane)
+{
+    return (hash ^ hash_round(0, lane)) * hash_prime_1 + hash_prime_4;
+}
+
+[[nodiscard]] std::uint64_t read_hash_word(const std::byte* data)
+{
+    std::uint64_t _word;
+    std::memcpy(&_word, data, sizeof(_word));
+    return _word;
+}
+
+void hash_stripe(std::uint64_t* lanes, const std::byte* stripe)
+{
+    for (int _lane = 0; _lane < 4; ++_lane) {
+        lanes[_lane] = hash_round(lanes[_lane], read_hash_word(stripe + _lane * 8));
+    }
+}
+
+[[nodiscard]] std::size_t get_state_segment_size(std::size_t index)
+{
+    return index < 6 ? std::min(state_segment_min_size << index, state_segment_max_size) : state_segment_max_size;
+}
+
+// state_hash
+
+void state_hash::update(const void* data, std::size_t size)
+{
+    const std::byte* _data = static_cast<const std::byte*>(data);
+    _total_size += size;
+    if (_stripe_size) {
+        const std::size_t _count = std::min(size, sizeof(_stripe) - _stripe_size);
+        std::memcpy(_stripe + _stripe_size, _data, _count);
+        _stripe_size += _count;
+        _data += _count;
+        size -= _count;
+        if (_stripe_size < sizeof(_stripe)) {
+            return;
+        }
+        hash_stripe(_lanes, _stripe);
+        _stripe_size = 0;
+    }
+    for (; size >= sizeof(_stripe); _data += sizeof(_stripe), size -= sizeof(_stripe)) {
+        hash_stripe(_lanes, _data);
+    }
+    if (size) {
+        std::memcpy(_stripe, _data, size);
+        _stripe_size = size;
+    }
+}
+
+std::uint64_t state_hash::digest() const
+{
+    std::uint64_t _hash;
+    if (_total_size >= sizeof(_stripe)) {
+        _hash = rotate_hash_left(_lanes[0], 1) + rotate_hash_left(_lanes[1], 7) + rotate_hash_left(_lanes[2], 12) + rotate_hash_left(_lanes[3], 18);
+        for (std::uint64_t _lane : _lanes) {
+            _hash = merge_hash_round(_hash, _lane);
+        }
+    } else {
+        _hash = hash_prime_5;
+    }
+    _hash += _total_size;
+
+    const std::byte* _tail = _stripe;
+    std::size_t _size = _stripe_size;
+    for (; _size >= 8; _tail += 8, _size -= 8) {
+        _hash = rotate_hash_left(_hash ^ hash_round(0, read_hash_word(_tail)), 27) * hash_prime_1 + hash_prime_4;
+    }
+    if (_size >= 4) {
+        std::uint32_t _word;
+        std::memcpy(&_word, _tail, sizeof(_word));
+        _hash = rotate_hash_left(_hash ^ (_word * hash_prime_1), 23) * hash_prime_2 + hash_prime_3;
+        _tail += 4;
+        _size -= 4;
+    }
+    for (; _size; ++_tail, --_size) {
+        _hash = rotate_hash_left(_hash ^ (static_cast<std::uint64_t>(*_tail) * hash_prime_5), 11) * hash_prime_1;
+    }
+
+    _hash ^= _hash >> 33;
+    _hash *= hash_prime_2;
+    _hash ^= _hash >> 29;
+    _hash *= hash_prime_3;
+    _hash ^= _hash >> 32;
+    return _hash;
+}
+
+// state_stream
+
+bool state_stream::create()
+{
+    _name = make_ipc_name("s");
+    _segments.clear();
+    _capacity = 0;
+    _size = 0;
+    _position = 0;
+    _is_writable = true;
+    return _name.size() + 4 < sandbox_ipc_name_capacity;
+}
+
+bool state_stream::open(const state_transfer& transfer)
+{
+    _name.assign(transfer.name, std::find(transfer.name, transfer.name + sandbox_ipc_name_capacity, '\0'));
+    _segments.clear();
+    _capacity = 0;
+    _size = transfer.size;
+    _position = 0;
+    _is_writable = false;
+    while (_capacity < _size) {
+        if (_segments.size() == state_max_segments) {
+            return false;
+        }
+        // the end of the last segment is never read so we do not map it
+        const std::size_t _segment_size = static_cast<std::size_t>(std::min<std::uint64_t>(get_state_segment_size(_segments.size()), _size - _capacity));
+        std::unique_ptr<shared_memory> _segment = std::make_unique<shared_memory>();
+        if (!_segment->open(_name + "." + std::to_string(_segments.size()), _segment_size)) {
+            return false;
+        }
+        _segments.push_back(std::move(_segment));
+        _capacity += _segment_size;
+    }
+    return true;
+}
+
+state_transfer state_stream::get_transfer() const
+{
+    state_transfer _transfer {};
+    std::memcpy(_transfer.name, _name.data(), std::min(_name.size(), sandbox_ipc_name_capacity - 1));
+    _transfer.size = _size;
+    return _transfer;
+}
+
+bool state_stream::reserve(std::uint64_t size)
+{
+    while (_capacity < size) {
+        if (!_is_writable || _segments.size() == state_max_segments) {
+            return false;
+        }
+        const std::size_t _segment_size = get_state_segment_size(_segments.size());
+        std::unique_ptr<shared_memory> _segment = std::make_unique<shared_memory>();
+        if (!_segment->create(_name + "." + std::to_string(_segments.size()), _segment_size)) {
+            return false;
+        }
+        _segments.push_back(std::move(_segment));
+        _capacity += _segment_size;
+    }
+    return true;
+}
+
+std::size_t state_stream::get_segment(std::uint64_t position, std::uint64_t& segment_offset) const
+{
+    std::size_t _index = 0;
+    segment_offset = position;
+    while (_index < _segments.size() && segment_offset >= _segments[_index]->size()) {
+        segment_offset -= _segments[_index]->size();
+        ++_index;
+    }
+    return _index;
+}
+
+Steinberg::tresult state_stream::append(Steinberg::IBStream* source, state_hash& hash)
+{
+    if (!source) {
+        return Steinberg::kInvalidArgument;
+    }
+    _position = _size;
+    while (true) {
+        if (!reserve(_size + 1)) {
+            return Steinberg::kOutOfMemory;
+        }
+        std::uint64_t _segment_offset = 0;
+        const std::size_t _index = get_segment(_size, _segment_offset);
+        std::byte* _data = static_cast<std::byte*>(_segments[_index]->data()) + _segment_offset;
+        const std::uint64_t _available = _segments[_index]->size() - _segment_offset;
+        Steinberg::int32 _read_size = 0;
+        if (source->read(_data, static_cast<Steinberg::int32>(std::min<std::uint64_t>(_available, 1 << 30)), &_read_size) != Steinberg::kResultOk || _read_size <= 0) {
+            return Steinberg::kResultOk;
+        }
+        hash.update(_data, static_cast<std::size_t>(_read_size));
+        _size += static_cast<std::uint64_t>(_read_size);
+        _position = _size;
+    }
+}
+
+Steinberg::tresult state_stream::copy_to(Steinberg::IBStream* target) const
+{
+    if (!target) {
+        return Steinberg::kInvalidArgument;
+    }
+    std::uint64_t _remaining = _size;
+    for (const std::unique_ptr<shared_memory>& _segment : _segments) {
+        const std::uint64_t _segment_size = std::min<std::uint64_t>(_segment->size(), _remaining);
+        for (std::uint64_t _offset = 0; _offset < _segment_size;) {
+            const Steinberg::int32 _chunk_size = static_cast<Steinberg::int32>(std::min<std::uint64_t>(_segment_size - _offset, 1 << 30));
+            Steinberg::int32 _written_size = 0;
+            if (target->write(static_cast<std::byte*>(_segment->data()) + _offset, _chunk_size, &_written_size) != Steinberg::kResultOk || _written_size <= 0) {
+                return Steinberg::kResultFalse;
+            }
+            _offset += static_cast<std::uint64_t>(_written_size);
+        }
+        _remaining -= _segment_size;
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API state_stream::read(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesRead)
+{
+    std::uint64_t _count = numBytes > 0 && _position < _size ? std::min<std::uint64_t>(static_cast<std::uint64_t>(numBytes), _size - _position) : 0;
+    std::byte* _buffer = static_cast<std::byte*>(buffer);
+    if (numBytesRead) {
+        *numBytesRead = static_cast<Steinberg::int32>(_count);
+    }
+    while (_count) {
+        std::uint64_t _segment_offset = 0;
+        const std::size_t _index = get_segment(_position, _segment_offset);
+        const std::uint64_t _chunk_size = std::min(_count, _segments[_index]->size() - _segment_offset);
+        std::memcpy(_buffer, static_cast<const std::byte*>(_segments[_index]->data()) + _segment_offset, static_cast<std::size_t>(_chunk_size));
+        _buffer += _chunk_size;
+        _position += _chunk_size;
+        _count -= _chunk_size;
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API state_stream::write(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesWritten)
+{
+    if (numBytesWritten) {
+        *numBytesWritten = 0;
+    }
+    if (numBytes < 0 || !reserve(_position + static_cast<std::uint64_t>(numBytes))) {
+        return Steinberg::kResultFalse;
+    }
+    std::uint64_t _count = static_cast<std::uint64_t>(numBytes);
+    const std::byte* _buffer = static_cast<const std::byte*>(buffer);
+    while (_count) {
+        std::uint64_t _segment_offset = 0;
+        const std::size_t _index = get_segment(_position, _segment_offset);
+        const std::uint64_t _chunk_size = std::min(_count, _segments[_index]->size() - _segment_offset);
+        std::memcpy(static_cast<std::byte*>(_segments[_index]->data()) + _segment_offset, _buffer, static_cast<std::size_t>(_chunk_size));
+        _buffer += _chunk_size;
+        _position += _chunk_size;
+        _count -= _chunk_size;
+    }
+    _size = std::max(_size, _position);
+    if (numBytesWritten) {
+        *numBytesWritten = numBytes;
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API state_stream::seek(Steinberg::int64 pos, Steinberg::int32 mode, Steinberg::int64* result)
+{
+    Steinberg::int64 _position_value = pos;
+    if (mode == kIBSeekCur) {
+        _position_value += static_cast<Steinberg::int64>(_position);
+    } else if (mode == kIBSeekEnd) {
+        _position_value += static_cast<Steinberg::int64>(_size);
+    } else if (mode != kIBSeekSet) {
+        return Steinberg::kInvalidArgument;
+    }
+    if (_position_value < 0) {
+        return Steinberg::kResultFalse;
+    }
+    // writing past the end leaves zeros in between like a file would
+    _position = static_cast<std::uint64_t>(_position_value);
+    if (result) {
+        *result = _position_value;
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API state_stream::tell(Steinberg::int64* pos)
+{
+    if (!pos) {
+        return Steinberg::kInvalidArgument;
+    }
+    *pos = static_cast<Steinberg::int64>(_position);
+    return Steinberg::kResultOk;
+}
+
+// state_slice
+
+state_slice::state_slice(Steinberg::IBStream* stream, std::int64_t offset, std::int64_t size)
+    : _stream(stream)
+    , _offset(offset)
+    , _size(std::max<std::int64_t>(size, 0))
+{
+}
+
+Steinberg::tresult PLUGIN_API state_slice::read(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesRead)
+{
+    if (numBytesRead) {
+        *numBytesRead = 0;
+    }
+    const std::int64_t _count = numBytes > 0 && _position < _size ? std::min<std::int64_t>(numBytes, _size - _position) : 0;
+    if (!_count) {
+        return Steinberg::kResultOk;
+    }
+    if (!_stream || _stream->seek(_offset + _position, kIBSeekSet, nullptr) != Steinberg::kResultOk) {
+        return Steinberg::kResultFalse;
+    }
+    Steinberg::int32 _read_size = 0;
+    const Steinberg::tresult _result = _stream->read(buffer, static_cast<Steinberg::int32>(_count), &_read_size);
+    _position += std::max<Steinberg::int32>(_read_size, 0);
+    if (numBytesRead) {
+        *numBytesRead = _read_size;
+    }
+    return _result;
+}
+
+Steinberg::tresult PLUGIN_API state_slice::write(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesWritten)
+{
+    if (numBytesWritten) {
+        *numBytesWritten = 0;
+    }
+    return Steinberg::kNotImplemented;
+}
+
+Steinberg::tresult PLUGIN_API state_slice::seek(Steinberg::int64 pos, Steinberg::int32 mode, Steinberg::int64* result)
+{
+    Steinberg::int64 _position_value = pos;
+    if (mode == kIBSeekCur) {
+        _position_value += _position;
+    } else if (mode == kIBSeekEnd) {
+        _position_value += _size;
+    } else if (mode != kIBSeekSet) {
+        return Steinberg::kInvalidArgument;
+    }
+    if (_position_value < 0) {
+        return Steinberg::kResultFalse;
+    }
+    _position = std::min<std::int64_t>(_position_value, _size);
+    if (result) {
+        *result = _position;
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API state_slice::tell(Steinberg::int64* pos)
+{
+    if (!pos) {
+        return Steinberg::kInvalidArgument;
+    }
+    *pos = _position;
+    return Steinberg::kResultOk;
+}
+
+// state_buffer
+
+Steinberg::tresult state_buffer::assign(Steinberg::IBStream* source)
+{
+    if (!source) {
+        return Steinberg::kInvalidArgument;
+    }
+    _bytes.clear();
+    _position = 0;
+    constexpr std::size_t _chunk_size = 1 << 20;
+    while (true) {
+        const std::size_t _offset = _bytes.size();
+        _bytes.resize(_offset + _chunk_size);
+        Steinberg::int32 _read_size = 0;
+        const Steinberg::tresult _result = source->read(_bytes.data() + _offset, static_cast<Steinberg::int32>(_chunk_size), &_read_size);
+        _bytes.resize(_offset + static_cast<std::size_t>(std::max<Steinberg::int32>(_read_size, 0)));
+        if (_result != Steinberg::kResultOk || _read_size <= 0) {
+            return Steinberg::kResultOk;
+        }
+    }
+}
+
+Steinberg::tresult state_buffer::copy_to(Steinberg::IBStream* target) const
+{
+    if (!target) {
+        return Steinberg::kInvalidArgument;
+    }
+    for (std::size_t _offset = 0; _offset < _bytes.size();) {
+        const Steinberg::int32 _chunk_size = static_cast<Steinberg::int32>(std::min<std::size_t>(_bytes.size() - _offset, 1 << 30));
+        Steinberg::int32 _written_size = 0;
+        if (target->write(const_cast<std::byte*>(_bytes.data()) + _offset, _chunk_size, &_written_size) != Steinberg::kResultOk || _written_size <= 0) {
+            return Steinberg::kResultFalse;
+        }
+        _offset += static_cast<std::size_t>(_written_size);
+    }
+    return Steinberg::kResultOk;
+}
+
+void state_buffer::shrink()
+{
+    _bytes.shrink_to_fit();
+}
+
+Steinberg::tresult PLUGIN_API state_buffer::read(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesRead)
+{
+    const std::size_t _count = numBytes > 0 && _position < _bytes.size() ? std::min<std::size_t>(static_cast<std::size_t>(numBytes), _bytes.size() - _position) : 0;
+    if (_count) {
+        std::memcpy(buffer, _bytes.data() + _position, _count);
+        _position += _count;
+    }
+    if (numBytesRead) {
+        *numBytesRead = static_cast<Steinberg::int32>(_count);
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API state_buffer::write(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesWritten)
+{
+    if (numBytesWritten) {
+        *numBytesWritten = 0;
+    }
+    if (numBytes < 0) {
+        return Steinberg::kResultFalse;
+    }
+    const std::size_t _count = static_cast<std::size_t>(numBytes);
+    if (_bytes.size() < _position + _count) {
+        _bytes.resize(_position + _count);
+    }
+    std::memcpy(_bytes.data() + _position, buffer, _count);
+    _position += _count;
+    if (numBytesWritten) {
+        *numBytesWritten = numBytes;
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API state_buffer::seek(Steinberg::int64 pos, Steinberg::int32 mode, Steinberg::int64* result)
+{
+    Steinberg::int64 _position_value = pos;
+    if (mode == kIBSeekCur) {
+        _position_value += static_cast<Steinberg::int64>(_position);
+    } else if (mode == kIBSeekEnd) {
+        _position_value += static_cast<Steinberg::int64>(_bytes.size());
+    } else if (mode != kIBSeekSet) {
+        return Steinberg::kInvalidArgument;
+    }
+    if (_position_value < 0) {
+        return Steinberg::kResultFalse;
+    }
+    // writing past the end leaves zeros in between like a file would
+    _position = static_cast<std::size_t>(_position_value);
+    if (result) {
+        *result = _position_value;
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API state_buffer::tell(Steinberg::int64* pos)
+{
+    if (!pos) {
+        return Steinberg::kInvalidArgument;
+    }
+    *pos = static_cast<Steinberg::int64>(_position);
+    return Steinberg::kResultOk;
+}
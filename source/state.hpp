@@ -0,0 +1,95 @@
+#pragma once
+
+#include <pluginterfaces/base/funknownimpl.h>
+#include <pluginterfaces/base/ibstream.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ipc.hpp>
+#include <transport.hpp>
+
+// 64 bit hash of a state fed in pieces of any size. It computes XXH64 with a zero seed, 32 bytes
+// per round, so hashing a large state costs about as much as reading it
+struct state_hash {
+    void update(const void* data, std::size_t size);
+    [[nodiscard]] std::uint64_t digest() const;
+
+private:
+    std::uint64_t _lanes[4] { 0x60ea27eeadc0b5d6ull, 0xc2b2ae3d27d4eb4full, 0, 0x61c8864e7a143579ull };
+    std::byte _stripe[32] {};
+    std::size_t _stripe_size { 0 };
+    std::uint64_t _total_size { 0 };
+};
+
+// stream over shared memory segments that carries a state between the proxy and the worker, so that
+// neither process copies a large state into memory of its own. The writer creates the segments
+// while the state grows. Each segment is twice the size of the previous one, up to
+// state_segment_max_size, and the kernel only commits pages once they are written. The reader maps
+// the segments of the transfer it received
+struct state_stream : public Steinberg::U::Implements<Steinberg::U::Directly<Steinberg::IBStream>> {
+    [[nodiscard]] bool create(); // empty and writable
+    [[nodiscard]] bool open(const state_transfer& transfer); // read only
+    [[nodiscard]] state_transfer get_transfer() const;
+
+    // reads source from its current position to its end straight into the segments
+    [[nodiscard]] Steinberg::tresult append(Steinberg::IBStream* source, state_hash& hash);
+    // writes the whole state to target straight from the segments
+    [[nodiscard]] Steinberg::tresult copy_to(Steinberg::IBStream* target) const;
+
+    Steinberg::tresult PLUGIN_API read(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesRead) override;
+    Steinberg::tresult PLUGIN_API write(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesWritten) override;
+    Steinberg::tresult PLUGIN_API seek(Steinberg::int64 pos, Steinberg::int32 mode, Steinberg::int64* result) override;
+    Steinberg::tresult PLUGIN_API tell(Steinberg::int64* pos) override;
+
+private:
+    [[nodiscard]] bool reserve(std::uint64_t size); // writable streams only
+    [[nodiscard]] std::size_t get_segment(std::uint64_t position, std::uint64_t& segment_offset) const;
+
+    std::string _name; // segments are named <name>.<index>
+    std::vector<std::unique_ptr<shared_memory>> _segments;
+    std::uint64_t _capacity { 0 };
+    std::uint64_t _size { 0 };
+    std::uint64_t _position { 0 };
+    bool _is_writable { false };
+};
+
+// read only window over size bytes of another stream starting at offset. The state of a chain holds
+// the states of its plugins one after the other and every plugin reads its own through a slice
+struct state_slice : public Steinberg::U::Implements<Steinberg::U::Directly<Steinberg::IBStream>> {
+    state_slice(Steinberg::IBStream* stream, std::int64_t offset, std::int64_t size);
+
+    Steinberg::tresult PLUGIN_API read(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesRead) override;
+    Steinberg::tresult PLUGIN_API write(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesWritten) override;
+    Steinberg::tresult PLUGIN_API seek(Steinberg::int64 pos, Steinberg::int32 mode, Steinberg::int64* result) override;
+    Steinberg::tresult PLUGIN_API tell(Steinberg::int64* pos) override;
+
+private:
+    Steinberg::IPtr<Steinberg::IBStream> _stream;
+    std::int64_t _offset;
+    std::int64_t _size;
+    std::int64_t _position { 0 };
+};
+
+// state kept in the memory of the proxy, for instances whose plugin is not loaded. It grows like a
+// vector while it is written and shrink drops the spare capacity once it is complete
+struct state_buffer : public Steinberg::U::Implements<Steinberg::U::Directly<Steinberg::IBStream>> {
+    // reads source from its current position to its end, replacing what the buffer held
+    [[nodiscard]] Steinberg::tresult assign(Steinberg::IBStream* source);
+    // writes the whole state to target
+    [[nodiscard]] Steinberg::tresult copy_to(Steinberg::IBStream* target) const;
+    void shrink();
+    [[nodiscard]] std::size_t size() const { return _bytes.size(); }
+
+    Steinberg::tresult PLUGIN_API read(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesRead) override;
+    Steinberg::tresult PLUGIN_API write(void* buffer, Steinberg::int32 numBytes, Steinberg::int32* numBytesWritten) override;
+    Steinberg::tresult PLUGIN_API seek(Steinberg::int64 pos, Steinberg::int32 mode, Steinberg::int64* result) override;
+    Steinberg::tresult PLUGIN_API tell(Steinberg::int64* pos) override;
+
+private:
+    std::vector<std::byte> _bytes;
+    std::size_t _position { 0 };
+};
@@ -0,0 +1,154 @@
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <new>
+
+#include <telemetry.hpp>
+
+struct telemetry_file {
+    ~telemetry_file()
+    {
+        memory.close();
+        std::error_code _error;
+        std::filesystem::remove(path, _error);
+    }
+
+    std::filesystem::path path;
+    shared_memory memory;
+};
+
+std::filesystem::path get_telemetry_file_path(const std::filesystem::path& directory, std::uint64_t process_id)
+{
+    return directory / ("vstsandbox." + std::to_string(process_id) + ".stats");
+}
+
+void remove_stale_telemetry_files(const std::filesystem::path& directory)
+{
+    // hosts that crashed could not remove their file
+    std::error_code _error;
+    for (const std::filesystem::directory_entry& _entry : std::filesystem::directory_iterator(directory, _error)) {
+        const std::string _file_name = _entry.path().filename().string();
+        const std::string _prefix = "vstsandbox.";
+        const std::string _suffix = ".stats";
+        if (_file_name.size() <= _prefix.size() + _suffix.size() || _file_name.compare(0, _prefix.size(), _prefix) != 0 || _file_name.compare(_file_name.size() - _suffix.size(), _suffix.size(), _suffix) != 0) {
+            continue;
+        }
+        const std::string _process_id = _file_name.substr(_prefix.size(), _file_name.size() - _prefix.size() - _suffix.size());
+        if (_process_id.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+        if (!is_process_running(std::stoull(_process_id))) {
+            const std::string _segment_name = read_telemetry_segment_name(_entry.path());
+            if (!_segment_name.empty()) {
+                shared_memory::remove(_segment_name);
+            }
+            std::filesystem::remove(_entry.path(), _error);
+        }
+    }
+}
+
+[[nodiscard]] std::shared_ptr<telemetry_file> get_telemetry_file(const std::filesystem::path& directory)
+{
+    // created with the first published record, removed once the module is unloaded and every record released
+    static std::mutex _mutex;
+    static std::shared_ptr<telemetry_file> _file;
+    static bool _has_failed = false;
+    std::lock_guard _lock(_mutex);
+    if (_file || _has_failed) {
+        return _file;
+    }
+
+    remove_stale_telemetry_files(directory);
+    std::shared_ptr<telemetry_file> _new_file = std::make_shared<telemetry_file>();
+    _new_file->path = get_telemetry_file_path(directory, get_current_process_id());
+    // the pages are touched now so that the first records of the audio threads do not fault either
+    if (!_new_file->memory.create(make_ipc_name("stats"), telemetry_file_size)) {
+        std::cerr << "Sandbox error: could not create the shared memory of the stats" << std::endl;
+        _has_failed = true;
+        return nullptr;
+    }
+    static_cast<void>(_new_file->memory.prefault(false));
+    std::ofstream _name_file(_new_file->path, std::ios::trunc);
+    if (!(_name_file << _new_file->memory.name() << "\n") || !_name_file.flush()) {
+        std::cerr << "Sandbox error: could not create the stats file " << _new_file->path << std::endl;
+        _has_failed = true;
+        return nullptr;
+    }
+    telemetry_header* _header = new (_new_file->memory.data()) telemetry_header();
+    _header->process_id = get_current_process_id();
+    _file = std::move(_new_file);
+    return _file;
+}
+
+void reset_telemetry_histogram(telemetry_histogram& histogram)
+{
+    for (std::atomic<std::uint64_t>& _bucket : histogram.buckets) {
+        _bucket.store(0, std::memory_order_relaxed);
+    }
+    histogram.count.store(0, std::memory_order_relaxed);
+    histogram.total.store(0, std::memory_order_relaxed);
+    histogram.maximum.store(0, std::memory_order_relaxed);
+}
+
+void reset_telemetry_instance(telemetry_instance& instance)
+{
+    instance.block_duration.store(0, std::memory_order_relaxed);
+    instance.block_count.store(0, std::memory_order_relaxed);
+    instance.missed_block_count.store(0, std::memory_order_relaxed);
+    instance.xrun_count.store(0, std::memory_order_relaxed);
+    instance.silent_block_count.store(0, std::memory_order_relaxed);
+    instance.is_late.store(0, std::memory_order_relaxed);
+    instance.is_worker_lost.store(0, std::memory_order_relaxed);
+    instance.realtime_refusals.store(0, std::memory_order_relaxed);
+    instance.is_hibernated.store(0, std::memory_order_relaxed);
+    instance.hibernation_count.store(0, std::memory_order_relaxed);
+    instance.recovery_count.store(0, std::memory_order_relaxed);
+    reset_telemetry_histogram(instance.process_time);
+    reset_telemetry_histogram(instance.round_trip_time);
+    reset_telemetry_histogram(instance.wakeup_latency);
+    reset_telemetry_histogram(instance.plugin_time);
+    reset_telemetry_histogram(instance.restore_time);
+    reset_telemetry_histogram(instance.recovery_time);
+}
+
+telemetry_record::telemetry_record()
+    : _private_instance(std::make_unique<telemetry_instance>())
+{
+    _instance = _private_instance.get();
+}
+
+telemetry_record::~telemetry_record()
+{
+    if (_file) {
+        _instance->state.store(telemetry_state::free, std::memory_order_release);
+    }
+}
+
+void telemetry_record::publish(const std::filesystem::path& directory, const std::string& plugin_name)
+{
+    if (_file) {
+        return;
+    }
+    std::shared_ptr<telemetry_file> _shared_file = get_telemetry_file(directory);
+    if (!_shared_file) {
+        return;
+    }
+    telemetry_instance* _instances = get_telemetry_instances(static_cast<std::byte*>(_shared_file->memory.data()));
+    for (std::uint32_t _index = 0; _index < telemetry_max_instances; ++_index) {
+        telemetry_state _free = telemetry_state::free;
+        if (!_instances[_index].state.compare_exchange_strong(_free, telemetry_state::claimed, std::memory_order_acquire)) {
+            continue;
+        }
+        telemetry_instance& _claimed = _instances[_index];
+        reset_telemetry_instance(_claimed);
+        std::memset(_claimed.plugin_name, 0, telemetry_name_capacity);
+        std::memcpy(_claimed.plugin_name, plugin_name.data(), std::min(plugin_name.size(), telemetry_name_capacity - 1));
+        _claimed.generation.fetch_add(1, std::memory_order_relaxed);
+        _claimed.state.store(telemetry_state::active, std::memory_order_release);
+        _instance = &_claimed;
+        _private_instance.reset();
+        _file = std::move(_shared_file);
+        return;
+    }
+    std::cerr << "Sandbox error: the stats file is full, " << plugin_name << " is not published" << std::endl;
+}
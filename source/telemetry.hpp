@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include <ipc.hpp>
+
+// every proxy process publishes the statistics of its instances in a shared memory segment, that
+// vstsandbox_stats reads while the host runs. The segment is never backed by a file on disk so the
+// audio thread never waits on writeback, the vstsandbox.<pid>.stats file next to vstsandbox.json
+// only holds its name. The audio thread of an instance is the only writer of its record while it
+// is active, the proxy and the monitor threads while it is not. Readers may see a record halfway
+// through an update
+
+constexpr std::uint32_t telemetry_magic = 0x74627376; // "vsbt"
+constexpr std::uint32_t telemetry_version = 5;
+constexpr std::uint32_t telemetry_max_instances = 512;
+constexpr std::size_t telemetry_name_capacity = 128;
+
+// four buckets per octave of nanoseconds starting at 256 ns, the last one also takes what is
+// above about 4 seconds
+constexpr std::uint32_t telemetry_bucket_count = 96;
+constexpr std::uint32_t telemetry_bucket_shift = 8;
+
+[[nodiscard]] constexpr std::uint32_t get_telemetry_bucket(std::uint64_t nanoseconds)
+{
+    const std::uint64_t _value = nanoseconds >> telemetry_bucket_shift;
+    if (!_value) {
+        return 0;
+    }
+    std::uint32_t _octave = 0;
+    while (_value >> (_octave + 1)) {
+        ++_octave;
+    }
+    const std::uint32_t _sub_bucket = static_cast<std::uint32_t>((_octave >= 2 ? _value >> (_octave - 2) : _value << (2 - _octave)) & 3);
+    const std::uint32_t _bucket = 1 + _octave * 4 + _sub_bucket;
+    return _bucket < telemetry_bucket_count ? _bucket : telemetry_bucket_count - 1;
+}
+
+// smallest value that lands in the bucket
+[[nodiscard]] constexpr std::uint64_t get_telemetry_bucket_floor(std::uint32_t bucket)
+{
+    if (!bucket) {
+        return 0;
+    }
+    const std::uint32_t _octave = (bucket - 1) / 4;
+    const std::uint64_t _sub_bucket = (bucket - 1) % 4;
+    return (((4 + _sub_bucket) << _octave) >> 2) << telemetry_bucket_shift;
+}
+
+struct telemetry_histogram {
+    std::atomic<std::uint64_t> buckets[telemetry_bucket_count];
+    std::atomic<std::uint64_t> count;
+    std::atomic<std::uint64_t> total; // nanoseconds
+    std::atomic<std::uint64_t> maximum; // nanoseconds
+
+    // single writer, plain loads and stores are enough and never lock
+    void record(std::uint64_t nanoseconds)
+    {
+        std::atomic<std::uint64_t>& _bucket = buckets[get_telemetry_bucket(nanoseconds)];
+        _bucket.store(_bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+        if (nanoseconds > maximum.load(std::memory_order_relaxed)) {
+            maximum.store(nanoseconds, std::memory_order_relaxed);
+        }
+    }
+};
+
+enum struct telemetry_state : std::uint32_t {
+    free,
+    claimed, // being reset by its new owner
+    active,
+};
+
+struct telemetry_instance {
+    std::atomic<telemetry_state> state;
+    std::atomic<std::uint32_t> generation; // bumped on every claim so that readers notice a reused record
+    char plugin_name[telemetry_name_capacity];
+    std::atomic<std::uint64_t> block_duration; // nanoseconds of a maximum size block, the real time budget
+    std::atomic<std::uint64_t> block_count;
+    std::atomic<std::uint64_t> missed_block_count; // blocks that got the watchdog fallback output
+    std::atomic<std::uint64_t> xrun_count; // blocks whose process call took longer than the audio it produced
+    std::atomic<std::uint64_t> silent_block_count; // silent blocks answered without waking the worker
+    std::atomic<std::uint32_t> is_late; // consistently misses its deadline
+    std::atomic<std::uint32_t> is_worker_lost;
+    std::atomic<std::uint32_t> realtime_refusals; // realtime_refused_* bits of the worker and of the proxy transport lock
+    std::atomic<std::uint32_t> is_hibernated;
+    std::atomic<std::uint64_t> hibernation_count;
+    std::atomic<std::uint64_t> recovery_count; // crashed workers replaced from the last state snapshot
+    telemetry_histogram process_time; // the whole process call of the proxy
+    telemetry_histogram round_trip_time; // from publishing a block until the proxy sees its results
+    telemetry_histogram wakeup_latency; // from publishing a block until the worker starts it
+    telemetry_histogram plugin_time; // the process call of the sandboxed plugin
+    telemetry_histogram restore_time; // from setActive until a hibernated plugin got its state back, written while inactive
+    telemetry_histogram recovery_time; // from noticing a crashed worker until its replacement processes again
+};
+
+struct telemetry_header {
+    std::uint32_t magic { telemetry_magic };
+    std::uint32_t version { telemetry_version };
+    std::uint64_t process_id { 0 };
+    std::uint32_t instance_count { telemetry_max_instances };
+    std::uint32_t instance_size { sizeof(telemetry_instance) };
+};
+
+constexpr std::size_t telemetry_instances_offset = (sizeof(telemetry_header) + 63) & ~std::size_t(63);
+constexpr std::size_t telemetry_file_size = telemetry_instances_offset + telemetry_max_instances * sizeof(telemetry_instance);
+
+[[nodiscard]] inline telemetry_instance* get_telemetry_instances(std::byte* file_data)
+{
+    return reinterpret_cast<telemetry_instance*>(file_data + telemetry_instances_offset);
+}
+
+[[nodiscard]] inline const telemetry_instance* get_telemetry_instances(const std::byte* file_data)
+{
+    return reinterpret_cast<const telemetry_instance*>(file_data + telemetry_instances_offset);
+}
+
+// differences of steady clock times taken in two processes may come out slightly negative
+[[nodiscard]] constexpr std::uint64_t clamp_telemetry_duration(std::int64_t nanoseconds)
+{
+    return nanoseconds > 0 ? static_cast<std::uint64_t>(nanoseconds) : 0;
+}
+
+[[nodiscard]] std::filesystem::path get_telemetry_file_path(const std::filesystem::path& directory, std::uint64_t process_id);
+
+// name of the shared memory segment that a stats file points to, empty when it is not a stats file
+[[nodiscard]] inline std::string read_telemetry_segment_name(const std::filesystem::path& path)
+{
+    std::ifstream _file(path);
+    std::string _name;
+    if (!std::getline(_file, _name) || _name.size() > 255) {
+        return {};
+    }
+    return _name;
+}
+
+struct telemetry_file;
+
+// the record of an instance in the stats file of the process, or a private one that nobody reads
+// when the file could not be created or is full
+struct telemetry_record {
+    telemetry_record();
+    telemetry_record(const telemetry_record&) = delete;
+    telemetry_record& operator=(const telemetry_record&) = delete;
+    ~telemetry_record();
+
+    // moves the record into the stats file and shows it under the plugin name
+    void publish(const std::filesystem::path& directory, const std::string& plugin_name);
+
+    [[nodiscard]] telemetry_instance* get() const { return _instance; }
+    [[nodiscard]] telemetry_instance* operator->() const { return _instance; }
+
+private:
+    telemetry_instance* _instance { nullptr };
+    std::unique_ptr<telemetry_instance> _private_instance;
+    std::shared_ptr<telemetry_file> _file; // keeps the mapping alive for records released during static destruction
+};
@@ -0,0 +1,192 @@
+#include <pluginterfaces/vst/ivstnoteexpression.h>
+
+#include <transport.hpp>
+
+std::uint32_t coalesce_parameter_points(std::int32_t* offsets, Steinberg::Vst::ParamValue* values, std::uint32_t count, double tolerance)
+{
+    if (!(tolerance > 0.) || count < 3) {
+        return count;
+    }
+
+    // a point can replace the ones since the last kept point when the slope to it stays within the
+    // slopes every one of them allows, otherwise the previous point is kept and starts a new ramp
+    std::uint32_t _kept_count = 1;
+    std::uint32_t _candidate = 0;
+    double _low_slope = -std::numeric_limits<double>::infinity();
+    double _high_slope = std::numeric_limits<double>::infinity();
+    for (std::uint32_t _index = 1; _index < count; ++_index) {
+        const std::uint32_t _anchor = _kept_count - 1;
+        const double _duration = static_cast<double>(offsets[_index]) - offsets[_anchor];
+        const double _slope = _duration > 0. ? (values[_index] - values[_anchor]) / _duration : 0.;
+        if (_candidate && _duration > 0. && _slope >= _low_slope && _slope <= _high_slope) {
+            _low_slope = std::max(_low_slope, (values[_index] - tolerance - values[_anchor]) / _duration);
+            _high_slope = std::min(_high_slope, (values[_index] + tolerance - values[_anchor]) / _duration);
+            _candidate = _index;
+            continue;
+        }
+        if (_candidate) {
+            offsets[_kept_count] = offsets[_candidate];
+            values[_kept_count] = values[_candidate];
+            ++_kept_count;
+        }
+        // points sharing an offset are steps, both sides of them are kept
+        const std::uint32_t _new_anchor = _kept_count - 1;
+        const double _new_duration = static_cast<double>(offsets[_index]) - offsets[_new_anchor];
+        if (_new_duration > 0.) {
+            _low_slope = (values[_index] - tolerance - values[_new_anchor]) / _new_duration;
+            _high_slope = (values[_index] + tolerance - values[_new_anchor]) / _new_duration;
+            _candidate = _index;
+        } else {
+            offsets[_kept_count] = offsets[_index];
+            values[_kept_count] = values[_index];
+            ++_kept_count;
+            _low_slope = -std::numeric_limits<double>::infinity();
+            _high_slope = std::numeric_limits<double>::infinity();
+            _candidate = 0;
+        }
+    }
+    if (_candidate) {
+        offsets[_kept_count] = offsets[_candidate];
+        values[_kept_count] = values[_candidate];
+        ++_kept_count;
+    }
+    return _kept_count;
+}
+
+void write_transport_parameters(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction, Steinberg::Vst::IParameterChanges* changes, bool should_append)
+{
+    transport_parameter_queue* _queues = get_transport_parameter_queues(header, slot, direction);
+    std::int32_t* _offsets = get_transport_parameter_offsets(header, slot, direction);
+    Steinberg::Vst::ParamValue* _values = get_transport_parameter_values(header, slot, direction);
+    std::uint32_t _queue_count = should_append ? slot->parameter_queue_counts[direction] : 0;
+    std::uint32_t _point_count = should_append ? slot->parameter_point_counts[direction] : 0;
+    const std::int32_t _source_count = changes ? changes->getParameterCount() : 0;
+    for (std::int32_t _queue_index = 0; _queue_index < _source_count && _point_count < sandbox_max_parameter_points; ++_queue_index) {
+        Steinberg::Vst::IParamValueQueue* _queue = changes->getParameterData(_queue_index);
+        if (!_queue) {
+            continue;
+        }
+        const std::int32_t _queue_point_count = _queue->getPointCount();
+        const std::uint32_t _first_point = _point_count;
+        for (std::int32_t _point_index = 0; _point_index < _queue_point_count && _point_count < sandbox_max_parameter_points; ++_point_index) {
+            if (_queue->getPoint(_point_index, _offsets[_point_count], _values[_point_count]) == Steinberg::kResultOk) {
+                ++_point_count;
+            }
+        }
+        if (_point_count == _first_point) {
+            continue;
+        }
+        _point_count = _first_point + coalesce_parameter_points(_offsets + _first_point, _values + _first_point, _point_count - _first_point, header->parameter_tolerance);
+        _queues[_queue_count].id = _queue->getParameterId();
+        _queues[_queue_count].point_count = _point_count - _first_point;
+        ++_queue_count;
+    }
+    slot->parameter_queue_counts[direction] = _queue_count;
+    slot->parameter_point_counts[direction] = _point_count;
+}
+
+[[nodiscard]] std::int32_t shift_sample_offset(std::int32_t sample_offset, std::int32_t offset_shift, std::int32_t max_offset)
+{
+    return std::clamp(sample_offset + offset_shift, 0, std::max(0, max_offset));
+}
+
+void read_transport_parameters(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction, Steinberg::Vst::IParameterChanges* changes, std::int32_t offset_shift, std::int32_t max_offset)
+{
+    if (!changes) {
+        return;
+    }
+    const transport_parameter_queue* _queues = get_transport_parameter_queues(header, slot, direction);
+    const std::int32_t* _offsets = get_transport_parameter_offsets(header, slot, direction);
+    const Steinberg::Vst::ParamValue* _values = get_transport_parameter_values(header, slot, direction);
+    // the counts come from the other process, a crashing plugin must not make us read past the slot
+    const std::uint32_t _queue_count = std::min(slot->parameter_queue_counts[direction], sandbox_max_parameter_points);
+    const std::uint32_t _point_count = std::min(slot->parameter_point_counts[direction], sandbox_max_parameter_points);
+    std::uint32_t _point_index = 0;
+    for (std::uint32_t _queue_index = 0; _queue_index < _queue_count; ++_queue_index) {
+        const transport_parameter_queue& _source = _queues[_queue_index];
+        Steinberg::int32 _index = 0;
+        Steinberg::Vst::IParamValueQueue* _queue = changes->addParameterData(_source.id, _index);
+        const std::uint32_t _end = _point_index + std::min(_source.point_count, _point_count - _point_index);
+        for (; _queue && _point_index < _end; ++_point_index) {
+            _queue->addPoint(shift_sample_offset(_offsets[_point_index], offset_shift, max_offset), _values[_point_index], _index);
+        }
+        _point_index = _end;
+    }
+}
+
+// events carrying a pointer get their payload copied after the event array, the pointer is
+// replaced by the offset of the payload while it lives in shared memory
+
+[[nodiscard]] const void** get_event_payload(Steinberg::Vst::Event& event, std::size_t& size)
+{
+    switch (event.type) {
+    case Steinberg::Vst::Event::kDataEvent:
+        size = event.data.size;
+        return reinterpret_cast<const void**>(&event.data.bytes);
+    case Steinberg::Vst::Event::kNoteExpressionTextEvent:
+        size = (event.noteExpressionText.textLen + 1) * sizeof(Steinberg::Vst::TChar);
+        return reinterpret_cast<const void**>(&event.noteExpressionText.text);
+    case Steinberg::Vst::Event::kChordEvent:
+        size = (event.chord.textLen + 1) * sizeof(Steinberg::Vst::TChar);
+        return reinterpret_cast<const void**>(&event.chord.text);
+    case Steinberg::Vst::Event::kScaleEvent:
+        size = (event.scale.textLen + 1) * sizeof(Steinberg::Vst::TChar);
+        return reinterpret_cast<const void**>(&event.scale.text);
+    default:
+        size = 0;
+        return nullptr;
+    }
+}
+
+void write_transport_events(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction, Steinberg::Vst::IEventList* events, bool should_append)
+{
+    Steinberg::Vst::Event* _events = get_transport_events(header, slot, direction);
+    std::byte* _event_data = get_transport_event_data(header, slot, direction);
+    std::uint32_t _event_count = should_append ? slot->event_counts[direction] : 0;
+    std::uint32_t _event_data_size = should_append ? slot->event_data_sizes[direction] : 0;
+    const std::int32_t _source_count = events ? events->getEventCount() : 0;
+    for (std::int32_t _source_index = 0; _source_index < _source_count && _event_count < sandbox_max_events; ++_source_index) {
+        Steinberg::Vst::Event& _event = _events[_event_count];
+        if (events->getEvent(_source_index, _event) != Steinberg::kResultOk) {
+            continue;
+        }
+        std::size_t _payload_size = 0;
+        if (const void** _payload = get_event_payload(_event, _payload_size)) {
+            if (!*_payload || _event_data_size + _payload_size > sandbox_max_event_data) {
+                continue;
+            }
+            std::memcpy(_event_data + _event_data_size, *_payload, _payload_size);
+            *_payload = reinterpret_cast<const void*>(static_cast<std::uintptr_t>(_event_data_size));
+            _event_data_size += static_cast<std::uint32_t>(align_transport_size(_payload_size));
+        }
+        ++_event_count;
+    }
+    slot->event_counts[direction] = _event_count;
+    slot->event_data_sizes[direction] = std::min(_event_data_size, sandbox_max_event_data);
+}
+
+void read_transport_events(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction, Steinberg::Vst::IEventList* events, std::int32_t offset_shift, std::int32_t max_offset)
+{
+    if (!events) {
+        return;
+    }
+    const Steinberg::Vst::Event* _events = get_transport_events(header, slot, direction);
+    std::byte* _event_data = get_transport_event_data(header, slot, direction);
+    // the counts and payload offsets come from the other process, events that point past the
+    // payloads it wrote are dropped
+    const std::uint32_t _event_count = std::min(slot->event_counts[direction], sandbox_max_events);
+    const std::size_t _event_data_size = std::min(slot->event_data_sizes[direction], sandbox_max_event_data);
+    for (std::uint32_t _event_index = 0; _event_index < _event_count; ++_event_index) {
+        Steinberg::Vst::Event _event = _events[_event_index];
+        std::size_t _payload_size = 0;
+        if (const void** _payload = get_event_payload(_event, _payload_size)) {
+            const std::uintptr_t _payload_offset = reinterpret_cast<std::uintptr_t>(*_payload);
+            if (_payload_offset > _event_data_size || _payload_size > _event_data_size - _payload_offset) {
+                continue;
+            }
+            *_payload = _event_data + _payload_offset;
+        }
+        _event.sampleOffset = shift_sample_offset(_event.sampleOffset, offset_shift, max_offset);
+        events->addEvent(_event);
+    }
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <pluginterfaces/vst/ivstaudioprocessor.h>
+#include <pluginterfaces/vst/ivsteditcontroller.h>
+#include <pluginterfaces/vst/ivstevents.h>
+#include <pluginterfaces/vst/ivstparameterchanges.h>
+#include <pluginterfaces/vst/ivstprocesscontext.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+constexpr std::uint32_t sandbox_protocol_magic = 0x78627376; // "vsbx"
+constexpr std::uint32_t sandbox_protocol_version = 11;
+constexpr std::size_t sandbox_control_payload_capacity = 1 << 20;
+constexpr std::size_t sandbox_transport_alignment = 64;
+constexpr std::size_t sandbox_ipc_name_capacity = 64;
+constexpr std::uint32_t sandbox_max_parameter_points = 4096; // per block and direction
+constexpr std::uint32_t sandbox_max_events = 1024; // per block and direction
+constexpr std::uint32_t sandbox_max_event_data = 64 * 1024; // sysex and text bytes per block and direction
+constexpr std::int32_t sandbox_max_buses = 256; // audio buses per direction
+
+// commands sent from the proxy to the worker process through the control block
+
+enum struct worker_command : std::uint32_t {
+    none,
+    load_plugin, // payload is one record per plugin of the chain, the 16 bytes class uid, the uint32 size of the utf8 module path then the path
+    setup_processing, // payload is a transport_setup
+    set_active, // payload is an int32 state
+    set_processing, // payload is an int32 state
+    can_process_sample_size, // payload is an int32 symbolic sample size
+    release_state, // closes the state captured by the last get_state command
+    processor_set_state, // payload is the state_transfer of the state to apply
+    processor_get_state, // captures the state, the response payload is its state_transfer
+    controller_set_state,
+    controller_get_state,
+    controller_set_component_state,
+    shutdown, // unloads the plugin of a session, or exits the process when sent to the group control block
+    open_session, // group control block only, payload is the name of the control block of the new session
+    get_latency_samples, // response payload is the uint32 latency of the sandboxed processor
+    get_tail_samples, // response payload is the uint32 tail of the sandboxed processor
+    get_buses, // response payload is the scanned_bus array of the sandboxed component
+    set_bus_arrangements, // payload is a bus_arrangements, the response payload is the bus_arrangements the processor kept
+    activate_bus, // payload is a bus_activation
+    get_parameters, // payload is the int32 index of the first parameter, the response payload is a parameter_page
+    get_param_string_by_value, // payload and response payload are a parameter_conversion
+    get_param_value_by_string,
+    normalized_param_to_plain,
+    plain_param_to_normalized,
+    load_module, // payload is the same as load_plugin, the session keeps the modules loaded without creating any plugin
+};
+
+struct control_block {
+    std::uint32_t magic { sandbox_protocol_magic };
+    std::uint32_t version { sandbox_protocol_version };
+    alignas(sandbox_transport_alignment) std::atomic<std::uint32_t> command_sequence { 0 }; // written by the proxy
+    alignas(sandbox_transport_alignment) std::atomic<std::uint32_t> response_sequence { 0 }; // written by the worker
+    alignas(sandbox_transport_alignment) worker_command command { worker_command::none };
+    Steinberg::tresult result { Steinberg::kResultOk };
+    std::uint64_t payload_size { 0 };
+    alignas(sandbox_transport_alignment) std::atomic<std::uint32_t> parameter_generation { 0 }; // bumped by the worker when the plugin reports changed parameter values or titles
+    alignas(sandbox_transport_alignment) std::byte payload[sandbox_control_payload_capacity];
+};
+
+// one per worker process whatever the number of instances it hosts. Proxies ring the command
+// doorbell after writing to any control block and the block doorbell after publishing any block,
+// so the worker waits on two words and wakes once for all the blocks published meanwhile
+
+struct worker_group_block {
+    std::uint32_t magic { sandbox_protocol_magic };
+    std::uint32_t version { sandbox_protocol_version };
+    alignas(sandbox_transport_alignment) std::atomic<std::uint32_t> command_doorbell { 0 };
+    alignas(sandbox_transport_alignment) std::atomic<std::uint32_t> block_doorbell { 0 };
+    alignas(sandbox_transport_alignment) std::atomic<std::uint32_t> is_dispatcher_sleeping { 0 }; // the block doorbell only wakes the worker when set
+    std::atomic<std::uint32_t> realtime_refusals { 0 }; // realtime_refused_* bits the worker sets
+    control_block control; // opens sessions and shuts the process down
+};
+
+struct transport_setup {
+    char transport_name[sandbox_ipc_name_capacity];
+    Steinberg::Vst::ProcessSetup process_setup;
+    std::uint32_t slot_count;
+    std::uint32_t input_channels;
+    std::uint32_t output_channels;
+    std::uint64_t transport_size;
+};
+
+struct bus_arrangements {
+    std::int32_t input_count;
+    std::int32_t output_count;
+    Steinberg::Vst::SpeakerArrangement arrangements[2 * sandbox_max_buses]; // inputs then outputs
+};
+
+struct bus_activation {
+    Steinberg::Vst::MediaType type;
+    Steinberg::Vst::BusDirection direction;
+    std::int32_t index;
+    std::int32_t state;
+};
+
+// parameter infos come in pages as large as the control payload allows
+struct parameter_page {
+    std::int32_t parameter_count; // of the whole controller
+    std::int32_t info_count; // in this page
+    Steinberg::Vst::ParameterInfo infos[(sandbox_control_payload_capacity - 2 * sizeof(std::int32_t)) / sizeof(Steinberg::Vst::ParameterInfo)];
+};
+
+// value holds the normalized or plain value and text the string of the conversion, the answer
+// fills the other one
+struct parameter_conversion {
+    Steinberg::Vst::ParamID id;
+    Steinberg::Vst::ParamValue value;
+    Steinberg::Vst::String128 text;
+};
+
+// states go through shared memory segments, see state_stream
+constexpr std::size_t state_segment_min_size = 1 << 20;
+constexpr std::size_t state_segment_max_size = 64 << 20;
+constexpr std::size_t state_max_segments = 256;
+
+struct state_transfer {
+    char name[sandbox_ipc_name_capacity];
+    std::uint64_t size;
+};
+
+// the transport is a single producer single consumer ring of block slots in shared memory. It
+// follows the Steinberg::OneReaderOneWriter::RingBuffer scheme with free running positions instead
+// of an element count so that the proxy also knows which blocks the worker has completed
+
+struct transport_header {
+    std::uint32_t magic { sandbox_protocol_magic };
+    std::uint32_t version { sandbox_protocol_version };
+    std::uint32_t slot_count { 0 };
+    std::uint32_t max_samples { 0 };
+    std::uint32_t input_channels { 0 };
+    std::uint32_t output_channels { 0 };
+    std::int32_t symbolic_sample_size { Steinberg::Vst::kSample32 };
+    std::uint64_t parameters_offset { 0 }; // from the start of a slot
+    std::uint64_t events_offset { 0 };
+    std::uint64_t event_data_offset { 0 };
+    std::uint64_t channels_offset { 0 };
+    std::uint64_t channel_stride { 0 };
+    std::uint64_t slot_stride { 0 };
+    double parameter_tolerance { 0. }; // both writers coalesce ramps within it, 0 keeps every point
+    alignas(sandbox_transport_alignment) std::atomic<std::uint32_t> write_position { 0 }; // blocks published by the proxy
+    alignas(sandbox_transport_alignment) std::atomic<std::uint32_t> read_position { 0 }; // blocks completed by the worker
+};
+
+// parameter changes go as one record per queue followed in two other arrays by the sample offsets
+// and the values of the points of every queue in the same order, so that an automation point costs
+// 12 bytes and its id is written once per queue
+struct transport_parameter_queue {
+    Steinberg::Vst::ParamID id;
+    std::uint32_t point_count;
+};
+
+constexpr std::size_t transport_parameter_queues_size = sandbox_max_parameter_points * sizeof(transport_parameter_queue);
+constexpr std::size_t transport_parameter_offsets_size = sandbox_max_parameter_points * sizeof(std::int32_t);
+constexpr std::size_t transport_parameter_values_size = sandbox_max_parameter_points * sizeof(Steinberg::Vst::ParamValue);
+
+// every array below is indexed by Steinberg::Vst::BusDirection, inputs go from the proxy to the
+// worker and outputs come back from the worker to the proxy
+struct transport_slot {
+    std::int32_t num_samples { 0 };
+    Steinberg::tresult result { Steinberg::kResultOk };
+    std::uint64_t input_silence_flags { 0 }; // one bit per transport channel
+    std::uint64_t output_silence_flags { 0 }; // one bit per transport channel
+    std::uint32_t has_process_context { 0 };
+    Steinberg::Vst::ProcessContext process_context {};
+    std::uint32_t parameter_queue_counts[2] { 0, 0 };
+    std::uint32_t parameter_point_counts[2] { 0, 0 };
+    std::uint32_t event_counts[2] { 0, 0 };
+    std::uint32_t event_data_sizes[2] { 0, 0 };
+    std::int64_t publish_time { 0 }; // written by the proxy
+    std::int64_t start_time { 0 }; // written by the worker when it picks the block up
+    std::int64_t end_time { 0 }; // written by the worker once the plugin processed the block
+};
+
+// steady clock nanoseconds. The clock counts from boot on every platform we support, so the times
+// of the proxy and of the worker can be compared
+[[nodiscard]] inline std::int64_t get_transport_time(std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now())
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+[[nodiscard]] constexpr std::size_t align_transport_size(std::size_t size)
+{
+    return (size + sandbox_transport_alignment - 1) & ~(sandbox_transport_alignment - 1);
+}
+
+[[nodiscard]] constexpr std::size_t get_sample_bytes(std::int32_t symbolic_sample_size)
+{
+    return symbolic_sample_size == Steinberg::Vst::kSample64 ? sizeof(Steinberg::Vst::Sample64) : sizeof(Steinberg::Vst::Sample32);
+}
+
+// queues, offsets then values for one direction
+[[nodiscard]] constexpr std::size_t get_transport_parameters_size()
+{
+    return align_transport_size(transport_parameter_queues_size) + align_transport_size(transport_parameter_offsets_size) + align_transport_size(transport_parameter_values_size);
+}
+
+inline void initialize_transport_header(transport_header& header, std::uint32_t slot_count, std::uint32_t max_samples, std::uint32_t input_channels, std::uint32_t output_channels, std::int32_t symbolic_sample_size)
+{
+    header.slot_count = slot_count;
+    header.max_samples = max_samples;
+    header.input_channels = input_channels;
+    header.output_channels = output_channels;
+    header.symbolic_sample_size = symbolic_sample_size;
+    header.parameters_offset = align_transport_size(sizeof(transport_slot));
+    header.events_offset = header.parameters_offset + 2 * get_transport_parameters_size();
+    header.event_data_offset = header.events_offset + align_transport_size(2 * sandbox_max_events * sizeof(Steinberg::Vst::Event));
+    header.channels_offset = header.event_data_offset + align_transport_size(2 * sandbox_max_event_data);
+    header.channel_stride = align_transport_size(max_samples * get_sample_bytes(symbolic_sample_size));
+    header.slot_stride = header.channels_offset + (input_channels + output_channels) * header.channel_stride;
+}
+
+[[nodiscard]] inline std::size_t get_transport_size(const transport_header& header)
+{
+    return align_transport_size(sizeof(transport_header)) + header.slot_count * header.slot_stride;
+}
+
+[[nodiscard]] inline transport_slot* get_transport_slot(transport_header* header, std::uint32_t position)
+{
+    std::byte* _slots = reinterpret_cast<std::byte*>(header) + align_transport_size(sizeof(transport_header));
+    return reinterpret_cast<transport_slot*>(_slots + (position % header->slot_count) * header->slot_stride);
+}
+
+[[nodiscard]] inline void* get_transport_channel(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction, std::uint32_t channel)
+{
+    std::byte* _channels = reinterpret_cast<std::byte*>(slot) + header->channels_offset;
+    if (direction == Steinberg::Vst::kOutput) {
+        channel += header->input_channels;
+    }
+    return _channels + channel * header->channel_stride;
+}
+
+[[nodiscard]] inline std::byte* get_transport_parameters(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction)
+{
+    return reinterpret_cast<std::byte*>(slot) + header->parameters_offset + direction * get_transport_parameters_size();
+}
+
+[[nodiscard]] inline transport_parameter_queue* get_transport_parameter_queues(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction)
+{
+    return reinterpret_cast<transport_parameter_queue*>(get_transport_parameters(header, slot, direction));
+}
+
+[[nodiscard]] inline std::int32_t* get_transport_parameter_offsets(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction)
+{
+    return reinterpret_cast<std::int32_t*>(get_transport_parameters(header, slot, direction) + align_transport_size(transport_parameter_queues_size));
+}
+
+[[nodiscard]] inline Steinberg::Vst::ParamValue* get_transport_parameter_values(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction)
+{
+    return reinterpret_cast<Steinberg::Vst::ParamValue*>(get_transport_parameters(header, slot, direction) + align_transport_size(transport_parameter_queues_size) + align_transport_size(transport_parameter_offsets_size));
+}
+
+[[nodiscard]] inline Steinberg::Vst::Event* get_transport_events(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction)
+{
+    return reinterpret_cast<Steinberg::Vst::Event*>(reinterpret_cast<std::byte*>(slot) + header->events_offset) + direction * sandbox_max_events;
+}
+
+[[nodiscard]] inline std::byte* get_transport_event_data(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction)
+{
+    return reinterpret_cast<std::byte*>(slot) + header->event_data_offset + direction * sandbox_max_event_data;
+}
+
+// drops the points of a queue that lie within tolerance of the straight line between the points
+// kept around them, which is how plugins interpolate automation. It keeps the first and last point,
+// runs once over the points and returns how many are left at the front of the arrays
+[[nodiscard]] std::uint32_t coalesce_parameter_points(std::int32_t* offsets, Steinberg::Vst::ParamValue* values, std::uint32_t count, double tolerance);
+
+// both sides call these from their audio thread, they never allocate and drop what does not fit.
+// Readers can move the sample offsets by a shift and clamp them to the block they deliver to, and
+// writers can append to what the slot already holds when they fill it in several passes
+
+constexpr std::int32_t transport_unclamped_offset = std::numeric_limits<std::int32_t>::max();
+
+void write_transport_parameters(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction, Steinberg::Vst::IParameterChanges* changes, bool should_append = false);
+void read_transport_parameters(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction, Steinberg::Vst::IParameterChanges* changes, std::int32_t offset_shift = 0, std::int32_t max_offset = transport_unclamped_offset);
+void write_transport_events(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction, Steinberg::Vst::IEventList* events, bool should_append = false);
+void read_transport_events(const transport_header* header, transport_slot* slot, Steinberg::Vst::BusDirection direction, Steinberg::Vst::IEventList* events, std::int32_t offset_shift = 0, std::int32_t max_offset = transport_unclamped_offset);
+
+inline void copy_ipc_name(char (&destination)[sandbox_ipc_name_capacity], const std::string& name)
+{
+    std::memset(destination, 0, sandbox_ipc_name_capacity);
+    std::memcpy(destination, name.data(), std::min(name.size(), sandbox_ipc_name_capacity - 1));
+}
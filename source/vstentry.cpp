@@ -7,6 +7,7 @@
 #include <rapidjson/writer.h>
 
 
+#include <algorithm>
 #include <array>
 #include <filesystem>
 #include <fstream>
@@ -15,6 +16,7 @@
 #include <random>
 #include <sstream>
 #include <stdexcept>
+#include <unordered_set>
 
 #include <sandbox.hpp>
 
@@ -22,14 +24,32 @@
 #define sandbox_url "github.com/adriensalon/vstsandbox"
 #define sandbox_email "adrien.salon@live.fr"
 #define vstsandbox_json_file "vstsandbox.json"
+#define vstsandbox_cache_file "vstsandbox.cache"
 
 #define VST_MAX_PATH 2048
+#if SMTG_OS_LINUX
+#include <dlfcn.h>
+Steinberg::tchar gPath[VST_MAX_PATH] = { 0 }; // linuxmain.cpp does not provide it
+#else
 extern Steinberg::tchar gPath[VST_MAX_PATH];
+#endif
 
 extern Steinberg::FUnknown* create_sandbox_processor_instance(void* context);
 extern Steinberg::FUnknown* create_sandbox_controller_instance(void* context);
 
 static std::vector<std::shared_ptr<sandboxed_plugin_data>> global_sandboxed_plugins;
+static sandbox_config global_sandbox_config;
+
+#if SMTG_OS_LINUX
+[[nodiscard]] std::filesystem::path get_proxy_module_path()
+{
+    Dl_info _info;
+    if (!dladdr(reinterpret_cast<void*>(&get_proxy_module_path), &_info) || !_info.dli_fname) {
+        return {};
+    }
+    return std::filesystem::absolute(_info.dli_fname);
+}
+#endif
 
 [[nodiscard]] std::filesystem::path get_proxy_working_directory()
 {
@@ -39,6 +59,22 @@ static std::vector<std::shared_ptr<sandboxed_plugin_data>> global_sandboxed_plug
     return std::filesystem::path(gPath).parent_path();
 }
 
+std::filesystem::path get_proxy_binary_directory()
+{
+#if SMTG_OS_WINDOWS
+    return std::filesystem::path(gPath).parent_path();
+#elif SMTG_OS_MACOS
+    return std::filesystem::path(gPath) / "Contents" / "MacOS";
+#else
+    return get_proxy_module_path().parent_path();
+#endif
+}
+
+const sandbox_config& get_sandbox_config()
+{
+    return global_sandbox_config;
+}
+
 [[nodiscard]] std::string hash_to_uid_string(const std::string& input)
 {
     std::hash<std::string> hasher;
@@ -68,9 +104,174 @@ static std::vector<std::shared_ptr<sandboxed_plugin_data>> global_sandboxed_plug
     return proxy;
 }
 
-[[nodiscard]] std::vector<std::filesystem::path> load_json_plugin_paths(const std::filesystem::path& json_path)
+void load_json_worker_settings(const rapidjson::Value& worker, sandbox_config& config)
+{
+    if (worker.HasMember("wait_mode") && worker["wait_mode"].IsString()) {
+        const std::string _wait_mode = worker["wait_mode"].GetString();
+        if (_wait_mode == "spin") {
+            config.wait_settings.mode = ipc_wait_mode::spin;
+        } else if (_wait_mode == "sleep") {
+            config.wait_settings.mode = ipc_wait_mode::sleep;
+        } else {
+            std::cerr << "Champ 'worker.wait_mode' invalide : " << _wait_mode << std::endl;
+        }
+    }
+    if (worker.HasMember("spin_microseconds") && worker["spin_microseconds"].IsUint()) {
+        config.wait_settings.spin_duration = std::chrono::microseconds(worker["spin_microseconds"].GetUint());
+    }
+    if (worker.HasMember("grouping") && worker["grouping"].IsString()) {
+        const std::string _grouping = worker["grouping"].GetString();
+        if (_grouping == "instance") {
+            config.worker_groups.grouping = worker_grouping::instance;
+        } else if (_grouping == "plugin") {
+            config.worker_groups.grouping = worker_grouping::plugin;
+        } else if (_grouping == "vendor") {
+            config.worker_groups.grouping = worker_grouping::vendor;
+        } else if (_grouping == "fixed") {
+            config.worker_groups.grouping = worker_grouping::fixed;
+        } else {
+            std::cerr << "Champ 'worker.grouping' invalide : " << _grouping << std::endl;
+        }
+    }
+    if (worker.HasMember("processes") && worker["processes"].IsUint()) {
+        config.worker_groups.process_count = std::max(1u, worker["processes"].GetUint());
+    }
+    if (worker.HasMember("threads") && worker["threads"].IsUint()) {
+        config.worker_groups.thread_count = worker["threads"].GetUint();
+    }
+    if (worker.HasMember("scheduling") && worker["scheduling"].IsString()) {
+        const std::string _scheduling = worker["scheduling"].GetString();
+        if (_scheduling == "normal") {
+            config.realtime.policy = realtime_policy::none;
+        } else if (_scheduling == "fifo") {
+            config.realtime.policy = realtime_policy::fifo;
+        } else if (_scheduling == "rr") {
+            config.realtime.policy = realtime_policy::round_robin;
+        } else {
+            std::cerr << "Champ 'worker.scheduling' invalide : " << _scheduling << std::endl;
+        }
+    }
+    if (worker.HasMember("priority") && worker["priority"].IsUint()) {
+        config.realtime.priority = static_cast<std::int32_t>(std::clamp(worker["priority"].GetUint(), 1u, 99u));
+    }
+    // a list of cpus pins every worker to all of them, a list of lists gives each worker its own
+    if (worker.HasMember("cpus") && worker["cpus"].IsArray()) {
+        std::vector<std::uint32_t> _shared_cpus;
+        for (const rapidjson::Value& _entry : worker["cpus"].GetArray()) {
+            if (_entry.IsUint()) {
+                _shared_cpus.push_back(_entry.GetUint());
+            } else if (_entry.IsArray()) {
+                std::vector<std::uint32_t>& _cpus = config.realtime.cpu_sets.emplace_back();
+                for (const rapidjson::Value& _cpu : _entry.GetArray()) {
+                    if (_cpu.IsUint()) {
+                        _cpus.push_back(_cpu.GetUint());
+                    }
+                }
+            } else {
+                std::cerr << "Champ 'worker.cpus' invalide" << std::endl;
+            }
+        }
+        if (!_shared_cpus.empty()) {
+            config.realtime.cpu_sets.push_back(std::move(_shared_cpus));
+        }
+    }
+    if (worker.HasMember("lock_memory") && worker["lock_memory"].IsBool()) {
+        config.realtime.should_lock_memory = worker["lock_memory"].GetBool();
+    }
+    if (worker.HasMember("pipelined") && worker["pipelined"].IsBool()) {
+        config.is_pipelined = worker["pipelined"].GetBool();
+    }
+    if (worker.HasMember("offline_blocks") && worker["offline_blocks"].IsUint()) {
+        config.offline_depth = std::min(worker["offline_blocks"].GetUint(), sandbox_max_offline_blocks);
+    }
+    if (worker.HasMember("block_size") && worker["block_size"].IsUint()) {
+        config.fixed_block_size = worker["block_size"].GetUint();
+    }
+    if (worker.HasMember("silence_bypass") && worker["silence_bypass"].IsBool()) {
+        config.should_bypass_silence = worker["silence_bypass"].GetBool();
+    }
+    if (worker.HasMember("automation_tolerance") && worker["automation_tolerance"].IsNumber()) {
+        config.automation_tolerance = std::max(0., worker["automation_tolerance"].GetDouble());
+    }
+    if (worker.HasMember("deadline") && worker["deadline"].IsNumber()) {
+        config.watchdog.deadline = std::max(0., worker["deadline"].GetDouble());
+    }
+    if (worker.HasMember("fallback") && worker["fallback"].IsString()) {
+        const std::string _fallback = worker["fallback"].GetString();
+        if (_fallback == "silence") {
+            config.watchdog.fallback = watchdog_fallback::silence;
+        } else if (_fallback == "passthrough") {
+            config.watchdog.fallback = watchdog_fallback::passthrough;
+        } else if (_fallback == "repeat") {
+            config.watchdog.fallback = watchdog_fallback::repeat;
+        } else {
+            std::cerr << "Champ 'worker.fallback' invalide : " << _fallback << std::endl;
+        }
+    }
+    if (worker.HasMember("late_ratio") && worker["late_ratio"].IsNumber()) {
+        config.watchdog.late_ratio = worker["late_ratio"].GetDouble();
+    }
+    if (worker.HasMember("lazy_load") && worker["lazy_load"].IsBool()) {
+        config.is_lazy_loaded = worker["lazy_load"].GetBool();
+    }
+    if (worker.HasMember("hibernate_seconds") && worker["hibernate_seconds"].IsUint()) {
+        config.hibernation_delay = std::chrono::seconds(worker["hibernate_seconds"].GetUint());
+    }
+    if (worker.HasMember("recovery") && worker["recovery"].IsBool()) {
+        config.should_recover = worker["recovery"].GetBool();
+    }
+    if (worker.HasMember("snapshot_milliseconds") && worker["snapshot_milliseconds"].IsUint()) {
+        config.snapshot_interval = std::chrono::milliseconds(std::max(10u, worker["snapshot_milliseconds"].GetUint()));
+    }
+    if (worker.HasMember("standby") && worker["standby"].IsBool()) {
+        config.has_standby = worker["standby"].GetBool();
+    }
+}
+
+void load_json_scan_settings(const rapidjson::Value& scan, sandbox_config& config)
+{
+    if (scan.HasMember("timeout_seconds") && scan["timeout_seconds"].IsNumber()) {
+        config.scan.timeout = std::chrono::milliseconds(static_cast<std::int64_t>(scan["timeout_seconds"].GetDouble() * 1000.));
+    }
+    if (scan.HasMember("processes") && scan["processes"].IsUint()) {
+        config.scan.process_count = scan["processes"].GetUint();
+    }
+}
+
+void load_json_instance_pool(const rapidjson::Value& instance_pool, sandbox_config& config)
+{
+    for (const auto& member : instance_pool.GetObject()) {
+        if (member.value.IsUint()) {
+            config.instance_pool_sizes[member.name.GetString()] = member.value.GetUint();
+        } else {
+            std::cerr << "Champ 'instance_pool." << member.name.GetString() << "' invalide." << std::endl;
+        }
+    }
+}
+
+void load_json_chains(const rapidjson::Value& chains, sandbox_config& config)
+{
+    for (const auto& member : chains.GetObject()) {
+        chain_settings _chain;
+        _chain.name = member.name.GetString();
+        if (member.value.IsArray()) {
+            for (const auto& _plugin : member.value.GetArray()) {
+                if (_plugin.IsString()) {
+                    _chain.plugins.emplace_back(_plugin.GetString());
+                }
+            }
+        }
+        if (!member.value.IsArray() || _chain.plugins.empty() || _chain.plugins.size() != member.value.Size()) {
+            std::cerr << "Champ 'chains." << _chain.name << "' invalide." << std::endl;
+            continue;
+        }
+        config.chains.push_back(std::move(_chain));
+    }
+}
+
+[[nodiscard]] sandbox_config load_json_config(const std::filesystem::path& json_path)
 {
-    std::vector<std::filesystem::path> result;
+    sandbox_config result;
     rapidjson::Document doc;
 
     if (!std::filesystem::exists(json_path)) {
@@ -80,6 +281,38 @@ static std::vector<std::shared_ptr<sandboxed_plugin_data>> global_sandboxed_plug
         doc.AddMember("vst2_paths", rapidjson::Value(rapidjson::kArrayType), allocator);
         doc.AddMember("vst3_paths", rapidjson::Value(rapidjson::kArrayType), allocator);
 
+        rapidjson::Value worker(rapidjson::kObjectType);
+        worker.AddMember("wait_mode", "sleep", allocator);
+        worker.AddMember("spin_microseconds", 50, allocator);
+        worker.AddMember("grouping", "instance", allocator);
+        worker.AddMember("processes", 4, allocator);
+        worker.AddMember("threads", 0, allocator);
+        worker.AddMember("scheduling", "normal", allocator);
+        worker.AddMember("priority", 70, allocator);
+        worker.AddMember("cpus", rapidjson::Value(rapidjson::kArrayType), allocator);
+        worker.AddMember("lock_memory", false, allocator);
+        worker.AddMember("pipelined", false, allocator);
+        worker.AddMember("offline_blocks", 8, allocator);
+        worker.AddMember("block_size", 0, allocator);
+        worker.AddMember("silence_bypass", true, allocator);
+        worker.AddMember("automation_tolerance", 0., allocator);
+        worker.AddMember("deadline", 1., allocator);
+        worker.AddMember("fallback", "silence", allocator);
+        worker.AddMember("late_ratio", 0.05, allocator);
+        worker.AddMember("lazy_load", true, allocator);
+        worker.AddMember("hibernate_seconds", 0, allocator);
+        worker.AddMember("recovery", false, allocator);
+        worker.AddMember("snapshot_milliseconds", 1000, allocator);
+        worker.AddMember("standby", false, allocator);
+        doc.AddMember("worker", worker, allocator);
+
+        rapidjson::Value scan(rapidjson::kObjectType);
+        scan.AddMember("timeout_seconds", 30, allocator);
+        scan.AddMember("processes", 0, allocator);
+        doc.AddMember("scan", scan, allocator);
+        doc.AddMember("instance_pool", rapidjson::Value(rapidjson::kObjectType), allocator);
+        doc.AddMember("chains", rapidjson::Value(rapidjson::kObjectType), allocator);
+
         std::ofstream out(json_path);
         if (out) {
             rapidjson::StringBuffer buffer;
@@ -118,76 +351,163 @@ static std::vector<std::shared_ptr<sandboxed_plugin_data>> global_sandboxed_plug
 
     for (const auto& val : doc["vst3_paths"].GetArray()) {
         if (val.IsString()) {
-            result.emplace_back(std::filesystem::path(val.GetString()));
+            result.vst3_paths.emplace_back(std::filesystem::u8path(val.GetString()));
         }
     }
 
+    if (doc.HasMember("worker") && doc["worker"].IsObject()) {
+        load_json_worker_settings(doc["worker"], result);
+    }
+    if (doc.HasMember("scan") && doc["scan"].IsObject()) {
+        load_json_scan_settings(doc["scan"], result);
+    }
+    if (doc.HasMember("instance_pool") && doc["instance_pool"].IsObject()) {
+        load_json_instance_pool(doc["instance_pool"], result);
+    }
+    if (doc.HasMember("chains") && doc["chains"].IsObject()) {
+        load_json_chains(doc["chains"], result);
+    }
+
     return result;
 }
 
-[[nodiscard]] void load_sandboxed_plugins(const std::filesystem::path& plugin_path)
+void load_sandboxed_plugins(const scanned_module& module)
 {
-    std::string _module_error;
-    VST3::Hosting::Module::Ptr _module = VST3::Hosting::Module::create(plugin_path.string(), _module_error);
-    if (!_module) {
-        std::string _error_text = "Sandbox error: could not create Module with error " + _module_error;
-        std::cerr << _error_text << std::endl;
-        throw std::runtime_error(_error_text);
-    }
-
-    VST3::Hosting::PluginFactory _factory = _module->getFactory();
-    for (VST3::Hosting::ClassInfo& _class_info : _factory.classInfos()) {
-
-        if (_class_info.category() == kVstAudioEffectClass) {            
-            Steinberg::Vst::PlugProvider* _plugin_provider = new Steinberg::Vst::PlugProvider(_factory, _class_info, true);
-            Steinberg::Vst::IComponent* _instance_processor = _plugin_provider->getComponent();
-            Steinberg::Vst::IEditController* _instance_controller = _plugin_provider->getController();
-
-            if (!_instance_processor) {
-                // throw
+    for (const scanned_class& _scanned_class : module.classes) {
+        std::shared_ptr<sandboxed_plugin_data> _original_plugin = global_sandboxed_plugins.emplace_back(std::make_shared<sandboxed_plugin_data>());
+
+        _original_plugin->class_info = _scanned_class.class_info;
+
+        _original_plugin->original_processor_uid = Steinberg::FUID::fromTUID(_scanned_class.class_info.ID().data());
+        _original_plugin->original_controller_uid = _scanned_class.controller_uid;
+
+        static std::size_t _salt_id = 0;
+        _original_plugin->proxy_processor_uid = derive_proxy_uid(_original_plugin->original_processor_uid, "p1" + std::to_string(_salt_id));
+        _original_plugin->proxy_controller_uid = derive_proxy_uid(_original_plugin->original_controller_uid, "p2" + std::to_string(_salt_id));
+        _salt_id++;
+
+        _original_plugin->plugin_path = module.path;
+        _original_plugin->plugin_name = _scanned_class.class_info.name();
+        _original_plugin->plugin_version = _scanned_class.class_info.version();
+        _original_plugin->original_parameters = _scanned_class.parameters;
+        _original_plugin->original_buses = _scanned_class.buses;
+        _original_plugin->stages = { { module.path, _original_plugin->original_processor_uid } };
+
+        char _processor_uid[33] = {};
+        _original_plugin->original_processor_uid.toString(_processor_uid);
+        for (const std::string& _key : { _original_plugin->plugin_name, std::string(_processor_uid) }) {
+            const auto _pool_size = global_sandbox_config.instance_pool_sizes.find(_key);
+            if (_pool_size != global_sandbox_config.instance_pool_sizes.end()) {
+                _original_plugin->pool_size = _pool_size->second;
             }
+        }
+    }
+}
 
-            if (!_instance_controller) {
-                continue;
-            }
+// chains can not contain other chains
+[[nodiscard]] const sandboxed_plugin_data* find_sandboxed_plugin(const std::string& key)
+{
+    for (const std::shared_ptr<sandboxed_plugin_data>& _plugin : global_sandboxed_plugins) {
+        char _processor_uid[33] = {};
+        _plugin->original_processor_uid.toString(_processor_uid);
+        if (_plugin->stages.size() == 1 && (_plugin->plugin_name == key || key == _processor_uid)) {
+            return _plugin.get();
+        }
+    }
+    return nullptr;
+}
 
-            Steinberg::TUID _original_controller_tuid;
-            if (_instance_processor->getControllerClassId(_original_controller_tuid) != Steinberg::kResultOk) {
-                // normalement ca passe
+void load_sandboxed_chains(const std::vector<chain_settings>& chains)
+{
+    for (const chain_settings& _chain : chains) {
+        std::vector<const sandboxed_plugin_data*> _plugins;
+        for (const std::string& _key : _chain.plugins) {
+            const sandboxed_plugin_data* _plugin = find_sandboxed_plugin(_key);
+            if (!_plugin) {
+                std::cerr << "Sandbox error: chain " << _chain.name << " has no plugin " << _key << ", skipping it" << std::endl;
+                _plugins.clear();
+                break;
             }
+            _plugins.push_back(_plugin);
+        }
+        if (_plugins.empty()) {
+            continue;
+        }
 
-            std::shared_ptr<sandboxed_plugin_data> _original_plugin = global_sandboxed_plugins.emplace_back(std::make_shared<sandboxed_plugin_data>());
-
-            _original_plugin->class_info = _class_info;
-
-            _original_plugin->original_processor_uid = Steinberg::FUID::fromTUID(_class_info.ID().data());
-            _original_plugin->original_controller_uid = Steinberg::FUID::fromTUID(_original_controller_tuid);
-
-            static std::size_t _salt_id = 0;
-            _original_plugin->proxy_processor_uid = derive_proxy_uid(_original_plugin->original_processor_uid, "p1" + std::to_string(_salt_id));
-            _original_plugin->proxy_controller_uid = derive_proxy_uid(_original_plugin->original_controller_uid, "p2" + std::to_string(_salt_id));
-            _salt_id++;
+        // a chain is categorized and grouped in workers like its first plugin. Its class ids only
+        // depend on its name so that projects find it again whatever it contains
+        const sandboxed_plugin_data& _first_plugin = *_plugins.front();
+        std::shared_ptr<sandboxed_plugin_data> _chain_plugin = std::make_shared<sandboxed_plugin_data>();
+        _chain_plugin->class_info = _first_plugin.class_info;
+        _chain_plugin->original_processor_uid = _first_plugin.original_processor_uid;
+        _chain_plugin->original_controller_uid = _first_plugin.original_controller_uid;
+        _chain_plugin->proxy_processor_uid = derive_proxy_uid(Steinberg::FUID(), "c1" + _chain.name);
+        _chain_plugin->proxy_controller_uid = derive_proxy_uid(Steinberg::FUID(), "c2" + _chain.name);
+        _chain_plugin->plugin_path = _first_plugin.plugin_path;
+        _chain_plugin->plugin_name = _chain.name;
+        _chain_plugin->plugin_version = _first_plugin.plugin_version;
+
+        // the worker renumbers the parameters of a chain so their table always comes from it, and
+        // so do the buses when a plugin only comes from moduleinfo.json
+        std::vector<std::vector<scanned_bus>> _stage_buses;
+        for (const sandboxed_plugin_data* _plugin : _plugins) {
+            _chain_plugin->stages.push_back(_plugin->stages.front());
+            _stage_buses.push_back(_plugin->original_buses);
+        }
+        if (std::none_of(_stage_buses.begin(), _stage_buses.end(), [](const std::vector<scanned_bus>& buses) { return buses.empty(); })) {
+            combine_chain_buses(_stage_buses, _chain_plugin->original_buses);
+        }
 
-            _original_plugin->plugin_path = plugin_path;
-            _original_plugin->plugin_name = _class_info.name();
-            _original_plugin->plugin_version = _class_info.version();
+        const auto _pool_size = global_sandbox_config.instance_pool_sizes.find(_chain.name);
+        if (_pool_size != global_sandbox_config.instance_pool_sizes.end()) {
+            _chain_plugin->pool_size = _pool_size->second;
+        }
+        global_sandboxed_plugins.push_back(std::move(_chain_plugin));
+    }
+}
 
-            // auto midiMapping = Steinberg::U::cast<Steinberg::Vst::IMidiMapping>(_original_plugin.plugin_controller);
-            
-            std::size_t _parameters_count = _instance_controller->getParameterCount();
-            _original_plugin->original_parameters.resize(_parameters_count);
-            for (Steinberg::int32 _k = 0; _k < _parameters_count; ++_k) {
-                Steinberg::Vst::ParameterInfo info;
-                if (_instance_controller->getParameterInfo(_k, info) == Steinberg::kResultOk) {
-                    _original_plugin->original_parameters[_k] = info;
-                } else {
-                    // error
-                }
+void scan_sandboxed_plugins(const std::vector<std::filesystem::path>& plugin_paths, const std::filesystem::path& cache_path, const scan_settings& settings)
+{
+    // unchanged modules come from the cache and the others are read from their moduleinfo.json or
+    // scanned by child processes, so a crashing or hanging module only ends up on the blocklist
+    scan_cache _cache;
+    static_cast<void>(_cache.open(cache_path));
+    // the cache is written again when a module changed or when it does not hold the configured
+    // modules, blocklisted and unreadable ones included
+    std::unordered_set<std::string> _configured_paths;
+    bool _is_cache_dirty = false;
+    std::vector<scanned_module> _modules(plugin_paths.size());
+    std::vector<scanned_module*> _pending_modules;
+    for (std::size_t _index = 0; _index < plugin_paths.size(); ++_index) {
+        scanned_module& _module = _modules[_index];
+        _module.path = plugin_paths[_index];
+        _configured_paths.insert(_module.path.u8string());
+        if (!get_module_fingerprint(_module.path, _module.modification_time, _module.size)) {
+            _module.blocked_reason = "could not read the module files";
+            _is_cache_dirty |= !_cache.contains(_module.path);
+        } else if (!_cache.find(_module.path, _module.modification_time, _module.size, _module)) {
+            if (!read_module_info(_module.path, _module)) {
+                _pending_modules.push_back(&_module);
             }
+            _is_cache_dirty = true;
+        }
+    }
+    _is_cache_dirty |= _cache.module_count() != _configured_paths.size();
+    _cache.close();
 
-
-            delete _plugin_provider;
+    if (!_pending_modules.empty()) {
+        scan_modules_in_processes(get_worker_executable_path(), _pending_modules, settings);
+    }
+    for (const scanned_module& _module : _modules) {
+        if (!_module.blocked_reason.empty()) {
+            std::cerr << "Sandbox error: " << _module.path << " is blocklisted, " << _module.blocked_reason << std::endl;
+            continue;
         }
+        load_sandboxed_plugins(_module);
+    }
+
+    if (_is_cache_dirty) {
+        static_cast<void>(scan_cache::write(cache_path, _modules));
     }
 }
 
@@ -200,6 +520,8 @@ void register_proxy_plugin(Steinberg::CPluginFactory* factory, sandboxed_plugin_
 {
     Steinberg::TUID _proxy_processor_tuid = INLINE_UID_FROM_FUID(original_plugin.proxy_processor_uid);
     Steinberg::TUID _proxy_controller_tuid = INLINE_UID_FROM_FUID(original_plugin.proxy_controller_uid);
+    // hosts sort instruments from effects by the subcategories so we copy the original ones
+    const std::string _sub_categories = original_plugin.class_info.subCategoriesString();
 
     Steinberg::PClassInfo2 _processor_class(
         _proxy_processor_tuid,
@@ -207,7 +529,7 @@ void register_proxy_plugin(Steinberg::CPluginFactory* factory, sandboxed_plugin_
         kVstAudioEffectClass,
         (original_plugin.plugin_name + " (Sandboxed)").c_str(),
         Steinberg::Vst::kDistributable,
-        "Fx", // TODO instruments !
+        _sub_categories.empty() ? "Fx" : _sub_categories.c_str(),
         nullptr,
         original_plugin.plugin_version.c_str(),
         kVstVersionString);
@@ -239,13 +561,17 @@ SMTG_EXPORT_SYMBOL Steinberg::IPluginFactory* PLUGIN_API GetPluginFactory()
             sandbox_email,
             Steinberg::Vst::kDefaultFactoryFlags);
 
+#if SMTG_OS_LINUX
+        const std::u16string _bundle_path = get_proxy_module_path().parent_path().parent_path().parent_path().u16string();
+        std::copy_n(_bundle_path.begin(), std::min<std::size_t>(_bundle_path.size(), VST_MAX_PATH - 1), gPath);
+#endif
         const std::filesystem::path _json_path = get_proxy_working_directory() / vstsandbox_json_file;
 
         Steinberg::gPluginFactory = new Steinberg::CPluginFactory(_factory_info);
 
-        for (const std::filesystem::path& _plugin_path : load_json_plugin_paths(_json_path)) {
-            load_sandboxed_plugins(_plugin_path);
-        }
+        global_sandbox_config = load_json_config(_json_path);
+        scan_sandboxed_plugins(global_sandbox_config.vst3_paths, get_proxy_working_directory() / vstsandbox_cache_file, global_sandbox_config.scan);
+        load_sandboxed_chains(global_sandbox_config.chains);
 
         for (std::shared_ptr<sandboxed_plugin_data>& _sandboxed_plugin : global_sandboxed_plugins) {
             proxy_plugin_callbacks _proxy_plugin;
@@ -253,6 +579,7 @@ SMTG_EXPORT_SYMBOL Steinberg::IPluginFactory* PLUGIN_API GetPluginFactory()
             _proxy_plugin.controller_create_instance_function = create_sandbox_controller_instance;
             register_proxy_plugin(Steinberg::gPluginFactory, *(_sandboxed_plugin.get()), _proxy_plugin);
         }
+        start_instance_pool(global_sandboxed_plugins);
     }
 
     return Steinberg::gPluginFactory;
@@ -0,0 +1,464 @@
+#include <pluginterfaces/base/ibstream.h>
+
+#include <sandbox.hpp>
+#include <state.hpp>
+
+#if SMTG_OS_WINDOWS
+#define sandbox_worker_executable "vstsandbox_worker.exe"
+#else
+#define sandbox_worker_executable "vstsandbox_worker"
+#endif
+
+std::filesystem::path get_worker_executable_path()
+{
+    return get_proxy_binary_directory() / sandbox_worker_executable;
+}
+
+// worker_host
+
+worker_host::~worker_host()
+{
+    shutdown();
+}
+
+bool worker_host::launch(const ipc_wait_settings& wait_settings, std::uint32_t thread_count, const realtime_settings& realtime)
+{
+    std::lock_guard _lock(_command_mutex);
+
+    const std::string _group_name = make_ipc_name("g");
+    if (!_group_memory.create(_group_name, sizeof(worker_group_block))) {
+        std::cerr << "Sandbox error: could not create group block " << _group_name << std::endl;
+        return false;
+    }
+    _group = new (_group_memory.data()) worker_group_block();
+    if (!_command_doorbell.create(_group_name + ".cmd", &_group->command_doorbell)
+        || !_block_doorbell.create(_group_name + ".blk", &_group->block_doorbell)
+        || !_response_signal.create(_group_name + ".rsp", &_group->control.response_sequence)) {
+        std::cerr << "Sandbox error: could not create group signals" << std::endl;
+        return false;
+    }
+
+    const std::filesystem::path _executable = get_worker_executable_path();
+    std::string _cpus;
+    for (std::uint32_t _cpu : realtime.cpus) {
+        _cpus += (_cpus.empty() ? "" : ",") + std::to_string(_cpu);
+    }
+    std::vector<std::string> _arguments = {
+        "--group", _group_name,
+        "--parent", std::to_string(get_current_process_id()),
+        "--wait", wait_settings.mode == ipc_wait_mode::spin ? "spin" : "sleep",
+        "--spin", std::to_string(wait_settings.spin_duration.count()),
+        "--threads", std::to_string(thread_count),
+        "--policy", realtime.policy == realtime_policy::fifo ? "fifo" : (realtime.policy == realtime_policy::round_robin ? "rr" : "none"),
+        "--priority", std::to_string(realtime.priority),
+        "--lock-memory", realtime.should_lock_memory ? "1" : "0"
+    };
+    if (!_cpus.empty()) {
+        _arguments.insert(_arguments.end(), { "--cpus", _cpus });
+    }
+    std::lock_guard _process_lock(_process_mutex);
+    if (!_process.spawn(_executable, _arguments)) {
+        std::cerr << "Sandbox error: could not launch worker " << _executable << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool worker_host::is_running()
+{
+    std::lock_guard _lock(_process_mutex);
+    const bool _is_running = _process.is_running();
+    if (!_is_running) {
+        _has_ended.store(true, std::memory_order_release);
+    }
+    return _is_running;
+}
+
+bool worker_host::has_ended() const
+{
+    return _has_ended.load(std::memory_order_acquire) || _process.has_ended();
+}
+
+void worker_host::shutdown()
+{
+    std::lock_guard _lock(_command_mutex);
+    if (_group && is_running()) {
+        static_cast<void>(transact(&_group->control, _response_signal, worker_command::shutdown, 0));
+        std::lock_guard _process_lock(_process_mutex);
+        _process.join(std::chrono::milliseconds(2000));
+    }
+    {
+        std::lock_guard _process_lock(_process_mutex);
+        _process.kill();
+    }
+    _command_doorbell.close();
+    _block_doorbell.close();
+    _response_signal.close();
+    _group_memory.close();
+    _group = nullptr;
+}
+
+Steinberg::tresult worker_host::open_session(const std::string& control_name)
+{
+    std::lock_guard _lock(_command_mutex);
+    if (!_group || control_name.size() >= sandbox_control_payload_capacity) {
+        return Steinberg::kInvalidArgument;
+    }
+    std::memcpy(_group->control.payload, control_name.data(), control_name.size());
+    return transact(&_group->control, _response_signal, worker_command::open_session, control_name.size());
+}
+
+Steinberg::tresult worker_host::transact(control_block* control, ipc_signal& response_signal, worker_command command, std::size_t payload_size)
+{
+    if (!_group) {
+        return Steinberg::kNotInitialized;
+    }
+
+    control->command = command;
+    control->payload_size = payload_size;
+    const std::uint32_t _sequence = control->command_sequence.load(std::memory_order_relaxed) + 1;
+    control->command_sequence.store(_sequence, std::memory_order_release);
+    _group->command_doorbell.fetch_add(1, std::memory_order_release);
+    _command_doorbell.notify();
+
+    // commands are not real time so we wait in slices and give up as soon as the worker is gone
+    const std::chrono::steady_clock::time_point _deadline = std::chrono::steady_clock::now() + sandbox_command_timeout;
+    while (!response_signal.wait_until([&]() { return control->response_sequence.load(std::memory_order_acquire) == _sequence; }, std::min(_deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(100)), ipc_wait_settings {})) {
+        if (!is_running() || std::chrono::steady_clock::now() >= _deadline) {
+            std::cerr << "Sandbox error: worker did not answer command " << static_cast<std::uint32_t>(command) << std::endl;
+            return Steinberg::kInternalError;
+        }
+    }
+
+    return control->result;
+}
+
+std::uint32_t worker_host::get_realtime_refusals() const
+{
+    return _group ? _group->realtime_refusals.load(std::memory_order_relaxed) : 0;
+}
+
+void worker_host::notify_blocks()
+{
+    // sequentially consistent on both sides so that either we see the dispatcher asleep or it sees
+    // the new doorbell value before sleeping
+    _group->block_doorbell.fetch_add(1, std::memory_order_seq_cst);
+    if (_group->is_dispatcher_sleeping.load(std::memory_order_seq_cst)) {
+        _block_doorbell.notify();
+    }
+}
+
+std::shared_ptr<worker_host> acquire_worker_host(const std::string& group_key, const sandbox_config& config)
+{
+    static std::mutex _hosts_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<worker_host>> _hosts;
+    static std::size_t _launch_count = 0;
+
+    std::unique_lock _lock(_hosts_mutex);
+    std::shared_ptr<worker_host> _host;
+    if (!group_key.empty()) {
+        _host = _hosts[group_key].lock();
+        if (_host && _host->is_running()) {
+            return _host;
+        }
+    }
+
+    // launched under the lock so that instances of one group never start two processes
+    realtime_settings _realtime;
+    _realtime.policy = config.realtime.policy;
+    _realtime.priority = config.realtime.priority;
+    _realtime.should_lock_memory = config.realtime.should_lock_memory;
+    if (!config.realtime.cpu_sets.empty()) {
+        _realtime.cpus = config.realtime.cpu_sets[_launch_count % config.realtime.cpu_sets.size()];
+    }
+    ++_launch_count;
+    _host = std::make_shared<worker_host>();
+    if (!_host->launch(config.wait_settings, config.worker_groups.thread_count, _realtime)) {
+        return nullptr;
+    }
+    if (!group_key.empty()) {
+        _hosts[group_key] = _host;
+    }
+    return _host;
+}
+
+// sandbox_worker
+
+sandbox_worker::~sandbox_worker()
+{
+    shutdown();
+}
+
+bool sandbox_worker::launch(const std::string& group_key)
+{
+    return launch(acquire_worker_host(group_key, get_sandbox_config()));
+}
+
+bool sandbox_worker::launch(std::shared_ptr<worker_host> host)
+{
+    std::lock_guard _lock(_command_mutex);
+
+    _host = std::move(host);
+    if (!_host) {
+        return false;
+    }
+
+    const std::string _control_name = make_ipc_name("c");
+    if (!_control_memory.create(_control_name, sizeof(control_block))) {
+        std::cerr << "Sandbox error: could not create control block " << _control_name << std::endl;
+        return false;
+    }
+    _control = new (_control_memory.data()) control_block();
+    if (!_response_signal.create(_control_name + ".rsp", &_control->response_sequence)) {
+        std::cerr << "Sandbox error: could not create control signals" << std::endl;
+        return false;
+    }
+    if (_host->open_session(_control_name) != Steinberg::kResultOk) {
+        std::cerr << "Sandbox error: worker could not open session " << _control_name << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool sandbox_worker::is_running()
+{
+    std::lock_guard _lock(_command_mutex);
+    return _host && _host->is_running();
+}
+
+void sandbox_worker::shutdown()
+{
+    std::lock_guard _lock(_command_mutex);
+    if (_control && _host && _host->is_running()) {
+        static_cast<void>(transact(worker_command::shutdown, 0));
+    }
+    _host.reset(); // the last session of a group shuts its worker down
+    _response_signal.close();
+    _control_memory.close();
+    _control = nullptr;
+}
+
+// the load_plugin and load_module payload, see worker_command
+[[nodiscard]] std::vector<std::byte> write_stage_records(const std::vector<sandboxed_stage>& stages)
+{
+    std::vector<std::byte> _payload;
+    for (const sandboxed_stage& _stage : stages) {
+        const std::string _path = _stage.plugin_path.u8string();
+        const std::uint32_t _path_size = static_cast<std::uint32_t>(_path.size());
+        const std::size_t _offset = _payload.size();
+        _payload.resize(_offset + sizeof(Steinberg::TUID) + sizeof(_path_size) + _path.size());
+        _stage.processor_uid.toTUID(reinterpret_cast<char*>(_payload.data() + _offset));
+        std::memcpy(_payload.data() + _offset + sizeof(Steinberg::TUID), &_path_size, sizeof(_path_size));
+        std::memcpy(_payload.data() + _offset + sizeof(Steinberg::TUID) + sizeof(_path_size), _path.data(), _path.size());
+    }
+    return _payload;
+}
+
+Steinberg::tresult sandbox_worker::load_plugin(const std::vector<sandboxed_stage>& stages)
+{
+    const std::vector<std::byte> _payload = write_stage_records(stages);
+    _has_component_state_hash = false;
+    return send_command(worker_command::load_plugin, _payload.data(), _payload.size());
+}
+
+Steinberg::tresult sandbox_worker::load_module(const std::vector<sandboxed_stage>& stages)
+{
+    const std::vector<std::byte> _payload = write_stage_records(stages);
+    return send_command(worker_command::load_module, _payload.data(), _payload.size());
+}
+
+Steinberg::tresult sandbox_worker::send_command(worker_command command, const void* payload, std::size_t payload_size, void* response, std::size_t response_size)
+{
+    std::lock_guard _lock(_command_mutex);
+    if (!_control || payload_size > sandbox_control_payload_capacity) {
+        return Steinberg::kInvalidArgument;
+    }
+    if (payload_size) {
+        std::memcpy(_control->payload, payload, payload_size);
+    }
+    const Steinberg::tresult _result = transact(command, payload_size);
+    if (_result != Steinberg::kResultOk || !response) {
+        return _result;
+    }
+    if (_control->payload_size != response_size) {
+        return Steinberg::kResultFalse;
+    }
+    std::memcpy(response, _control->payload, response_size);
+    return _result;
+}
+
+Steinberg::tresult sandbox_worker::send_state(worker_command command, Steinberg::IBStream* state)
+{
+    std::lock_guard _lock(_command_mutex);
+    if (!_control || !state) {
+        return Steinberg::kInvalidArgument;
+    }
+
+    // the host stream is read straight into shared memory that the plugin then reads from
+    Steinberg::IPtr<state_stream> _stream = Steinberg::owned(new state_stream());
+    state_hash _hash;
+    if (!_stream->create()) {
+        return Steinberg::kOutOfMemory;
+    }
+    const Steinberg::tresult _append_result = _stream->append(state, _hash);
+    if (_append_result != Steinberg::kResultOk) {
+        std::cerr << "Sandbox error: could not copy a state of " << _stream->get_transfer().size << " bytes to shared memory" << std::endl;
+        return _append_result;
+    }
+
+    // hosts send the component state to the controller again after every load and save, it is
+    // only parsed again when it changed since the controller last got it
+    const std::uint64_t _state_hash = _hash.digest();
+    if (command == worker_command::controller_set_component_state && _has_component_state_hash && _component_state_hash == _state_hash) {
+        return Steinberg::kResultOk;
+    }
+
+    const state_transfer _transfer = _stream->get_transfer();
+    std::memcpy(_control->payload, &_transfer, sizeof(_transfer));
+    const Steinberg::tresult _result = transact(command, sizeof(_transfer));
+    if (command == worker_command::controller_set_component_state) {
+        _has_component_state_hash = _result == Steinberg::kResultOk;
+        _component_state_hash = _state_hash;
+    } else if (command == worker_command::controller_set_state) {
+        _has_component_state_hash = false;
+    }
+    return _result;
+}
+
+Steinberg::tresult sandbox_worker::receive_state(worker_command command, Steinberg::IBStream* state)
+{
+    std::lock_guard _lock(_command_mutex);
+    if (!_control || !state) {
+        return Steinberg::kInvalidArgument;
+    }
+
+    // the worker keeps the shared memory the plugin wrote its state to until we copied it out
+    Steinberg::tresult _result = transact(command, 0);
+    if (_result != Steinberg::kResultOk || _control->payload_size != sizeof(state_transfer)) {
+        return _result == Steinberg::kResultOk ? Steinberg::kInternalError : _result;
+    }
+    state_transfer _transfer;
+    std::memcpy(&_transfer, _control->payload, sizeof(_transfer));
+    {
+        Steinberg::IPtr<state_stream> _stream = Steinberg::owned(new state_stream());
+        if (!_stream->open(_transfer)) {
+            std::cerr << "Sandbox error: could not open a state of " << _transfer.size << " bytes" << std::endl;
+            _result = Steinberg::kInternalError;
+        } else {
+            _result = _stream->copy_to(state);
+        }
+    }
+    static_cast<void>(transact(worker_command::release_state, 0));
+    return _result;
+}
+
+Steinberg::tresult sandbox_worker::get_buses(std::vector<scanned_bus>& buses)
+{
+    std::lock_guard _lock(_command_mutex);
+    buses.clear();
+    const Steinberg::tresult _result = transact(worker_command::get_buses, 0);
+    if (_result != Steinberg::kResultOk || _control->payload_size % sizeof(scanned_bus)) {
+        return _result == Steinberg::kResultOk ? Steinberg::kInternalError : _result;
+    }
+    buses.resize(static_cast<std::size_t>(_control->payload_size / sizeof(scanned_bus)));
+    std::memcpy(buses.data(), _control->payload, buses.size() * sizeof(scanned_bus));
+    return _result;
+}
+
+Steinberg::tresult sandbox_worker::get_parameters(std::vector<Steinberg::Vst::ParameterInfo>& parameters)
+{
+    std::lock_guard _lock(_command_mutex);
+    parameters.clear();
+    if (!_control) {
+        return Steinberg::kInvalidArgument;
+    }
+    // the infos are copied straight out of the control payload, a page is too large for the stack
+    const parameter_page* _page = reinterpret_cast<const parameter_page*>(_control->payload);
+    do {
+        const std::int32_t _first_index = static_cast<std::int32_t>(parameters.size());
+        std::memcpy(_control->payload, &_first_index, sizeof(_first_index));
+        const Steinberg::tresult _result = transact(worker_command::get_parameters, sizeof(_first_index));
+        if (_result != Steinberg::kResultOk || _control->payload_size != sizeof(parameter_page)) {
+            return _result == Steinberg::kResultOk ? Steinberg::kInternalError : _result;
+        }
+        parameters.insert(parameters.end(), _page->infos, _page->infos + std::max(0, _page->info_count));
+    } while (_page->info_count > 0 && static_cast<std::int32_t>(parameters.size()) < _page->parameter_count);
+    return Steinberg::kResultOk;
+}
+
+std::uint32_t sandbox_worker::get_parameter_generation() const
+{
+    return _control ? _control->parameter_generation.load(std::memory_order_acquire) : 0;
+}
+
+std::shared_ptr<worker_host> sandbox_worker::get_host()
+{
+    std::lock_guard _lock(_command_mutex);
+    return _host;
+}
+
+std::uint32_t sandbox_worker::get_realtime_refusals() const
+{
+    return _host ? _host->get_realtime_refusals() : 0;
+}
+
+Steinberg::tresult sandbox_worker::set_bus_arrangements(bus_arrangements& arrangements)
+{
+    std::lock_guard _lock(_command_mutex);
+    if (!_control) {
+        return Steinberg::kInvalidArgument;
+    }
+    std::memcpy(_control->payload, &arrangements, sizeof(arrangements));
+    const Steinberg::tresult _result = transact(worker_command::set_bus_arrangements, sizeof(arrangements));
+    // the arrangements come back whether the plugin accepted them or not
+    if (_control->payload_size == sizeof(arrangements)) {
+        std::memcpy(&arrangements, _control->payload, sizeof(arrangements));
+    }
+    return _result;
+}
+
+Steinberg::tresult sandbox_worker::transact(worker_command command, std::size_t payload_size)
+{
+    if (!_control || !_host) {
+        return Steinberg::kNotInitialized;
+    }
+    return _host->transact(_control, _response_signal, command, payload_size);
+}
+
+// sandbox_transport
+
+bool sandbox_transport::create(std::uint32_t slot_count, std::uint32_t max_samples, std::uint32_t input_channels, std::uint32_t output_channels, std::int32_t symbolic_sample_size)
+{
+    close();
+
+    transport_header _layout;
+    initialize_transport_header(_layout, slot_count, max_samples, input_channels, output_channels, symbolic_sample_size);
+    const std::string _transport_name = make_ipc_name("t");
+    if (!memory.create(_transport_name, get_transport_size(_layout))) {
+        std::cerr << "Sandbox error: could not create transport " << _transport_name << std::endl;
+        return false;
+    }
+
+    header = new (memory.data()) transport_header();
+    initialize_transport_header(*header, slot_count, max_samples, input_channels, output_channels, symbolic_sample_size);
+    for (std::uint32_t _position = 0; _position < slot_count; ++_position) {
+        new (get_transport_slot(header, _position)) transport_slot();
+    }
+
+    if (!response_signal.create(_transport_name + ".rsp", &header->read_position)) {
+        std::cerr << "Sandbox error: could not create transport signals" << std::endl;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void sandbox_transport::close()
+{
+    response_signal.close();
+    memory.close();
+    header = nullptr;
+}
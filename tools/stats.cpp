@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <telemetry.hpp>
+
+// prints the statistics that running hosts publish for their sandboxed instances. Percentiles cover
+// the last interval once an instance was seen before, maximums and counters cover its whole life
+
+struct histogram_snapshot {
+    std::array<std::uint64_t, telemetry_bucket_count> buckets {};
+    std::uint64_t count { 0 };
+    std::uint64_t total { 0 };
+    std::uint64_t maximum { 0 };
+};
+
+struct instance_snapshot {
+    std::uint32_t generation { 0 };
+    std::string plugin_name;
+    std::uint64_t block_duration { 0 };
+    std::uint64_t block_count { 0 };
+    std::uint64_t missed_block_count { 0 };
+    std::uint64_t xrun_count { 0 };
+    std::uint64_t silent_block_count { 0 };
+    bool is_late { false };
+    bool is_worker_lost { false };
+    std::uint32_t realtime_refusals { 0 };
+    bool is_hibernated { false };
+    std::uint64_t hibernation_count { 0 };
+    std::uint64_t recovery_count { 0 };
+    std::array<histogram_snapshot, 6> histograms;
+};
+
+struct stats_settings {
+    std::filesystem::path path { std::filesystem::current_path() }; // a stats file or the directory of vstsandbox.json
+    std::chrono::milliseconds interval { 1000 };
+    bool is_once { false };
+};
+
+constexpr const char* histogram_names[] = { "process", "round trip", "wakeup", "plugin", "restore", "recovery" };
+constexpr std::size_t restore_histogram = 4; // only shown once an instance came back from hibernation
+constexpr std::size_t recovery_histogram = 5; // only shown once a crashed worker was replaced
+
+[[nodiscard]] histogram_snapshot read_histogram(const telemetry_histogram& histogram)
+{
+    histogram_snapshot _snapshot;
+    for (std::uint32_t _bucket = 0; _bucket < telemetry_bucket_count; ++_bucket) {
+        _snapshot.buckets[_bucket] = histogram.buckets[_bucket].load(std::memory_order_relaxed);
+    }
+    _snapshot.count = histogram.count.load(std::memory_order_relaxed);
+    _snapshot.total = histogram.total.load(std::memory_order_relaxed);
+    _snapshot.maximum = histogram.maximum.load(std::memory_order_relaxed);
+    return _snapshot;
+}
+
+[[nodiscard]] instance_snapshot read_instance(const telemetry_instance& instance)
+{
+    instance_snapshot _snapshot;
+    _snapshot.generation = instance.generation.load(std::memory_order_acquire);
+    _snapshot.plugin_name.assign(instance.plugin_name, std::find(instance.plugin_name, instance.plugin_name + telemetry_name_capacity, '\0'));
+    _snapshot.block_duration = instance.block_duration.load(std::memory_order_relaxed);
+    _snapshot.block_count = instance.block_count.load(std::memory_order_relaxed);
+    _snapshot.missed_block_count = instance.missed_block_count.load(std::memory_order_relaxed);
+    _snapshot.xrun_count = instance.xrun_count.load(std::memory_order_relaxed);
+    _snapshot.silent_block_count = instance.silent_block_count.load(std::memory_order_relaxed);
+    _snapshot.is_late = instance.is_late.load(std::memory_order_relaxed) != 0;
+    _snapshot.is_worker_lost = instance.is_worker_lost.load(std::memory_order_relaxed) != 0;
+    _snapshot.realtime_refusals = instance.realtime_refusals.load(std::memory_order_relaxed);
+    _snapshot.is_hibernated = instance.is_hibernated.load(std::memory_order_relaxed) != 0;
+    _snapshot.hibernation_count = instance.hibernation_count.load(std::memory_order_relaxed);
+    _snapshot.recovery_count = instance.recovery_count.load(std::memory_order_relaxed);
+    _snapshot.histograms[0] = read_histogram(instance.process_time);
+    _snapshot.histograms[1] = read_histogram(instance.round_trip_time);
+    _snapshot.histograms[2] = read_histogram(instance.wakeup_latency);
+    _snapshot.histograms[3] = read_histogram(instance.plugin_time);
+    _snapshot.histograms[4] = read_histogram(instance.restore_time);
+    _snapshot.histograms[5] = read_histogram(instance.recovery_time);
+    return _snapshot;
+}
+
+[[nodiscard]] histogram_snapshot subtract_histogram(const histogram_snapshot& current, const histogram_snapshot& previous)
+{
+    // a record is updated while we read it, so a bucket may briefly run ahead of the count
+    histogram_snapshot _difference;
+    for (std::uint32_t _bucket = 0; _bucket < telemetry_bucket_count; ++_bucket) {
+        _difference.buckets[_bucket] = current.buckets[_bucket] - std::min(current.buckets[_bucket], previous.buckets[_bucket]);
+    }
+    _difference.count = current.count - std::min(current.count, previous.count);
+    _difference.total = current.total - std::min(current.total, previous.total);
+    _difference.maximum = current.maximum;
+    return _difference;
+}
+
+// middle of the bucket that holds the percentile
+[[nodiscard]] double get_percentile(const histogram_snapshot& histogram, double fraction)
+{
+    std::uint64_t _total_count = 0;
+    for (std::uint64_t _count : histogram.buckets) {
+        _total_count += _count;
+    }
+    if (!_total_count) {
+        return 0.;
+    }
+    const std::uint64_t _target = static_cast<std::uint64_t>(fraction * static_cast<double>(_total_count - 1));
+    std::uint64_t _seen = 0;
+    for (std::uint32_t _bucket = 0; _bucket < telemetry_bucket_count; ++_bucket) {
+        _seen += histogram.buckets[_bucket];
+        if (_seen > _target) {
+            const double _floor = static_cast<double>(get_telemetry_bucket_floor(_bucket));
+            const double _ceiling = _bucket + 1 < telemetry_bucket_count ? static_cast<double>(get_telemetry_bucket_floor(_bucket + 1)) : _floor;
+            return std::min((_floor + _ceiling) / 2., static_cast<double>(histogram.maximum));
+        }
+    }
+    return static_cast<double>(histogram.maximum);
+}
+
+void print_microseconds(const char* label, double nanoseconds)
+{
+    std::cout << "  " << label << std::setw(10) << nanoseconds / 1000. << "us";
+}
+
+void print_instance(std::uint32_t index, const instance_snapshot& current, const instance_snapshot* previous)
+{
+    std::cout << "  #" << index << " " << current.plugin_name
+              << "  blocks " << current.block_count
+              << "  missed " << current.missed_block_count
+              << "  xruns " << current.xrun_count
+              << "  silent " << current.silent_block_count;
+    if (current.hibernation_count) {
+        std::cout << "  hibernations " << current.hibernation_count;
+    }
+    if (current.recovery_count) {
+        std::cout << "  recoveries " << current.recovery_count;
+    }
+    if (current.block_duration) {
+        std::cout << "  budget " << current.block_duration / 1000. << "us";
+    }
+    if (current.is_late) {
+        std::cout << "  [late]";
+    }
+    if (current.is_worker_lost) {
+        std::cout << "  [worker lost]";
+    }
+    if (current.is_hibernated) {
+        std::cout << "  [hibernated]";
+    }
+    if (current.realtime_refusals & realtime_refused_priority) {
+        std::cout << "  [no real time priority]";
+    }
+    if (current.realtime_refusals & realtime_refused_affinity) {
+        std::cout << "  [no cpu affinity]";
+    }
+    if (current.realtime_refusals & realtime_refused_memory_lock) {
+        std::cout << "  [memory not locked]";
+    }
+    std::cout << "\n";
+
+    for (std::size_t _histogram = 0; _histogram < current.histograms.size(); ++_histogram) {
+        if ((_histogram == restore_histogram || _histogram == recovery_histogram) && !current.histograms[_histogram].count) {
+            continue;
+        }
+        const histogram_snapshot _interval = previous ? subtract_histogram(current.histograms[_histogram], previous->histograms[_histogram]) : current.histograms[_histogram];
+        std::cout << "    " << std::left << std::setw(12) << histogram_names[_histogram] << std::right;
+        print_microseconds("p50", get_percentile(_interval, 0.5));
+        print_microseconds("p99", get_percentile(_interval, 0.99));
+        print_microseconds("p99.9", get_percentile(_interval, 0.999));
+        print_microseconds("max", static_cast<double>(_interval.maximum));
+        print_microseconds("mean", _interval.count ? static_cast<double>(_interval.total) / static_cast<double>(_interval.count) : 0.);
+        if (current.block_duration && _histogram == 0) {
+            std::cout << "  p99 " << std::setw(6) << 100. * get_percentile(_interval, 0.99) / static_cast<double>(current.block_duration) << "% of budget";
+        }
+        std::cout << "\n";
+    }
+}
+
+[[nodiscard]] std::vector<std::filesystem::path> find_stats_files(const std::filesystem::path& path)
+{
+    std::vector<std::filesystem::path> _files;
+    std::error_code _error;
+    if (!std::filesystem::is_directory(path, _error)) {
+        _files.push_back(path);
+        return _files;
+    }
+    for (const std::filesystem::directory_entry& _entry : std::filesystem::directory_iterator(path, _error)) {
+        if (_entry.path().extension() == ".stats") {
+            _files.push_back(_entry.path());
+        }
+    }
+    std::sort(_files.begin(), _files.end());
+    return _files;
+}
+
+// returns false when the file is not a stats file we understand
+[[nodiscard]] bool print_stats_file(const std::filesystem::path& path, std::map<std::pair<std::filesystem::path, std::uint32_t>, instance_snapshot>& previous_snapshots)
+{
+    const std::string _segment_name = read_telemetry_segment_name(path);
+    shared_memory _memory;
+    if (_segment_name.empty() || !_memory.open(_segment_name, telemetry_file_size)) {
+        return false;
+    }
+    const std::byte* _data = static_cast<const std::byte*>(_memory.data());
+    const telemetry_header* _header = reinterpret_cast<const telemetry_header*>(_data);
+    if (_header->magic != telemetry_magic || _header->version != telemetry_version || _header->instance_count != telemetry_max_instances || _header->instance_size != sizeof(telemetry_instance)) {
+        return false;
+    }
+
+    std::cout << path.filename().string() << " (process " << _header->process_id << (is_process_running(_header->process_id) ? "" : ", not running") << ")\n";
+    const telemetry_instance* _instances = get_telemetry_instances(_data);
+    for (std::uint32_t _index = 0; _index < telemetry_max_instances; ++_index) {
+        const std::pair<std::filesystem::path, std::uint32_t> _key(path, _index);
+        if (_instances[_index].state.load(std::memory_order_acquire) != telemetry_state::active) {
+            previous_snapshots.erase(_key);
+            continue;
+        }
+        const instance_snapshot _snapshot = read_instance(_instances[_index]);
+        const auto _previous = previous_snapshots.find(_key);
+        const bool _has_previous = _previous != previous_snapshots.end() && _previous->second.generation == _snapshot.generation;
+        print_instance(_index, _snapshot, _has_previous ? &_previous->second : nullptr);
+        previous_snapshots[_key] = _snapshot;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    stats_settings _settings;
+    for (int _index = 1; _index < argc; ++_index) {
+        const std::string _argument = argv[_index];
+        if (_argument == "--interval" && _index + 1 < argc) {
+            _settings.interval = std::chrono::milliseconds(std::max(10ul, std::stoul(argv[++_index])));
+        } else if (_argument == "--once") {
+            _settings.is_once = true;
+        } else if (_argument == "--help" || _argument == "-h") {
+            std::cout << "usage: vstsandbox_stats [stats file or directory of vstsandbox.json] [--interval milliseconds] [--once]" << std::endl;
+            return 0;
+        } else {
+            _settings.path = _argument;
+        }
+    }
+
+    std::map<std::pair<std::filesystem::path, std::uint32_t>, instance_snapshot> _previous_snapshots;
+    while (true) {
+        std::cout << std::fixed << std::setprecision(1);
+        const std::vector<std::filesystem::path> _files = find_stats_files(_settings.path);
+        bool _has_printed = false;
+        for (const std::filesystem::path& _path : _files) {
+            _has_printed |= print_stats_file(_path, _previous_snapshots);
+        }
+        if (!_has_printed) {
+            std::cout << "no stats file in " << _settings.path.string() << "\n";
+        }
+        std::cout << std::endl;
+        if (_settings.is_once) {
+            return _has_printed ? 0 : 1;
+        }
+        std::this_thread::sleep_for(_settings.interval);
+    }
+}
@@ -0,0 +1,804 @@
+#include <public.sdk/source/vst/utility/stringconvert.h>
+#include <pluginterfaces/vst/ivstunits.h>
+
+#include <iterator>
+
+#include <state.hpp>
+#include <worker.hpp>
+
+void reserve_parameter_changes(Steinberg::Vst::ParameterChanges& changes, std::int32_t queue_count, std::int32_t point_count)
+{
+    // queues keep their capacity when they are cleared so filling them once is enough
+    changes.setMaxParameters(queue_count);
+    for (std::int32_t _queue_index = 0; _queue_index < queue_count; ++_queue_index) {
+        Steinberg::int32 _index = 0;
+        Steinberg::Vst::IParamValueQueue* _queue = changes.addParameterData(static_cast<Steinberg::Vst::ParamID>(_queue_index), _index);
+        for (std::int32_t _point_index = 0; _queue && _point_index < point_count; ++_point_index) {
+            _queue->addPoint(_point_index, 0., _index);
+        }
+    }
+    changes.clearQueue();
+}
+
+void copy_parameter_points(Steinberg::Vst::IParamValueQueue* source, Steinberg::Vst::IParamValueQueue* target)
+{
+    const Steinberg::int32 _point_count = source->getPointCount();
+    for (Steinberg::int32 _point = 0; target && _point < _point_count; ++_point) {
+        Steinberg::int32 _offset = 0;
+        Steinberg::Vst::ParamValue _value = 0.;
+        Steinberg::int32 _index = 0;
+        if (source->getPoint(_point, _offset, _value) == Steinberg::kResultOk) {
+            target->addPoint(_offset, _value, _index);
+        }
+    }
+}
+
+[[nodiscard]] std::vector<Steinberg::Vst::SpeakerArrangement> get_bus_arrangements(hosted_stage& stage, Steinberg::Vst::BusDirection direction)
+{
+    std::vector<Steinberg::Vst::SpeakerArrangement> _arrangements(std::max(0, stage.component->getBusCount(Steinberg::Vst::kAudio, direction)), 0);
+    for (std::size_t _index = 0; _index < _arrangements.size(); ++_index) {
+        static_cast<void>(stage.processor->getBusArrangement(direction, static_cast<Steinberg::int32>(_index), _arrangements[_index]));
+    }
+    return _arrangements;
+}
+
+[[nodiscard]] Steinberg::tresult set_stage_state(hosted_stage& stage, worker_command command, Steinberg::IBStream* state)
+{
+    if (command == worker_command::processor_set_state) {
+        return stage.component->setState(state);
+    } else if (command == worker_command::controller_set_state) {
+        return stage.controller->setState(state);
+    } else if (command == worker_command::controller_set_component_state) {
+        return stage.controller->setComponentState(state);
+    }
+    return Steinberg::kInvalidArgument;
+}
+
+[[nodiscard]] Steinberg::tresult get_stage_state(hosted_stage& stage, worker_command command, Steinberg::IBStream* state)
+{
+    if (command == worker_command::processor_get_state) {
+        return stage.component->getState(state);
+    } else if (command == worker_command::controller_get_state) {
+        return stage.controller->getState(state);
+    }
+    return Steinberg::kInvalidArgument;
+}
+
+void set_channel_buffer(Steinberg::Vst::AudioBusBuffers& buffers, std::int32_t channel, void* data, bool is_double)
+{
+    if (is_double) {
+        buffers.channelBuffers64[channel] = static_cast<Steinberg::Vst::Sample64*>(data);
+    } else {
+        buffers.channelBuffers32[channel] = static_cast<Steinberg::Vst::Sample32*>(data);
+    }
+}
+
+VST3::Hosting::Module::Ptr get_shared_module(const std::string& module_path, std::string& error)
+{
+    // plugins of the same module share one dlopen and one factory for as long as one of them lives
+    static std::mutex _modules_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<VST3::Hosting::Module>> _modules;
+    std::lock_guard _lock(_modules_mutex);
+    std::weak_ptr<VST3::Hosting::Module>& _cached_module = _modules[module_path];
+    VST3::Hosting::Module::Ptr _module = _cached_module.lock();
+    if (!_module) {
+        _module = VST3::Hosting::Module::create(module_path, error);
+        _cached_module = _module;
+    }
+    return _module;
+}
+
+worker_component_handler::worker_component_handler(std::atomic<std::uint32_t>* parameter_generation)
+    : _parameter_generation(parameter_generation)
+{
+}
+
+Steinberg::tresult PLUGIN_API worker_component_handler::beginEdit(Steinberg::Vst::ParamID id)
+{
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API worker_component_handler::performEdit(Steinberg::Vst::ParamID id, Steinberg::Vst::ParamValue valueNormalized)
+{
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API worker_component_handler::endEdit(Steinberg::Vst::ParamID id)
+{
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult PLUGIN_API worker_component_handler::restartComponent(Steinberg::int32 flags)
+{
+    if (_parameter_generation && (flags & (Steinberg::Vst::kParamValuesChanged | Steinberg::Vst::kParamTitlesChanged))) {
+        _parameter_generation->fetch_add(1, std::memory_order_release);
+    }
+    return Steinberg::kResultOk;
+}
+
+// hosted_stage
+
+hosted_stage::~hosted_stage()
+{
+    unload();
+}
+
+Steinberg::tresult hosted_stage::load(const hosted_class& plugin_class, std::atomic<std::uint32_t>* parameter_generation)
+{
+    unload();
+
+    std::string _module_error;
+    host_module = get_shared_module(plugin_class.module_path, _module_error);
+    if (!host_module) {
+        std::cerr << "Sandbox worker error: could not create Module with error " << _module_error << std::endl;
+        return Steinberg::kResultFalse;
+    }
+
+    for (const VST3::Hosting::ClassInfo& _class_info : host_module->getFactory().classInfos()) {
+        if (_class_info.ID() == plugin_class.class_id) {
+            plugin_provider = std::make_shared<Steinberg::Vst::PlugProvider>(host_module->getFactory(), _class_info, true);
+            name = _class_info.name();
+            break;
+        }
+    }
+    if (!plugin_provider) {
+        std::cerr << "Sandbox worker error: could not find class " << plugin_class.class_id.toString() << " in " << plugin_class.module_path << std::endl;
+        return Steinberg::kResultFalse;
+    }
+
+    component = plugin_provider->getComponent();
+    controller = plugin_provider->getController();
+    processor = Steinberg::U::cast<Steinberg::Vst::IAudioProcessor>(component);
+    if (!component || !controller || !processor) {
+        std::cerr << "Sandbox worker error: could not create sandboxed processor or controller" << std::endl;
+        return Steinberg::kResultFalse;
+    }
+
+    component_handler = Steinberg::owned(new worker_component_handler(parameter_generation));
+    controller->setComponentHandler(component_handler);
+
+    // activate the main buses as a regular host would do, the proxy starts with the same buses
+    // active and forwards what the host changes
+    active_inputs.assign(std::max(0, component->getBusCount(Steinberg::Vst::kAudio, Steinberg::Vst::kInput)), false);
+    active_outputs.assign(std::max(0, component->getBusCount(Steinberg::Vst::kAudio, Steinberg::Vst::kOutput)), false);
+    if (!active_inputs.empty()) {
+        active_inputs[0] = component->activateBus(Steinberg::Vst::kAudio, Steinberg::Vst::kInput, 0, true) == Steinberg::kResultOk;
+    }
+    if (!active_outputs.empty()) {
+        active_outputs[0] = component->activateBus(Steinberg::Vst::kAudio, Steinberg::Vst::kOutput, 0, true) == Steinberg::kResultOk;
+    }
+    has_event_input = component->getBusCount(Steinberg::Vst::kEvent, Steinberg::Vst::kInput) > 0;
+    has_event_output = component->getBusCount(Steinberg::Vst::kEvent, Steinberg::Vst::kOutput) > 0;
+    if (has_event_input) {
+        component->activateBus(Steinberg::Vst::kEvent, Steinberg::Vst::kInput, 0, true);
+    }
+
+    return Steinberg::kResultOk;
+}
+
+void hosted_stage::unload()
+{
+    process_data.unprepare();
+    processor = nullptr;
+    component = nullptr;
+    if (controller) {
+        controller->setComponentHandler(nullptr);
+    }
+    controller = nullptr;
+    plugin_provider.reset(); // terminates the component and the controller
+    component_handler = nullptr;
+    host_module.reset();
+}
+
+// hosted_plugin
+
+hosted_plugin::~hosted_plugin()
+{
+    unload();
+}
+
+Steinberg::tresult hosted_plugin::load(const std::vector<hosted_class>& classes)
+{
+    unload();
+    if (classes.empty()) {
+        return Steinberg::kInvalidArgument;
+    }
+
+    for (const hosted_class& _class : classes) {
+        std::unique_ptr<hosted_stage> _stage = std::make_unique<hosted_stage>();
+        const Steinberg::tresult _result = _stage->load(_class, parameter_generation);
+        if (_result != Steinberg::kResultOk) {
+            unload();
+            return _result;
+        }
+        _stages.push_back(std::move(_stage));
+    }
+
+    // the events a plugin outputs go to the next plugin of the chain, the host only decides for the last one
+    for (std::size_t _index = 0; _index + 1 < _stages.size(); ++_index) {
+        if (_stages[_index]->has_event_output) {
+            _stages[_index]->component->activateBus(Steinberg::Vst::kEvent, Steinberg::Vst::kOutput, 0, true);
+        }
+    }
+
+    if (is_chain()) {
+        _chain_parameter_ids.resize(_stages.size());
+        for (std::uint32_t _stage_index = 0; _stage_index < _stages.size(); ++_stage_index) {
+            Steinberg::Vst::IEditController* _controller = _stages[_stage_index]->controller;
+            const Steinberg::int32 _parameter_count = _controller->getParameterCount();
+            for (Steinberg::int32 _index = 0; _index < _parameter_count; ++_index) {
+                Steinberg::Vst::ParameterInfo _info {};
+                if (_controller->getParameterInfo(_index, _info) == Steinberg::kResultOk) {
+                    _chain_parameter_ids[_stage_index].emplace(_info.id, static_cast<Steinberg::Vst::ParamID>(_chain_parameters.size()));
+                    _chain_parameters.push_back({ _stage_index, _index, _info.id });
+                }
+            }
+        }
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult hosted_plugin::setup_processing(const transport_setup& setup, block_scheduler& scheduler)
+{
+    stop_processing();
+
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+
+    const std::string _transport_name(setup.transport_name);
+    if (!_transport_memory.open(_transport_name, setup.transport_size)) {
+        std::cerr << "Sandbox worker error: could not open transport " << _transport_name << std::endl;
+        return Steinberg::kResultFalse;
+    }
+    _transport = static_cast<transport_header*>(_transport_memory.data());
+    if (_transport->magic != sandbox_protocol_magic || _transport->version != sandbox_protocol_version) {
+        std::cerr << "Sandbox worker error: transport " << _transport_name << " has an unexpected version" << std::endl;
+        return Steinberg::kResultFalse;
+    }
+    // the proxy committed the pages, this maps them so that the first blocks do not fault
+    static_cast<void>(_transport_memory.prefault(false));
+    if (!_response_signal.open(_transport_name + ".rsp", &_transport->read_position)) {
+        std::cerr << "Sandbox worker error: could not open transport signals" << std::endl;
+        return Steinberg::kResultFalse;
+    }
+
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        Steinberg::Vst::ProcessSetup _process_setup = setup.process_setup;
+        const Steinberg::tresult _result = _stage->processor->setupProcessing(_process_setup);
+        if (_result != Steinberg::kResultOk) {
+            return _result;
+        }
+    }
+    _symbolic_sample_size = setup.process_setup.symbolicSampleSize;
+    _silence_buffer.assign(_transport->channel_stride, std::byte { 0 });
+    _scratch_buffer.assign(_transport->channel_stride, std::byte { 0 });
+    prepare_stages();
+
+    const std::int32_t _reserved_points = std::min(worker_reserved_queue_points, setup.process_setup.maxSamplesPerBlock);
+    reserve_parameter_changes(_input_parameter_changes, get_parameter_count(), _reserved_points);
+    reserve_parameter_changes(_output_parameter_changes, get_parameter_count(), _reserved_points);
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        _stage->process_data.processMode = setup.process_setup.processMode;
+        if (is_chain()) {
+            reserve_parameter_changes(_stage->input_parameter_changes, _stage->controller->getParameterCount(), _reserved_points);
+            reserve_parameter_changes(_stage->output_parameter_changes, _stage->controller->getParameterCount(), _reserved_points);
+        }
+    }
+
+    _read_position = _transport->read_position.load(std::memory_order_relaxed);
+    if (!scheduler.add(this)) {
+        std::cerr << "Sandbox worker error: too many processing plugins in one worker" << std::endl;
+        return Steinberg::kResultFalse;
+    }
+    _scheduler = &scheduler;
+    // after the plugin allocated its processing buffers and the scheduler started its threads
+    scheduler.lock_memory();
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult hosted_plugin::can_process_sample_size(std::int32_t symbolic_sample_size)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        const Steinberg::tresult _result = _stage->processor->canProcessSampleSize(symbolic_sample_size);
+        if (_result != Steinberg::kResultTrue) {
+            return _result;
+        }
+    }
+    return Steinberg::kResultTrue;
+}
+
+Steinberg::tresult hosted_plugin::set_active(bool state)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    Steinberg::tresult _result = Steinberg::kResultOk;
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        const Steinberg::tresult _stage_result = _stage->component->setActive(state);
+        _result = _result == Steinberg::kResultOk ? _stage_result : _result;
+    }
+    return _result;
+}
+
+Steinberg::tresult hosted_plugin::set_processing(bool state)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    Steinberg::tresult _result = Steinberg::kResultOk;
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        const Steinberg::tresult _stage_result = _stage->processor->setProcessing(state);
+        _result = _result == Steinberg::kResultOk ? _stage_result : _result;
+    }
+    return _result;
+}
+
+Steinberg::tresult hosted_plugin::set_bus_arrangements(bus_arrangements& arrangements)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    if (arrangements.input_count < 0 || arrangements.output_count < 0 || arrangements.input_count > sandbox_max_buses || arrangements.output_count > sandbox_max_buses) {
+        return Steinberg::kInvalidArgument;
+    }
+    Steinberg::Vst::SpeakerArrangement* _inputs = arrangements.arrangements;
+    Steinberg::Vst::SpeakerArrangement* _outputs = arrangements.arrangements + arrangements.input_count;
+    hosted_stage& _first_stage = *_stages.front();
+    hosted_stage& _last_stage = *_stages.back();
+    Steinberg::tresult _result = Steinberg::kResultOk;
+    if (!is_chain()) {
+        _result = _first_stage.processor->setBusArrangements(_inputs, arrangements.input_count, _outputs, arrangements.output_count);
+    } else {
+        // the inputs go to the first plugin and the outputs to the last one. The main buses in
+        // between take the main output arrangement so that the whole chain runs on the same channels
+        Steinberg::Vst::SpeakerArrangement _link = 0;
+        if (arrangements.output_count > 0) {
+            _link = _outputs[0];
+        } else if (arrangements.input_count > 0) {
+            _link = _inputs[0];
+        } else {
+            static_cast<void>(_first_stage.processor->getBusArrangement(Steinberg::Vst::kOutput, 0, _link));
+        }
+        for (std::size_t _index = 0; _index < _stages.size(); ++_index) {
+            hosted_stage& _stage = *_stages[_index];
+            const bool _is_first = _index == 0;
+            const bool _is_last = _index + 1 == _stages.size();
+            std::vector<Steinberg::Vst::SpeakerArrangement> _stage_inputs = get_bus_arrangements(_stage, Steinberg::Vst::kInput);
+            std::vector<Steinberg::Vst::SpeakerArrangement> _stage_outputs = get_bus_arrangements(_stage, Steinberg::Vst::kOutput);
+            if (_is_first) {
+                std::copy_n(_inputs, std::min<std::size_t>(arrangements.input_count, _stage_inputs.size()), _stage_inputs.begin());
+            } else if (!_stage_inputs.empty()) {
+                _stage_inputs[0] = _link;
+            }
+            if (_is_last) {
+                std::copy_n(_outputs, std::min<std::size_t>(arrangements.output_count, _stage_outputs.size()), _stage_outputs.begin());
+            } else if (!_stage_outputs.empty()) {
+                _stage_outputs[0] = _link;
+            }
+            // the plugins in between adapt to what they get, only the ends answer the host
+            const Steinberg::tresult _stage_result = _stage.processor->setBusArrangements(_stage_inputs.data(), static_cast<Steinberg::int32>(_stage_inputs.size()), _stage_outputs.data(), static_cast<Steinberg::int32>(_stage_outputs.size()));
+            if ((_is_first || _is_last) && _result == Steinberg::kResultOk) {
+                _result = _stage_result;
+            }
+        }
+    }
+
+    // a plugin that refuses adapts its arrangements to the closest it supports, the host reads them back
+    for (std::int32_t _index = 0; _index < arrangements.input_count; ++_index) {
+        static_cast<void>(_first_stage.processor->getBusArrangement(Steinberg::Vst::kInput, _index, _inputs[_index]));
+    }
+    for (std::int32_t _index = 0; _index < arrangements.output_count; ++_index) {
+        static_cast<void>(_last_stage.processor->getBusArrangement(Steinberg::Vst::kOutput, _index, _outputs[_index]));
+    }
+    if (_transport) {
+        prepare_stages();
+    }
+    return _result;
+}
+
+Steinberg::tresult hosted_plugin::activate_bus(const bus_activation& activation)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    // the buses of a chain are the inputs of its first plugin and the outputs of its last one,
+    // except for event inputs that belong to the first plugin that has some
+    hosted_stage* _stage = activation.direction == Steinberg::Vst::kInput ? _stages.front().get() : _stages.back().get();
+    if (activation.type == Steinberg::Vst::kEvent && activation.direction == Steinberg::Vst::kInput) {
+        const auto _found = std::find_if(_stages.begin(), _stages.end(), [](const std::unique_ptr<hosted_stage>& stage) { return stage->has_event_input; });
+        _stage = _found != _stages.end() ? _found->get() : _stage;
+    }
+    const Steinberg::tresult _result = _stage->component->activateBus(activation.type, activation.direction, activation.index, activation.state != 0);
+    std::vector<bool>& _active_buses = activation.direction == Steinberg::Vst::kInput ? _stage->active_inputs : _stage->active_outputs;
+    if (_result == Steinberg::kResultOk && activation.type == Steinberg::Vst::kAudio && activation.index >= 0 && activation.index < static_cast<std::int32_t>(_active_buses.size())) {
+        _active_buses[activation.index] = activation.state != 0;
+    }
+    return _result;
+}
+
+Steinberg::tresult hosted_plugin::get_latency_samples(std::uint32_t& latency)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    latency = 0;
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        latency += _stage->processor->getLatencySamples();
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult hosted_plugin::get_tail_samples(std::uint32_t& tail)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    tail = 0;
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        const std::uint32_t _stage_tail = _stage->processor->getTailSamples();
+        if (_stage_tail >= Steinberg::Vst::kInfiniteTail - tail) {
+            tail = Steinberg::Vst::kInfiniteTail;
+            break;
+        }
+        tail += _stage_tail;
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult hosted_plugin::get_buses(std::vector<scanned_bus>& buses)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    if (!is_chain()) {
+        scan_buses(_stages.front()->component, _stages.front()->processor, buses);
+        return Steinberg::kResultOk;
+    }
+    std::vector<std::vector<scanned_bus>> _stage_buses(_stages.size());
+    for (std::size_t _index = 0; _index < _stages.size(); ++_index) {
+        scan_buses(_stages[_index]->component, _stages[_index]->processor, _stage_buses[_index]);
+    }
+    combine_chain_buses(_stage_buses, buses);
+    return Steinberg::kResultOk;
+}
+
+std::int32_t hosted_plugin::get_parameter_count() const
+{
+    if (!is_loaded()) {
+        return 0;
+    }
+    return is_chain() ? static_cast<std::int32_t>(_chain_parameters.size()) : _stages.front()->controller->getParameterCount();
+}
+
+Steinberg::tresult hosted_plugin::get_parameter_info(std::int32_t index, Steinberg::Vst::ParameterInfo& info)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    if (!is_chain()) {
+        return _stages.front()->controller->getParameterInfo(index, info);
+    }
+    if (index < 0 || index >= static_cast<std::int32_t>(_chain_parameters.size())) {
+        return Steinberg::kInvalidArgument;
+    }
+    const chain_parameter& _parameter = _chain_parameters[index];
+    const hosted_stage& _stage = *_stages[_parameter.stage];
+    const Steinberg::tresult _result = _stage.controller->getParameterInfo(_parameter.index, info);
+    if (_result != Steinberg::kResultOk) {
+        return _result;
+    }
+
+    // titles tell which plugin a parameter belongs to. Units only make sense within one plugin and
+    // a bypass would only bypass one plugin, so the chain has neither
+    const std::u16string _title = Steinberg::Vst::StringConvert::convert(_stage.name + ": ") + std::u16string(info.title);
+    std::fill(std::begin(info.title), std::end(info.title), 0);
+    std::copy_n(_title.begin(), std::min(_title.size(), std::size(info.title) - 1), info.title);
+    info.id = static_cast<Steinberg::Vst::ParamID>(index);
+    info.unitId = Steinberg::Vst::kRootUnitId;
+    info.flags &= ~Steinberg::Vst::ParameterInfo::kIsBypass;
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult hosted_plugin::convert_parameter(worker_command command, parameter_conversion& conversion)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    Steinberg::Vst::IEditController* _controller = _stages.front()->controller;
+    Steinberg::Vst::ParamID _id = conversion.id;
+    if (is_chain()) {
+        if (conversion.id >= _chain_parameters.size()) {
+            return Steinberg::kInvalidArgument;
+        }
+        _controller = _stages[_chain_parameters[conversion.id].stage]->controller;
+        _id = _chain_parameters[conversion.id].id;
+    }
+
+    if (command == worker_command::get_param_string_by_value) {
+        return _controller->getParamStringByValue(_id, conversion.value, conversion.text);
+    } else if (command == worker_command::get_param_value_by_string) {
+        conversion.text[std::size(conversion.text) - 1] = 0;
+        return _controller->getParamValueByString(_id, conversion.text, conversion.value);
+    } else if (command == worker_command::normalized_param_to_plain) {
+        conversion.value = _controller->normalizedParamToPlain(_id, conversion.value);
+        return Steinberg::kResultOk;
+    } else if (command == worker_command::plain_param_to_normalized) {
+        conversion.value = _controller->plainParamToNormalized(_id, conversion.value);
+        return Steinberg::kResultOk;
+    }
+    return Steinberg::kInvalidArgument;
+}
+
+// the state of a chain is the state of every plugin in order, each one preceded by its int64 size.
+// Plugins that do not implement a state leave theirs empty
+
+Steinberg::tresult hosted_plugin::set_state(worker_command command, Steinberg::IBStream* state)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    if (!is_chain()) {
+        return set_stage_state(*_stages.front(), command, state);
+    }
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        std::int64_t _size = 0;
+        Steinberg::int32 _read_size = 0;
+        Steinberg::int64 _offset = 0;
+        if (state->read(&_size, sizeof(_size), &_read_size) != Steinberg::kResultOk || _read_size != sizeof(_size) || _size < 0 || state->tell(&_offset) != Steinberg::kResultOk) {
+            return Steinberg::kResultFalse;
+        }
+        Steinberg::IPtr<state_slice> _slice = Steinberg::owned(new state_slice(state, _offset, _size));
+        const Steinberg::tresult _result = set_stage_state(*_stage, command, _slice);
+        if (_result != Steinberg::kResultOk && _result != Steinberg::kNotImplemented) {
+            return _result;
+        }
+        if (state->seek(_offset + _size, Steinberg::IBStream::kIBSeekSet, nullptr) != Steinberg::kResultOk) {
+            return Steinberg::kResultFalse;
+        }
+    }
+    return Steinberg::kResultOk;
+}
+
+Steinberg::tresult hosted_plugin::get_state(worker_command command, Steinberg::IBStream* state)
+{
+    if (!is_loaded()) {
+        return Steinberg::kNotInitialized;
+    }
+    if (!is_chain()) {
+        return get_stage_state(*_stages.front(), command, state);
+    }
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        std::int64_t _size = 0;
+        Steinberg::int64 _size_position = 0;
+        if (state->tell(&_size_position) != Steinberg::kResultOk || state->write(&_size, sizeof(_size), nullptr) != Steinberg::kResultOk) {
+            return Steinberg::kResultFalse;
+        }
+        const Steinberg::tresult _result = get_stage_state(*_stage, command, state);
+        if (_result != Steinberg::kResultOk && _result != Steinberg::kNotImplemented) {
+            return _result;
+        }
+        Steinberg::int64 _end = 0;
+        if (state->seek(0, Steinberg::IBStream::kIBSeekEnd, &_end) != Steinberg::kResultOk) {
+            return Steinberg::kResultFalse;
+        }
+        _size = _end - _size_position - static_cast<std::int64_t>(sizeof(_size));
+        if (state->seek(_size_position, Steinberg::IBStream::kIBSeekSet, nullptr) != Steinberg::kResultOk || state->write(&_size, sizeof(_size), nullptr) != Steinberg::kResultOk
+            || state->seek(_end, Steinberg::IBStream::kIBSeekSet, nullptr) != Steinberg::kResultOk) {
+            return Steinberg::kResultFalse;
+        }
+    }
+    return Steinberg::kResultOk;
+}
+
+void hosted_plugin::unload()
+{
+    stop_processing();
+    _stages.clear();
+    _chain_parameters.clear();
+    _chain_parameter_ids.clear();
+}
+
+bool hosted_plugin::has_pending_blocks() const
+{
+    // read_position and not _read_position since the dispatcher asks while another thread processes
+    return _transport->write_position.load(std::memory_order_acquire) != _transport->read_position.load(std::memory_order_acquire);
+}
+
+void hosted_plugin::process_pending_blocks()
+{
+    // blocks published meanwhile are taken right away, a proxy that queues blocks ahead, like
+    // offline rendering does, keeps the plugin busy without going through the dispatcher
+    while (_read_position != _transport->write_position.load(std::memory_order_acquire)) {
+        process_slot(get_transport_slot(_transport, _read_position));
+        ++_read_position;
+        _response_signal.store(_read_position);
+    }
+}
+
+void hosted_plugin::prepare_stages()
+{
+    // single plugins exchange parameter changes with the transport directly, chains route them
+    std::size_t _chain_channel_count = 0;
+    for (std::size_t _index = 0; _index < _stages.size(); ++_index) {
+        hosted_stage& _stage = *_stages[_index];
+        Steinberg::Vst::HostProcessData& _data = _stage.process_data;
+        _data.prepare(*_stage.component, 0, _symbolic_sample_size);
+        _data.inputParameterChanges = is_chain() ? &_stage.input_parameter_changes : &_input_parameter_changes;
+        _data.outputParameterChanges = is_chain() ? &_stage.output_parameter_changes : &_output_parameter_changes;
+        _data.outputEvents = &_stage.output_events;
+        if (_index > 0 && _data.numInputs > 0) {
+            _chain_channel_count = std::max<std::size_t>(_chain_channel_count, _data.inputs[0].numChannels);
+        }
+        if (_index + 1 < _stages.size() && _data.numOutputs > 0) {
+            _chain_channel_count = std::max<std::size_t>(_chain_channel_count, _data.outputs[0].numChannels);
+        }
+    }
+    _chain_buffers.resize(_chain_channel_count);
+    for (std::vector<std::byte>& _buffer : _chain_buffers) {
+        _buffer.assign(_transport->channel_stride, std::byte { 0 });
+    }
+}
+
+void hosted_plugin::stop_processing()
+{
+    if (_scheduler) {
+        _scheduler->remove(this);
+        _scheduler = nullptr;
+    }
+    _response_signal.close();
+    _transport_memory.close();
+    _transport = nullptr;
+}
+
+void hosted_plugin::route_input_parameters()
+{
+    for (std::unique_ptr<hosted_stage>& _stage : _stages) {
+        _stage->input_parameter_changes.clearQueue();
+    }
+    const Steinberg::int32 _queue_count = _input_parameter_changes.getParameterCount();
+    for (Steinberg::int32 _queue_index = 0; _queue_index < _queue_count; ++_queue_index) {
+        Steinberg::Vst::IParamValueQueue* _queue = _input_parameter_changes.getParameterData(_queue_index);
+        if (!_queue || _queue->getParameterId() >= _chain_parameters.size()) {
+            continue;
+        }
+        const chain_parameter& _parameter = _chain_parameters[_queue->getParameterId()];
+        Steinberg::int32 _index = 0;
+        copy_parameter_points(_queue, _stages[_parameter.stage]->input_parameter_changes.addParameterData(_parameter.id, _index));
+    }
+}
+
+void hosted_plugin::route_output_parameters()
+{
+    for (std::size_t _stage_index = 0; _stage_index < _stages.size(); ++_stage_index) {
+        Steinberg::Vst::ParameterChanges& _changes = _stages[_stage_index]->output_parameter_changes;
+        const Steinberg::int32 _queue_count = _changes.getParameterCount();
+        for (Steinberg::int32 _queue_index = 0; _queue_index < _queue_count; ++_queue_index) {
+            Steinberg::Vst::IParamValueQueue* _queue = _changes.getParameterData(_queue_index);
+            const auto _found = _queue ? _chain_parameter_ids[_stage_index].find(_queue->getParameterId()) : _chain_parameter_ids[_stage_index].end();
+            if (_found == _chain_parameter_ids[_stage_index].end()) {
+                continue;
+            }
+            Steinberg::int32 _index = 0;
+            copy_parameter_points(_queue, _output_parameter_changes.addParameterData(_found->second, _index));
+        }
+    }
+}
+
+void hosted_plugin::connect_stage_buffers(std::size_t index, transport_slot* slot)
+{
+    hosted_stage& _stage = *_stages[index];
+    Steinberg::Vst::HostProcessData& _data = _stage.process_data;
+    const bool _is_double = _symbolic_sample_size == Steinberg::Vst::kSample64;
+    const bool _is_last = index + 1 == _stages.size();
+
+    // the first plugin reads the channels of active buses from the transport, where they are
+    // packed in bus order. The next ones read the main output of the previous plugin from the chain
+    // buffers. Everything else is fed silence
+    const Steinberg::Vst::AudioBusBuffers* _previous_outputs = nullptr;
+    std::int32_t _previous_channel_count = 0;
+    if (index > 0 && _stages[index - 1]->process_data.numOutputs > 0 && _stages[index - 1]->active_outputs[0]) {
+        _previous_outputs = _stages[index - 1]->process_data.outputs;
+        _previous_channel_count = std::min<std::int32_t>(_previous_outputs->numChannels, static_cast<std::int32_t>(_chain_buffers.size()));
+    }
+    std::uint32_t _channel = 0;
+    for (std::int32_t _bus = 0; _bus < _data.numInputs; ++_bus) {
+        Steinberg::Vst::AudioBusBuffers& _buffers = _data.inputs[_bus];
+        const bool _is_active = _bus < static_cast<std::int32_t>(_stage.active_inputs.size()) && _stage.active_inputs[_bus];
+        _buffers.silenceFlags = 0;
+        for (std::int32_t _bus_channel = 0; _bus_channel < _buffers.numChannels; ++_bus_channel) {
+            // channels flagged silent are not copied by the proxy nor cleared by plugins
+            void* _buffer = _silence_buffer.data();
+            if (index == 0 && _is_active && _channel < _transport->input_channels) {
+                if (!(slot->input_silence_flags & (std::uint64_t(1) << _channel))) {
+                    _buffer = get_transport_channel(_transport, slot, Steinberg::Vst::kInput, _channel);
+                }
+            } else if (index > 0 && _is_active && _bus == 0 && _bus_channel < _previous_channel_count) {
+                if (!(_previous_outputs->silenceFlags & (std::uint64_t(1) << _bus_channel))) {
+                    _buffer = _chain_buffers[_bus_channel].data();
+                }
+            }
+            if (_buffer == _silence_buffer.data()) {
+                _buffers.silenceFlags |= std::uint64_t(1) << _bus_channel;
+            }
+            _channel += _is_active ? 1 : 0;
+            set_channel_buffer(_buffers, _bus_channel, _buffer, _is_double);
+        }
+    }
+
+    // the last plugin writes to the transport and the others write their main output to the chain
+    // buffers, so that the plugins in between process them in place
+    _channel = 0;
+    for (std::int32_t _bus = 0; _bus < _data.numOutputs; ++_bus) {
+        Steinberg::Vst::AudioBusBuffers& _buffers = _data.outputs[_bus];
+        const bool _is_active = _bus < static_cast<std::int32_t>(_stage.active_outputs.size()) && _stage.active_outputs[_bus];
+        _buffers.silenceFlags = 0;
+        for (std::int32_t _bus_channel = 0; _bus_channel < _buffers.numChannels; ++_bus_channel) {
+            void* _buffer = _scratch_buffer.data();
+            if (_is_last && _is_active && _channel < _transport->output_channels) {
+                _buffer = get_transport_channel(_transport, slot, Steinberg::Vst::kOutput, _channel++);
+            } else if (!_is_last && _is_active && _bus == 0 && _bus_channel < static_cast<std::int32_t>(_chain_buffers.size())) {
+                _buffer = _chain_buffers[_bus_channel].data();
+            }
+            set_channel_buffer(_buffers, _bus_channel, _buffer, _is_double);
+        }
+    }
+}
+
+void hosted_plugin::process_slot(transport_slot* slot)
+{
+    slot->start_time = get_transport_time();
+
+    _input_parameter_changes.clearQueue();
+    _output_parameter_changes.clearQueue();
+    _input_events.clear();
+    read_transport_parameters(_transport, slot, Steinberg::Vst::kInput, &_input_parameter_changes);
+    read_transport_events(_transport, slot, Steinberg::Vst::kInput, &_input_events);
+    _process_context = slot->process_context;
+    if (is_chain()) {
+        route_input_parameters();
+    }
+
+    // events go down the chain, a plugin that has an event output replaces them with its own
+    Steinberg::Vst::IEventList* _events = &_input_events;
+    slot->result = Steinberg::kResultOk;
+    for (std::size_t _index = 0; _index < _stages.size(); ++_index) {
+        hosted_stage& _stage = *_stages[_index];
+        connect_stage_buffers(_index, slot);
+        _stage.output_events.clear();
+        _stage.output_parameter_changes.clearQueue();
+        _stage.process_data.inputEvents = _events;
+        _stage.process_data.processContext = slot->has_process_context ? &_process_context : nullptr;
+        _stage.process_data.numSamples = slot->num_samples;
+        const Steinberg::tresult _result = _stage.processor->process(_stage.process_data);
+        slot->result = slot->result == Steinberg::kResultOk ? _result : slot->result;
+        if (_stage.has_event_output) {
+            _events = &_stage.output_events;
+        }
+    }
+    slot->end_time = get_transport_time();
+
+    if (is_chain()) {
+        route_output_parameters();
+    }
+    hosted_stage& _last_stage = *_stages.back();
+    write_transport_parameters(_transport, slot, Steinberg::Vst::kOutput, &_output_parameter_changes);
+    write_transport_events(_transport, slot, Steinberg::Vst::kOutput, &_last_stage.output_events);
+
+    std::uint32_t _channel = 0;
+    slot->output_silence_flags = 0;
+    for (std::int32_t _bus = 0; _bus < _last_stage.process_data.numOutputs; ++_bus) {
+        const Steinberg::Vst::AudioBusBuffers& _buffers = _last_stage.process_data.outputs[_bus];
+        if (_bus >= static_cast<std::int32_t>(_last_stage.active_outputs.size()) || !_last_stage.active_outputs[_bus]) {
+            continue;
+        }
+        for (std::int32_t _bus_channel = 0; _bus_channel < _buffers.numChannels && _channel < _transport->output_channels; ++_bus_channel, ++_channel) {
+            if (_buffers.silenceFlags & (std::uint64_t(1) << _bus_channel)) {
+                slot->output_silence_flags |= std::uint64_t(1) << _channel;
+            }
+        }
+    }
+}
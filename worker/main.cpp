@@ -0,0 +1,439 @@
+#include <public.sdk/source/vst/hosting/hostclasses.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+
+#include <state.hpp>
+#include <worker.hpp>
+
+
+constexpr std::chrono::milliseconds parent_check_interval { 500 };
+
+struct worker_arguments {
+    std::string group_name;
+    std::string scan_path; // scanner mode, the process scans this module and exits
+    std::string output_path;
+    std::uint64_t parent_process_id { 0 };
+    ipc_wait_settings wait_settings;
+    std::uint32_t thread_count { 0 };
+    realtime_settings realtime;
+};
+
+[[nodiscard]] bool parse_worker_arguments(int argc, char* argv[], worker_arguments& arguments)
+{
+    for (int _index = 1; _index + 1 < argc; _index += 2) {
+        const std::string _key = argv[_index];
+        const std::string _value = argv[_index + 1];
+        if (_key == "--group") {
+            arguments.group_name = _value;
+        } else if (_key == "--scan") {
+            arguments.scan_path = _value;
+        } else if (_key == "--output") {
+            arguments.output_path = _value;
+        } else if (_key == "--parent") {
+            arguments.parent_process_id = std::stoull(_value);
+        } else if (_key == "--wait") {
+            arguments.wait_settings.mode = _value == "spin" ? ipc_wait_mode::spin : ipc_wait_mode::sleep;
+        } else if (_key == "--spin") {
+            arguments.wait_settings.spin_duration = std::chrono::microseconds(std::stoll(_value));
+        } else if (_key == "--threads") {
+            arguments.thread_count = static_cast<std::uint32_t>(std::stoul(_value));
+        } else if (_key == "--policy") {
+            arguments.realtime.policy = _value == "fifo" ? realtime_policy::fifo : (_value == "rr" ? realtime_policy::round_robin : realtime_policy::none);
+        } else if (_key == "--priority") {
+            arguments.realtime.priority = std::stoi(_value);
+        } else if (_key == "--cpus") {
+            std::istringstream _cpus(_value);
+            std::string _cpu;
+            while (std::getline(_cpus, _cpu, ',')) {
+                arguments.realtime.cpus.push_back(static_cast<std::uint32_t>(std::stoul(_cpu)));
+            }
+        } else if (_key == "--lock-memory") {
+            arguments.realtime.should_lock_memory = _value == "1";
+        }
+    }
+    return !arguments.group_name.empty() || (!arguments.scan_path.empty() && !arguments.output_path.empty());
+}
+
+[[nodiscard]] int run_scanner(const worker_arguments& arguments)
+{
+    // the result goes through a single module scan cache so the proxy reads it like any other
+    scanned_module _module;
+    _module.path = std::filesystem::u8path(arguments.scan_path);
+    if (!get_module_fingerprint(_module.path, _module.modification_time, _module.size)) {
+        _module.blocked_reason = "could not read the module files";
+    } else {
+        try {
+            scan_module(_module.path, _module);
+        } catch (const std::exception& _exception) {
+            _module.classes.clear();
+            _module.blocked_reason = _exception.what();
+        }
+    }
+    if (!scan_cache::write(std::filesystem::u8path(arguments.output_path), { _module })) {
+        return 1;
+    }
+    return _module.blocked_reason.empty() ? 0 : 2;
+}
+
+// the load_plugin payload holds one record per class, see worker_command
+[[nodiscard]] bool read_hosted_classes(const std::byte* payload, std::size_t payload_size, std::vector<hosted_class>& classes)
+{
+    std::size_t _offset = 0;
+    while (_offset < payload_size) {
+        std::uint32_t _path_size = 0;
+        if (payload_size - _offset < sizeof(Steinberg::TUID) + sizeof(_path_size)) {
+            return false;
+        }
+        std::memcpy(&_path_size, payload + _offset + sizeof(Steinberg::TUID), sizeof(_path_size));
+        if (payload_size - _offset - sizeof(Steinberg::TUID) - sizeof(_path_size) < _path_size) {
+            return false;
+        }
+        hosted_class& _class = classes.emplace_back();
+        _class.class_id = VST3::UID::fromTUID(reinterpret_cast<const Steinberg::int8*>(payload + _offset));
+        _offset += sizeof(Steinberg::TUID) + sizeof(_path_size);
+        _class.module_path.assign(reinterpret_cast<const char*>(payload + _offset), _path_size);
+        _offset += _path_size;
+    }
+    return !classes.empty();
+}
+
+struct worker_session {
+    shared_memory control_memory;
+    control_block* control { nullptr };
+    ipc_signal response_signal;
+    std::uint32_t sequence { 0 }; // last command answered
+    hosted_plugin plugin;
+    std::vector<VST3::Hosting::Module::Ptr> modules; // loaded ahead by a standby session, plugins of later sessions share them
+    block_scheduler* scheduler { nullptr };
+    Steinberg::IPtr<state_stream> outgoing_state; // captured by a get_state command until the proxy copied it
+
+    [[nodiscard]] Steinberg::tresult apply_state(worker_command command, std::size_t payload_size);
+    [[nodiscard]] Steinberg::tresult capture_state(worker_command command);
+    [[nodiscard]] bool open(const std::string& control_name);
+    [[nodiscard]] Steinberg::tresult execute(worker_command command);
+};
+
+Steinberg::tresult worker_session::apply_state(worker_command command, std::size_t payload_size)
+{
+    if (payload_size != sizeof(state_transfer)) {
+        return Steinberg::kInvalidArgument;
+    }
+    state_transfer _transfer;
+    std::memcpy(&_transfer, control->payload, sizeof(_transfer));
+    Steinberg::IPtr<state_stream> _stream = Steinberg::owned(new state_stream());
+    if (!_stream->open(_transfer)) {
+        std::cerr << "Sandbox worker error: could not open a state of " << _transfer.size << " bytes" << std::endl;
+        return Steinberg::kInternalError;
+    }
+
+    // the plugin reads the state straight from the memory the proxy wrote it to
+    return plugin.set_state(command, _stream);
+}
+
+Steinberg::tresult worker_session::capture_state(worker_command command)
+{
+    outgoing_state = Steinberg::owned(new state_stream());
+    if (!outgoing_state->create()) {
+        outgoing_state = nullptr;
+        return Steinberg::kOutOfMemory;
+    }
+    const Steinberg::tresult _result = plugin.get_state(command, outgoing_state);
+    if (_result != Steinberg::kResultOk) {
+        outgoing_state = nullptr;
+        return _result;
+    }
+    const state_transfer _transfer = outgoing_state->get_transfer();
+    std::memcpy(control->payload, &_transfer, sizeof(_transfer));
+    control->payload_size = sizeof(_transfer);
+    return _result;
+}
+
+bool worker_session::open(const std::string& control_name)
+{
+    if (!control_memory.open(control_name, sizeof(control_block))) {
+        std::cerr << "Sandbox worker error: could not open control block " << control_name << std::endl;
+        return false;
+    }
+    control = static_cast<control_block*>(control_memory.data());
+    if (control->magic != sandbox_protocol_magic || control->version != sandbox_protocol_version) {
+        std::cerr << "Sandbox worker error: control block " << control_name << " has an unexpected version" << std::endl;
+        return false;
+    }
+    if (!response_signal.open(control_name + ".rsp", &control->response_sequence)) {
+        std::cerr << "Sandbox worker error: could not open control signals" << std::endl;
+        return false;
+    }
+    sequence = control->command_sequence.load(std::memory_order_acquire);
+    plugin.parameter_generation = &control->parameter_generation;
+    return true;
+}
+
+Steinberg::tresult worker_session::execute(worker_command command)
+{
+    const std::size_t _payload_size = static_cast<std::size_t>(control->payload_size);
+    control->payload_size = 0;
+
+    switch (command) {
+    case worker_command::load_plugin: {
+        std::vector<hosted_class> _classes;
+        if (!read_hosted_classes(control->payload, _payload_size, _classes)) {
+            return Steinberg::kInvalidArgument;
+        }
+        return plugin.load(_classes);
+    }
+    case worker_command::load_module: {
+        std::vector<hosted_class> _classes;
+        if (!read_hosted_classes(control->payload, _payload_size, _classes)) {
+            return Steinberg::kInvalidArgument;
+        }
+        for (const hosted_class& _class : _classes) {
+            std::string _module_error;
+            VST3::Hosting::Module::Ptr _module = get_shared_module(_class.module_path, _module_error);
+            if (!_module) {
+                std::cerr << "Sandbox worker error: could not create Module with error " << _module_error << std::endl;
+                return Steinberg::kResultFalse;
+            }
+            modules.push_back(std::move(_module));
+        }
+        return Steinberg::kResultOk;
+    }
+    case worker_command::setup_processing: {
+        if (_payload_size != sizeof(transport_setup)) {
+            return Steinberg::kInvalidArgument;
+        }
+        transport_setup _setup;
+        std::memcpy(&_setup, control->payload, sizeof(_setup));
+        return plugin.setup_processing(_setup, *scheduler);
+    }
+    case worker_command::can_process_sample_size: {
+        std::int32_t _symbolic_sample_size = 0;
+        if (_payload_size != sizeof(_symbolic_sample_size)) {
+            return Steinberg::kInvalidArgument;
+        }
+        std::memcpy(&_symbolic_sample_size, control->payload, sizeof(_symbolic_sample_size));
+        return plugin.can_process_sample_size(_symbolic_sample_size);
+    }
+    case worker_command::get_latency_samples:
+    case worker_command::get_tail_samples: {
+        std::uint32_t _samples = 0;
+        const Steinberg::tresult _result = command == worker_command::get_latency_samples ? plugin.get_latency_samples(_samples) : plugin.get_tail_samples(_samples);
+        if (_result != Steinberg::kResultOk) {
+            return _result;
+        }
+        std::memcpy(control->payload, &_samples, sizeof(_samples));
+        control->payload_size = sizeof(_samples);
+        return Steinberg::kResultOk;
+    }
+    case worker_command::get_buses: {
+        std::vector<scanned_bus> _buses;
+        const Steinberg::tresult _result = plugin.get_buses(_buses);
+        if (_result != Steinberg::kResultOk) {
+            return _result;
+        }
+        if (_buses.size() * sizeof(scanned_bus) > sandbox_control_payload_capacity) {
+            return Steinberg::kOutOfMemory;
+        }
+        std::memcpy(control->payload, _buses.data(), _buses.size() * sizeof(scanned_bus));
+        control->payload_size = _buses.size() * sizeof(scanned_bus);
+        return Steinberg::kResultOk;
+    }
+    case worker_command::set_bus_arrangements: {
+        bus_arrangements _arrangements;
+        if (_payload_size != sizeof(_arrangements)) {
+            return Steinberg::kInvalidArgument;
+        }
+        std::memcpy(&_arrangements, control->payload, sizeof(_arrangements));
+        const Steinberg::tresult _result = plugin.set_bus_arrangements(_arrangements);
+        std::memcpy(control->payload, &_arrangements, sizeof(_arrangements));
+        control->payload_size = sizeof(_arrangements);
+        return _result;
+    }
+    case worker_command::activate_bus: {
+        bus_activation _activation;
+        if (_payload_size != sizeof(_activation)) {
+            return Steinberg::kInvalidArgument;
+        }
+        std::memcpy(&_activation, control->payload, sizeof(_activation));
+        return plugin.activate_bus(_activation);
+    }
+    case worker_command::get_parameters: {
+        std::int32_t _first_index = 0;
+        if (_payload_size != sizeof(_first_index)) {
+            return Steinberg::kInvalidArgument;
+        }
+        if (!plugin.is_loaded()) {
+            return Steinberg::kNotInitialized;
+        }
+        std::memcpy(&_first_index, control->payload, sizeof(_first_index));
+        parameter_page* _page = reinterpret_cast<parameter_page*>(control->payload);
+        _page->parameter_count = plugin.get_parameter_count();
+        _page->info_count = 0;
+        for (std::int32_t _index = std::max(0, _first_index); _index < _page->parameter_count && _page->info_count < static_cast<std::int32_t>(std::size(_page->infos)); ++_index) {
+            if (plugin.get_parameter_info(_index, _page->infos[_page->info_count]) == Steinberg::kResultOk) {
+                ++_page->info_count;
+            }
+        }
+        control->payload_size = sizeof(parameter_page);
+        return Steinberg::kResultOk;
+    }
+    case worker_command::get_param_string_by_value:
+    case worker_command::get_param_value_by_string:
+    case worker_command::normalized_param_to_plain:
+    case worker_command::plain_param_to_normalized: {
+        parameter_conversion _conversion;
+        if (_payload_size != sizeof(_conversion)) {
+            return Steinberg::kInvalidArgument;
+        }
+        std::memcpy(&_conversion, control->payload, sizeof(_conversion));
+        const Steinberg::tresult _result = plugin.convert_parameter(command, _conversion);
+        std::memcpy(control->payload, &_conversion, sizeof(_conversion));
+        control->payload_size = sizeof(_conversion);
+        return _result;
+    }
+    case worker_command::set_active:
+    case worker_command::set_processing: {
+        std::int32_t _state = 0;
+        if (_payload_size != sizeof(_state)) {
+            return Steinberg::kInvalidArgument;
+        }
+        std::memcpy(&_state, control->payload, sizeof(_state));
+        return command == worker_command::set_active ? plugin.set_active(_state != 0) : plugin.set_processing(_state != 0);
+    }
+    case worker_command::release_state:
+        outgoing_state = nullptr;
+        return Steinberg::kResultOk;
+    case worker_command::processor_set_state:
+    case worker_command::controller_set_state:
+    case worker_command::controller_set_component_state:
+        return apply_state(command, _payload_size);
+    case worker_command::processor_get_state:
+    case worker_command::controller_get_state:
+        return capture_state(command);
+    case worker_command::shutdown:
+        plugin.unload();
+        modules.clear();
+        return Steinberg::kResultOk;
+    default:
+        return Steinberg::kNotImplemented;
+    }
+}
+
+// answers the commands of one control block, returns whether it had a new one
+template <typename execute_t>
+[[nodiscard]] bool answer_command(control_block* control, ipc_signal& response_signal, std::uint32_t& sequence, execute_t&& execute)
+{
+    const std::uint32_t _sequence = control->command_sequence.load(std::memory_order_acquire);
+    if (_sequence == sequence) {
+        return false;
+    }
+    sequence = _sequence;
+    control->result = execute(control->command);
+    response_signal.store(sequence);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    worker_arguments _arguments;
+    if (!parse_worker_arguments(argc, argv, _arguments)) {
+        std::cerr << "usage: vstsandbox_worker --group <name> --parent <pid> [--wait sleep|spin] [--spin <microseconds>] [--threads <count>]" << std::endl;
+        std::cerr << "                         [--policy none|fifo|rr] [--priority <1-99>] [--cpus <cpu,cpu,...>] [--lock-memory 0|1]" << std::endl;
+        std::cerr << "       vstsandbox_worker --scan <module> --output <file> [--parent <pid>]" << std::endl;
+        return 1;
+    }
+
+    // exits even when a plugin call never returns. PR_SET_PDEATHSIG is not enough because it fires
+    // when the thread that spawned us exits, which can be any short lived host thread
+    if (_arguments.parent_process_id) {
+        std::thread([_parent_process_id = _arguments.parent_process_id]() {
+            while (is_process_running(_parent_process_id)) {
+                std::this_thread::sleep_for(parent_check_interval);
+            }
+            std::_Exit(0);
+        }).detach();
+    }
+
+    Steinberg::IPtr<Steinberg::Vst::HostApplication> _host_application = Steinberg::owned(new Steinberg::Vst::HostApplication());
+    Steinberg::Vst::PluginContextFactory::instance().setPluginContext(_host_application);
+
+    if (!_arguments.scan_path.empty()) {
+        const int _exit_code = run_scanner(_arguments);
+        Steinberg::Vst::PluginContextFactory::instance().setPluginContext(nullptr);
+        return _exit_code;
+    }
+
+    shared_memory _group_memory;
+    if (!_group_memory.open(_arguments.group_name, sizeof(worker_group_block))) {
+        std::cerr << "Sandbox worker error: could not open group block " << _arguments.group_name << std::endl;
+        return 1;
+    }
+    worker_group_block* _group = static_cast<worker_group_block*>(_group_memory.data());
+    if (_group->magic != sandbox_protocol_magic || _group->version != sandbox_protocol_version) {
+        std::cerr << "Sandbox worker error: group block has an unexpected version" << std::endl;
+        return 1;
+    }
+    ipc_signal _command_doorbell;
+    ipc_signal _response_signal;
+    if (!_command_doorbell.open(_arguments.group_name + ".cmd", &_group->command_doorbell) || !_response_signal.open(_arguments.group_name + ".rsp", &_group->control.response_sequence)) {
+        std::cerr << "Sandbox worker error: could not open group signals" << std::endl;
+        return 1;
+    }
+    block_scheduler _scheduler;
+    if (!_scheduler.start(_group, _arguments.group_name, _arguments.thread_count, _arguments.wait_settings, _arguments.realtime)) {
+        return 1;
+    }
+
+    // every command of every session runs on this thread, like the main thread of a regular host
+    std::vector<std::unique_ptr<worker_session>> _sessions;
+    std::uint32_t _group_sequence = 0;
+    bool _is_running = true;
+    while (_is_running) {
+        const std::uint32_t _seen_doorbell = _command_doorbell.load();
+        bool _has_answered = answer_command(&_group->control, _response_signal, _group_sequence, [&](worker_command command) -> Steinberg::tresult {
+            if (command == worker_command::shutdown) {
+                _is_running = false;
+                return Steinberg::kResultOk;
+            }
+            if (command != worker_command::open_session) {
+                return Steinberg::kNotImplemented;
+            }
+            std::unique_ptr<worker_session> _session = std::make_unique<worker_session>();
+            const std::string _control_name(reinterpret_cast<const char*>(_group->control.payload), static_cast<std::size_t>(_group->control.payload_size));
+            if (!_session->open(_control_name)) {
+                return Steinberg::kResultFalse;
+            }
+            _session->scheduler = &_scheduler;
+            _sessions.push_back(std::move(_session));
+            return Steinberg::kResultOk;
+        });
+
+        for (std::size_t _index = 0; _index < _sessions.size();) {
+            worker_session& _session = *_sessions[_index];
+            bool _is_closed = false;
+            _has_answered |= answer_command(_session.control, _session.response_signal, _session.sequence, [&](worker_command command) {
+                _is_closed = command == worker_command::shutdown;
+                return _session.execute(command);
+            });
+            if (_is_closed) {
+                _sessions.erase(_sessions.begin() + static_cast<std::ptrdiff_t>(_index));
+            } else {
+                ++_index;
+            }
+        }
+
+        if (!_has_answered) {
+            _command_doorbell.wait(_seen_doorbell, parent_check_interval);
+            if (_arguments.parent_process_id && !is_process_running(_arguments.parent_process_id)) {
+                break;
+            }
+        }
+    }
+
+    _sessions.clear();
+    _scheduler.stop();
+    Steinberg::Vst::PluginContextFactory::instance().setPluginContext(nullptr);
+    return 0;
+}
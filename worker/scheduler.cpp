@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <future>
+#include <sstream>
+
+#include <worker.hpp>
+
+constexpr std::chrono::milliseconds scheduler_idle_timeout { 100 };
+
+block_scheduler::~block_scheduler()
+{
+    stop();
+}
+
+bool block_scheduler::start(worker_group_block* group, const std::string& group_name, std::uint32_t thread_count, const ipc_wait_settings& wait_settings, const realtime_settings& realtime)
+{
+    stop();
+    if (!_block_doorbell.open(group_name + ".blk", &group->block_doorbell)) {
+        std::cerr << "Sandbox worker error: could not open the block doorbell of " << group_name << std::endl;
+        return false;
+    }
+    _group = group;
+    _wait_settings = wait_settings;
+    _realtime = realtime;
+    _max_thread_count = std::clamp(thread_count ? thread_count : std::thread::hardware_concurrency(), 1u, worker_max_plugins);
+    _queues = std::make_unique<task_queue[]>(_max_thread_count);
+    _plugins.reserve(worker_max_plugins);
+    _dispatched_plugins.reserve(worker_max_plugins);
+    _threads.reserve(_max_thread_count);
+
+    _is_running.store(true);
+    _thread_count.store(1, std::memory_order_release);
+    start_thread(0);
+    return true;
+}
+
+void block_scheduler::stop()
+{
+    if (!_is_running.exchange(false)) {
+        return;
+    }
+    _block_doorbell.notify();
+    {
+        std::lock_guard _lock(_wake_mutex);
+        ++_wake_epoch;
+    }
+    _wake_condition.notify_all();
+    _plugins_condition.notify_all();
+    for (std::thread& _thread : _threads) {
+        _thread.join();
+    }
+    _threads.clear();
+    _thread_count.store(0);
+    _block_doorbell.close();
+}
+
+bool block_scheduler::add(hosted_plugin* plugin)
+{
+    std::lock_guard _lock(_plugins_mutex);
+    if (!_is_running.load() || _plugins.size() >= worker_max_plugins) {
+        return false;
+    }
+    plugin->schedule.store(schedule_state::idle, std::memory_order_release);
+    _plugins.push_back(plugin);
+    ++_plugins_version;
+    _has_plugins_changed.store(true, std::memory_order_release);
+
+    // one more thread per processing plugin until the configured count
+    if (_threads.size() < std::min<std::size_t>(_max_thread_count, _plugins.size())) {
+        const std::uint32_t _thread_index = static_cast<std::uint32_t>(_threads.size());
+        start_thread(_thread_index);
+        _thread_count.store(_thread_index + 1, std::memory_order_release);
+    }
+    return true;
+}
+
+void block_scheduler::remove(hosted_plugin* plugin)
+{
+    std::unique_lock _lock(_plugins_mutex);
+    const std::vector<hosted_plugin*>::iterator _found = std::find(_plugins.begin(), _plugins.end(), plugin);
+    if (_found == _plugins.end()) {
+        return;
+    }
+    _plugins.erase(_found);
+    const std::uint64_t _version = ++_plugins_version;
+    _has_plugins_changed.store(true, std::memory_order_release);
+    _lock.unlock();
+
+    // claims fail from now on, a thread that already owns the plugin finishes its blocks first
+    schedule_state _idle = schedule_state::idle;
+    while (!plugin->schedule.compare_exchange_weak(_idle, schedule_state::removed, std::memory_order_acq_rel)) {
+        _idle = schedule_state::idle;
+        std::this_thread::yield();
+    }
+
+    // the dispatcher may still look at the plugin until it picks up the new list
+    _lock.lock();
+    ring_doorbell();
+    _plugins_condition.wait(_lock, [&]() { return _dispatched_version >= _version || !_is_running.load(); });
+}
+
+void block_scheduler::lock_memory()
+{
+    if (_realtime.should_lock_memory && !lock_process_memory()) {
+        report_refusal(realtime_refused_memory_lock, "could not lock the worker memory, the memlock limit of the user is too low");
+    }
+}
+
+void block_scheduler::start_thread(std::uint32_t thread_index)
+{
+    // returns once the thread has its scheduling, so that the proxy sees the refusals as soon as
+    // the command that started the thread is answered
+    std::promise<void> _prepared;
+    std::future<void> _is_prepared = _prepared.get_future();
+    _threads.emplace_back([this, thread_index, &_prepared]() {
+        prepare_thread();
+        _prepared.set_value();
+        if (thread_index) {
+            run_helper(thread_index);
+        } else {
+            run_dispatcher();
+        }
+    });
+    _is_prepared.wait();
+}
+
+void block_scheduler::prepare_thread()
+{
+    if (_realtime.policy != realtime_policy::none) {
+        std::int32_t _priority = _realtime.priority;
+        const realtime_grant _grant = set_thread_realtime(_realtime.policy, _priority);
+        std::ostringstream _message;
+        _message << "could not get real time priority " << _realtime.priority;
+        if (_grant == realtime_grant::reduced_priority) {
+            _message << ", running at priority " << _priority << " which the rtprio limit of the user allows";
+        } else if (_grant == realtime_grant::nice) {
+            _message << ", running with nice value " << _priority << " instead. Raise the rtprio limit of the user or grant CAP_SYS_NICE to the worker";
+        } else if (_grant == realtime_grant::none) {
+            _message << " nor a lower nice value. Raise the rtprio limit of the user or grant CAP_SYS_NICE to the worker";
+        }
+        if (_grant != realtime_grant::full) {
+            report_refusal(realtime_refused_priority, _message.str());
+        }
+    }
+    if (!set_thread_affinity(_realtime.cpus)) {
+        report_refusal(realtime_refused_affinity, "could not pin the processing threads to the cpus of the worker");
+    }
+}
+
+void block_scheduler::report_refusal(std::uint32_t refusal, const std::string& message)
+{
+    // once per worker, every thread gets the same answer
+    if (!(_group->realtime_refusals.fetch_or(refusal, std::memory_order_relaxed) & refusal)) {
+        std::cerr << "Sandbox worker error: " << message << std::endl;
+    }
+}
+
+void block_scheduler::run_dispatcher()
+{
+    while (_is_running.load(std::memory_order_relaxed)) {
+        const std::uint32_t _seen_doorbell = _group->block_doorbell.load(std::memory_order_seq_cst);
+        if (_has_plugins_changed.exchange(false, std::memory_order_acq_rel)) {
+            std::lock_guard _lock(_plugins_mutex);
+            _dispatched_plugins.assign(_plugins.begin(), _plugins.end());
+            _dispatched_version = _plugins_version;
+            _plugins_condition.notify_all();
+        }
+
+        // the first task stays on this thread so that a single pending plugin costs no extra wake
+        const std::uint32_t _active_threads = _thread_count.load(std::memory_order_acquire);
+        std::uint32_t _task_count = 0;
+        for (hosted_plugin* _plugin : _dispatched_plugins) {
+            schedule_state _idle = schedule_state::idle;
+            if (_plugin->has_pending_blocks() && _plugin->schedule.compare_exchange_strong(_idle, schedule_state::scheduled, std::memory_order_acq_rel)) {
+                push_task(_task_count++ % _active_threads, _plugin);
+            }
+        }
+        const std::uint32_t _helper_count = std::min(_task_count, _active_threads) - (_task_count ? 1 : 0);
+        if (_helper_count) {
+            {
+                std::lock_guard _lock(_wake_mutex);
+                ++_wake_epoch;
+            }
+            for (std::uint32_t _index = 0; _index < _helper_count; ++_index) {
+                _wake_condition.notify_one();
+            }
+        }
+        while (run_task(0)) {
+        }
+
+        wait_for_blocks(_seen_doorbell);
+    }
+}
+
+void block_scheduler::run_helper(std::uint32_t thread_index)
+{
+    std::uint64_t _seen_epoch = 0;
+    {
+        std::lock_guard _lock(_wake_mutex);
+        _seen_epoch = _wake_epoch;
+    }
+    while (_is_running.load(std::memory_order_relaxed)) {
+        while (run_task(thread_index)) {
+        }
+        if (_wait_settings.mode == ipc_wait_mode::spin) {
+            const std::chrono::steady_clock::time_point _spin_end = std::chrono::steady_clock::now() + _wait_settings.spin_duration;
+            bool _has_run = false;
+            while (!_has_run && std::chrono::steady_clock::now() < _spin_end) {
+                _has_run = run_task(thread_index);
+            }
+            if (_has_run) {
+                continue;
+            }
+        }
+        std::unique_lock _lock(_wake_mutex);
+        _wake_condition.wait(_lock, [&]() { return _wake_epoch != _seen_epoch || !_is_running.load(std::memory_order_relaxed); });
+        _seen_epoch = _wake_epoch;
+    }
+}
+
+void block_scheduler::wait_for_blocks(std::uint32_t seen_doorbell)
+{
+    const auto _has_rung = [&]() {
+        return _group->block_doorbell.load(std::memory_order_seq_cst) != seen_doorbell || !_is_running.load(std::memory_order_relaxed);
+    };
+    if (_wait_settings.mode == ipc_wait_mode::spin) {
+        const std::chrono::steady_clock::time_point _spin_end = std::chrono::steady_clock::now() + _wait_settings.spin_duration;
+        std::uint32_t _iterations = 0;
+        while (std::chrono::steady_clock::now() < _spin_end) {
+            if (_has_rung()) {
+                return;
+            }
+            if (++_iterations % 64 == 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // proxies only enter the kernel to wake us while the flag is set, see worker_host::notify_blocks
+    _group->is_dispatcher_sleeping.store(1, std::memory_order_seq_cst);
+    if (!_has_rung()) {
+        _block_doorbell.wait(seen_doorbell, scheduler_idle_timeout);
+    }
+    _group->is_dispatcher_sleeping.store(0, std::memory_order_relaxed);
+}
+
+void block_scheduler::ring_doorbell()
+{
+    _group->block_doorbell.fetch_add(1, std::memory_order_seq_cst);
+    if (_group->is_dispatcher_sleeping.load(std::memory_order_seq_cst)) {
+        _block_doorbell.notify();
+    }
+}
+
+void block_scheduler::push_task(std::uint32_t thread_index, hosted_plugin* plugin)
+{
+    task_queue& _queue = _queues[thread_index];
+    std::lock_guard _lock(_queue.mutex);
+    _queue.tasks[_queue.back++ % worker_max_plugins] = plugin;
+}
+
+bool block_scheduler::run_task(std::uint32_t thread_index)
+{
+    // our own queue from the back, the others from the front
+    hosted_plugin* _plugin = nullptr;
+    {
+        task_queue& _queue = _queues[thread_index];
+        std::lock_guard _lock(_queue.mutex);
+        if (_queue.front != _queue.back) {
+            _plugin = _queue.tasks[--_queue.back % worker_max_plugins];
+        }
+    }
+    const std::uint32_t _active_threads = _thread_count.load(std::memory_order_acquire);
+    for (std::uint32_t _offset = 1; !_plugin && _offset < _active_threads; ++_offset) {
+        task_queue& _queue = _queues[(thread_index + _offset) % _active_threads];
+        std::lock_guard _lock(_queue.mutex);
+        if (_queue.front != _queue.back) {
+            _plugin = _queue.tasks[_queue.front++ % worker_max_plugins];
+        }
+    }
+    if (!_plugin) {
+        return false;
+    }
+
+    std::uint32_t _seen_doorbell = 0;
+    while (true) {
+        _plugin->process_pending_blocks();
+        _seen_doorbell = _group->block_doorbell.load(std::memory_order_seq_cst);
+        if (!_plugin->has_pending_blocks()) {
+            break;
+        }
+    }
+    _plugin->schedule.store(schedule_state::idle, std::memory_order_seq_cst);
+
+    // the plugin may be gone from here on. A block published after our last look may have rung
+    // while the dispatcher still saw the plugin scheduled, ringing again makes it look once more
+    if (_group->block_doorbell.load(std::memory_order_seq_cst) != _seen_doorbell) {
+        ring_doorbell();
+    }
+    return true;
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <public.sdk/source/vst/hosting/eventlist.h>
+#include <public.sdk/source/vst/hosting/module.h>
+#include <public.sdk/source/vst/hosting/parameterchanges.h>
+#include <public.sdk/source/vst/hosting/plugprovider.h>
+#include <public.sdk/source/vst/hosting/processdata.h>
+#include <pluginterfaces/base/funknownimpl.h>
+#include <pluginterfaces/base/ibstream.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <ipc.hpp>
+#include <scan.hpp>
+#include <transport.hpp>
+
+// points reserved in every parameter queue so that the audio thread does not grow them. A queue
+// holds at most one point per sample offset so we never reserve more than the block size
+constexpr std::int32_t worker_reserved_queue_points = 64;
+
+constexpr std::uint32_t worker_max_plugins = 256; // processing plugins per worker process
+
+
+[[nodiscard]] VST3::Hosting::Module::Ptr get_shared_module(const std::string& module_path, std::string& error);
+
+struct block_scheduler;
+
+enum struct schedule_state : std::uint32_t {
+    idle, // the scheduler may claim the plugin
+    scheduled, // a scheduler thread owns the plugin until it stores idle again
+    removed, // not processing, nothing claims the plugin anymore
+};
+
+// the handler of the sandboxed controller. Edits have no host to go to, restarts that change the
+// display of parameters bump the counter the proxy checks before answering from its cache
+struct worker_component_handler : public Steinberg::U::Implements<Steinberg::U::Directly<Steinberg::Vst::IComponentHandler>> {
+    explicit worker_component_handler(std::atomic<std::uint32_t>* parameter_generation);
+
+    Steinberg::tresult PLUGIN_API beginEdit(Steinberg::Vst::ParamID id) override;
+    Steinberg::tresult PLUGIN_API performEdit(Steinberg::Vst::ParamID id, Steinberg::Vst::ParamValue valueNormalized) override;
+    Steinberg::tresult PLUGIN_API endEdit(Steinberg::Vst::ParamID id) override;
+    Steinberg::tresult PLUGIN_API restartComponent(Steinberg::int32 flags) override;
+
+private:
+    std::atomic<std::uint32_t>* _parameter_generation;
+};
+
+// a plugin class of the module at module_path
+struct hosted_class {
+    std::string module_path;
+    VST3::UID class_id;
+};
+
+// one plugin of a session. Sessions that sandbox a chain run several stages one after the other on
+// every block, each with its own process data
+struct hosted_stage {
+    hosted_stage() = default;
+    hosted_stage(const hosted_stage&) = delete;
+    hosted_stage& operator=(const hosted_stage&) = delete;
+    ~hosted_stage();
+
+    [[nodiscard]] Steinberg::tresult load(const hosted_class& plugin_class, std::atomic<std::uint32_t>* parameter_generation);
+    void unload();
+
+    VST3::Hosting::Module::Ptr host_module;
+    std::shared_ptr<Steinberg::Vst::PlugProvider> plugin_provider;
+    Steinberg::Vst::IComponent* component { nullptr }; // owned by plugin_provider
+    Steinberg::Vst::IEditController* controller { nullptr }; // owned by plugin_provider
+    Steinberg::IPtr<Steinberg::Vst::IAudioProcessor> processor;
+    Steinberg::IPtr<worker_component_handler> component_handler;
+    std::string name;
+    Steinberg::Vst::HostProcessData process_data;
+    Steinberg::Vst::ParameterChanges input_parameter_changes; // chains only, single plugins use the changes of the session
+    Steinberg::Vst::ParameterChanges output_parameter_changes;
+    Steinberg::Vst::EventList output_events { sandbox_max_events };
+    std::vector<bool> active_inputs; // audio buses, the transport only carries the channels of active ones
+    std::vector<bool> active_outputs;
+    bool has_event_input { false };
+    bool has_event_output { false };
+};
+
+struct hosted_plugin {
+    hosted_plugin() = default;
+    hosted_plugin(const hosted_plugin&) = delete;
+    hosted_plugin& operator=(const hosted_plugin&) = delete;
+    ~hosted_plugin();
+
+    // several classes make a chain, blocks go through them in order
+    [[nodiscard]] Steinberg::tresult load(const std::vector<hosted_class>& classes);
+    [[nodiscard]] Steinberg::tresult setup_processing(const transport_setup& setup, block_scheduler& scheduler);
+    [[nodiscard]] Steinberg::tresult can_process_sample_size(std::int32_t symbolic_sample_size);
+    [[nodiscard]] Steinberg::tresult set_active(bool state);
+    [[nodiscard]] Steinberg::tresult set_processing(bool state);
+    [[nodiscard]] Steinberg::tresult set_bus_arrangements(bus_arrangements& arrangements); // arrangements receives what the processor kept
+    [[nodiscard]] Steinberg::tresult activate_bus(const bus_activation& activation);
+    [[nodiscard]] Steinberg::tresult get_latency_samples(std::uint32_t& latency); // sum of the stages
+    [[nodiscard]] Steinberg::tresult get_tail_samples(std::uint32_t& tail); // sum of the stages
+    [[nodiscard]] Steinberg::tresult get_buses(std::vector<scanned_bus>& buses);
+    [[nodiscard]] std::int32_t get_parameter_count() const;
+    [[nodiscard]] Steinberg::tresult get_parameter_info(std::int32_t index, Steinberg::Vst::ParameterInfo& info);
+    [[nodiscard]] Steinberg::tresult convert_parameter(worker_command command, parameter_conversion& conversion);
+    [[nodiscard]] Steinberg::tresult set_state(worker_command command, Steinberg::IBStream* state);
+    [[nodiscard]] Steinberg::tresult get_state(worker_command command, Steinberg::IBStream* state);
+    [[nodiscard]] bool is_loaded() const { return !_stages.empty(); }
+    void unload();
+
+    // called by the scheduler threads, only the thread that moved schedule to scheduled processes
+    [[nodiscard]] bool has_pending_blocks() const;
+    void process_pending_blocks();
+
+    std::atomic<schedule_state> schedule { schedule_state::removed };
+    std::atomic<std::uint32_t>* parameter_generation { nullptr }; // in the control block of the session
+
+private:
+    // chains renumber the parameters of their stages from 0 so that ids of different plugins never collide
+    struct chain_parameter {
+        std::uint32_t stage;
+        std::int32_t index; // in the controller of the stage
+        Steinberg::Vst::ParamID id; // in the controller of the stage
+    };
+
+    [[nodiscard]] bool is_chain() const { return _stages.size() > 1; }
+    void prepare_stages();
+    void stop_processing();
+    void process_slot(transport_slot* slot);
+    void connect_stage_buffers(std::size_t index, transport_slot* slot);
+    void route_input_parameters();
+    void route_output_parameters();
+
+    std::vector<std::unique_ptr<hosted_stage>> _stages;
+    std::vector<chain_parameter> _chain_parameters; // indexed by the id the proxy sees
+    std::vector<std::unordered_map<Steinberg::Vst::ParamID, Steinberg::Vst::ParamID>> _chain_parameter_ids; // per stage, to the id the proxy sees
+    Steinberg::Vst::ParameterChanges _input_parameter_changes;
+    Steinberg::Vst::ParameterChanges _output_parameter_changes;
+    Steinberg::Vst::EventList _input_events { sandbox_max_events };
+    Steinberg::Vst::ProcessContext _process_context {};
+    shared_memory _transport_memory;
+    transport_header* _transport { nullptr };
+    std::uint32_t _read_position { 0 };
+    ipc_signal _response_signal;
+    block_scheduler* _scheduler { nullptr };
+    std::int32_t _symbolic_sample_size { Steinberg::Vst::kSample32 };
+    std::vector<std::byte> _silence_buffer; // feeds the plugin channels the transport does not carry
+    std::vector<std::byte> _scratch_buffer; // receives the plugin channels the transport does not carry
+    std::vector<std::vector<std::byte>> _chain_buffers; // main bus channels passed from stage to stage, processed in place
+};
+
+// processes the blocks of every plugin hosted by the worker. The dispatcher thread sleeps on the
+// block doorbell of the group, claims every plugin that has a pending block when it wakes and
+// spreads them over per thread queues. It processes its own queue and the other threads steal
+// from the front of the busy queues once theirs is empty, so that one slow plugin does not hold
+// the others back. Threads are started on demand, never more than there are processing plugins
+struct block_scheduler {
+    block_scheduler() = default;
+    block_scheduler(const block_scheduler&) = delete;
+    block_scheduler& operator=(const block_scheduler&) = delete;
+    ~block_scheduler();
+
+    [[nodiscard]] bool start(worker_group_block* group, const std::string& group_name, std::uint32_t thread_count, const ipc_wait_settings& wait_settings, const realtime_settings& realtime);
+    void stop();
+
+    // locks the memory of the process when vstsandbox.json asks for it, called once the plugin and
+    // its transport are mapped
+    void lock_memory();
+
+    [[nodiscard]] bool add(hosted_plugin* plugin);
+
+    // returns once neither the dispatcher nor any thread uses the plugin anymore
+    void remove(hosted_plugin* plugin);
+
+private:
+    struct task_queue {
+        std::mutex mutex;
+        std::array<hosted_plugin*, worker_max_plugins> tasks {};
+        std::uint32_t front { 0 }; // free running, every plugin is at most once in all the queues
+        std::uint32_t back { 0 };
+    };
+
+    void start_thread(std::uint32_t thread_index); // the dispatcher is thread 0
+    void prepare_thread();
+    void report_refusal(std::uint32_t refusal, const std::string& message);
+    void run_dispatcher();
+    void run_helper(std::uint32_t thread_index);
+    void wait_for_blocks(std::uint32_t seen_doorbell);
+    void ring_doorbell();
+    void push_task(std::uint32_t thread_index, hosted_plugin* plugin);
+    [[nodiscard]] bool run_task(std::uint32_t thread_index);
+
+    worker_group_block* _group { nullptr };
+    ipc_signal _block_doorbell;
+    ipc_wait_settings _wait_settings;
+    realtime_settings _realtime;
+    std::uint32_t _max_thread_count { 1 };
+    std::unique_ptr<task_queue[]> _queues;
+    std::vector<std::thread> _threads; // the dispatcher comes first
+    std::atomic<std::uint32_t> _thread_count { 0 };
+    std::atomic<bool> _is_running { false };
+
+    std::mutex _plugins_mutex;
+    std::condition_variable _plugins_condition;
+    std::vector<hosted_plugin*> _plugins;
+    std::uint64_t _plugins_version { 0 };
+    std::uint64_t _dispatched_version { 0 };
+    std::atomic<bool> _has_plugins_changed { false };
+    std::vector<hosted_plugin*> _dispatched_plugins; // dispatcher only, reserved so that it never allocates
+
+    std::mutex _wake_mutex;
+    std::condition_variable _wake_condition;
+    std::uint64_t _wake_epoch { 0 };
+};